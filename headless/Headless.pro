@@ -0,0 +1,41 @@
+TEMPLATE = app
+TARGET = Headless
+
+QT += core gui
+CONFIG += debug console
+CONFIG += C++17
+
+OBJECTS_DIR = generated_files
+MOC_DIR = generated_files
+
+INCLUDEPATH += . ./src 
+
+DEPENDPATH += ../raytracer ../raytracer/src
+INCLUDEPATH += ../raytracer ../raytracer/src
+
+QMAKE_LFLAGS += -Wl,-rpath,"$$PWD/../raytracer"
+LIBS +=  -L../raytracer/ -lRaytracer -lEGL
+
+# Keep Xlib's macros out of the EGL headers; Headless never talks to an X server through EGL
+DEFINES += EGL_NO_X11 MESA_EGL_NO_X11_HEADERS
+
+
+# You can make your code fail to compile if you use deprecated APIs.
+# In order to do so, uncomment the following line.
+# Please consult the documentation of the deprecated API in order to know
+# how to port your code away from it.
+# You can also select to disable deprecated APIs only up to a certain version of Qt.
+DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
+
+# Input
+HEADERS +=  src/HeadlessRenderer.hpp \
+			src/Camera.hpp \
+			src/DemoScene.hpp \
+			src/Benchmarks.hpp
+			
+
+SOURCES +=  src/main.cpp \
+			src/HeadlessRenderer.cpp \
+			src/Camera.cpp \
+			src/DemoScene.cpp \
+			src/Benchmarks.cpp
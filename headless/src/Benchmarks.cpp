@@ -0,0 +1,882 @@
+#include "Benchmarks.hpp"
+
+#include <QElapsedTimer>
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <acceleration/BVH.hpp>
+#include <acceleration/QuantizedBVH.hpp>
+#include <acceleration/TaskPool.hpp>
+#include <acceleration/WideBVH.hpp>
+#include <rendering/CPURenderer.hpp>
+#include <rendering/FloatImage.hpp>
+#include <scene/Node.hpp>
+#include <scene/Vertex.hpp>
+#include <scene/lights/PointLight.hpp>
+#include <scene/lights/SunLight.hpp>
+
+#include "Camera.hpp"
+#include "DemoScene.hpp"
+
+namespace {
+
+    struct Triangle {
+        glm::vec3 positions[3];
+    };
+
+    struct Ray {
+        glm::vec3 origin;
+        glm::vec3 direction;
+    };
+
+    constexpr float near_plane = 0.0001f;
+    constexpr float far_plane = 1000.0f;
+
+    std::vector<Triangle> get_triangles(const Rt::Mesh& mesh) {
+        const std::vector<Rt::Vertex>& vertices = mesh.get_vertices();
+        const std::vector<Rt::Index>& indices = mesh.get_indices();
+        std::vector<Triangle> triangles(indices.size() / 3);
+        for (size_t i=0; i<triangles.size(); i++) {
+            for (int j=0; j<3; j++) triangles[i].positions[j] = glm::vec3(vertices[indices[3*i+j]].position);
+        }
+        return triangles;
+    }
+
+    std::vector<Rt::AABB> get_bounds(const std::vector<Triangle>& triangles) {
+        std::vector<Rt::AABB> bounds(triangles.size());
+        for (size_t i=0; i<triangles.size(); i++) {
+            for (const glm::vec3& position : triangles[i].positions) bounds[i].grow(position);
+        }
+        return bounds;
+    }
+
+    // Viewpoint of the terrain benchmarks: looking down at the terrain from above one corner
+    const glm::vec3 terrain_eye(-1.2f, 0.9f, 1.2f);
+    const glm::vec3 terrain_target(0.0f, -0.1f, 0.0f);
+    constexpr float terrain_fov = 60.0f;
+
+    // Primary rays of a width x height image seen from terrain_eye
+    std::vector<Ray> get_camera_rays(unsigned int width, unsigned int height) {
+        glm::vec3 origin = terrain_eye;
+        glm::vec3 forward = glm::normalize(terrain_target - origin);
+        glm::vec3 right = glm::normalize(glm::cross(forward, glm::vec3(0.0f, 1.0f, 0.0f)));
+        glm::vec3 up = glm::cross(right, forward);
+        float scale = std::tan(0.5f * glm::radians(terrain_fov));
+
+        std::vector<Ray> rays;
+        rays.reserve(width * height);
+        for (unsigned int y=0; y<height; y++) {
+            for (unsigned int x=0; x<width; x++) {
+                float u = (2.0f*(x+0.5f)/width - 1.0f) * scale * width/height;
+                float v = (1.0f - 2.0f*(y+0.5f)/height) * scale;
+                rays.push_back(Ray{origin, glm::normalize(forward + u*right + v*up)});
+            }
+        }
+        return rays;
+    }
+
+    // Moeller-Trumbore test; moves far to the hit if the ray hits the triangle within [near_plane, far]
+    bool intersect_triangle(const Ray& ray, const Triangle& triangle, float& far) {
+        glm::vec3 edge1 = triangle.positions[1] - triangle.positions[0];
+        glm::vec3 edge2 = triangle.positions[2] - triangle.positions[0];
+        glm::vec3 p = glm::cross(ray.direction, edge2);
+        float determinant = glm::dot(edge1, p);
+        if (std::abs(determinant) < 1e-12f) return false;
+        float inverse_determinant = 1.0f / determinant;
+        glm::vec3 s = ray.origin - triangle.positions[0];
+        float u = glm::dot(s, p) * inverse_determinant;
+        if (u < 0.0f || u > 1.0f) return false;
+        glm::vec3 q = glm::cross(s, edge1);
+        float v = glm::dot(ray.direction, q) * inverse_determinant;
+        if (v < 0.0f || u+v > 1.0f) return false;
+        float t = glm::dot(edge2, q) * inverse_determinant;
+        if (t < near_plane || t >= far) return false;
+        far = t;
+        return true;
+    }
+
+    double per_second(size_t count, qint64 nanoseconds) {
+        return nanoseconds > 0 ? count * 1.0e9 / nanoseconds : 0.0;
+    }
+
+    // Nearest hit distance of every ray found by testing every triangle
+    std::vector<float> trace_brute_force(const std::vector<Ray>& rays, const std::vector<Triangle>& triangles) {
+        std::vector<float> distances(rays.size());
+        for (size_t r=0; r<rays.size(); r++) {
+            float far = far_plane;
+            for (const Triangle& triangle : triangles) intersect_triangle(rays[r], triangle, far);
+            distances[r] = far;
+        }
+        return distances;
+    }
+
+    // Nearest hit distance of every ray found through hierarchy: a BVH built over triangles or
+    // a QuantizedBVH/WideBVH made from it (whose leaves index the BVH's primitive_indices)
+    template <typename Hierarchy>
+    std::vector<float> trace_bvh(const std::vector<Ray>& rays, const std::vector<Triangle>& triangles,
+                                 const std::vector<uint32_t>& primitive_indices, const Hierarchy& hierarchy) {
+        std::vector<float> distances(rays.size());
+        for (size_t r=0; r<rays.size(); r++) {
+            const Ray& ray = rays[r];
+            distances[r] = hierarchy.traverse(ray.origin, ray.direction, near_plane, far_plane, [&](uint32_t first, uint32_t count, float far) {
+                for (uint32_t i=first; i<first+count; i++) intersect_triangle(ray, triangles[primitive_indices[i]], far);
+                return far;
+            });
+        }
+        return distances;
+    }
+
+    // Whether every ray hits a triangle before far_plane through the any hit query of bvh
+    std::vector<bool> trace_occlusion(const std::vector<Ray>& rays, const std::vector<Triangle>& triangles, const Rt::BVH& bvh) {
+        const std::vector<uint32_t>& primitive_indices = bvh.get_primitive_indices();
+        std::vector<bool> occluded(rays.size());
+        for (size_t r=0; r<rays.size(); r++) {
+            const Ray& ray = rays[r];
+            occluded[r] = bvh.occluded(ray.origin, ray.direction, near_plane, far_plane, [&](uint32_t first, uint32_t count) {
+                for (uint32_t i=first; i<first+count; i++) {
+                    float far = far_plane;
+                    if (intersect_triangle(ray, triangles[primitive_indices[i]], far)) return true;
+                }
+                return false;
+            });
+        }
+        return occluded;
+    }
+
+    bool benchmark_bvh(HeadlessRenderer&, QTextStream& out) {
+        // Brute force gets fewer rays on large scenes so every size takes about as long
+        constexpr size_t brute_force_tests = size_t(1) << 25;
+        std::vector<Ray> rays = get_camera_rays(256, 256);
+
+        out << "Single threaded primary rays (256x256) through terrains of increasing size" << Qt::endl;
+        out << QString::asprintf("%10s %12s %16s %16s %9s %8s", "triangles", "build (ms)", "brute (rays/s)", "BVH (rays/s)", "speedup", "match") << Qt::endl;
+        for (unsigned int nr_triangles : {1000u, 10000u, 100000u, 1000000u}) {
+            std::vector<Triangle> triangles = get_triangles(*create_terrain_mesh(nr_triangles));
+
+            Rt::BVH bvh;
+            bvh.build_binned(get_bounds(triangles));
+
+            size_t nr_brute_force_rays = std::clamp(brute_force_tests / triangles.size(), size_t(64), rays.size());
+            std::vector<Ray> brute_force_rays;
+            for (size_t i=0; i<nr_brute_force_rays; i++) brute_force_rays.push_back(rays[i * rays.size() / nr_brute_force_rays]);
+
+            QElapsedTimer timer;
+            timer.start();
+            std::vector<float> brute_force_distances = trace_brute_force(brute_force_rays, triangles);
+            qint64 brute_force_time = timer.nsecsElapsed();
+
+            timer.start();
+            std::vector<float> bvh_distances = trace_bvh(rays, triangles, bvh.get_primitive_indices(), bvh);
+            qint64 bvh_time = timer.nsecsElapsed();
+
+            // The BVH must find the same nearest hits as testing every triangle
+            bool match = true;
+            for (size_t i=0; i<nr_brute_force_rays; i++) {
+                match = match && bvh_distances[i * rays.size() / nr_brute_force_rays] == brute_force_distances[i];
+            }
+
+            double brute_force_rate = per_second(brute_force_rays.size(), brute_force_time);
+            double bvh_rate = per_second(rays.size(), bvh_time);
+            out << QString::asprintf("%10zu %12.1f %16.0f %16.0f %8.1fx %8s", triangles.size(), bvh.get_build_statistics().build_time,
+                brute_force_rate, bvh_rate, bvh_rate / brute_force_rate, match ? "yes" : "NO") << Qt::endl;
+            if (!match) return false;
+        }
+        return true;
+    }
+
+    // Mean time of nr_frames GPU renders of renderer's scene after a few warmup frames
+    double time_gpu_frames(HeadlessRenderer& renderer, unsigned int width, unsigned int height, unsigned int nr_frames) {
+        renderer.set_use_cpu(false);
+        for (int i=0; i<2; i++) renderer.render(width, height);
+        QElapsedTimer timer;
+        timer.start();
+        for (unsigned int i=0; i<nr_frames; i++) renderer.render(width, height);
+        return timer.nsecsElapsed() / 1.0e6 / nr_frames;
+    }
+
+    bool benchmark_shadows(HeadlessRenderer& renderer, QTextStream& out) {
+        const glm::vec3 sun_direction = glm::normalize(glm::vec3(0.8f, 0.15f, -0.4f));
+        std::vector<Ray> rays = get_camera_rays(256, 256);
+
+        out << "Single threaded primary rays (256x256) and shadow rays from their hits towards a low sun through the BVH" << Qt::endl;
+        out << QString::asprintf("%10s %16s %12s %9s %18s %18s %6s", "triangles", "primary (rays/s)", "shadow rays", "occluded",
+            "closest (rays/s)", "any hit (rays/s)", "match") << Qt::endl;
+        for (unsigned int nr_triangles : {10000u, 100000u, 1000000u}) {
+            std::vector<Triangle> triangles = get_triangles(*create_terrain_mesh(nr_triangles));
+            Rt::BVH bvh;
+            bvh.build_binned(get_bounds(triangles));
+
+            QElapsedTimer timer;
+            timer.start();
+            std::vector<float> distances = trace_bvh(rays, triangles, bvh.get_primitive_indices(), bvh);
+            double primary_rate = per_second(rays.size(), timer.nsecsElapsed());
+
+            // Offset along the ray direction like BIAS in raytrace.glsl so the shadow rays don't hit their own triangle
+            std::vector<Ray> shadow_rays;
+            for (size_t i=0; i<rays.size(); i++) {
+                if (distances[i] < far_plane) shadow_rays.push_back(Ray{rays[i].origin + distances[i]*rays[i].direction + 0.001f*sun_direction, sun_direction});
+            }
+
+            timer.start();
+            std::vector<float> shadow_distances = trace_bvh(shadow_rays, triangles, bvh.get_primitive_indices(), bvh);
+            double closest_rate = per_second(shadow_rays.size(), timer.nsecsElapsed());
+
+            timer.start();
+            std::vector<bool> occluded = trace_occlusion(shadow_rays, triangles, bvh);
+            double any_hit_rate = per_second(shadow_rays.size(), timer.nsecsElapsed());
+
+            // The any hit query must agree with whether the closest hit query found anything
+            bool match = true;
+            size_t nr_occluded = 0;
+            for (size_t i=0; i<shadow_rays.size(); i++) {
+                match = match && occluded[i] == (shadow_distances[i] < far_plane);
+                if (occluded[i]) nr_occluded++;
+            }
+            out << QString::asprintf("%10zu %16.0f %12zu %8.0f%% %18.0f %18.0f %6s", triangles.size(), primary_rate, shadow_rays.size(),
+                100.0 * nr_occluded / std::max(shadow_rays.size(), size_t(1)), closest_rate, any_hit_rate, match ? "yes" : "NO") << Qt::endl;
+            if (!match) return false;
+        }
+
+        if (!renderer.get_gpu_available()) {
+            out << "No OpenGL context; skipped the GPU frame times" << Qt::endl;
+            return true;
+        }
+
+        // The sun adds one shadow ray (and its shading) per hit pixel to the primary rays
+        constexpr unsigned int nr_frames = 10;
+        Camera camera(1.0f, terrain_fov);
+        camera.position = terrain_eye;
+        camera.target = terrain_target;
+        Rt::Scene scene({create_terrain_mesh(1000000, std::make_shared<Rt::Material>("terrain"))});
+        renderer.set_camera(&camera);
+        renderer.set_scene(&scene);
+
+        out << "GPU frames (512x512, mean of " << nr_frames << ") of " << scene.get_static_indices().size() / 3 << " triangles" << Qt::endl;
+        out << QString::asprintf("%32s %12s", "lights", "frame (ms)") << Qt::endl;
+        out << QString::asprintf("%32s %12.2f", "none (primary rays only)", time_gpu_frames(renderer, 512, 512, nr_frames)) << Qt::endl;
+
+        Rt::Node* sun = new Rt::SunLight(glm::vec3(2.0f));
+        sun->set_rotation(glm::vec3(0.6f, 0.0f, 0.55f));
+        scene.add_node(std::shared_ptr<Rt::Node>(sun));
+        out << QString::asprintf("%32s %12.2f", "sun (a shadow ray per hit)", time_gpu_frames(renderer, 512, 512, nr_frames)) << Qt::endl;
+        return true;
+    }
+
+    bool benchmark_quantized(HeadlessRenderer& renderer, QTextStream& out) {
+        std::vector<Ray> rays = get_camera_rays(256, 256);
+
+        out << "Memory and single threaded traversal of full (" << Rt::bvh_node_size_in_opengl << " bytes per node) and quantized ("
+            << Rt::quantized_bvh_node_size_in_opengl << " bytes per interior node) BVHs with primary rays (256x256)" << Qt::endl;
+        out << QString::asprintf("%10s %12s %12s %7s %14s %14s %9s %6s", "triangles", "full (KB)", "quant. (KB)", "saved",
+            "full (rays/s)", "quant. (rays/s)", "speedup", "match") << Qt::endl;
+        for (unsigned int nr_triangles : {10000u, 100000u, 1000000u}) {
+            std::vector<Triangle> triangles = get_triangles(*create_terrain_mesh(nr_triangles));
+            Rt::BVH bvh;
+            bvh.build_binned(get_bounds(triangles));
+            Rt::QuantizedBVH quantized_bvh;
+            quantized_bvh.build(bvh);
+            if (quantized_bvh.is_empty()) {
+                out << "The BVH of " << triangles.size() << " triangles couldn't be quantized" << Qt::endl;
+                return false;
+            }
+
+            QElapsedTimer timer;
+            timer.start();
+            std::vector<float> full_distances = trace_bvh(rays, triangles, bvh.get_primitive_indices(), bvh);
+            qint64 full_time = timer.nsecsElapsed();
+
+            timer.start();
+            std::vector<float> quantized_distances = trace_bvh(rays, triangles, bvh.get_primitive_indices(), quantized_bvh);
+            qint64 quantized_time = timer.nsecsElapsed();
+
+            double full_size = bvh.get_nodes().size() * Rt::bvh_node_size_in_opengl / 1024.0;
+            double quantized_size = quantized_bvh.get_nodes().size() * Rt::quantized_bvh_node_size_in_opengl / 1024.0;
+            double full_rate = per_second(rays.size(), full_time);
+            double quantized_rate = per_second(rays.size(), quantized_time);
+            bool match = full_distances == quantized_distances;
+            out << QString::asprintf("%10zu %12.0f %12.0f %6.0f%% %14.0f %15.0f %8.2fx %6s", triangles.size(), full_size, quantized_size,
+                100.0 * (1.0 - quantized_size / full_size), full_rate, quantized_rate, quantized_rate / full_rate, match ? "yes" : "NO") << Qt::endl;
+            if (!match) return false;
+        }
+
+        if (!renderer.get_gpu_available()) {
+            out << "No OpenGL context; skipped the GPU frame times" << Qt::endl;
+            return true;
+        }
+
+        constexpr unsigned int nr_frames = 10;
+        Camera camera(1.0f, terrain_fov);
+        camera.position = terrain_eye;
+        camera.target = terrain_target;
+        Rt::Scene scene({create_terrain_mesh(1000000, std::make_shared<Rt::Material>("terrain"))});
+        renderer.set_camera(&camera);
+        renderer.set_scene(&scene);
+
+        out << "GPU frames (512x512, mean of " << nr_frames << ") of " << scene.get_static_indices().size() / 3 << " triangles" << Qt::endl;
+        out << QString::asprintf("%12s %12s", "static BVH", "frame (ms)") << Qt::endl;
+        for (bool quantized : {false, true}) {
+            renderer.get_renderer()->set_quantized_static_bvh(quantized);
+            out << QString::asprintf("%12s %12.2f", quantized ? "quantized" : "full", time_gpu_frames(renderer, 512, 512, nr_frames)) << Qt::endl;
+        }
+        renderer.get_renderer()->set_quantized_static_bvh(false);
+        return true;
+    }
+
+    const char* simd_level_name(Rt::SIMDLevel simd_level) {
+        switch (simd_level) {
+            case Rt::SSE: return "SSE";
+            case Rt::AVX2: return "AVX2";
+            default: return "scalar";
+        }
+    }
+
+    // Traces rays through wide_bvh at every SIMD level the CPU supports and prints a row per level
+    template <int Width>
+    bool benchmark_wide_bvh(const std::vector<Ray>& rays, const std::vector<Triangle>& triangles, const Rt::BVH& bvh,
+                            const std::vector<float>& binary_distances, double binary_rate, QTextStream& out) {
+        Rt::WideBVH<Width> wide_bvh;
+        wide_bvh.build(bvh);
+        bool match = true;
+        for (Rt::SIMDLevel simd_level : {Rt::SCALAR, Rt::SSE, Rt::AVX2}) {
+            wide_bvh.set_simd_level(simd_level);
+            if (wide_bvh.get_simd_level() != simd_level) continue;
+
+            QElapsedTimer timer;
+            timer.start();
+            std::vector<float> distances = trace_bvh(rays, triangles, bvh.get_primitive_indices(), wide_bvh);
+            double rate = per_second(rays.size(), timer.nsecsElapsed());
+            bool same = distances == binary_distances;
+            match = match && same;
+            out << QString::asprintf("%10zu %8s %8s %14.0f %9.2fx %6s", triangles.size(), QString("%1-wide").arg(Width).toLatin1().constData(),
+                simd_level_name(simd_level), rate, rate / binary_rate, same ? "yes" : "NO") << Qt::endl;
+        }
+        return match;
+    }
+
+    bool benchmark_wide(HeadlessRenderer&, QTextStream& out) {
+        std::vector<Ray> rays = get_camera_rays(256, 256);
+
+        out << "Single threaded primary rays (256x256) through binary and 4/8-wide BVHs at every SIMD level this CPU supports" << Qt::endl;
+        out << QString::asprintf("%10s %8s %8s %14s %10s %6s", "triangles", "BVH", "SIMD", "rays/s", "speedup", "match") << Qt::endl;
+        for (unsigned int nr_triangles : {10000u, 100000u, 1000000u}) {
+            std::vector<Triangle> triangles = get_triangles(*create_terrain_mesh(nr_triangles));
+            Rt::BVH bvh;
+            bvh.build_binned(get_bounds(triangles));
+
+            QElapsedTimer timer;
+            timer.start();
+            std::vector<float> binary_distances = trace_bvh(rays, triangles, bvh.get_primitive_indices(), bvh);
+            double binary_rate = per_second(rays.size(), timer.nsecsElapsed());
+            out << QString::asprintf("%10zu %8s %8s %14.0f %9.2fx %6s", triangles.size(), "binary", "scalar", binary_rate, 1.0, "-") << Qt::endl;
+
+            if (!benchmark_wide_bvh<4>(rays, triangles, bvh, binary_distances, binary_rate, out)) return false;
+            if (!benchmark_wide_bvh<8>(rays, triangles, bvh, binary_distances, binary_rate, out)) return false;
+        }
+        return true;
+    }
+
+    bool same_hierarchy(const Rt::BVH& a, const Rt::BVH& b) {
+        const std::vector<Rt::BVHNode>& a_nodes = a.get_nodes();
+        const std::vector<Rt::BVHNode>& b_nodes = b.get_nodes();
+        return a_nodes.size() == b_nodes.size() && a.get_primitive_indices() == b.get_primitive_indices()
+            && std::memcmp(a_nodes.data(), b_nodes.data(), a_nodes.size() * sizeof(Rt::BVHNode)) == 0;
+    }
+
+    bool benchmark_build_threads(HeadlessRenderer&, QTextStream& out) {
+        constexpr int nr_builds = 3;
+        std::vector<Rt::AABB> bounds = get_bounds(get_triangles(*create_terrain_mesh(1000000)));
+
+        Rt::BVH reference;
+        reference.build_binned(bounds, 4, 1);
+
+        out << "Binned BVH build of " << bounds.size() << " triangles (best of " << nr_builds << ") on "
+            << Rt::TaskPool::get_shared().get_nr_threads() << " hardware threads" << Qt::endl;
+        out << QString::asprintf("%8s %12s %9s %10s", "threads", "build (ms)", "speedup", "identical") << Qt::endl;
+        double single_threaded_time = 0.0;
+        bool identical = true;
+        for (unsigned int nr_threads : {1u, 2u, 4u, 8u, 16u}) {
+            double best_time = 0.0;
+            Rt::BVH bvh;
+            for (int i=0; i<nr_builds; i++) {
+                bvh.build_binned(bounds, 4, nr_threads);
+                double time = bvh.get_build_statistics().build_time;
+                if (i == 0 || time < best_time) best_time = time;
+            }
+            if (nr_threads == 1) single_threaded_time = best_time;
+
+            // The hierarchy mustn't depend on the number of threads
+            bool same = same_hierarchy(bvh, reference);
+            identical = identical && same;
+            out << QString::asprintf("%8u %12.1f %8.2fx %10s", nr_threads, best_time,
+                best_time > 0.0 ? single_threaded_time / best_time : 0.0, same ? "yes" : "NO") << Qt::endl;
+        }
+        return identical;
+    }
+
+    // Mean time of nr_frames renders of the demo scene after a few warmup frames
+    // (which also give the tile scheduler the previous frame's tile costs)
+    double time_cpu_frames(Rt::CPURenderer& cpu_renderer, Rt::FloatImage& image, unsigned int width, unsigned int height, unsigned int nr_frames) {
+        for (int i=0; i<2; i++) cpu_renderer.render(&image, width, height);
+        QElapsedTimer timer;
+        timer.start();
+        for (unsigned int i=0; i<nr_frames; i++) cpu_renderer.render(&image, width, height);
+        return timer.nsecsElapsed() / 1.0e6 / nr_frames;
+    }
+
+    // Mostly sky with the terrain in one part of the image lit by many point lights, so a few
+    // tiles cost far more than the rest and an equal share of tiles isn't an equal share of work
+    Rt::Scene* create_uneven_scene() {
+        constexpr int nr_lights = 16;
+        Rt::Scene* scene = new Rt::Scene({create_terrain_mesh(200000, std::make_shared<Rt::Material>("terrain"))});
+        for (int i=0; i<nr_lights; i++) {
+            float angle = 6.2831853f * i / nr_lights;
+            float radius = 0.3f + 0.2f * (i % 4);
+            scene->add_node(std::shared_ptr<Rt::Node>(new Rt::PointLight(glm::vec3(radius*std::cos(angle), 0.4f, radius*std::sin(angle)), glm::vec3(0.3f))));
+        }
+        return scene;
+    }
+
+    bool benchmark_tiles(HeadlessRenderer&, QTextStream& out) {
+        // 4096 tiles of 16x16 pixels, still 64 for each of 64 threads
+        constexpr unsigned int width = 1024;
+        constexpr unsigned int height = 1024;
+        constexpr unsigned int nr_frames = 3;
+
+        Camera camera;
+        camera.position = glm::vec3(-2.5f, 1.5f, 2.5f);
+        camera.target = glm::vec3(1.0f, 1.0f, -1.0f);
+        std::unique_ptr<Rt::Scene> scene(create_uneven_scene());
+
+        Rt::CPURenderer cpu_renderer;
+        cpu_renderer.set_camera(&camera);
+        cpu_renderer.set_scene(scene.get());
+
+        // Powers of two up to 64 threads or every hardware thread if there are more (and that count itself)
+        unsigned int nr_hardware_threads = std::max(std::thread::hardware_concurrency(), 1u);
+        std::vector<unsigned int> thread_counts;
+        for (unsigned int nr_threads=1; nr_threads<=std::max(nr_hardware_threads, 64u); nr_threads*=2) thread_counts.push_back(nr_threads);
+        if (std::find(thread_counts.begin(), thread_counts.end(), nr_hardware_threads) == thread_counts.end()) {
+            thread_counts.push_back(nr_hardware_threads);
+            std::sort(thread_counts.begin(), thread_counts.end());
+        }
+
+        out << "CPURenderer frames of a terrain in a corner of the sky lit by point lights (" << width << "x" << height
+            << ", mean of " << nr_frames << ") on " << nr_hardware_threads << " hardware threads" << Qt::endl;
+        out << "static: every thread renders an equal share of the tiles, stealing: idle threads steal tiles from the others" << Qt::endl;
+        out << QString::asprintf("%8s %12s %9s %13s %9s %8s", "threads", "static (ms)", "speedup", "stealing (ms)", "speedup", "steals") << Qt::endl;
+        double single_threaded_time = 0.0;
+        for (unsigned int nr_threads : thread_counts) {
+            cpu_renderer.set_nr_threads(nr_threads);
+            Rt::FloatImage image;
+            cpu_renderer.set_work_stealing(false);
+            double static_time = time_cpu_frames(cpu_renderer, image, width, height, nr_frames);
+            cpu_renderer.set_work_stealing(true);
+            double stealing_time = time_cpu_frames(cpu_renderer, image, width, height, nr_frames);
+            if (nr_threads == 1) single_threaded_time = static_time;
+            out << QString::asprintf("%8u %12.1f %8.2fx %13.1f %8.2fx %8u", nr_threads, static_time,
+                static_time > 0.0 ? single_threaded_time / static_time : 0.0, stealing_time,
+                stealing_time > 0.0 ? single_threaded_time / stealing_time : 0.0, cpu_renderer.get_nr_steals()) << Qt::endl;
+        }
+        return true;
+    }
+
+    bool benchmark_vertex_layout(HeadlessRenderer& renderer, QTextStream& out) {
+        out << "Size and single threaded encoding time of the full (" << Rt::vertex_size_in_opengl << " bytes) and compact ("
+            << Rt::compact_vertex_size_in_opengl << " bytes) vertex formats" << Qt::endl;
+        out << QString::asprintf("%10s %10s %12s %14s %7s %12s %15s", "triangles", "vertices", "full (MB)", "compact (MB)", "saved",
+            "full (ms)", "compact (ms)") << Qt::endl;
+        for (unsigned int nr_triangles : {100000u, 1000000u, 4000000u}) {
+            std::shared_ptr<Rt::Mesh> mesh = create_terrain_mesh(nr_triangles);
+            const std::vector<Rt::Vertex>& vertices = mesh->get_vertices();
+
+            std::vector<unsigned char> full_bytes(vertices.size() * Rt::vertex_size_in_opengl);
+            QElapsedTimer timer;
+            timer.start();
+            for (size_t i=0; i<vertices.size(); i++) vertices[i].as_byte_array(&full_bytes[i*Rt::vertex_size_in_opengl]);
+            double full_time = timer.nsecsElapsed() / 1.0e6;
+
+            std::vector<unsigned char> compact_bytes(vertices.size() * Rt::compact_vertex_size_in_opengl);
+            timer.start();
+            for (size_t i=0; i<vertices.size(); i++) vertices[i].as_compact_byte_array(&compact_bytes[i*Rt::compact_vertex_size_in_opengl]);
+            double compact_time = timer.nsecsElapsed() / 1.0e6;
+
+            out << QString::asprintf("%10zu %10zu %12.1f %14.1f %6.0f%% %12.1f %15.1f", mesh->get_indices().size() / 3, vertices.size(),
+                full_bytes.size() / 1048576.0, compact_bytes.size() / 1048576.0, 100.0 * (1.0 - double(compact_bytes.size()) / full_bytes.size()),
+                full_time, compact_time) << Qt::endl;
+        }
+
+        if (!renderer.get_gpu_available()) {
+            out << "No OpenGL context; skipped the GPU frame times" << Qt::endl;
+            return true;
+        }
+
+        // A static terrain whose vertices are read by the raytracer for every hit and a dynamic one
+        // which is also transformed by the vertex shader every frame
+        constexpr unsigned int nr_frames = 10;
+        std::shared_ptr<Rt::Material> material = std::make_shared<Rt::Material>("terrain");
+        Rt::Scene scene({create_terrain_mesh(1000000, material)});
+        std::shared_ptr<Rt::Node> dynamic_terrain = std::make_shared<Rt::Node>(create_terrain_mesh(1000000, material));
+        dynamic_terrain->set_translation(glm::vec3(0.0f, -0.2f, 0.0f));
+        scene.add_node(dynamic_terrain);
+
+        Camera camera(1.0f, terrain_fov);
+        camera.position = terrain_eye;
+        camera.target = terrain_target;
+        renderer.set_camera(&camera);
+        renderer.set_scene(&scene);
+
+        out << "GPU frames (512x512, mean of " << nr_frames << ") of a static and a dynamic terrain of 1M triangles each" << Qt::endl;
+        out << QString::asprintf("%8s %18s %14s %12s", "format", "static (MB)", "upload (MB)", "frame (ms)") << Qt::endl;
+        for (Rt::Renderer::VertexFormat vertex_format : {Rt::Renderer::FULL, Rt::Renderer::COMPACT}) {
+            renderer.get_renderer()->set_vertex_format(vertex_format);
+            bool compact = vertex_format == Rt::Renderer::COMPACT;
+            size_t static_bytes = compact ? scene.get_static_compact_vertices().size() : scene.get_static_vertices().size();
+
+            // The first frame uploads the dynamic vertices in the new format
+            renderer.render(512, 512);
+            size_t uploaded_bytes = renderer.get_renderer()->get_uploaded_bytes();
+            double time = time_gpu_frames(renderer, 512, 512, nr_frames);
+            out << QString::asprintf("%8s %18.1f %14.1f %12.2f", compact ? "compact" : "full", static_bytes / 1048576.0,
+                uploaded_bytes / 1048576.0, time) << Qt::endl;
+        }
+        renderer.get_renderer()->set_vertex_format(Rt::Renderer::FULL);
+        return true;
+    }
+
+    bool benchmark_transformed_meshes(HeadlessRenderer& renderer, QTextStream& out) {
+        if (!renderer.get_gpu_available()) {
+            out << "No OpenGL context; skipped the benchmark" << Qt::endl;
+            return true;
+        }
+
+        // Only update() is timed so the raytrace dispatch (which tests every triangle in TRANSFORMED) doesn't drown it out
+        constexpr unsigned int nr_meshes = 10000;
+        constexpr unsigned int nr_frames = 60;
+        std::shared_ptr<Rt::Material> material = std::make_shared<Rt::Material>("terrain");
+        Rt::Scene scene;
+        std::vector<std::shared_ptr<Rt::Node>> nodes;
+        size_t nr_vertices = 0;
+        for (unsigned int i=0; i<nr_meshes; i++) {
+            std::shared_ptr<Rt::Mesh> mesh = create_terrain_mesh(100, material);
+            nr_vertices += mesh->get_vertices().size();
+            std::shared_ptr<Rt::Node> node = std::make_shared<Rt::Node>(mesh);
+            node->set_scale(glm::vec3(0.005f));
+            node->set_translation(glm::vec3(float(i % 100) / 50.0f - 1.0f, 0.0f, float(i / 100) / 50.0f - 1.0f));
+            nodes.push_back(node);
+            scene.add_node(node);
+        }
+
+        Camera camera(1.0f, terrain_fov);
+        camera.position = terrain_eye;
+        camera.target = terrain_target;
+        renderer.set_camera(&camera);
+        renderer.set_scene(&scene);
+        Rt::Renderer* gl_renderer = renderer.get_renderer();
+        Rt::Renderer::DynamicGeometry dynamic_geometry = gl_renderer->get_dynamic_geometry();
+        gl_renderer->set_dynamic_geometry(Rt::Renderer::TRANSFORMED);
+        gl_renderer->update();
+
+        out << "update() of " << nr_meshes << " dynamic meshes (" << nr_vertices << " vertices) in TRANSFORMED mode, "
+            << nr_frames << " frames each moving every mesh or one in a hundred" << Qt::endl;
+        out << QString::asprintf("%8s %12s %14s %12s %12s %16s", "moved", "update (ms)", "traversal (ms)", "upload (ms)",
+            "vertex (ms)", "vertex p99 (ms)") << Qt::endl;
+        for (unsigned int stride : {1u, 100u}) {
+            gl_renderer->set_stage_timing(false);
+            gl_renderer->set_stage_timing_window(nr_frames);
+            gl_renderer->set_stage_timing(true);
+            QElapsedTimer timer;
+            timer.start();
+            for (unsigned int frame=0; frame<nr_frames; frame++) {
+                for (unsigned int i=frame % stride; i<nr_meshes; i+=stride) {
+                    glm::vec3 translation = nodes[i]->get_translation();
+                    nodes[i]->set_translation(glm::vec3(translation.x, 0.01f * float(frame % 10), translation.z));
+                }
+                gl_renderer->update();
+            }
+            double update_time = timer.nsecsElapsed() / 1.0e6 / nr_frames;
+
+            Rt::TimingStatistics traversal = gl_renderer->get_stage_statistics(Rt::Renderer::SCENE_TRAVERSAL);
+            Rt::TimingStatistics upload = gl_renderer->get_stage_statistics(Rt::Renderer::UPLOAD);
+            Rt::TimingStatistics vertex_shader = gl_renderer->get_stage_statistics(Rt::Renderer::VERTEX_SHADER);
+            out << QString::asprintf("%8u %12.2f %14.2f %12.2f %12.3f %16.3f", nr_meshes / stride, update_time, traversal.mean,
+                upload.mean, vertex_shader.mean, vertex_shader.p99) << Qt::endl;
+        }
+        gl_renderer->set_stage_timing(false);
+        gl_renderer->set_dynamic_geometry(dynamic_geometry);
+        return true;
+    }
+
+    bool benchmark_upload(HeadlessRenderer& renderer, QTextStream& out) {
+        if (!renderer.get_gpu_available()) {
+            out << "No OpenGL context; skipped the benchmark" << Qt::endl;
+            return true;
+        }
+
+        // Moving nodes rewrite their mesh records and the TLAS every frame while the previous
+        // frames' raytrace dispatches may still be reading them
+        constexpr unsigned int nr_meshes = 2000;
+        constexpr unsigned int nr_lights = 64;
+        constexpr unsigned int nr_frames = 60;
+        std::shared_ptr<Rt::Material> material = std::make_shared<Rt::Material>("terrain");
+        std::shared_ptr<Rt::Mesh> mesh = create_terrain_mesh(100, material);
+        Rt::Scene scene;
+        std::vector<std::shared_ptr<Rt::Node>> nodes;
+        for (unsigned int i=0; i<nr_meshes; i++) {
+            std::shared_ptr<Rt::Node> node = std::make_shared<Rt::Node>(mesh);
+            node->set_scale(glm::vec3(0.02f));
+            node->set_translation(glm::vec3(float(i % 50) / 25.0f - 1.0f, 0.0f, float(i / 50) / 20.0f - 1.0f));
+            nodes.push_back(node);
+            scene.add_node(node);
+        }
+        for (unsigned int i=0; i<nr_lights; i++) {
+            std::shared_ptr<Rt::Node> light(new Rt::PointLight(glm::vec3(float(i % 8) / 4.0f - 1.0f, 0.3f, float(i / 8) / 4.0f - 1.0f), glm::vec3(0.05f)));
+            nodes.push_back(light);
+            scene.add_node(light);
+        }
+
+        Camera camera(1.0f, terrain_fov);
+        camera.position = terrain_eye;
+        camera.target = terrain_target;
+        renderer.set_camera(&camera);
+        renderer.set_scene(&scene);
+        Rt::Renderer* gl_renderer = renderer.get_renderer();
+        renderer.set_use_cpu(false);
+
+        out << "Frames (64x64) of " << nr_meshes << " instanced meshes and " << nr_lights << " point lights, "
+            << nr_frames << " frames each moving every node or one in a hundred" << Qt::endl;
+        out << "ring: persistently mapped RingBuffers, plain: glNamedBufferData and glNamedBufferSubData" << Qt::endl;
+        out << QString::asprintf("%8s %7s %14s %12s %16s %12s", "moved", "buffers", "uploaded (KB)", "upload (ms)",
+            "upload p99 (ms)", "frame (ms)") << Qt::endl;
+        for (unsigned int stride : {1u, 100u}) {
+            for (bool persistent_buffers : {false, true}) {
+                gl_renderer->set_persistent_buffers(persistent_buffers);
+                renderer.render(64, 64);
+                gl_renderer->set_stage_timing(false);
+                gl_renderer->set_stage_timing_window(nr_frames);
+                gl_renderer->set_stage_timing(true);
+
+                size_t uploaded_bytes = 0;
+                QElapsedTimer timer;
+                timer.start();
+                for (unsigned int frame=0; frame<nr_frames; frame++) {
+                    for (unsigned int i=frame % stride; i<nodes.size(); i+=stride) {
+                        glm::vec3 translation = nodes[i]->get_translation();
+                        nodes[i]->set_translation(glm::vec3(translation.x, 0.01f * float(frame % 10), translation.z));
+                    }
+                    renderer.render(64, 64);
+                    uploaded_bytes += gl_renderer->get_uploaded_bytes();
+                }
+                double frame_time = timer.nsecsElapsed() / 1.0e6 / nr_frames;
+
+                Rt::TimingStatistics upload = gl_renderer->get_stage_statistics(Rt::Renderer::UPLOAD);
+                out << QString::asprintf("%8zu %7s %14.1f %12.3f %16.3f %12.2f", nodes.size() / stride, persistent_buffers ? "ring" : "plain",
+                    uploaded_bytes / 1024.0 / nr_frames, upload.mean, upload.p99, frame_time) << Qt::endl;
+            }
+        }
+        gl_renderer->set_stage_timing(false);
+        return true;
+    }
+
+    float max_difference(const Rt::FloatImage& a, const Rt::FloatImage& b) {
+        const std::vector<float>& a_data = a.get_data();
+        const std::vector<float>& b_data = b.get_data();
+        if (a_data.size() != b_data.size()) return INFINITY;
+        float difference = 0.0f;
+        for (size_t i=0; i<a_data.size(); i++) difference = std::max(difference, std::abs(a_data[i] - b_data[i]));
+        return difference;
+    }
+
+    bool benchmark_packets(HeadlessRenderer&, QTextStream& out) {
+        constexpr unsigned int width = 512;
+        constexpr unsigned int height = 512;
+        constexpr unsigned int nr_frames = 3;
+
+        Camera camera;
+        camera.position = glm::vec3(0.0f, 0.0f, 5.0f);
+        camera.target = glm::vec3(0.0f);
+        std::unique_ptr<Rt::Scene> scene(create_demo_scene());
+
+        Rt::CPURenderer cpu_renderer;
+        cpu_renderer.set_camera(&camera);
+        cpu_renderer.set_scene(scene.get());
+        cpu_renderer.set_nr_threads(1);
+
+        out << "Single threaded CPURenderer frames of the demo scene (" << width << "x" << height << ", mean of " << nr_frames
+            << ") tracing every ray on its own and as packets" << Qt::endl;
+        out << QString::asprintf("%8s %8s %12s %16s %9s %12s", "packet", "SIMD", "frame (ms)", "primary (rays/s)", "speedup", "difference") << Qt::endl;
+        Rt::FloatImage single_ray_image;
+        double single_ray_time = 0.0;
+        bool match = true;
+        for (unsigned int packet_size : {1u, 4u, 8u, 16u}) {
+            for (Rt::SIMDLevel simd_level : {Rt::SCALAR, Rt::SSE, Rt::AVX2}) {
+                // Without SSE/AVX2 every ray is traced on its own anyway
+                if (simd_level > Rt::get_simd_level() || (packet_size == 1) != (simd_level == Rt::SCALAR)) continue;
+                cpu_renderer.set_packet_size(packet_size);
+                cpu_renderer.set_simd_level(simd_level);
+
+                Rt::FloatImage image;
+                double time = time_cpu_frames(cpu_renderer, image, width, height, nr_frames);
+                if (packet_size == 1) {
+                    single_ray_image = image;
+                    single_ray_time = time;
+                }
+
+                // Packets must render the same image as single rays
+                float difference = max_difference(image, single_ray_image);
+                match = match && difference <= 1e-4f;
+                out << QString::asprintf("%8u %8s %12.1f %16.0f %8.2fx %12g", packet_size, simd_level_name(simd_level), time,
+                    per_second(width*height, qint64(time * 1.0e6)), single_ray_time / time, difference) << Qt::endl;
+            }
+        }
+        return match;
+    }
+
+    // Fraction of the pixels of a and b with a channel differing by more than threshold
+    double mismatched_pixels(const Rt::FloatImage& a, const Rt::FloatImage& b, float threshold) {
+        const std::vector<float>& a_data = a.get_data();
+        const std::vector<float>& b_data = b.get_data();
+        if (a_data.size() != b_data.size() || a_data.empty()) return 1.0;
+        size_t nr_mismatched = 0;
+        for (size_t i=0; i<a_data.size(); i+=4) {
+            for (size_t j=i; j<i+4; j++) {
+                if (std::abs(a_data[j] - b_data[j]) > threshold) {
+                    nr_mismatched++;
+                    break;
+                }
+            }
+        }
+        return nr_mismatched / (a_data.size() / 4.0);
+    }
+
+    bool benchmark_compare(HeadlessRenderer& renderer, QTextStream& out) {
+        if (!renderer.get_gpu_available()) {
+            out << "No OpenGL context to compare the CPURenderer with" << Qt::endl;
+            return false;
+        }
+
+        constexpr unsigned int width = 256;
+        constexpr unsigned int height = 256;
+        // Rays grazing an edge may hit a different triangle (or none) in the GPU's arithmetic so a
+        // few silhouette pixels are allowed to differ; anything shaded differently shows up in many more
+        constexpr float pixel_tolerance = 0.01f;
+        constexpr double mismatch_tolerance = 0.005;
+
+        Camera camera;
+        camera.position = glm::vec3(0.0f, 0.0f, 5.0f);
+        camera.target = glm::vec3(0.0f);
+        std::unique_ptr<Rt::Scene> scene(create_demo_scene());
+        // Point lights with cutoff radii in front of the demo scene so culling and sampling have lights to choose from
+        std::vector<Rt::PointLight*> point_lights;
+        for (const glm::vec3& position : {glm::vec3(-1.5f, 1.0f, 1.0f), glm::vec3(1.5f, 1.0f, 1.0f), glm::vec3(-1.5f, -1.0f, 1.5f), glm::vec3(1.5f, -1.0f, 1.5f)}) {
+            Rt::PointLight* light = new Rt::PointLight(position, glm::vec3(1.5f));
+            light->set_cutoff_radius(2.5f);
+            scene->add_node(std::shared_ptr<Rt::Node>(light));
+            point_lights.push_back(light);
+        }
+        renderer.set_camera(&camera);
+        renderer.set_scene(scene.get());
+        Rt::Renderer* gpu_renderer = renderer.get_renderer();
+        Rt::CPURenderer* cpu_renderer = renderer.get_cpu_renderer();
+
+        struct LightMode {
+            const char* name;
+            unsigned int nr_samples;
+            bool culling;
+        };
+        const LightMode light_modes[] = {{"all", 0, false}, {"culled", 0, true}, {"2 samples", 2, false}};
+
+        // Both renderers count the frames they render so their light samples stay in step
+        out << "GPU and CPURenderer frames of the demo scene with four more point lights (" << width << "x" << height
+            << "); at most " << 100.0 * mismatch_tolerance << "% of the pixels may differ by more than " << pixel_tolerance << Qt::endl;
+        out << QString::asprintf("%12s %10s %8s %9s %10s %12s %12s %6s", "triangles", "lights", "visible", "vertices", "static BVH",
+            "difference", "mismatched", "match") << Qt::endl;
+        bool match = true;
+        for (Rt::Renderer::TriangleIntersection triangle_intersection : {Rt::Renderer::WATERTIGHT, Rt::Renderer::LEGACY}) {
+            for (const LightMode& light_mode : light_modes) {
+                for (bool visible : {false, true}) {
+                    for (Rt::Renderer::VertexFormat vertex_format : {Rt::Renderer::FULL, Rt::Renderer::COMPACT}) {
+                        for (bool quantized : {false, true}) {
+                            gpu_renderer->set_triangle_intersection(triangle_intersection);
+                            cpu_renderer->set_triangle_intersection(triangle_intersection);
+                            gpu_renderer->set_light_samples(light_mode.nr_samples);
+                            cpu_renderer->set_light_samples(light_mode.nr_samples);
+                            gpu_renderer->set_light_culling(light_mode.culling);
+                            cpu_renderer->set_light_culling(light_mode.culling);
+                            for (Rt::PointLight* light : point_lights)
+                                light->set_visibility(visible ? Rt::AbstractLight::SPHERE : Rt::AbstractLight::INVISIBLE);
+                            // The CPURenderer always uses full vertices and BVH nodes
+                            gpu_renderer->set_vertex_format(vertex_format);
+                            gpu_renderer->set_quantized_static_bvh(quantized);
+
+                            renderer.set_use_cpu(false);
+                            if (!renderer.render(width, height)) return false;
+                            Rt::FloatImage gpu_image = renderer.get_result();
+                            renderer.set_use_cpu(true);
+                            if (!renderer.render(width, height)) return false;
+                            const Rt::FloatImage& cpu_image = renderer.get_result();
+
+                            double mismatched = mismatched_pixels(gpu_image, cpu_image, pixel_tolerance);
+                            bool config_match = mismatched <= mismatch_tolerance;
+                            match = match && config_match;
+                            out << QString::asprintf("%12s %10s %8s %9s %10s %12g %11.2f%% %6s",
+                                triangle_intersection == Rt::Renderer::WATERTIGHT ? "watertight" : "legacy", light_mode.name,
+                                visible ? "yes" : "no", vertex_format == Rt::Renderer::COMPACT ? "compact" : "full",
+                                quantized ? "quantized" : "full", max_difference(gpu_image, cpu_image), 100.0 * mismatched,
+                                config_match ? "yes" : "NO") << Qt::endl;
+                        }
+                    }
+                }
+            }
+        }
+
+        renderer.set_use_cpu(false);
+        gpu_renderer->set_triangle_intersection(Rt::Renderer::WATERTIGHT);
+        cpu_renderer->set_triangle_intersection(Rt::Renderer::WATERTIGHT);
+        gpu_renderer->set_light_samples(0);
+        cpu_renderer->set_light_samples(0);
+        gpu_renderer->set_light_culling(true);
+        cpu_renderer->set_light_culling(true);
+        gpu_renderer->set_vertex_format(Rt::Renderer::FULL);
+        gpu_renderer->set_quantized_static_bvh(false);
+        return match;
+    }
+
+    struct Benchmark {
+        const char* name;
+        const char* description;
+        bool (*run)(HeadlessRenderer& renderer, QTextStream& out);
+    };
+
+    const Benchmark benchmarks[] = {
+        {"bvh", "rays/s of brute force and BVH traversal on generated scenes of 1k to 1M triangles", benchmark_bvh},
+        {"build-threads", "binned BVH build time of a 1M triangle scene on 1, 2, 4, 8 and 16 threads", benchmark_build_threads},
+        {"quantized", "memory and traversal speed of quantized BVH nodes against full ones on the CPU and the GPU", benchmark_quantized},
+        {"wide", "traversal speed of 4 and 8-wide BVHs with SSE/AVX2 against the binary BVH", benchmark_wide},
+        {"shadows", "throughput of shadow rays with the any hit query against closest hit traversal and primary rays", benchmark_shadows},
+        {"packets", "CPURenderer frame time of the demo scene tracing single rays and 4, 8 and 16 ray packets at every SIMD level", benchmark_packets},
+        {"vertex-layout", "memory, upload size and GPU frame time of compact vertices against full ones on meshes of up to 4M triangles", benchmark_vertex_layout},
+        {"transformed-meshes", "update() time and vertex shader GPU time of 10k dynamic meshes in TRANSFORMED mode when all or few of them move", benchmark_transformed_meshes},
+        {"upload", "upload stage time and bytes of moving nodes' mesh records, lights and TLAS written through persistent ring buffers and plain buffers", benchmark_upload},
+        {"tiles", "CPURenderer frame time of an unevenly expensive scene on 1 to 64 (or every hardware) threads with a static partition of the tiles and with work stealing", benchmark_tiles},
+        {"compare", "renders the demo scene on the GPU and the CPU with every triangle test, light, vertex and BVH option and fails if they differ", benchmark_compare}
+    };
+
+}
+
+QStringList get_benchmark_descriptions() {
+    QStringList descriptions;
+    for (const Benchmark& benchmark : benchmarks) descriptions << QString(benchmark.name) + ": " + benchmark.description;
+    return descriptions;
+}
+
+bool run_benchmark(const QString& name, HeadlessRenderer& renderer, QTextStream& out) {
+    for (const Benchmark& benchmark : benchmarks) {
+        if (name == benchmark.name) return benchmark.run(renderer, out);
+    }
+    return false;
+}
@@ -0,0 +1,20 @@
+#ifndef BENCHMARKS_HPP
+#define BENCHMARKS_HPP
+
+#include <QString>
+#include <QStringList>
+#include <QTextStream>
+
+#include "HeadlessRenderer.hpp"
+
+// Benchmarks run by Headless --benchmark <name> instead of rendering frames
+// Every benchmark generates its own scenes and prints a table of its measurements
+
+// "name: description" of every benchmark
+QStringList get_benchmark_descriptions();
+
+// Returns false if there is no benchmark called name or it couldn't run
+// (e.g. it needs the GPU and renderer has no OpenGL context)
+bool run_benchmark(const QString& name, HeadlessRenderer& renderer, QTextStream& out);
+
+#endif
@@ -0,0 +1,37 @@
+#include "Camera.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+Camera::Camera(float aspect_ratio, float fov, QObject* parent) :
+    Rt::AbstractCamera(parent),
+    aspect_ratio(aspect_ratio),
+    fov(fov)
+{
+    position = glm::vec3(0.0f);
+    target = glm::vec3(0.0f, 0.0f, -1.0f);
+
+    perspective = glm::infinitePerspective(fov, aspect_ratio, 0.1f);
+}
+
+Camera::~Camera() {}
+
+const glm::vec3& Camera::get_position() const {
+    return position;
+}
+
+const glm::mat4& Camera::get_view() const {
+    return view;
+}
+
+const glm::mat4& Camera::get_perspective() const {
+    return perspective;
+}
+
+void Camera::update_perspective(float new_aspect_ratio) {
+    if (new_aspect_ratio != 0.0f) aspect_ratio = new_aspect_ratio;
+    perspective = glm::infinitePerspective(fov, aspect_ratio, 0.1f);
+}
+
+void Camera::update_view() {
+    view = glm::lookAt(position, target, glm::vec3(0.0f, 1.0f, 0.0f));
+}
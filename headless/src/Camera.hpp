@@ -0,0 +1,36 @@
+#ifndef CAMERA_HPP
+#define CAMERA_HPP
+
+#include <QObject>
+
+#include <glm/glm.hpp>
+
+#include <rendering/AbstractCamera.hpp>
+
+// Camera looking from position at target which only moves when told to
+class Camera : public Rt::AbstractCamera {
+    Q_OBJECT;
+
+public:
+    glm::vec3 position;
+    glm::vec3 target;
+
+    Camera(float aspect_ratio=1.0f, float fov=45.0f, QObject* parent=nullptr);
+    virtual ~Camera() override;
+
+    virtual const glm::vec3& get_position() const override;
+    virtual const glm::mat4& get_view() const override;
+    virtual const glm::mat4& get_perspective() const override;
+
+    virtual void update_perspective(float new_aspect_ratio=0.0f) override;
+    virtual void update_view() override;
+
+private:
+    float aspect_ratio;
+    float fov;
+
+    glm::mat4 perspective;
+    glm::mat4 view;
+};
+
+#endif
@@ -0,0 +1,148 @@
+#include "DemoScene.hpp"
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <memory>
+
+#include <scene/Mesh.hpp>
+#include <scene/lights/SunLight.hpp>
+#include <scene/lights/PointLight.hpp>
+
+Rt::Scene* create_demo_scene() {
+    std::vector<std::shared_ptr<Rt::Mesh>> static_meshes;
+
+    std::shared_ptr<Rt::Material> face_material = std::make_shared<Rt::Material>("face_material");
+    face_material->albedo = glm::vec3(1.0f);
+    face_material->texture_paths[0] = "resources/textures/awesomeface.png";
+
+    std::shared_ptr<Rt::Material> metal_material = std::make_shared<Rt::Material>("Jupiter");
+    metal_material->albedo = glm::vec3(1.0f,0.2f,0.2f);
+    metal_material->metalness = 1.0f;
+    metal_material->roughness = 1.0f;
+    metal_material->texture_paths[0] = "resources/textures/Metal004_4K-JPG/Metal004_4K_Color";
+    metal_material->texture_paths[2] = "resources/textures/Metal004_4K-JPG/Metal004_4K_Roughness";
+    metal_material->texture_paths[3] = "resources/textures/Metal004_4K-JPG/Metal004_4K_Metalness";
+    metal_material->texture_paths[5] = "resources/textures/Metal004_4K-JPG/Metal004_4K_Normal";
+
+    std::shared_ptr<Rt::Material> brick_material = std::make_shared<Rt::Material>("brick_material");
+    brick_material->albedo = glm::vec3(1.0f,1.0f,1.0f);
+    brick_material->metalness = 0.0f;
+    brick_material->roughness = 1.0f;
+    brick_material->texture_paths[0] = "resources/textures/Bricks/church_bricks_02_diff_png_4k.jpg";
+    brick_material->texture_paths[2] = "resources/textures/Bricks/church_bricks_02_rough_4k";
+    brick_material->texture_paths[4] = "resources/textures/Bricks/church_bricks_02_ao_4k";
+    brick_material->texture_paths[5] = "resources/textures/Bricks/church_bricks_02_nor_4k";
+    
+    std::shared_ptr<Rt::Material> floor_material = std::make_shared<Rt::Material>("floor_material");
+    floor_material->albedo = glm::vec3(1.0f,1.0f,1.0f);
+    floor_material->metalness = 0.0f;
+    floor_material->roughness = 1.0f;
+    floor_material->texture_paths[0] = "resources/textures/Floor/floor_tiles_02_diff_1k.jpg";
+    floor_material->texture_paths[2] = "resources/textures/Floor/floor_tiles_02_rough_1k.jpg";
+    floor_material->texture_paths[4] = "resources/textures/Floor/floor_tiles_02_ao_1k.jpg";
+    floor_material->texture_paths[5] = "resources/textures/Floor/floor_tiles_02_nor_1k.jpg";
+
+    std::shared_ptr<Rt::Mesh> mesh = std::make_shared<Rt::Mesh>(
+        std::vector<Rt::Vertex>{
+            Rt::Vertex(glm::vec4(-1.0f,0.0f,0.0f,1.0f), glm::vec4(0.0f,0.0f,1.0f,0.0f), glm::vec4(1.0f,0.0f,0.0f,0.0f), glm::vec4(0.0f,1.0f,0.0f,0.0f), glm::vec2(0.0f, 0.0f)),
+            Rt::Vertex(glm::vec4( 1.0f,0.0f,0.0f,1.0f), glm::vec4(0.0f,0.0f,1.0f,0.0f), glm::vec4(1.0f,0.0f,0.0f,0.0f), glm::vec4(0.0f,1.0f,0.0f,0.0f), glm::vec2(1.0f, 0.0f)),
+            Rt::Vertex(glm::vec4( 0.0f,1.0f,0.0f,1.0f), glm::vec4(0.0f,0.0f,1.0f,0.0f), glm::vec4(1.0f,0.0f,0.0f,0.0f), glm::vec4(0.0f,1.0f,0.0f,0.0f), glm::vec2(0.5f, 1.0f))
+        },
+        std::vector<Rt::Index>{
+            0, 1, 2
+        }
+    );
+    mesh->set_material(brick_material);
+    
+    static_meshes.push_back(mesh);
+    Rt::Scene* scene = new Rt::Scene(static_meshes);
+
+    std::shared_ptr<Rt::Mesh> mesh1 = std::make_shared<Rt::Mesh>(
+        std::vector<Rt::Vertex>{
+            Rt::Vertex(glm::vec4(-1.0f,-1.0f,0.0f,1.0f), glm::vec4(0.0f,0.0f,1.0f,0.0f), glm::vec4(1.0f,0.0f,0.0f,0.0f), glm::vec4(0.0f,1.0f,0.0f,0.0f), glm::vec2(0.0f, 0.0f)),
+            Rt::Vertex(glm::vec4( 1.0f,-1.0f,0.0f,1.0f), glm::vec4(0.0f,0.0f,1.0f,0.0f), glm::vec4(1.0f,0.0f,0.0f,0.0f), glm::vec4(0.0f,1.0f,0.0f,0.0f), glm::vec2(1.0f, 0.0f)),
+            Rt::Vertex(glm::vec4( 1.0f, 1.0f,0.0f,1.0f), glm::vec4(0.0f,0.0f,1.0f,0.0f), glm::vec4(1.0f,0.0f,0.0f,0.0f), glm::vec4(0.0f,1.0f,0.0f,0.0f), glm::vec2(1.0f, 1.0f)),
+            Rt::Vertex(glm::vec4(-1.0f, 1.0f,0.0f,1.0f), glm::vec4(0.0f,0.0f,1.0f,0.0f), glm::vec4(1.0f,0.0f,0.0f,0.0f), glm::vec4(0.0f,1.0f,0.0f,0.0f), glm::vec2(0.0f, 1.0f))
+        },
+        std::vector<Rt::Index>{
+            0, 1, 2,
+            2, 3, 0
+        }
+    );
+    mesh1->set_material(metal_material);
+
+    std::shared_ptr<Rt::Node> node2 = std::make_shared<Rt::Node>(mesh1);
+    node2->set_translation(glm::vec3(2.0f,0.0f,0.0f));
+    node2->set_rotation(glm::vec3(3.14f, 1.507f, 0.0f));
+
+    std::shared_ptr<Rt::Mesh> mesh2 = std::make_shared<Rt::Mesh>(
+        std::vector<Rt::Vertex>{
+            Rt::Vertex(glm::vec4(-2.5f,0.0f,-2.0f, 1.0f), glm::vec4(0.0f,-1.0f,0.0f,0.0f), glm::vec4(1.0f,0.0f,0.0f,0.0f), glm::vec4(0.0f,0.0f,1.0f,0.0f), glm::vec2(0.0f, 0.0f)),
+            Rt::Vertex(glm::vec4( 2.5f,0.0f,-2.0f, 1.0f), glm::vec4(0.0f,-1.0f,0.0f,0.0f), glm::vec4(1.0f,0.0f,0.0f,0.0f), glm::vec4(0.0f,0.0f,1.0f,0.0f), glm::vec2(1.0f, 0.0f)),
+            Rt::Vertex(glm::vec4( 0.0f,0.0f, 2.33f,1.0f), glm::vec4(0.0f,-1.0f,0.0f,0.0f), glm::vec4(1.0f,0.0f,0.0f,0.0f), glm::vec4(0.0f,0.0f,1.0f,0.0f), glm::vec2(0.5f, 1.0f)),
+        },
+        std::vector<Rt::Index>{
+            0, 1, 2
+        }
+    );
+    mesh2->set_material(floor_material);
+    node2->add_mesh(mesh2);
+
+    scene->add_node(node2);
+    scene->add_mesh(mesh2);
+
+    Rt::Node* sun = new Rt::SunLight(glm::vec3(2.0f));
+    sun->set_rotation(glm::vec3(0.6f,0.0f,0.55f));
+    scene->add_node(std::shared_ptr<Rt::Node>(sun));
+
+    Rt::Node* pl = new Rt::PointLight(glm::vec3(1.0f,1.0f,-1.0f), glm::vec3(4.0f));
+    scene->add_node(std::shared_ptr<Rt::Node>(pl));
+
+    return scene;
+}
+
+namespace {
+
+    float terrain_height(float x, float z) {
+        return 0.15f*std::sin(7.0f*x)*std::cos(5.0f*z) + 0.05f*std::sin(23.0f*x + 17.0f*z);
+    }
+
+}
+
+std::shared_ptr<Rt::Mesh> create_terrain_mesh(unsigned int nr_triangles, std::shared_ptr<Rt::Material> material) {
+    // Two triangles per cell of a cells x cells grid
+    unsigned int cells = std::max(1u, (unsigned int) std::ceil(std::sqrt(nr_triangles / 2.0)));
+
+    std::vector<Rt::Vertex> vertices;
+    vertices.reserve((cells+1) * (cells+1));
+    float step = 2.0f / cells;
+    for (unsigned int z=0; z<=cells; z++) {
+        for (unsigned int x=0; x<=cells; x++) {
+            float px = -1.0f + x*step;
+            float pz = -1.0f + z*step;
+            glm::vec3 dx(2.0f*step, terrain_height(px+step, pz) - terrain_height(px-step, pz), 0.0f);
+            glm::vec3 dz(0.0f, terrain_height(px, pz+step) - terrain_height(px, pz-step), 2.0f*step);
+            glm::vec3 normal = glm::normalize(glm::cross(dz, dx));
+            glm::vec3 tangent = glm::normalize(dx);
+            vertices.push_back(Rt::Vertex(
+                glm::vec4(px, terrain_height(px, pz), pz, 1.0f),
+                glm::vec4(normal, 0.0f),
+                glm::vec4(tangent, 0.0f),
+                glm::vec4(glm::cross(normal, tangent), 0.0f),
+                glm::vec2(float(x)/cells, float(z)/cells)
+            ));
+        }
+    }
+
+    std::vector<Rt::Index> indices;
+    indices.reserve(6 * cells * cells);
+    for (unsigned int z=0; z<cells; z++) {
+        for (unsigned int x=0; x<cells; x++) {
+            Rt::Index i = z*(cells+1) + x;
+            indices.insert(indices.end(), {i, i+cells+1, i+1, i+1, i+cells+1, i+cells+2});
+        }
+    }
+
+    return std::make_shared<Rt::Mesh>(vertices, indices, material);
+}
@@ -0,0 +1,17 @@
+#ifndef DEMO_SCENE_HPP
+#define DEMO_SCENE_HPP
+
+#include <memory>
+
+#include <scene/Scene.hpp>
+#include <scene/Mesh.hpp>
+
+// The Sandbox's scene; texture paths are relative to the working directory (the sandbox directory)
+// The caller owns the returned scene
+Rt::Scene* create_demo_scene();
+
+// Rolling heightfield over [-1, 1] x [-1, 1] (y up) with at least nr_triangles triangles
+// Generated scene used by the benchmarks to scale the geometry to any size
+std::shared_ptr<Rt::Mesh> create_terrain_mesh(unsigned int nr_triangles, std::shared_ptr<Rt::Material> material=nullptr);
+
+#endif
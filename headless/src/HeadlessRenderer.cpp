@@ -0,0 +1,176 @@
+#include "HeadlessRenderer.hpp"
+
+#include <QDebug>
+#include <QGuiApplication>
+#include <QSurfaceFormat>
+#include <QtPlatformHeaders/QEGLNativeContext>
+
+#include <EGL/eglext.h>
+#include <cstring>
+
+HeadlessRenderer::HeadlessRenderer(QObject* parent) :
+    QObject(parent),
+    gl(&context, &surface)
+{
+    gpu_available = false;
+    use_cpu = false;
+    render_result_width = 0;
+    render_result_height = 0;
+    result_downloaded = true;
+}
+
+HeadlessRenderer::~HeadlessRenderer() {}
+
+bool HeadlessRenderer::SurfacelessContext::create() {
+    const char* client_extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    if (!client_extensions || !std::strstr(client_extensions, "EGL_MESA_platform_surfaceless")) {
+        qCritical("EGL doesn't support the surfaceless platform (EGL_MESA_platform_surfaceless).");
+        return false;
+    }
+    display = eglGetPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    EGLint major, minor;
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+        qCritical("Failed to initialize the surfaceless EGL display.");
+        display = EGL_NO_DISPLAY;
+        return false;
+    }
+
+    // The surfaceless platform has no window configs; pbuffer ones also cover the QOffscreenSurface
+    // if the driver lacks EGL_KHR_surfaceless_context and Qt has to give it a pbuffer
+    const EGLint config_attributes[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_ALPHA_SIZE, 8,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint nr_configs = 0;
+    if (!eglChooseConfig(display, config_attributes, &config, 1, &nr_configs) || nr_configs == 0) {
+        qCritical("The surfaceless EGL display has no OpenGL pbuffer config.");
+        return false;
+    }
+
+    const EGLint context_attributes[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 4,
+        EGL_CONTEXT_MINOR_VERSION, 5,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    eglBindAPI(EGL_OPENGL_API);
+    context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attributes);
+    if (context == EGL_NO_CONTEXT) {
+        qCritical("Failed to create an OpenGL 4.5 core context on the surfaceless EGL display.");
+        return false;
+    }
+    return true;
+}
+
+HeadlessRenderer::SurfacelessContext::~SurfacelessContext() {
+    if (context == EGL_NO_CONTEXT) return;
+    eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglDestroyContext(display, context);
+}
+
+bool HeadlessRenderer::initialize() {
+    QSurfaceFormat format = QSurfaceFormat::defaultFormat();
+    format.setRenderableType(QSurfaceFormat::OpenGL);
+    format.setVersion(4, 5);
+    format.setProfile(QSurfaceFormat::CoreProfile);
+
+    // eglfs would choose a window config for its own context, which the surfaceless platform doesn't have
+    if (QGuiApplication::platformName() == "eglfs") {
+        if (!surfaceless_context.create()) return false;
+        context.setNativeHandle(QVariant::fromValue(QEGLNativeContext(surfaceless_context.context, surfaceless_context.display)));
+    }
+
+    context.setFormat(format);
+    if (!context.create()) {
+        qCritical("Failed to create an OpenGL context.");
+        return false;
+    }
+    if (context.format().version() < qMakePair(4, 5)) {
+        qCritical() << "OpenGL 4.5 is required but only" << context.format().majorVersion() << "." << context.format().minorVersion() << "is available.";
+        return false;
+    }
+
+    surface.setFormat(context.format());
+    surface.create();
+    if (!surface.isValid() || !context.makeCurrent(&surface)) {
+        qCritical("Failed to make the OpenGL context current on an offscreen surface.");
+        return false;
+    }
+
+    gl.initializeOpenGLFunctions();
+
+    qDebug() << "GL Version:" << QString((const char*)gl.glGetString(GL_VERSION));
+    qDebug() << "GL Renderer:" << QString((const char*)gl.glGetString(GL_RENDERER));
+
+    renderer.initialize(&gl);
+    render_result.initialize(&gl);
+
+    gpu_available = true;
+    return true;
+}
+
+bool HeadlessRenderer::get_gpu_available() const {
+    return gpu_available;
+}
+
+void HeadlessRenderer::set_use_cpu(bool new_use_cpu) {
+    use_cpu = new_use_cpu;
+}
+
+bool HeadlessRenderer::get_use_cpu() const {
+    return use_cpu;
+}
+
+Rt::Renderer* HeadlessRenderer::get_renderer() {
+    return &renderer;
+}
+
+Rt::CPURenderer* HeadlessRenderer::get_cpu_renderer() {
+    return &cpu_renderer;
+}
+
+void HeadlessRenderer::set_camera(Rt::AbstractCamera* camera) {
+    renderer.set_camera(camera);
+    cpu_renderer.set_camera(camera);
+}
+
+void HeadlessRenderer::set_scene(Rt::Scene* scene) {
+    // Renderer uploads the scene right away which needs the context
+    if (gpu_available) renderer.set_scene(scene);
+    cpu_renderer.set_scene(scene);
+}
+
+bool HeadlessRenderer::render(unsigned int width, unsigned int height) {
+    if (use_cpu) {
+        // The CPURenderer renders straight into result so the GPU's last frame mustn't be downloaded over it
+        result_downloaded = true;
+        return cpu_renderer.render(&result, width, height);
+    }
+    if (!gpu_available) return false;
+
+    if (render_result_width == 0) {
+        render_result.create(width, height, Rt::TextureOptions::default_2D_options());
+    }
+    else if (render_result_width != width || render_result_height != height) {
+        render_result.resize(width, height);
+    }
+    render_result_width = width;
+    render_result_height = height;
+
+    if (!renderer.render(&render_result, width, height)) return false;
+    // Without a swap nothing else waits for the GPU
+    gl.glFinish();
+    result_downloaded = false;
+    return true;
+}
+
+const Rt::FloatImage& HeadlessRenderer::get_result() {
+    if (!result_downloaded) {
+        render_result.download(&result);
+        result_downloaded = true;
+    }
+    return result;
+}
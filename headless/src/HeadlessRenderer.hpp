@@ -0,0 +1,80 @@
+#ifndef HEADLESS_RENDERER_HPP
+#define HEADLESS_RENDERER_HPP
+
+#include <QObject>
+#include <QOpenGLContext>
+#include <QOffscreenSurface>
+
+#include <EGL/egl.h>
+
+#include <rendering/OpenGLFunctions.hpp>
+#include <rendering/Renderer.hpp>
+#include <rendering/CPURenderer.hpp>
+#include <rendering/FloatImage.hpp>
+#include <materials/Texture.hpp>
+
+// Drives a Renderer (or CPURenderer) without a window: the GPU renders into a Texture through
+// a context on an offscreen surface instead of an OpenGLWidget
+// On the eglfs platform (which main() picks without a display server) the context is created
+// on Mesa's surfaceless EGL platform and adopted by the QOpenGLContext, so it needs no X server
+class HeadlessRenderer : public QObject {
+    Q_OBJECT;
+
+public:
+    HeadlessRenderer(QObject* parent=nullptr);
+    ~HeadlessRenderer();
+
+    // Creates an OpenGL 4.5 core context and initializes the renderer with it
+    // Returns false if the platform can't create one; the CPURenderer still works without it
+    bool initialize();
+    // initialize() succeeded so the GPU can render
+    bool get_gpu_available() const;
+
+    // Render with the CPURenderer instead of the GPU (default false)
+    void set_use_cpu(bool new_use_cpu);
+    bool get_use_cpu() const;
+
+    Rt::Renderer* get_renderer();
+    Rt::CPURenderer* get_cpu_renderer();
+
+    void set_camera(Rt::AbstractCamera* camera);
+    void set_scene(Rt::Scene* scene);
+
+    // Renders a frame and waits for it to be finished so it can be timed
+    // Returns false if nothing was rendered
+    bool render(unsigned int width, unsigned int height);
+
+    // The last rendered frame (copied back from the GPU)
+    const Rt::FloatImage& get_result();
+
+private:
+    // The EGL context adopted by context on eglfs; Qt never destroys adopted contexts so this does
+    // Declared first so the context outlives everything rendering with it
+    struct SurfacelessContext {
+        EGLDisplay display = EGL_NO_DISPLAY;
+        EGLContext context = EGL_NO_CONTEXT;
+        bool create();
+        ~SurfacelessContext();
+    };
+    SurfacelessContext surfaceless_context;
+
+    QOpenGLContext context;
+    QOffscreenSurface surface;
+    // Declared before the renderers so it outlives them
+    Rt::OpenGLFunctions gl;
+
+    bool gpu_available;
+    bool use_cpu;
+    Rt::Renderer renderer;
+    Rt::CPURenderer cpu_renderer;
+
+    Rt::Texture render_result;
+    unsigned int render_result_width;
+    unsigned int render_result_height;
+
+    Rt::FloatImage result;
+    // The GPU's render result has been copied into result since the last render
+    bool result_downloaded;
+};
+
+#endif
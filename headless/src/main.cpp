@@ -0,0 +1,178 @@
+#include <QGuiApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QMetaEnum>
+#include <QFileInfo>
+#include <QFile>
+#include <QDir>
+#include <QTextStream>
+#include <QDebug>
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "HeadlessRenderer.hpp"
+#include "DemoScene.hpp"
+#include "Camera.hpp"
+#include "Benchmarks.hpp"
+
+// Renders the Sandbox's scene without a window, e.g.
+//   Headless --width 1920 --height 1080 --frames 100 --warmup 10 --output frame_%1.png --timings timings.csv
+// Every frame is waited on and timed; the timings are printed and optionally written as CSV
+// With --benchmark it runs one of the benchmarks in Benchmarks.cpp instead
+int main(int argc, char *argv[]) {
+    // Without a display server render through EGL's surfaceless platform on eglfs instead of failing
+    // to connect to one (HeadlessRenderer creates the context itself and eglfs adopts it)
+    // eglfs gets no device integration, input or cursor, and /dev/null as its framebuffer since
+    // nothing is ever shown; EGL_PLATFORM makes its display the surfaceless one HeadlessRenderer uses
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM") && qEnvironmentVariableIsEmpty("DISPLAY") && qEnvironmentVariableIsEmpty("WAYLAND_DISPLAY")) {
+        qputenv("QT_QPA_PLATFORM", "eglfs");
+        qputenv("QT_QPA_EGLFS_INTEGRATION", "none");
+        qputenv("QT_QPA_EGLFS_FB", "/dev/null");
+        qputenv("QT_QPA_EGLFS_DISABLE_INPUT", "1");
+        qputenv("QT_QPA_EGLFS_HIDECURSOR", "1");
+        qputenv("EGL_PLATFORM", "surfaceless");
+    }
+
+    QGuiApplication app(argc, argv);
+    QCoreApplication::setApplicationName("Headless");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Renders the Sandbox's scene offscreen and writes the frames to disk.");
+    parser.addHelpOption();
+    QCommandLineOption width_option("width", "Width of the frames in pixels.", "pixels", "800");
+    QCommandLineOption height_option("height", "Height of the frames in pixels.", "pixels", "600");
+    QCommandLineOption frames_option({"n", "frames"}, "Number of frames to render and time.", "frames", "1");
+    QCommandLineOption warmup_option("warmup", "Number of frames to render before the timed ones.", "frames", "0");
+    QCommandLineOption output_option({"o", "output"}, "Image the last frame is written to; with %1 in the name every frame is written with %1 replaced by its number. Empty to write nothing.", "file", "render.png");
+    QCommandLineOption timings_option("timings", "CSV file the frame times are written to.", "file");
+    QCommandLineOption cpu_option("cpu", "Render with the CPU instead of the GPU.");
+    QCommandLineOption threads_option("threads", "Number of threads rendering with --cpu (0 for every hardware thread).", "threads", "0");
+    QCommandLineOption dynamic_geometry_option("dynamic-geometry", "How the GPU intersects dynamic geometry: INSTANCED, TRANSFORMED, REFITTED or REBUILT.", "mode", "INSTANCED");
+    QCommandLineOption stage_timings_option("stage-timings", "Time every stage of the GPU's frames and print their statistics.");
+    QCommandLineOption resources_option("resources", "Directory the scene's texture paths are relative to (the sandbox directory by default).", "directory");
+    QCommandLineOption benchmark_option("benchmark", "Run a benchmark instead of rendering frames:\n" + get_benchmark_descriptions().join("\n"), "name");
+    parser.addOptions({width_option, height_option, frames_option, warmup_option, output_option, timings_option, cpu_option, threads_option, dynamic_geometry_option, stage_timings_option, resources_option, benchmark_option});
+    parser.process(app);
+
+    unsigned int width = parser.value(width_option).toUInt();
+    unsigned int height = parser.value(height_option).toUInt();
+    unsigned int nr_frames = parser.value(frames_option).toUInt();
+    unsigned int nr_warmup_frames = parser.value(warmup_option).toUInt();
+    if (width == 0 || height == 0 || nr_frames == 0) {
+        qCritical("The width, height and number of frames must be positive numbers.");
+        return 1;
+    }
+
+    bool valid_mode;
+    QMetaEnum dynamic_geometries = QMetaEnum::fromType<Rt::Renderer::DynamicGeometry>();
+    int dynamic_geometry = dynamic_geometries.keyToValue(parser.value(dynamic_geometry_option).toUpper().toLatin1().constData(), &valid_mode);
+    if (!valid_mode) {
+        qCritical() << "Unknown dynamic geometry mode" << parser.value(dynamic_geometry_option);
+        return 1;
+    }
+
+    // Resolve the output paths before moving into the resource directory
+    QString output = parser.value(output_option);
+    if (!output.isEmpty()) output = QFileInfo(output).absoluteFilePath();
+    QString timings = parser.value(timings_option);
+    if (!timings.isEmpty()) timings = QFileInfo(timings).absoluteFilePath();
+
+    QString resources = parser.isSet(resources_option) ? parser.value(resources_option) : QCoreApplication::applicationDirPath() + "/../sandbox";
+    if (!QDir::setCurrent(resources)) {
+        qCritical() << "Resource directory" << resources << "doesn't exist.";
+        return 1;
+    }
+
+    // Benchmarks which need the GPU check for a context themselves
+    HeadlessRenderer renderer;
+    if (!renderer.initialize() && !parser.isSet(cpu_option) && !parser.isSet(benchmark_option)) {
+        qCritical("Rendering on the GPU needs an OpenGL 4.5 context (through EGL's surfaceless platform or a display server); use --cpu without one.");
+        return 1;
+    }
+
+    QTextStream out(stdout);
+
+    if (parser.isSet(benchmark_option)) {
+        QString benchmark = parser.value(benchmark_option);
+        if (!run_benchmark(benchmark, renderer, out)) {
+            qCritical() << "Benchmark" << benchmark << "failed or doesn't exist.";
+            return 1;
+        }
+        return 0;
+    }
+
+    renderer.set_use_cpu(parser.isSet(cpu_option));
+    renderer.get_cpu_renderer()->set_nr_threads(parser.value(threads_option).toUInt());
+    renderer.get_renderer()->set_dynamic_geometry(Rt::Renderer::DynamicGeometry(dynamic_geometry));
+    renderer.get_renderer()->set_stage_timing(parser.isSet(stage_timings_option));
+    renderer.get_renderer()->set_stage_timing_window(nr_frames);
+
+    Camera camera;
+    camera.position = glm::vec3(0.0f, 0.0f, 5.0f);
+    camera.target = glm::vec3(0.0f);
+    renderer.set_camera(&camera);
+
+    std::unique_ptr<Rt::Scene> scene(create_demo_scene());
+    renderer.set_scene(scene.get());
+
+    for (unsigned int i=0; i<nr_warmup_frames; i++) {
+        if (!renderer.render(width, height)) {
+            qCritical("Rendering failed.");
+            return 1;
+        }
+    }
+
+    std::vector<double> frame_times;
+    QElapsedTimer timer;
+    for (unsigned int i=0; i<nr_frames; i++) {
+        timer.start();
+        if (!renderer.render(width, height)) {
+            qCritical("Rendering failed.");
+            return 1;
+        }
+        frame_times.push_back(timer.nsecsElapsed() / 1.0e6);
+        out << "Frame " << i << ": " << frame_times.back() << " ms" << Qt::endl;
+
+        bool last_frame = i+1 == nr_frames;
+        bool every_frame = output.contains("%1");
+        if (!output.isEmpty() && (last_frame || every_frame)) {
+            QString path = every_frame ? output.arg(i, 4, 10, QChar('0')) : output;
+            if (!renderer.get_result().to_image().save(path)) {
+                qCritical() << "Failed to write" << path;
+                return 1;
+            }
+        }
+    }
+
+    std::vector<double> sorted_times = frame_times;
+    std::sort(sorted_times.begin(), sorted_times.end());
+    double total_time = 0.0;
+    for (double frame_time : frame_times) total_time += frame_time;
+    out << nr_frames << " frames at " << width << "x" << height << " on the " << (renderer.get_use_cpu() ? "CPU" : "GPU")
+        << ": mean " << total_time/nr_frames << " ms, median " << sorted_times[nr_frames/2] << " ms, min "
+        << sorted_times.front() << " ms, max " << sorted_times.back() << " ms" << Qt::endl;
+
+    if (renderer.get_renderer()->get_stage_timing() && !renderer.get_use_cpu()) {
+        QMetaEnum stages = QMetaEnum::fromType<Rt::Renderer::Stage>();
+        for (int i=0; i<Rt::Renderer::nr_stages; i++) {
+            Rt::TimingStatistics statistics = renderer.get_renderer()->get_stage_statistics(Rt::Renderer::Stage(i));
+            if (statistics.nr_samples == 0) continue;
+            out << stages.valueToKey(i) << ": mean " << statistics.mean << " ms, p50 " << statistics.p50
+                << " ms, p99 " << statistics.p99 << " ms (" << statistics.nr_samples << " samples)" << Qt::endl;
+        }
+    }
+
+    if (!timings.isEmpty()) {
+        QFile file(timings);
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+            qCritical() << "Failed to write" << timings;
+            return 1;
+        }
+        QTextStream csv(&file);
+        csv << "frame,time_ms\n";
+        for (size_t i=0; i<frame_times.size(); i++) csv << i << "," << frame_times[i] << "\n";
+    }
+
+    return 0;
+}
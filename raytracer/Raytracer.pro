@@ -29,6 +29,12 @@ HEADERS +=  src/RaytracerGlobals.hpp \
 			src/rendering/OpenGLWidget.hpp \
 			src/rendering/OpenGLFunctions.hpp \
 			src/rendering/Renderer.hpp \
+			src/rendering/CPURenderer.hpp \
+			src/rendering/FloatImage.hpp \
+			src/rendering/TileScheduler.hpp \
+			src/rendering/StageTimer.hpp \
+			src/rendering/RingBuffer.hpp \
+			src/rendering/FreeListAllocator.hpp \
 			src/rendering/Shader.hpp \
 			src/rendering/AbstractCamera.hpp \
 			src/scene/Scene.hpp \
@@ -38,6 +44,15 @@ HEADERS +=  src/RaytracerGlobals.hpp \
 			src/scene/lights/AbstractLight.hpp \
 			src/scene/lights/SunLight.hpp \
 			src/scene/lights/PointLight.hpp \
+			src/scene/lights/LightSampler.hpp \
+			src/scene/lights/LightGrid.hpp \
+			src/acceleration/BVH.hpp \
+			src/acceleration/BVHCache.hpp \
+			src/acceleration/QuantizedBVH.hpp \
+			src/acceleration/WideBVH.hpp \
+			src/acceleration/SIMD.hpp \
+			src/acceleration/RayPacket.hpp \
+			src/acceleration/TaskPool.hpp \
 			src/materials/MaterialManager.hpp \
 			src/materials/Material.hpp \
 			src/materials/Texture.hpp \
@@ -48,6 +63,12 @@ HEADERS +=  src/RaytracerGlobals.hpp \
 
 SOURCES +=  src/rendering/OpenGLWidget.cpp \
 			src/rendering/Renderer.cpp \
+			src/rendering/CPURenderer.cpp \
+			src/rendering/FloatImage.cpp \
+			src/rendering/TileScheduler.cpp \
+			src/rendering/StageTimer.cpp \
+			src/rendering/RingBuffer.cpp \
+			src/rendering/FreeListAllocator.cpp \
 			src/rendering/Shader.cpp \
 			src/rendering/AbstractCamera.cpp \
 			src/scene/Scene.cpp \
@@ -57,6 +78,15 @@ SOURCES +=  src/rendering/OpenGLWidget.cpp \
 			src/scene/lights/AbstractLight.cpp \
 			src/scene/lights/SunLight.cpp \
 			src/scene/lights/PointLight.cpp \
+			src/scene/lights/LightSampler.cpp \
+			src/scene/lights/LightGrid.cpp \
+			src/acceleration/BVH.cpp \
+			src/acceleration/BVHCache.cpp \
+			src/acceleration/QuantizedBVH.cpp \
+			src/acceleration/WideBVH.cpp \
+			src/acceleration/SIMD.cpp \
+			src/acceleration/RayPacket.cpp \
+			src/acceleration/TaskPool.cpp \
 			src/materials/MaterialManager.cpp \
 			src/materials/Material.cpp \
 			src/materials/Texture.cpp \
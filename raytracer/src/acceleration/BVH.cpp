@@ -0,0 +1,652 @@
+#include "BVH.hpp"
+#include "TaskPool.hpp"
+
+#include <QElapsedTimer>
+
+#include <algorithm>
+#include <limits>
+#include <thread>
+#include <utility>
+
+namespace Rt {
+
+    namespace {
+
+        // Nodes with fewer primitives than this are built by a single thread
+        constexpr uint32_t min_parallel_primitives = 8192;
+
+        // Runs f(thread_index, begin, end) as nr_threads tasks of the shared TaskPool, each given an equal part of [0, count)
+        template <typename F>
+        void parallel_for(uint32_t count, unsigned int nr_threads, const F& f) {
+            TaskPool::get_shared().run(nr_threads, [&](unsigned int t) {
+                f(t, uint64_t(count)*t/nr_threads, uint64_t(count)*(t+1)/nr_threads);
+            });
+        }
+
+        struct Bin {
+            AABB bounds;
+            uint32_t count = 0;
+        };
+
+        // The bins of every axis
+        struct Bins {
+            Bin bins[3][BVH::nr_bins];
+        };
+
+        struct Split {
+            AABB bounds;
+            // -1 if the node should become a leaf
+            int axis = -1;
+            // Primitives in the bins before this one go to the left child
+            int bin = 0;
+            // Maps a centroid to its bin along axis
+            int nr_bins = BVH::nr_bins;
+            float centroid_min = 0.0f;
+            float bin_scale = 0.0f;
+
+            bool goes_left(const glm::vec3& centroid) const {
+                int b = int((centroid[axis] - centroid_min) * bin_scale);
+                return std::min(b, nr_bins-1) < bin;
+            }
+        };
+
+        class BinnedBuilder {
+        public:
+            BinnedBuilder(const std::vector<AABB>& primitive_bounds, std::vector<uint32_t>& primitive_indices, unsigned int max_leaf_size) :
+                primitive_bounds(primitive_bounds),
+                primitive_indices(primitive_indices),
+                max_leaf_size(max_leaf_size)
+            {}
+
+            void compute_centroids(unsigned int nr_threads) {
+                centroids.resize(primitive_bounds.size());
+                parallel_for(primitive_bounds.size(), nr_threads, [&](unsigned int, uint32_t begin, uint32_t end) {
+                    for (uint32_t i=begin; i<end; i++) centroids[i] = primitive_bounds[i].centroid();
+                });
+            }
+
+            // Builds the subtree over primitive_indices[first, first+count) whose root is at depth
+            // The returned nodes use the same layout as BVH::build() with the subtree's root at 0
+            std::vector<BVHNode> build(uint32_t first, uint32_t count, unsigned int nr_threads, int depth) {
+                if (nr_threads <= 1 || count < min_parallel_primitives)
+                    return build_serial(first, count, depth);
+
+                Split split = find_split(first, count, nr_threads, depth);
+                if (split.axis == -1)
+                    return std::vector<BVHNode>{BVHNode{split.bounds, first, count}};
+                uint32_t left_count = partition(first, count, split, nr_threads);
+
+                // Build both subtrees at once, splitting the threads between them in proportion
+                // to their number of primitives (but at least one each)
+                unsigned int left_threads = (uint64_t(nr_threads)*left_count + count/2) / count;
+                left_threads = std::clamp(left_threads, 1u, nr_threads-1);
+                std::vector<BVHNode> left_nodes;
+                std::vector<BVHNode> right_nodes;
+                TaskPool::get_shared().run(2, [&](unsigned int side) {
+                    if (side == 0) left_nodes = build(first, left_count, left_threads, depth+1);
+                    else right_nodes = build(first+left_count, count-left_count, nr_threads-left_threads, depth+1);
+                });
+
+                // Merge into [root, left root, right root, rest of left, rest of right] which is
+                // the same order the serial build lays the nodes out in
+                std::vector<BVHNode> subtree;
+                subtree.reserve(1 + left_nodes.size() + right_nodes.size());
+                subtree.push_back(BVHNode{split.bounds, 1, 0});
+                uint32_t left_offset = 2;
+                uint32_t right_offset = 3 + left_nodes.size()-1 - 1;
+                subtree.push_back(relocated(left_nodes[0], left_offset));
+                subtree.push_back(relocated(right_nodes[0], right_offset));
+                for (size_t i=1; i<left_nodes.size(); i++) subtree.push_back(relocated(left_nodes[i], left_offset));
+                for (size_t i=1; i<right_nodes.size(); i++) subtree.push_back(relocated(right_nodes[i], right_offset));
+                return subtree;
+            }
+
+        private:
+            const std::vector<AABB>& primitive_bounds;
+            std::vector<uint32_t>& primitive_indices;
+            std::vector<glm::vec3> centroids;
+            unsigned int max_leaf_size;
+
+            // Moves an interior node's children from local index i (>= 1) to offset+i
+            static BVHNode relocated(BVHNode node, uint32_t offset) {
+                if (!node.is_leaf()) node.left_or_first += offset;
+                return node;
+            }
+
+            std::vector<BVHNode> build_serial(uint32_t first, uint32_t count, int depth) {
+                std::vector<BVHNode> subtree{BVHNode{AABB(), first, count}};
+                // Nodes still waiting to be split and their depth
+                std::vector<std::pair<uint32_t, int>> to_split{{0, depth}};
+                while (!to_split.empty()) {
+                    uint32_t node_index = to_split.back().first;
+                    int node_depth = to_split.back().second;
+                    to_split.pop_back();
+
+                    uint32_t node_first = subtree[node_index].left_or_first;
+                    uint32_t node_count = subtree[node_index].count;
+                    Split split = find_split(node_first, node_count, 1, node_depth);
+                    subtree[node_index].bounds = split.bounds;
+                    if (split.axis == -1) continue;
+
+                    uint32_t left_count = partition(node_first, node_count, split, 1);
+
+                    uint32_t left_index = subtree.size();
+                    subtree[node_index].left_or_first = left_index;
+                    subtree[node_index].count = 0;
+                    subtree.push_back(BVHNode{AABB(), node_first, left_count});
+                    subtree.push_back(BVHNode{AABB(), node_first+left_count, node_count-left_count});
+
+                    to_split.push_back({left_index+1, node_depth+1});
+                    to_split.push_back({left_index, node_depth+1});
+                }
+                return subtree;
+            }
+
+            void grow_bounds(uint32_t begin, uint32_t end, AABB& bounds, AABB& centroid_bounds) const {
+                for (uint32_t i=begin; i<end; i++) {
+                    bounds.grow(primitive_bounds[primitive_indices[i]]);
+                    centroid_bounds.grow(centroids[primitive_indices[i]]);
+                }
+            }
+
+            void fill_bins(uint32_t begin, uint32_t end, int nr_bins, const glm::vec3& centroid_min, const glm::vec3& bin_scale, Bins& bins) const {
+                for (uint32_t i=begin; i<end; i++) {
+                    uint32_t primitive = primitive_indices[i];
+                    for (int axis=0; axis<3; axis++) {
+                        int b = std::min(int((centroids[primitive][axis] - centroid_min[axis]) * bin_scale[axis]), nr_bins-1);
+                        bins.bins[axis][b].bounds.grow(primitive_bounds[primitive]);
+                        bins.bins[axis][b].count++;
+                    }
+                }
+            }
+
+            Split find_split(uint32_t first, uint32_t count, unsigned int nr_threads, int depth) {
+                Split split;
+
+                // Bounds of the primitives and of their centroids
+                AABB centroid_bounds;
+                if (nr_threads <= 1) {
+                    grow_bounds(first, first+count, split.bounds, centroid_bounds);
+                } else {
+                    std::vector<AABB> thread_bounds(nr_threads);
+                    std::vector<AABB> thread_centroid_bounds(nr_threads);
+                    parallel_for(count, nr_threads, [&](unsigned int t, uint32_t begin, uint32_t end) {
+                        grow_bounds(first+begin, first+end, thread_bounds[t], thread_centroid_bounds[t]);
+                    });
+                    for (unsigned int t=0; t<nr_threads; t++) {
+                        split.bounds.grow(thread_bounds[t]);
+                        centroid_bounds.grow(thread_centroid_bounds[t]);
+                    }
+                }
+
+                if (count <= 1 || depth >= BVH::max_depth) return split;
+
+                // Bin the primitives along every axis
+                // Small nodes use fewer bins since there are only so many ways to split them
+                int nr_bins = std::min(BVH::nr_bins, int(count));
+                glm::vec3 extent = centroid_bounds.extent();
+                glm::vec3 bin_scale;
+                for (int axis=0; axis<3; axis++)
+                    bin_scale[axis] = extent[axis] > 0.0f ? nr_bins / extent[axis] : 0.0f;
+
+                Bins node_bins;
+                if (nr_threads <= 1) {
+                    fill_bins(first, first+count, nr_bins, centroid_bounds.min, bin_scale, node_bins);
+                } else {
+                    std::vector<Bins> thread_bins(nr_threads);
+                    parallel_for(count, nr_threads, [&](unsigned int t, uint32_t begin, uint32_t end) {
+                        fill_bins(first+begin, first+end, nr_bins, centroid_bounds.min, bin_scale, thread_bins[t]);
+                    });
+                    for (unsigned int t=0; t<nr_threads; t++) {
+                        for (int axis=0; axis<3; axis++) {
+                            for (int b=0; b<nr_bins; b++) {
+                                node_bins.bins[axis][b].bounds.grow(thread_bins[t].bins[axis][b].bounds);
+                                node_bins.bins[axis][b].count += thread_bins[t].bins[axis][b].count;
+                            }
+                        }
+                    }
+                }
+                const Bin (&bins)[3][BVH::nr_bins] = node_bins.bins;
+
+                // Sweep the planes between the bins
+                float best_cost = std::numeric_limits<float>::max();
+                for (int axis=0; axis<3; axis++) {
+                    if (bin_scale[axis] == 0.0f) continue;
+
+                    float right_costs[BVH::nr_bins];
+                    AABB right;
+                    uint32_t right_count = 0;
+                    for (int b=nr_bins-1; b>0; b--) {
+                        right.grow(bins[axis][b].bounds);
+                        right_count += bins[axis][b].count;
+                        right_costs[b] = right.surface_area()*right_count;
+                    }
+
+                    AABB left;
+                    uint32_t left_count = 0;
+                    for (int b=1; b<nr_bins; b++) {
+                        left.grow(bins[axis][b-1].bounds);
+                        left_count += bins[axis][b-1].count;
+                        if (left_count == 0 || left_count == count) continue;
+                        float cost = left.surface_area()*left_count + right_costs[b];
+                        if (cost < best_cost) {
+                            best_cost = cost;
+                            split.axis = axis;
+                            split.bin = b;
+                        }
+                    }
+                }
+
+                float parent_area = split.bounds.surface_area();
+                float split_cost = BVH::traversal_cost + BVH::intersection_cost * (parent_area > 0.0f ? best_cost/parent_area : count);
+                float leaf_cost = BVH::intersection_cost * count;
+                if (count <= max_leaf_size && (split.axis == -1 || leaf_cost <= split_cost)) {
+                    split.axis = -1;
+                    return split;
+                }
+
+                if (split.axis == -1) {
+                    // Every centroid is in the same spot; split the range in half
+                    split.axis = 0;
+                    split.bin = -1;
+                } else {
+                    split.nr_bins = nr_bins;
+                    split.centroid_min = centroid_bounds.min[split.axis];
+                    split.bin_scale = bin_scale[split.axis];
+                }
+                return split;
+            }
+
+            // Stable partition of primitive_indices[first, first+count) by split
+            // Returns the number of primitives in the left child
+            uint32_t partition(uint32_t first, uint32_t count, const Split& split, unsigned int nr_threads) {
+                if (split.bin == -1) return count / 2;
+
+                auto begin = std::begin(primitive_indices) + first;
+                if (nr_threads <= 1) {
+                    auto middle = std::stable_partition(begin, begin+count, [&](uint32_t primitive) {
+                        return split.goes_left(centroids[primitive]);
+                    });
+                    return middle - begin;
+                }
+
+                // Count each thread's left primitives, then scatter both sides into a copy
+                std::vector<uint32_t> left_counts(nr_threads+1, 0);
+                parallel_for(count, nr_threads, [&](unsigned int t, uint32_t b, uint32_t e) {
+                    for (uint32_t i=first+b; i<first+e; i++)
+                        left_counts[t+1] += split.goes_left(centroids[primitive_indices[i]]);
+                });
+                for (unsigned int t=0; t<nr_threads; t++) left_counts[t+1] += left_counts[t];
+                uint32_t left_count = left_counts[nr_threads];
+
+                std::vector<uint32_t> partitioned(count);
+                parallel_for(count, nr_threads, [&](unsigned int t, uint32_t b, uint32_t e) {
+                    uint32_t left = left_counts[t];
+                    uint32_t right = left_count + b - left_counts[t];
+                    for (uint32_t i=first+b; i<first+e; i++) {
+                        uint32_t primitive = primitive_indices[i];
+                        if (split.goes_left(centroids[primitive])) partitioned[left++] = primitive;
+                        else partitioned[right++] = primitive;
+                    }
+                });
+                std::copy(std::begin(partitioned), std::end(partitioned), begin);
+                return left_count;
+            }
+        };
+
+    }
+
+    AABB::AABB() :
+        min(glm::vec3(std::numeric_limits<float>::max())),
+        max(glm::vec3(-std::numeric_limits<float>::max()))
+    {}
+
+    AABB::AABB(const glm::vec3& min, const glm::vec3& max) : min(min), max(max) {}
+
+    void AABB::grow(const glm::vec3& point) {
+        min = glm::min(min, point);
+        max = glm::max(max, point);
+    }
+
+    void AABB::grow(const AABB& other) {
+        min = glm::min(min, other.min);
+        max = glm::max(max, other.max);
+    }
+
+    bool AABB::is_empty() const {
+        return min.x > max.x || min.y > max.y || min.z > max.z;
+    }
+
+    glm::vec3 AABB::centroid() const {
+        return (min + max) * 0.5f;
+    }
+
+    glm::vec3 AABB::extent() const {
+        return max - min;
+    }
+
+    float AABB::surface_area() const {
+        if (is_empty()) return 0.0f;
+        glm::vec3 e = extent();
+        return 2.0f * (e.x*e.y + e.y*e.z + e.z*e.x);
+    }
+
+    AABB AABB::transformed(const glm::mat4& transformation) const {
+        AABB result;
+        if (is_empty()) return result;
+        for (int corner=0; corner<8; corner++) {
+            glm::vec4 point(
+                corner & 1 ? max.x : min.x,
+                corner & 2 ? max.y : min.y,
+                corner & 4 ? max.z : min.z,
+                1.0f
+            );
+            result.grow(glm::vec3(transformation * point));
+        }
+        return result;
+    }
+
+    float AABB::intersect(const glm::vec3& origin, const glm::vec3& inverse_direction, float near_plane, float far_plane) const {
+        glm::vec3 t0 = (min - origin) * inverse_direction;
+        glm::vec3 t1 = (max - origin) * inverse_direction;
+        glm::vec3 t_min = glm::min(t0, t1);
+        glm::vec3 t_max = glm::max(t0, t1);
+
+        float t_enter = std::max(std::max(t_min.x, t_min.y), std::max(t_min.z, near_plane));
+        float t_exit = std::min(std::min(t_max.x, t_max.y), std::min(t_max.z, far_plane));
+
+        return t_enter <= t_exit ? t_enter : -1.0f;
+    }
+
+
+    bool BVHNode::is_leaf() const {
+        return count > 0;
+    }
+
+    void BVHNode::as_byte_array(unsigned char byte_array[bvh_node_size_in_opengl]) const {
+        unsigned char const* tmp = reinterpret_cast<unsigned char const*>(&bounds.min);
+        std::copy(tmp, tmp+12, byte_array);
+
+        tmp = reinterpret_cast<unsigned char const*>(&left_or_first);
+        std::copy(tmp, tmp+4, byte_array+12);
+
+        tmp = reinterpret_cast<unsigned char const*>(&bounds.max);
+        std::copy(tmp, tmp+12, byte_array+16);
+
+        tmp = reinterpret_cast<unsigned char const*>(&count);
+        std::copy(tmp, tmp+4, byte_array+28);
+    }
+
+    BVHNode BVHNode::from_byte_array(const unsigned char byte_array[bvh_node_size_in_opengl]) {
+        BVHNode node;
+        std::copy(byte_array, byte_array+12, reinterpret_cast<unsigned char*>(&node.bounds.min));
+        std::copy(byte_array+12, byte_array+16, reinterpret_cast<unsigned char*>(&node.left_or_first));
+        std::copy(byte_array+16, byte_array+28, reinterpret_cast<unsigned char*>(&node.bounds.max));
+        std::copy(byte_array+28, byte_array+32, reinterpret_cast<unsigned char*>(&node.count));
+        return node;
+    }
+
+
+    BVH::BVH() {
+        build_statistics = BVHBuildStatistics{0.0, 0, 0.0f, 0};
+    }
+
+    void BVH::build(const std::vector<AABB>& primitive_bounds, unsigned int max_leaf_size) {
+        QElapsedTimer timer;
+        timer.start();
+
+        nodes.clear();
+        primitive_indices.resize(primitive_bounds.size());
+        for (uint32_t i=0; i<primitive_indices.size(); i++) primitive_indices[i] = i;
+        if (primitive_bounds.empty()) return;
+        max_leaf_size = std::max(max_leaf_size, 1u);
+
+        std::vector<glm::vec3> centroids(primitive_bounds.size());
+        for (size_t i=0; i<primitive_bounds.size(); i++) centroids[i] = primitive_bounds[i].centroid();
+
+        nodes.reserve(2*primitive_bounds.size());
+        nodes.push_back(BVHNode{AABB(), 0, (uint32_t) primitive_bounds.size()});
+
+        // Scratch space for the sweep; right_areas[i] is the area of primitives [i, count)
+        std::vector<float> right_areas(primitive_bounds.size());
+
+        // Nodes still waiting to be split and their depth (explicit stack to avoid deep recursion)
+        std::vector<std::pair<uint32_t, int>> to_split{{0, 0}};
+        while (!to_split.empty()) {
+            uint32_t node_index = to_split.back().first;
+            int depth = to_split.back().second;
+            to_split.pop_back();
+
+            uint32_t first = nodes[node_index].left_or_first;
+            uint32_t count = nodes[node_index].count;
+            auto begin = std::begin(primitive_indices) + first;
+            auto end = begin + count;
+
+            AABB bounds;
+            for (auto it=begin; it!=end; ++it) bounds.grow(primitive_bounds[*it]);
+            nodes[node_index].bounds = bounds;
+
+            if (count <= 1 || depth >= max_depth) continue;
+
+            // Sweep every axis for the cheapest split
+            float best_cost = std::numeric_limits<float>::max();
+            int best_axis = -1;
+            uint32_t best_split = 0;
+            for (int axis=0; axis<3; axis++) {
+                std::sort(begin, end, [&](uint32_t a, uint32_t b) {
+                    return centroids[a][axis] < centroids[b][axis];
+                });
+
+                AABB right;
+                for (uint32_t i=count; i>0; i--) {
+                    right.grow(primitive_bounds[*(begin+i-1)]);
+                    right_areas[i-1] = right.surface_area();
+                }
+
+                AABB left;
+                for (uint32_t i=1; i<count; i++) {
+                    left.grow(primitive_bounds[*(begin+i-1)]);
+                    float cost = left.surface_area()*i + right_areas[i]*(count-i);
+                    if (cost < best_cost) {
+                        best_cost = cost;
+                        best_axis = axis;
+                        best_split = i;
+                    }
+                }
+            }
+
+            // Compare against the cost of leaving the primitives in a leaf
+            float parent_area = bounds.surface_area();
+            float split_cost = traversal_cost + intersection_cost * (parent_area > 0.0f ? best_cost/parent_area : count);
+            float leaf_cost = intersection_cost * count;
+            if (count <= max_leaf_size && leaf_cost <= split_cost) continue;
+
+            // The range is currently sorted along z; restore the best axis' order
+            if (best_axis != 2) {
+                std::sort(begin, end, [&](uint32_t a, uint32_t b) {
+                    return centroids[a][best_axis] < centroids[b][best_axis];
+                });
+            }
+
+            uint32_t left_index = nodes.size();
+            nodes[node_index].left_or_first = left_index;
+            nodes[node_index].count = 0;
+            nodes.push_back(BVHNode{AABB(), first, best_split});
+            nodes.push_back(BVHNode{AABB(), first+best_split, count-best_split});
+
+            // Push the right child first so the left subtree is processed (and laid out) first
+            to_split.push_back({left_index+1, depth+1});
+            to_split.push_back({left_index, depth+1});
+        }
+        nodes.shrink_to_fit();
+
+        update_build_statistics(timer.nsecsElapsed(), 1);
+    }
+
+    void BVH::build_binned(const std::vector<AABB>& primitive_bounds, unsigned int max_leaf_size, unsigned int nr_threads) {
+        QElapsedTimer timer;
+        timer.start();
+
+        if (nr_threads == 0) nr_threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+        nodes.clear();
+        primitive_indices.resize(primitive_bounds.size());
+        for (uint32_t i=0; i<primitive_indices.size(); i++) primitive_indices[i] = i;
+
+        if (!primitive_bounds.empty()) {
+            BinnedBuilder builder(primitive_bounds, primitive_indices, std::max(max_leaf_size, 1u));
+            builder.compute_centroids(primitive_bounds.size() < min_parallel_primitives ? 1 : nr_threads);
+            nodes = builder.build(0, primitive_bounds.size(), nr_threads, 0);
+        }
+
+        update_build_statistics(timer.nsecsElapsed(), nr_threads);
+    }
+
+    void BVH::refit(const std::vector<AABB>& primitive_bounds) {
+        // Children always have a higher index than their parent so walking the nodes
+        // backwards visits both children before their parent
+        for (size_t i=nodes.size(); i>0; i--) {
+            BVHNode& node = nodes[i-1];
+            AABB bounds;
+            if (node.is_leaf()) {
+                for (uint32_t p=node.left_or_first; p<node.left_or_first+node.count; p++)
+                    bounds.grow(primitive_bounds[primitive_indices[p]]);
+            } else {
+                bounds.grow(nodes[node.left_or_first].bounds);
+                bounds.grow(nodes[node.left_or_first+1].bounds);
+            }
+            node.bounds = bounds;
+        }
+    }
+
+    const std::vector<BVHNode>& BVH::get_nodes() const {
+        return nodes;
+    }
+
+    const std::vector<uint32_t>& BVH::get_primitive_indices() const {
+        return primitive_indices;
+    }
+
+    std::vector<uint32_t> BVH::get_parent_indices() const {
+        std::vector<uint32_t> parents(nodes.size(), no_parent);
+        for (uint32_t i=0; i<nodes.size(); i++) {
+            if (!nodes[i].is_leaf()) {
+                parents[nodes[i].left_or_first] = i;
+                parents[nodes[i].left_or_first+1] = i;
+            }
+        }
+        return parents;
+    }
+
+    bool BVH::is_empty() const {
+        return nodes.empty();
+    }
+
+    AABB BVH::get_bounds() const {
+        if (nodes.empty()) return AABB();
+        return nodes[0].bounds;
+    }
+
+    float BVH::traverse(const glm::vec3& origin, const glm::vec3& direction, float near_plane, float far_plane, const LeafIntersector& intersect_leaf) const {
+        if (nodes.empty()) return far_plane;
+        glm::vec3 inverse_direction = 1.0f / direction;
+        if (nodes[0].bounds.intersect(origin, inverse_direction, near_plane, far_plane) < 0.0f) return far_plane;
+
+        // Same order as the traversal in raytrace.glsl: the nearer child is visited first
+        uint32_t stack[traversal_stack_size];
+        int stack_size = 0;
+        stack[stack_size++] = 0;
+        while (stack_size > 0) {
+            const BVHNode& node = nodes[stack[--stack_size]];
+            if (node.is_leaf()) {
+                far_plane = intersect_leaf(node.left_or_first, node.count, far_plane);
+                continue;
+            }
+
+            uint32_t left = node.left_or_first;
+            uint32_t right = left + 1;
+            float left_distance = nodes[left].bounds.intersect(origin, inverse_direction, near_plane, far_plane);
+            float right_distance = nodes[right].bounds.intersect(origin, inverse_direction, near_plane, far_plane);
+            // Can't fail for hierarchies no deeper than max_depth; anything else would lose children
+            Q_ASSERT(stack_size+2 <= traversal_stack_size);
+            if (left_distance >= 0.0f && right_distance >= 0.0f && stack_size+2 <= traversal_stack_size) {
+                bool left_first = left_distance <= right_distance;
+                stack[stack_size++] = left_first ? right : left;
+                stack[stack_size++] = left_first ? left : right;
+            } else if (left_distance >= 0.0f && stack_size < traversal_stack_size) {
+                stack[stack_size++] = left;
+            } else if (right_distance >= 0.0f && stack_size < traversal_stack_size) {
+                stack[stack_size++] = right;
+            }
+        }
+        return far_plane;
+    }
+
+    bool BVH::occluded(const glm::vec3& origin, const glm::vec3& direction, float near_plane, float far_plane, const LeafOcclusionTest& is_leaf_occluded) const {
+        if (nodes.empty()) return false;
+        glm::vec3 inverse_direction = 1.0f / direction;
+        if (nodes[0].bounds.intersect(origin, inverse_direction, near_plane, far_plane) < 0.0f) return false;
+
+        // Any hit will do so the children are visited in whichever order they come
+        uint32_t stack[traversal_stack_size];
+        int stack_size = 0;
+        stack[stack_size++] = 0;
+        while (stack_size > 0) {
+            const BVHNode& node = nodes[stack[--stack_size]];
+            if (node.is_leaf()) {
+                if (is_leaf_occluded(node.left_or_first, node.count)) return true;
+                continue;
+            }
+
+            Q_ASSERT(stack_size+2 <= traversal_stack_size);
+            for (uint32_t child=node.left_or_first; child<node.left_or_first+2; child++) {
+                if (nodes[child].bounds.intersect(origin, inverse_direction, near_plane, far_plane) >= 0.0f && stack_size < traversal_stack_size)
+                    stack[stack_size++] = child;
+            }
+        }
+        return false;
+    }
+
+    float BVH::sah_cost() const {
+        if (nodes.empty()) return 0.0f;
+        float root_area = nodes[0].bounds.surface_area();
+        if (root_area <= 0.0f) return intersection_cost * primitive_indices.size();
+
+        float cost = 0.0f;
+        for (const BVHNode& node : nodes) {
+            float relative_area = node.bounds.surface_area() / root_area;
+            if (node.is_leaf())
+                cost += intersection_cost * node.count * relative_area;
+            else
+                cost += traversal_cost * relative_area;
+        }
+        return cost;
+    }
+
+    void BVH::set_hierarchy(std::vector<BVHNode> new_nodes, std::vector<uint32_t> new_primitive_indices) {
+        nodes = std::move(new_nodes);
+        primitive_indices = std::move(new_primitive_indices);
+        update_build_statistics(0, 0);
+    }
+
+    const BVHBuildStatistics& BVH::get_build_statistics() const {
+        return build_statistics;
+    }
+
+    void BVH::update_build_statistics(qint64 build_time_ns, unsigned int nr_threads) {
+        build_statistics.build_time = build_time_ns / 1e6;
+        build_statistics.nr_nodes = nodes.size();
+        build_statistics.sah_cost = sah_cost();
+        build_statistics.nr_threads = nr_threads;
+    }
+
+    void BVH::nodes_as_byte_array(std::vector<unsigned char>& byte_array) const {
+        size_t offset = byte_array.size();
+        byte_array.resize(offset + nodes.size()*bvh_node_size_in_opengl);
+        for (const BVHNode& node : nodes) {
+            node.as_byte_array(byte_array.data()+offset);
+            offset += bvh_node_size_in_opengl;
+        }
+    }
+
+}
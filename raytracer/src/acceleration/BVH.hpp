@@ -0,0 +1,156 @@
+#ifndef RT_BVH_HPP
+#define RT_BVH_HPP
+
+#include <QtGlobal>
+#include <glm/glm.hpp>
+#include <functional>
+#include <vector>
+
+#include "RaytracerGlobals.hpp"
+
+namespace Rt {
+
+    constexpr int bvh_node_size_in_opengl = 32;
+
+    struct RAYTRACER_LIB_EXPORT AABB {
+        glm::vec3 min;
+        glm::vec3 max;
+
+        // Creates an empty (inverted) box which any call to grow() will overwrite
+        AABB();
+        AABB(const glm::vec3& min, const glm::vec3& max);
+
+        void grow(const glm::vec3& point);
+        void grow(const AABB& other);
+
+        bool is_empty() const;
+        glm::vec3 centroid() const;
+        glm::vec3 extent() const;
+        // Returns 0 for an empty box
+        float surface_area() const;
+        // Returns the box enclosing this box after it has been transformed
+        AABB transformed(const glm::mat4& transformation) const;
+
+        // Slab test mirroring ray_aabb_int in raytrace.glsl
+        // Returns the distance at which the ray enters the box (clamped to near_plane)
+        // or a negative number if it misses the box within [near_plane, far_plane]
+        float intersect(const glm::vec3& origin, const glm::vec3& inverse_direction, float near_plane, float far_plane) const;
+    };
+
+    // Called by the CPU traversals for every leaf the ray reaches with the leaf's range of
+    // primitive indices and the distance to the nearest hit so far
+    // Returns the distance to the nearest hit after testing the leaf's primitives
+    using LeafIntersector = std::function<float(uint32_t first, uint32_t count, float far_plane)>;
+
+    // Called by the CPU occlusion queries for every leaf the ray reaches with the leaf's range
+    // of primitive indices; returns true if any of them blocks the ray
+    using LeafOcclusionTest = std::function<bool(uint32_t first, uint32_t count)>;
+
+    struct RAYTRACER_LIB_EXPORT BVHNode {
+        AABB bounds;
+
+        // Interior nodes: index of the left child; the right child is always left_or_first+1
+        // Leaf nodes: index of the first primitive in BVH::get_primitive_indices()
+        uint32_t left_or_first;
+
+        // Number of primitives in a leaf; 0 for interior nodes
+        uint32_t count;
+
+        bool is_leaf() const;
+
+        // OpenGL (std430) memory layout:
+        //                  // Base Alignment  // Aligned Offset
+        // bounds.min       // 16                 0
+        // left_or_first    // 4                  12
+        // bounds.max       // 16                 16
+        // count            // 4                  28
+        // Total Size: 32
+        void as_byte_array(unsigned char byte_array[bvh_node_size_in_opengl]) const;
+        static BVHNode from_byte_array(const unsigned char byte_array[bvh_node_size_in_opengl]);
+    };
+
+    struct RAYTRACER_LIB_EXPORT BVHBuildStatistics {
+        // Wall clock time of the last build in milliseconds
+        double build_time;
+        size_t nr_nodes;
+        float sah_cost;
+        unsigned int nr_threads;
+    };
+
+    // Bounding volume hierarchy over an arbitrary list of primitive bounds
+    // The nodes are stored depth first with the root at index 0 and sibling nodes
+    // next to each other so children always have a higher index than their parent
+    class RAYTRACER_LIB_EXPORT BVH {
+    public:
+        // Relative costs used by the surface area heuristic
+        static constexpr float traversal_cost = 1.0f;
+        static constexpr float intersection_cost = 1.0f;
+
+        BVH();
+
+        // Builds the hierarchy with a full sweep of the surface area heuristic over every axis
+        // Nodes with more than max_leaf_size primitives are always split (unless at max_depth)
+        void build(const std::vector<AABB>& primitive_bounds, unsigned int max_leaf_size=4);
+
+        // Builds the hierarchy by evaluating the surface area heuristic at nr_bins planes per axis
+        // Large nodes are binned and partitioned by all threads and their subtrees are then built
+        // in parallel; the result doesn't depend on the number of threads
+        // The work is split into tasks for nr_threads threads which run on TaskPool::get_shared()
+        // nr_threads=0 uses every hardware thread
+        static constexpr int nr_bins = 16;
+        void build_binned(const std::vector<AABB>& primitive_bounds, unsigned int max_leaf_size=4, unsigned int nr_threads=0);
+
+        // Recomputes the bounds of every node bottom up while keeping the hierarchy as it is
+        // primitive_bounds must hold the same primitives, in the same order, as the last build()
+        void refit(const std::vector<AABB>& primitive_bounds);
+
+        const std::vector<BVHNode>& get_nodes() const;
+        // Leaf nodes reference ranges of this array which holds indices into the primitive
+        // bounds build() was called with
+        const std::vector<uint32_t>& get_primitive_indices() const;
+
+        // Index of the parent of every node; the root's parent is no_parent
+        static constexpr uint32_t no_parent = 0xFFFFFFFF;
+        std::vector<uint32_t> get_parent_indices() const;
+
+        bool is_empty() const;
+        AABB get_bounds() const;
+
+        // Should match BVH_STACK_SIZE in raytrace.glsl
+        static constexpr int traversal_stack_size = 64;
+        // Depth (the root is at 0) at which the builders always make a leaf, even one with more
+        // than max_leaf_size primitives
+        // A node at depth d is visited with at most d others on the traversal stack so no
+        // traversal ever runs out of stack space and skips part of the hierarchy
+        static constexpr int max_depth = traversal_stack_size - 1;
+        // Visits the leaves the ray reaches nearest first, skipping everything beyond the nearest hit
+        // Returns the distance to the nearest hit (far_plane if nothing was hit)
+        float traverse(const glm::vec3& origin, const glm::vec3& direction, float near_plane, float far_plane, const LeafIntersector& intersect_leaf) const;
+        // Any hit query mirroring occluded() in raytrace.glsl for shadow rays
+        // Stops at the first leaf for which is_leaf_occluded returns true without looking for the nearest hit
+        bool occluded(const glm::vec3& origin, const glm::vec3& direction, float near_plane, float far_plane, const LeafOcclusionTest& is_leaf_occluded) const;
+
+        // Expected cost of intersecting a random ray with the hierarchy, relative to the
+        // root's surface area (lower is better)
+        float sah_cost() const;
+
+        // Replaces the hierarchy with one built earlier (e.g. loaded by BVHCache)
+        // The build time and number of threads of the statistics are set to 0
+        void set_hierarchy(std::vector<BVHNode> new_nodes, std::vector<uint32_t> new_primitive_indices);
+
+        // Build time, node count and SAH cost of the last build()/build_binned()
+        const BVHBuildStatistics& get_build_statistics() const;
+
+        // Appends the nodes to byte_array using the OpenGL memory layout of BVHNode
+        void nodes_as_byte_array(std::vector<unsigned char>& byte_array) const;
+
+    private:
+        std::vector<BVHNode> nodes;
+        std::vector<uint32_t> primitive_indices;
+        BVHBuildStatistics build_statistics;
+        void update_build_statistics(qint64 build_time_ns, unsigned int nr_threads);
+    };
+
+}
+
+#endif
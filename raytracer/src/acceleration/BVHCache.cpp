@@ -0,0 +1,265 @@
+#include "BVHCache.hpp"
+
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+#include <algorithm>
+#include <cstring>
+
+namespace Rt {
+
+    namespace {
+
+        /*
+        File layout (host byte order):
+            // Offset
+            magic                   // 0  (8 bytes)
+            version                 // 8
+            node size               // 12 (bvh_node_size_in_opengl)
+            nr_nodes                // 16 (uint64)
+            nr_primitive_indices    // 24 (uint64)
+            nodes                   // 32 (BVHNode OpenGL layout)
+            primitive indices       // 32 + nr_nodes*node size (uint32)
+        */
+        constexpr char magic[8] = {'R', 't', 'B', 'V', 'H', 0, 0, 0};
+        constexpr qint64 header_size = 32;
+
+        struct Header {
+            char magic[8];
+            uint32_t version;
+            uint32_t node_size;
+            uint64_t nr_nodes;
+            uint64_t nr_primitive_indices;
+        };
+        static_assert(sizeof(Header) == header_size, "Header must match the file layout");
+
+        // Makes sure the hierarchy can't send a traversal out of bounds, around in circles
+        // or past the end of its stack (children always come after their parent, see BVH)
+        bool is_valid(const std::vector<BVHNode>& nodes, const std::vector<uint32_t>& primitive_indices) {
+            std::vector<int> depths(nodes.size(), 0);
+            for (size_t i=0; i<nodes.size(); i++) {
+                const BVHNode& node = nodes[i];
+                if (depths[i] > BVH::max_depth) return false;
+                if (node.is_leaf()) {
+                    if (uint64_t(node.left_or_first) + node.count > primitive_indices.size()) return false;
+                } else if (node.left_or_first <= i || uint64_t(node.left_or_first) + 1 >= nodes.size()) {
+                    return false;
+                } else {
+                    depths[node.left_or_first] = std::max(depths[node.left_or_first], depths[i] + 1);
+                    depths[node.left_or_first + 1] = std::max(depths[node.left_or_first + 1], depths[i] + 1);
+                }
+            }
+            for (uint32_t primitive : primitive_indices) {
+                if (primitive >= primitive_indices.size()) return false;
+            }
+            return true;
+        }
+
+    }
+
+    bool BVHCache::enabled = true;
+    QString BVHCache::directory;
+    qint64 BVHCache::max_size = qint64(1) << 30;
+
+    BVHCache::Key::Key() : hash(QCryptographicHash::Sha1) {}
+
+    void BVHCache::Key::add_mesh(const std::vector<Vertex>& vertices, const std::vector<Index>& indices) {
+        // Only the positions matter to the hierarchy
+        std::vector<float> positions;
+        positions.reserve(3*vertices.size());
+        for (const Vertex& vertex : vertices) {
+            positions.push_back(vertex.position.x);
+            positions.push_back(vertex.position.y);
+            positions.push_back(vertex.position.z);
+        }
+        uint64_t sizes[2] = {vertices.size(), indices.size()};
+        hash.addData(reinterpret_cast<const char*>(sizes), sizeof(sizes));
+        hash.addData(reinterpret_cast<const char*>(positions.data()), positions.size()*sizeof(float));
+        hash.addData(reinterpret_cast<const char*>(indices.data()), indices.size()*sizeof(Index));
+    }
+
+    QByteArray BVHCache::Key::result() const {
+        return hash.result().toHex();
+    }
+
+    void BVHCache::set_enabled(bool new_enabled) {
+        enabled = new_enabled;
+    }
+
+    bool BVHCache::is_enabled() {
+        return enabled;
+    }
+
+    void BVHCache::set_directory(const QString& new_directory) {
+        directory = new_directory;
+    }
+
+    QString BVHCache::get_directory() {
+        if (directory.isEmpty()) {
+            QString cache_location = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+            if (cache_location.isEmpty())
+                cache_location = QDir::tempPath() + "/Raytracer";
+            directory = cache_location + "/bvh";
+        }
+        return directory;
+    }
+
+    void BVHCache::set_max_size(qint64 new_max_size) {
+        max_size = new_max_size;
+    }
+
+    qint64 BVHCache::get_max_size() {
+        return max_size;
+    }
+
+    QString BVHCache::get_file_path(const QByteArray& key) {
+        return QDir(get_directory()).filePath(QString::fromLatin1(key) + ".v" + QString::number(version) + ".bvh");
+    }
+
+    bool BVHCache::load(const QByteArray& key, BVH& bvh, std::vector<unsigned char>* node_bytes) {
+        QFile file(get_file_path(key));
+        if (!file.exists() || !file.open(QIODevice::ReadOnly))
+            return false;
+
+        qint64 file_size = file.size();
+        if (file_size < header_size) {
+            qWarning() << "Ignoring truncated BVH cache file" << file.fileName();
+            return false;
+        }
+
+        uchar* data = file.map(0, file_size);
+        if (!data) {
+            qWarning() << "Unable to map BVH cache file" << file.fileName() << ":" << file.errorString();
+            return false;
+        }
+
+        Header header;
+        std::memcpy(&header, data, sizeof(Header));
+        uint64_t expected_size = header_size + header.nr_nodes*bvh_node_size_in_opengl + header.nr_primitive_indices*sizeof(uint32_t);
+        if (std::memcmp(header.magic, magic, sizeof(magic)) != 0 || header.version != version ||
+            header.node_size != bvh_node_size_in_opengl || expected_size != uint64_t(file_size)) {
+            qWarning() << "Ignoring invalid or outdated BVH cache file" << file.fileName();
+            file.unmap(data);
+            return false;
+        }
+
+        // The file holds the nodes in the layout the GPU reads so they are copied as they are;
+        // only the CPU side BVHNodes have to be decoded
+        std::vector<BVHNode> nodes(header.nr_nodes);
+        unsigned char const* node_data = data + header_size;
+        for (size_t i=0; i<nodes.size(); i++)
+            nodes[i] = BVHNode::from_byte_array(node_data + i*bvh_node_size_in_opengl);
+
+        std::vector<uint32_t> primitive_indices(header.nr_primitive_indices);
+        std::memcpy(primitive_indices.data(), node_data + nodes.size()*bvh_node_size_in_opengl, primitive_indices.size()*sizeof(uint32_t));
+
+        if (!is_valid(nodes, primitive_indices)) {
+            qWarning() << "Ignoring corrupt BVH cache file" << file.fileName();
+            file.unmap(data);
+            return false;
+        }
+
+        if (node_bytes)
+            node_bytes->assign(node_data, node_data + nodes.size()*bvh_node_size_in_opengl);
+        file.unmap(data);
+        file.close();
+
+        // Loading counts as a use for the least recently used eviction
+        // (Windows only sets file times through a handle with write access)
+        if (file.open(QIODevice::ReadWrite)) {
+            file.setFileTime(QDateTime::currentDateTime(), QFileDevice::FileModificationTime);
+            file.close();
+        }
+
+        bvh.set_hierarchy(std::move(nodes), std::move(primitive_indices));
+        return true;
+    }
+
+    bool BVHCache::store(const QByteArray& key, const BVH& bvh) {
+        if (!QDir().mkpath(get_directory())) {
+            qWarning() << "Unable to create the BVH cache directory" << get_directory();
+            return false;
+        }
+
+        Header header;
+        std::memcpy(header.magic, magic, sizeof(magic));
+        header.version = version;
+        header.node_size = bvh_node_size_in_opengl;
+        header.nr_nodes = bvh.get_nodes().size();
+        header.nr_primitive_indices = bvh.get_primitive_indices().size();
+
+        std::vector<unsigned char> nodes;
+        bvh.nodes_as_byte_array(nodes);
+        const std::vector<uint32_t>& primitive_indices = bvh.get_primitive_indices();
+
+        QSaveFile file(get_file_path(key));
+        if (!file.open(QIODevice::WriteOnly)) {
+            qWarning() << "Unable to write BVH cache file" << file.fileName() << ":" << file.errorString();
+            return false;
+        }
+        file.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+        file.write(reinterpret_cast<const char*>(nodes.data()), nodes.size());
+        file.write(reinterpret_cast<const char*>(primitive_indices.data()), primitive_indices.size()*sizeof(uint32_t));
+        if (!file.commit()) {
+            qWarning() << "Unable to write BVH cache file" << file.fileName() << ":" << file.errorString();
+            return false;
+        }
+
+        evict(get_file_path(key));
+        return true;
+    }
+
+    void BVHCache::evict(const QString& keep) {
+        // Newest first; load() touches the files it reads so this is also the order of use
+        QFileInfoList files = QDir(get_directory()).entryInfoList(QStringList() << "*.bvh", QDir::Files, QDir::Time);
+        QString keep_path = QFileInfo(keep).absoluteFilePath();
+        qint64 total_size = 0;
+        for (const QFileInfo& file : files) {
+            total_size += file.size();
+            if (total_size <= max_size || file.absoluteFilePath() == keep_path) continue;
+            if (QFile::remove(file.absoluteFilePath()))
+                qDebug() << "Evicted BVH cache file" << file.fileName() << "to keep the cache below" << max_size << "bytes";
+        }
+    }
+
+    void BVHCache::build(const QByteArray& key, BVH& bvh, const std::vector<AABB>& primitive_bounds, unsigned int max_leaf_size,
+                         std::vector<unsigned char>* node_bytes) {
+        if (!enabled || primitive_bounds.empty()) {
+            bvh.build_binned(primitive_bounds, max_leaf_size);
+            if (node_bytes) {
+                node_bytes->clear();
+                bvh.nodes_as_byte_array(*node_bytes);
+            }
+            return;
+        }
+
+        QByteArray full_key = key + "-" + QByteArray::number(max_leaf_size);
+
+        QElapsedTimer timer;
+        timer.start();
+        if (load(full_key, bvh, node_bytes) && bvh.get_primitive_indices().size() == primitive_bounds.size()) {
+            qDebug() << "BVH cache hit" << full_key << ": loaded" << bvh.get_nodes().size() << "nodes in" << timer.nsecsElapsed()/1e6 << "ms";
+            return;
+        }
+
+        bvh.build_binned(primitive_bounds, max_leaf_size);
+        const BVHBuildStatistics& statistics = bvh.get_build_statistics();
+        if (node_bytes) {
+            node_bytes->clear();
+            bvh.nodes_as_byte_array(*node_bytes);
+        }
+
+        timer.restart();
+        bool stored = store(full_key, bvh);
+        qDebug() << "BVH cache miss" << full_key << ": built" << statistics.nr_nodes << "nodes in" << statistics.build_time
+                 << "ms on" << statistics.nr_threads << "threads (SAH cost" << statistics.sah_cost << ")"
+                 << (stored ? "and stored them in" : "but couldn't store them after") << timer.nsecsElapsed()/1e6 << "ms";
+    }
+
+}
@@ -0,0 +1,77 @@
+#ifndef RT_BVH_CACHE_HPP
+#define RT_BVH_CACHE_HPP
+
+#include <QtGlobal>
+#include <QByteArray>
+#include <QCryptographicHash>
+#include <QString>
+#include <vector>
+
+#include "RaytracerGlobals.hpp"
+#include "BVH.hpp"
+#include "scene/Vertex.hpp"
+
+namespace Rt {
+
+    // Stores built BVHs on disk so hierarchies over geometry that was seen before (e.g. the
+    // static geometry of a scene on every launch) are loaded instead of rebuilt
+    // Each hierarchy is a versioned binary file named after a content hash of its geometry
+    // Only meant for hierarchies built while loading a scene; geometry edited at runtime is rarely
+    // seen again and would only fill the cache up
+    // Once the files take up more than get_max_size() the least recently used ones are deleted
+    class RAYTRACER_LIB_EXPORT BVHCache {
+    public:
+        // Bump whenever the file layout or the builders change
+        static constexpr uint32_t version = 2;
+
+        // Content hash of the vertex positions and indices of one or more meshes
+        class RAYTRACER_LIB_EXPORT Key {
+        public:
+            Key();
+            void add_mesh(const std::vector<Vertex>& vertices, const std::vector<Index>& indices);
+            // Hex string identifying everything added so far
+            QByteArray result() const;
+
+        private:
+            QCryptographicHash hash;
+        };
+
+        // Enabled by default
+        static void set_enabled(bool new_enabled);
+        static bool is_enabled();
+
+        // Defaults to a "bvh" directory in the application's cache location
+        static void set_directory(const QString& new_directory);
+        static QString get_directory();
+
+        // Total size of the files in bytes (default 1 GiB)
+        static void set_max_size(qint64 new_max_size);
+        static qint64 get_max_size();
+
+        // Loads the hierarchy cached under key into bvh (memory mapping the file)
+        // node_bytes (if given) is set to the nodes in the OpenGL layout of BVHNode straight from
+        // the file so they can be uploaded without encoding them again
+        // Returns false if there is no valid file for key
+        static bool load(const QByteArray& key, BVH& bvh, std::vector<unsigned char>* node_bytes=nullptr);
+        // Writes bvh to the cache under key (atomically replacing any existing file)
+        // and deletes the least recently used files if the cache grew too large
+        static bool store(const QByteArray& key, const BVH& bvh);
+
+        // Loads the hierarchy for key, or builds it with BVH::build_binned() and stores it
+        // node_bytes (if given) is set to the nodes in the OpenGL layout of BVHNode either way
+        // Cache hits, misses and their timings are logged
+        static void build(const QByteArray& key, BVH& bvh, const std::vector<AABB>& primitive_bounds, unsigned int max_leaf_size=4,
+                          std::vector<unsigned char>* node_bytes=nullptr);
+
+    private:
+        static bool enabled;
+        static QString directory;
+        static qint64 max_size;
+        static QString get_file_path(const QByteArray& key);
+        // Deletes the least recently used files (except keep) until the cache fits in max_size
+        static void evict(const QString& keep);
+    };
+
+}
+
+#endif
@@ -0,0 +1,228 @@
+#include "QuantizedBVH.hpp"
+
+#include <QDebug>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace Rt {
+
+    namespace {
+
+        // Grid spacing for a biased exponent; exactly the float with that exponent and a 0 mantissa
+        float grid_spacing(uint8_t exponent) {
+            uint32_t bits = uint32_t(exponent) << 23;
+            float spacing;
+            std::memcpy(&spacing, &bits, sizeof(float));
+            return spacing;
+        }
+
+        // Same arithmetic as the decoding in raytrace.glsl; q*spacing is exact so the result
+        // doesn't depend on whether the multiply and add get fused
+        float decode(float origin, uint8_t q, uint8_t exponent) {
+            return origin + float(q) * grid_spacing(exponent);
+        }
+
+        // Picks the smallest spacing whose 255 steps from bounds.min cover bounds.max
+        uint8_t quantization_exponent(float min, float max) {
+            int exponent;
+            std::frexp((max - min) / 255.0f, &exponent);
+            int biased = std::clamp(exponent + 127, 1, 254);
+            while (biased < 254 && decode(min, 255, biased) < max) biased++;
+            return uint8_t(biased);
+        }
+
+        uint8_t quantize_min(float origin, uint8_t exponent, float min) {
+            int q = std::clamp(int(std::floor((min - origin) / grid_spacing(exponent))), 0, 255);
+            // The subtraction can round so make sure the decoded bound is still conservative
+            while (q > 0 && decode(origin, q, exponent) > min) q--;
+            return uint8_t(q);
+        }
+
+        uint8_t quantize_max(float origin, uint8_t exponent, float max) {
+            int q = std::clamp(int(std::ceil((max - origin) / grid_spacing(exponent))), 0, 255);
+            while (q < 255 && decode(origin, q, exponent) < max) q++;
+            return uint8_t(q);
+        }
+
+        QuantizedBVHNode quantized_node(const AABB& bounds, const AABB child_bounds[2]) {
+            QuantizedBVHNode node;
+            node.origin = bounds.min;
+            for (int axis=0; axis<3; axis++) {
+                node.exponents[axis] = quantization_exponent(bounds.min[axis], bounds.max[axis]);
+                for (int child=0; child<2; child++) {
+                    if (child_bounds[child].is_empty()) {
+                        // Decodes to an inverted box which no ray hits
+                        node.child_min[child][axis] = 255;
+                        node.child_max[child][axis] = 0;
+                    } else {
+                        node.child_min[child][axis] = quantize_min(node.origin[axis], node.exponents[axis], child_bounds[child].min[axis]);
+                        node.child_max[child][axis] = quantize_max(node.origin[axis], node.exponents[axis], child_bounds[child].max[axis]);
+                    }
+                }
+            }
+            return node;
+        }
+
+        uint32_t leaf_child(uint32_t first, uint32_t count) {
+            return QuantizedBVH::leaf_flag | count << QuantizedBVH::count_shift | first;
+        }
+
+    }
+
+    AABB QuantizedBVHNode::get_child_bounds(int child) const {
+        AABB bounds;
+        for (int axis=0; axis<3; axis++) {
+            bounds.min[axis] = decode(origin[axis], child_min[child][axis], exponents[axis]);
+            bounds.max[axis] = decode(origin[axis], child_max[child][axis], exponents[axis]);
+        }
+        return bounds;
+    }
+
+    bool QuantizedBVHNode::is_leaf(int child) const {
+        return children[child] & QuantizedBVH::leaf_flag;
+    }
+
+    uint32_t QuantizedBVHNode::get_first(int child) const {
+        return children[child] & QuantizedBVH::max_first_primitive;
+    }
+
+    uint32_t QuantizedBVHNode::get_count(int child) const {
+        return (children[child] & ~QuantizedBVH::leaf_flag) >> QuantizedBVH::count_shift;
+    }
+
+    void QuantizedBVHNode::as_byte_array(unsigned char byte_array[quantized_bvh_node_size_in_opengl]) const {
+        unsigned char const* tmp = reinterpret_cast<unsigned char const*>(&origin);
+        std::copy(tmp, tmp+12, byte_array);
+
+        std::copy(exponents, exponents+3, byte_array+12);
+        byte_array[15] = 0;
+
+        for (int child=0; child<2; child++) {
+            std::copy(child_min[child], child_min[child]+3, byte_array+16+6*child);
+            std::copy(child_max[child], child_max[child]+3, byte_array+16+6*child+3);
+        }
+
+        tmp = reinterpret_cast<unsigned char const*>(children);
+        std::copy(tmp, tmp+8, byte_array+28);
+    }
+
+
+    void QuantizedBVH::build(const BVH& bvh) {
+        nodes.clear();
+        const std::vector<BVHNode>& bvh_nodes = bvh.get_nodes();
+        if (bvh_nodes.empty()) return;
+
+        for (const BVHNode& node : bvh_nodes) {
+            if (node.is_leaf() && (node.count > max_leaf_size || node.left_or_first > max_first_primitive)) {
+                qWarning() << "Unable to quantize a BVH with a leaf of" << node.count << "primitives starting at" << node.left_or_first;
+                return;
+            }
+        }
+
+        if (bvh_nodes[0].is_leaf()) {
+            // A single leaf becomes a node with the leaf as its first child and nothing as its second
+            AABB child_bounds[2] = {bvh_nodes[0].bounds, AABB()};
+            QuantizedBVHNode node = quantized_node(bvh_nodes[0].bounds, child_bounds);
+            node.children[0] = leaf_child(bvh_nodes[0].left_or_first, bvh_nodes[0].count);
+            node.children[1] = leaf_child(0, 0);
+            nodes.push_back(node);
+            return;
+        }
+
+        // Interior nodes keep their relative (depth first) order; leaves are folded into their parents
+        std::vector<uint32_t> quantized_indices(bvh_nodes.size());
+        uint32_t nr_interior_nodes = 0;
+        for (size_t i=0; i<bvh_nodes.size(); i++) {
+            if (!bvh_nodes[i].is_leaf()) quantized_indices[i] = nr_interior_nodes++;
+        }
+
+        nodes.reserve(nr_interior_nodes);
+        for (const BVHNode& bvh_node : bvh_nodes) {
+            if (bvh_node.is_leaf()) continue;
+
+            const BVHNode* children[2] = {&bvh_nodes[bvh_node.left_or_first], &bvh_nodes[bvh_node.left_or_first+1]};
+            AABB child_bounds[2] = {children[0]->bounds, children[1]->bounds};
+            QuantizedBVHNode node = quantized_node(bvh_node.bounds, child_bounds);
+            for (int c=0; c<2; c++) {
+                if (children[c]->is_leaf())
+                    node.children[c] = leaf_child(children[c]->left_or_first, children[c]->count);
+                else
+                    node.children[c] = quantized_indices[bvh_node.left_or_first+c];
+            }
+            nodes.push_back(node);
+        }
+    }
+
+    const std::vector<QuantizedBVHNode>& QuantizedBVH::get_nodes() const {
+        return nodes;
+    }
+
+    bool QuantizedBVH::is_empty() const {
+        return nodes.empty();
+    }
+
+    float QuantizedBVH::traverse(const glm::vec3& origin, const glm::vec3& direction, float near_plane, float far_plane, const LeafIntersector& intersect_leaf) const {
+        if (nodes.empty()) return far_plane;
+        glm::vec3 inverse_direction = 1.0f / direction;
+
+        // Same order as the traversal in raytrace.glsl: leaf children are intersected as soon as
+        // their parent is visited and interior children are pushed so the nearer one is popped first
+        uint32_t stack[BVH::traversal_stack_size];
+        int stack_size = 0;
+        stack[stack_size++] = 0;
+        while (stack_size > 0) {
+            const QuantizedBVHNode& node = nodes[stack[--stack_size]];
+
+            float distances[2];
+            for (int c=0; c<2; c++)
+                distances[c] = node.get_child_bounds(c).intersect(origin, inverse_direction, near_plane, far_plane);
+            int near = (distances[1] >= 0.0f && (distances[0] < 0.0f || distances[1] < distances[0])) ? 1 : 0;
+            int order[2] = {near, 1-near};
+
+            for (int c : order) {
+                if (distances[c] >= 0.0f && node.is_leaf(c))
+                    far_plane = intersect_leaf(node.get_first(c), node.get_count(c), far_plane);
+            }
+            for (int i=1; i>=0; i--) {
+                int c = order[i];
+                if (distances[c] >= 0.0f && !node.is_leaf(c) && stack_size < BVH::traversal_stack_size)
+                    stack[stack_size++] = node.children[c];
+            }
+        }
+        return far_plane;
+    }
+
+    bool QuantizedBVH::occluded(const glm::vec3& origin, const glm::vec3& direction, float near_plane, float far_plane, const LeafOcclusionTest& is_leaf_occluded) const {
+        if (nodes.empty()) return false;
+        glm::vec3 inverse_direction = 1.0f / direction;
+
+        uint32_t stack[BVH::traversal_stack_size];
+        int stack_size = 0;
+        stack[stack_size++] = 0;
+        while (stack_size > 0) {
+            const QuantizedBVHNode& node = nodes[stack[--stack_size]];
+            for (int c=0; c<2; c++) {
+                if (node.get_child_bounds(c).intersect(origin, inverse_direction, near_plane, far_plane) < 0.0f)
+                    continue;
+                if (node.is_leaf(c)) {
+                    if (is_leaf_occluded(node.get_first(c), node.get_count(c))) return true;
+                } else if (stack_size < BVH::traversal_stack_size) {
+                    stack[stack_size++] = node.children[c];
+                }
+            }
+        }
+        return false;
+    }
+
+    void QuantizedBVH::nodes_as_byte_array(std::vector<unsigned char>& byte_array) const {
+        size_t offset = byte_array.size();
+        byte_array.resize(offset + nodes.size()*quantized_bvh_node_size_in_opengl);
+        for (const QuantizedBVHNode& node : nodes) {
+            node.as_byte_array(byte_array.data()+offset);
+            offset += quantized_bvh_node_size_in_opengl;
+        }
+    }
+
+}
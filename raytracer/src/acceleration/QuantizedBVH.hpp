@@ -0,0 +1,77 @@
+#ifndef RT_QUANTIZED_BVH_HPP
+#define RT_QUANTIZED_BVH_HPP
+
+#include <QtGlobal>
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "RaytracerGlobals.hpp"
+#include "BVH.hpp"
+
+namespace Rt {
+
+    constexpr int quantized_bvh_node_size_in_opengl = 36;
+
+    // Interior node of a QuantizedBVH holding the bounds of both of its children
+    // The child bounds are stored as 8 bit offsets on a grid covering the node's own bounds
+    // whose spacing along each axis is a power of 2 so decoding them is exact
+    struct RAYTRACER_LIB_EXPORT QuantizedBVHNode {
+        glm::vec3 origin;
+        // Biased like float exponents; the grid spacing along an axis is 2^(exponent-127)
+        uint8_t exponents[3];
+        uint8_t child_min[2][3];
+        uint8_t child_max[2][3];
+
+        // Interior children: index of the child's node
+        // Leaf children: QuantizedBVH::leaf_flag | count << QuantizedBVH::count_shift | first primitive
+        uint32_t children[2];
+
+        // Bounds covering the child's bounds in the original BVH
+        AABB get_child_bounds(int child) const;
+        bool is_leaf(int child) const;
+        // Range of BVH::get_primitive_indices() held by a leaf child
+        uint32_t get_first(int child) const;
+        uint32_t get_count(int child) const;
+
+        // OpenGL (std430) memory layout:
+        //                  // Base Alignment  // Aligned Offset
+        // origin           // 4                  0
+        // exponents        // 4                  12
+        // child_min/max    // 4                  16 (child 0 min, child 0 max, child 1 min, child 1 max)
+        // children         // 4                  28
+        // Total Size: 36
+        void as_byte_array(unsigned char byte_array[quantized_bvh_node_size_in_opengl]) const;
+    };
+
+    // Compact copy of a BVH with 18 bytes per child instead of the 32 bytes of a BVHNode
+    // Leaves don't get a node of their own; their parent stores their primitive range
+    // The bounds are conservative so traversals visit every leaf they would in the original
+    class RAYTRACER_LIB_EXPORT QuantizedBVH {
+    public:
+        static constexpr uint32_t leaf_flag = 0x80000000;
+        static constexpr int count_shift = 27;
+        // Leaves may hold at most this many primitives
+        static constexpr uint32_t max_leaf_size = 15;
+        static constexpr uint32_t max_first_primitive = (1u << count_shift) - 1;
+
+        // Leaves the hierarchy empty (with a warning) if bvh has leaves which can't be encoded
+        void build(const BVH& bvh);
+
+        const std::vector<QuantizedBVHNode>& get_nodes() const;
+        bool is_empty() const;
+
+        // Same as BVH::traverse
+        float traverse(const glm::vec3& origin, const glm::vec3& direction, float near_plane, float far_plane, const LeafIntersector& intersect_leaf) const;
+        // Same as BVH::occluded
+        bool occluded(const glm::vec3& origin, const glm::vec3& direction, float near_plane, float far_plane, const LeafOcclusionTest& is_leaf_occluded) const;
+
+        // Appends the nodes to byte_array using the OpenGL memory layout of QuantizedBVHNode
+        void nodes_as_byte_array(std::vector<unsigned char>& byte_array) const;
+
+    private:
+        std::vector<QuantizedBVHNode> nodes;
+    };
+
+}
+
+#endif
@@ -0,0 +1,602 @@
+#include "RayPacket.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(RT_SIMD_SSE)
+    #include <immintrin.h>
+#endif
+
+namespace Rt {
+
+    namespace {
+
+        // Lowest lane in a mask
+        int first_lane(uint32_t mask) {
+            int lane = 0;
+            while (!(mask & (1u << lane))) lane++;
+            return lane;
+        }
+
+#if defined(RT_SIMD_SSE)
+        // Tests 4 lanes starting at first; the same operations as AABB::intersect in the same order
+        // (the operands of min/max are swapped to pick the same one as std::min/std::max does)
+        uint32_t intersect_box_sse(const float* origin_x, const float* origin_y, const float* origin_z, const float* inverse_x, const float* inverse_y, const float* inverse_z, const float* near_plane, const float* far_plane, const AABB& bounds, float* distances) {
+            __m128 o_x = _mm_load_ps(origin_x);
+            __m128 o_y = _mm_load_ps(origin_y);
+            __m128 o_z = _mm_load_ps(origin_z);
+
+            __m128 t0_x = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(bounds.min.x), o_x), _mm_load_ps(inverse_x));
+            __m128 t0_y = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(bounds.min.y), o_y), _mm_load_ps(inverse_y));
+            __m128 t0_z = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(bounds.min.z), o_z), _mm_load_ps(inverse_z));
+            __m128 t1_x = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(bounds.max.x), o_x), _mm_load_ps(inverse_x));
+            __m128 t1_y = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(bounds.max.y), o_y), _mm_load_ps(inverse_y));
+            __m128 t1_z = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(bounds.max.z), o_z), _mm_load_ps(inverse_z));
+
+            __m128 t_enter = _mm_max_ps(
+                _mm_max_ps(_mm_min_ps(t1_y, t0_y), _mm_min_ps(t1_x, t0_x)),
+                _mm_max_ps(_mm_load_ps(near_plane), _mm_min_ps(t1_z, t0_z))
+            );
+            __m128 t_exit = _mm_min_ps(
+                _mm_min_ps(_mm_max_ps(t1_y, t0_y), _mm_max_ps(t1_x, t0_x)),
+                _mm_min_ps(_mm_load_ps(far_plane), _mm_max_ps(t1_z, t0_z))
+            );
+
+            _mm_store_ps(distances, t_enter);
+            return uint32_t(_mm_movemask_ps(_mm_cmple_ps(t_enter, t_exit)));
+        }
+
+        // Picks x for lanes in is_x, y for lanes in is_y and z for the others
+        __m128 select_axis_sse(__m128 is_x, __m128 is_y, __m128 x, __m128 y, __m128 z) {
+            __m128 y_or_z = _mm_or_ps(_mm_and_ps(is_y, y), _mm_andnot_ps(is_y, z));
+            return _mm_or_ps(_mm_and_ps(is_x, x), _mm_andnot_ps(is_x, y_or_z));
+        }
+
+        // Watertight triangle test of 4 lanes; the same operations as the scalar test in the same order
+        // Writes the distance and the unnormalized barycentric coordinates divided by the determinant
+        uint32_t intersect_triangle_sse(const float* origin_x, const float* origin_y, const float* origin_z, const int32_t* kx, const int32_t* ky, const int32_t* kz, const float* Sx, const float* Sy, const float* Sz, const float* near_plane, const float* far_plane, const glm::vec3& tri0, const glm::vec3& tri1, const glm::vec3& tri2, float* dist, float* u, float* v, float* w) {
+            __m128 o_x = _mm_load_ps(origin_x);
+            __m128 o_y = _mm_load_ps(origin_y);
+            __m128 o_z = _mm_load_ps(origin_z);
+            __m128 A_x = _mm_sub_ps(_mm_set1_ps(tri0.x), o_x);
+            __m128 A_y = _mm_sub_ps(_mm_set1_ps(tri0.y), o_y);
+            __m128 A_z = _mm_sub_ps(_mm_set1_ps(tri0.z), o_z);
+            __m128 B_x = _mm_sub_ps(_mm_set1_ps(tri1.x), o_x);
+            __m128 B_y = _mm_sub_ps(_mm_set1_ps(tri1.y), o_y);
+            __m128 B_z = _mm_sub_ps(_mm_set1_ps(tri1.z), o_z);
+            __m128 C_x = _mm_sub_ps(_mm_set1_ps(tri2.x), o_x);
+            __m128 C_y = _mm_sub_ps(_mm_set1_ps(tri2.y), o_y);
+            __m128 C_z = _mm_sub_ps(_mm_set1_ps(tri2.z), o_z);
+
+            __m128i zero = _mm_setzero_si128();
+            __m128i one = _mm_set1_epi32(1);
+            __m128i kx_i = _mm_load_si128(reinterpret_cast<const __m128i*>(kx));
+            __m128i ky_i = _mm_load_si128(reinterpret_cast<const __m128i*>(ky));
+            __m128i kz_i = _mm_load_si128(reinterpret_cast<const __m128i*>(kz));
+            __m128 kx_0 = _mm_castsi128_ps(_mm_cmpeq_epi32(kx_i, zero)), kx_1 = _mm_castsi128_ps(_mm_cmpeq_epi32(kx_i, one));
+            __m128 ky_0 = _mm_castsi128_ps(_mm_cmpeq_epi32(ky_i, zero)), ky_1 = _mm_castsi128_ps(_mm_cmpeq_epi32(ky_i, one));
+            __m128 kz_0 = _mm_castsi128_ps(_mm_cmpeq_epi32(kz_i, zero)), kz_1 = _mm_castsi128_ps(_mm_cmpeq_epi32(kz_i, one));
+
+            __m128 A_kz = select_axis_sse(kz_0, kz_1, A_x, A_y, A_z);
+            __m128 B_kz = select_axis_sse(kz_0, kz_1, B_x, B_y, B_z);
+            __m128 C_kz = select_axis_sse(kz_0, kz_1, C_x, C_y, C_z);
+            __m128 S_x = _mm_load_ps(Sx);
+            __m128 S_y = _mm_load_ps(Sy);
+            __m128 Ax = _mm_sub_ps(select_axis_sse(kx_0, kx_1, A_x, A_y, A_z), _mm_mul_ps(S_x, A_kz));
+            __m128 Ay = _mm_sub_ps(select_axis_sse(ky_0, ky_1, A_x, A_y, A_z), _mm_mul_ps(S_y, A_kz));
+            __m128 Bx = _mm_sub_ps(select_axis_sse(kx_0, kx_1, B_x, B_y, B_z), _mm_mul_ps(S_x, B_kz));
+            __m128 By = _mm_sub_ps(select_axis_sse(ky_0, ky_1, B_x, B_y, B_z), _mm_mul_ps(S_y, B_kz));
+            __m128 Cx = _mm_sub_ps(select_axis_sse(kx_0, kx_1, C_x, C_y, C_z), _mm_mul_ps(S_x, C_kz));
+            __m128 Cy = _mm_sub_ps(select_axis_sse(ky_0, ky_1, C_x, C_y, C_z), _mm_mul_ps(S_y, C_kz));
+
+            __m128 U = _mm_sub_ps(_mm_mul_ps(Cx, By), _mm_mul_ps(Cy, Bx));
+            __m128 V = _mm_sub_ps(_mm_mul_ps(Ax, Cy), _mm_mul_ps(Ay, Cx));
+            __m128 W = _mm_sub_ps(_mm_mul_ps(Bx, Ay), _mm_mul_ps(By, Ax));
+
+            __m128 zero_ps = _mm_setzero_ps();
+            __m128 any_negative = _mm_or_ps(_mm_or_ps(_mm_cmplt_ps(U, zero_ps), _mm_cmplt_ps(V, zero_ps)), _mm_cmplt_ps(W, zero_ps));
+            __m128 any_positive = _mm_or_ps(_mm_or_ps(_mm_cmpgt_ps(U, zero_ps), _mm_cmpgt_ps(V, zero_ps)), _mm_cmpgt_ps(W, zero_ps));
+            __m128 det = _mm_add_ps(_mm_add_ps(U, V), W);
+
+            __m128 T = _mm_mul_ps(_mm_load_ps(Sz), _mm_add_ps(_mm_add_ps(_mm_mul_ps(U, A_kz), _mm_mul_ps(V, B_kz)), _mm_mul_ps(W, C_kz)));
+            __m128 distance = _mm_div_ps(T, det);
+            __m128 hit = _mm_andnot_ps(
+                _mm_and_ps(any_negative, any_positive),
+                _mm_and_ps(_mm_cmpneq_ps(det, zero_ps), _mm_and_ps(_mm_cmpge_ps(distance, _mm_load_ps(near_plane)), _mm_cmple_ps(distance, _mm_load_ps(far_plane))))
+            );
+
+            _mm_store_ps(dist, distance);
+            _mm_store_ps(u, _mm_div_ps(U, det));
+            _mm_store_ps(v, _mm_div_ps(V, det));
+            _mm_store_ps(w, _mm_div_ps(W, det));
+            return uint32_t(_mm_movemask_ps(hit));
+        }
+#endif
+
+#if defined(RT_SIMD_AVX2)
+        // 8 lane versions of the functions above
+        RT_TARGET_AVX2
+        uint32_t intersect_box_avx2(const float* origin_x, const float* origin_y, const float* origin_z, const float* inverse_x, const float* inverse_y, const float* inverse_z, const float* near_plane, const float* far_plane, const AABB& bounds, float* distances) {
+            __m256 o_x = _mm256_load_ps(origin_x);
+            __m256 o_y = _mm256_load_ps(origin_y);
+            __m256 o_z = _mm256_load_ps(origin_z);
+
+            __m256 t0_x = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(bounds.min.x), o_x), _mm256_load_ps(inverse_x));
+            __m256 t0_y = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(bounds.min.y), o_y), _mm256_load_ps(inverse_y));
+            __m256 t0_z = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(bounds.min.z), o_z), _mm256_load_ps(inverse_z));
+            __m256 t1_x = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(bounds.max.x), o_x), _mm256_load_ps(inverse_x));
+            __m256 t1_y = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(bounds.max.y), o_y), _mm256_load_ps(inverse_y));
+            __m256 t1_z = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(bounds.max.z), o_z), _mm256_load_ps(inverse_z));
+
+            __m256 t_enter = _mm256_max_ps(
+                _mm256_max_ps(_mm256_min_ps(t1_y, t0_y), _mm256_min_ps(t1_x, t0_x)),
+                _mm256_max_ps(_mm256_load_ps(near_plane), _mm256_min_ps(t1_z, t0_z))
+            );
+            __m256 t_exit = _mm256_min_ps(
+                _mm256_min_ps(_mm256_max_ps(t1_y, t0_y), _mm256_max_ps(t1_x, t0_x)),
+                _mm256_min_ps(_mm256_load_ps(far_plane), _mm256_max_ps(t1_z, t0_z))
+            );
+
+            _mm256_store_ps(distances, t_enter);
+            return uint32_t(_mm256_movemask_ps(_mm256_cmp_ps(t_enter, t_exit, _CMP_LE_OQ)));
+        }
+
+        RT_TARGET_AVX2
+        __m256 select_axis_avx2(__m256 is_x, __m256 is_y, __m256 x, __m256 y, __m256 z) {
+            return _mm256_blendv_ps(_mm256_blendv_ps(z, y, is_y), x, is_x);
+        }
+
+        RT_TARGET_AVX2
+        uint32_t intersect_triangle_avx2(const float* origin_x, const float* origin_y, const float* origin_z, const int32_t* kx, const int32_t* ky, const int32_t* kz, const float* Sx, const float* Sy, const float* Sz, const float* near_plane, const float* far_plane, const glm::vec3& tri0, const glm::vec3& tri1, const glm::vec3& tri2, float* dist, float* u, float* v, float* w) {
+            __m256 o_x = _mm256_load_ps(origin_x);
+            __m256 o_y = _mm256_load_ps(origin_y);
+            __m256 o_z = _mm256_load_ps(origin_z);
+            __m256 A_x = _mm256_sub_ps(_mm256_set1_ps(tri0.x), o_x);
+            __m256 A_y = _mm256_sub_ps(_mm256_set1_ps(tri0.y), o_y);
+            __m256 A_z = _mm256_sub_ps(_mm256_set1_ps(tri0.z), o_z);
+            __m256 B_x = _mm256_sub_ps(_mm256_set1_ps(tri1.x), o_x);
+            __m256 B_y = _mm256_sub_ps(_mm256_set1_ps(tri1.y), o_y);
+            __m256 B_z = _mm256_sub_ps(_mm256_set1_ps(tri1.z), o_z);
+            __m256 C_x = _mm256_sub_ps(_mm256_set1_ps(tri2.x), o_x);
+            __m256 C_y = _mm256_sub_ps(_mm256_set1_ps(tri2.y), o_y);
+            __m256 C_z = _mm256_sub_ps(_mm256_set1_ps(tri2.z), o_z);
+
+            __m256i zero = _mm256_setzero_si256();
+            __m256i one = _mm256_set1_epi32(1);
+            __m256i kx_i = _mm256_load_si256(reinterpret_cast<const __m256i*>(kx));
+            __m256i ky_i = _mm256_load_si256(reinterpret_cast<const __m256i*>(ky));
+            __m256i kz_i = _mm256_load_si256(reinterpret_cast<const __m256i*>(kz));
+            __m256 kx_0 = _mm256_castsi256_ps(_mm256_cmpeq_epi32(kx_i, zero)), kx_1 = _mm256_castsi256_ps(_mm256_cmpeq_epi32(kx_i, one));
+            __m256 ky_0 = _mm256_castsi256_ps(_mm256_cmpeq_epi32(ky_i, zero)), ky_1 = _mm256_castsi256_ps(_mm256_cmpeq_epi32(ky_i, one));
+            __m256 kz_0 = _mm256_castsi256_ps(_mm256_cmpeq_epi32(kz_i, zero)), kz_1 = _mm256_castsi256_ps(_mm256_cmpeq_epi32(kz_i, one));
+
+            __m256 A_kz = select_axis_avx2(kz_0, kz_1, A_x, A_y, A_z);
+            __m256 B_kz = select_axis_avx2(kz_0, kz_1, B_x, B_y, B_z);
+            __m256 C_kz = select_axis_avx2(kz_0, kz_1, C_x, C_y, C_z);
+            __m256 S_x = _mm256_load_ps(Sx);
+            __m256 S_y = _mm256_load_ps(Sy);
+            __m256 Ax = _mm256_sub_ps(select_axis_avx2(kx_0, kx_1, A_x, A_y, A_z), _mm256_mul_ps(S_x, A_kz));
+            __m256 Ay = _mm256_sub_ps(select_axis_avx2(ky_0, ky_1, A_x, A_y, A_z), _mm256_mul_ps(S_y, A_kz));
+            __m256 Bx = _mm256_sub_ps(select_axis_avx2(kx_0, kx_1, B_x, B_y, B_z), _mm256_mul_ps(S_x, B_kz));
+            __m256 By = _mm256_sub_ps(select_axis_avx2(ky_0, ky_1, B_x, B_y, B_z), _mm256_mul_ps(S_y, B_kz));
+            __m256 Cx = _mm256_sub_ps(select_axis_avx2(kx_0, kx_1, C_x, C_y, C_z), _mm256_mul_ps(S_x, C_kz));
+            __m256 Cy = _mm256_sub_ps(select_axis_avx2(ky_0, ky_1, C_x, C_y, C_z), _mm256_mul_ps(S_y, C_kz));
+
+            __m256 U = _mm256_sub_ps(_mm256_mul_ps(Cx, By), _mm256_mul_ps(Cy, Bx));
+            __m256 V = _mm256_sub_ps(_mm256_mul_ps(Ax, Cy), _mm256_mul_ps(Ay, Cx));
+            __m256 W = _mm256_sub_ps(_mm256_mul_ps(Bx, Ay), _mm256_mul_ps(By, Ax));
+
+            __m256 zero_ps = _mm256_setzero_ps();
+            __m256 any_negative = _mm256_or_ps(_mm256_or_ps(_mm256_cmp_ps(U, zero_ps, _CMP_LT_OQ), _mm256_cmp_ps(V, zero_ps, _CMP_LT_OQ)), _mm256_cmp_ps(W, zero_ps, _CMP_LT_OQ));
+            __m256 any_positive = _mm256_or_ps(_mm256_or_ps(_mm256_cmp_ps(U, zero_ps, _CMP_GT_OQ), _mm256_cmp_ps(V, zero_ps, _CMP_GT_OQ)), _mm256_cmp_ps(W, zero_ps, _CMP_GT_OQ));
+            __m256 det = _mm256_add_ps(_mm256_add_ps(U, V), W);
+
+            __m256 T = _mm256_mul_ps(_mm256_load_ps(Sz), _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(U, A_kz), _mm256_mul_ps(V, B_kz)), _mm256_mul_ps(W, C_kz)));
+            __m256 distance = _mm256_div_ps(T, det);
+            __m256 hit = _mm256_andnot_ps(
+                _mm256_and_ps(any_negative, any_positive),
+                _mm256_and_ps(_mm256_cmp_ps(det, zero_ps, _CMP_NEQ_UQ), _mm256_and_ps(_mm256_cmp_ps(distance, _mm256_load_ps(near_plane), _CMP_GE_OQ), _mm256_cmp_ps(distance, _mm256_load_ps(far_plane), _CMP_LE_OQ)))
+            );
+
+            _mm256_store_ps(dist, distance);
+            _mm256_store_ps(u, _mm256_div_ps(U, det));
+            _mm256_store_ps(v, _mm256_div_ps(V, det));
+            _mm256_store_ps(w, _mm256_div_ps(W, det));
+            return uint32_t(_mm256_movemask_ps(hit));
+        }
+#endif
+
+    }
+
+    template <int Size>
+    RayPacket<Size>::RayPacket() {
+        lanes = Lanes{};
+        active_lanes = 0;
+        simd_level = Rt::get_simd_level();
+    }
+
+    template <int Size>
+    void RayPacket<Size>::set_simd_level(SIMDLevel new_simd_level) {
+        simd_level = std::min(new_simd_level, Rt::get_simd_level());
+    }
+
+    template <int Size>
+    SIMDLevel RayPacket<Size>::get_simd_level() const {
+        return simd_level;
+    }
+
+    template <int Size>
+    void RayPacket<Size>::set_ray(int lane, const glm::vec3& origin, const glm::vec3& direction, float near_plane, float far_plane) {
+        glm::vec3 inverse_direction = 1.0f / direction;
+        lanes.origin_x[lane] = origin.x;
+        lanes.origin_y[lane] = origin.y;
+        lanes.origin_z[lane] = origin.z;
+        lanes.direction_x[lane] = direction.x;
+        lanes.direction_y[lane] = direction.y;
+        lanes.direction_z[lane] = direction.z;
+        lanes.inverse_x[lane] = inverse_direction.x;
+        lanes.inverse_y[lane] = inverse_direction.y;
+        lanes.inverse_z[lane] = inverse_direction.z;
+        lanes.near_plane[lane] = near_plane;
+        lanes.far_plane[lane] = far_plane;
+
+        // Same as the start of ray_triangle_int_watertight
+        glm::vec3 abs_dir = glm::abs(direction);
+        int kz = abs_dir.x > abs_dir.y ? (abs_dir.x > abs_dir.z ? 0 : 2) : (abs_dir.y > abs_dir.z ? 1 : 2);
+        int kx = kz == 2 ? 0 : kz + 1;
+        int ky = kx == 2 ? 0 : kx + 1;
+        if (direction[kz] < 0.0f) std::swap(kx, ky);
+        lanes.kx[lane] = kx;
+        lanes.ky[lane] = ky;
+        lanes.kz[lane] = kz;
+        lanes.Sz[lane] = 1.0f / direction[kz];
+        lanes.Sx[lane] = direction[kx] * lanes.Sz[lane];
+        lanes.Sy[lane] = direction[ky] * lanes.Sz[lane];
+
+        active_lanes |= 1u << lane;
+    }
+
+    template <int Size>
+    uint32_t RayPacket<Size>::get_active_lanes() const {
+        return active_lanes;
+    }
+
+    template <int Size>
+    glm::vec3 RayPacket<Size>::get_origin(int lane) const {
+        return glm::vec3(lanes.origin_x[lane], lanes.origin_y[lane], lanes.origin_z[lane]);
+    }
+
+    template <int Size>
+    glm::vec3 RayPacket<Size>::get_direction(int lane) const {
+        return glm::vec3(lanes.direction_x[lane], lanes.direction_y[lane], lanes.direction_z[lane]);
+    }
+
+    template <int Size>
+    float RayPacket<Size>::get_near_plane(int lane) const {
+        return lanes.near_plane[lane];
+    }
+
+    template <int Size>
+    float RayPacket<Size>::get_far_plane(int lane) const {
+        return lanes.far_plane[lane];
+    }
+
+    template <int Size>
+    void RayPacket<Size>::set_far_plane(int lane, float far_plane) {
+        lanes.far_plane[lane] = far_plane;
+    }
+
+    template <int Size>
+    RayPacket<Size> RayPacket<Size>::transformed(const glm::mat4& transformation, uint32_t mask) const {
+        RayPacket<Size> packet;
+        packet.simd_level = simd_level;
+        for (int lane=0; lane<Size; lane++) {
+            if (!(mask & (1u << lane))) continue;
+            glm::vec3 origin = glm::vec3(transformation * glm::vec4(get_origin(lane), 1.0f));
+            glm::vec3 direction = glm::mat3(transformation) * get_direction(lane);
+            packet.set_ray(lane, origin, direction, lanes.near_plane[lane], lanes.far_plane[lane]);
+        }
+        return packet;
+    }
+
+    template <int Size>
+    typename RayPacket<Size>::Frustum RayPacket<Size>::get_frustum(uint32_t mask) const {
+        Frustum frustum;
+        frustum.min_origin = glm::vec3(std::numeric_limits<float>::max());
+        frustum.max_origin = glm::vec3(-std::numeric_limits<float>::max());
+        frustum.min_inverse = glm::vec3(std::numeric_limits<float>::max());
+        frustum.max_inverse = glm::vec3(-std::numeric_limits<float>::max());
+        frustum.min_near_plane = std::numeric_limits<float>::max();
+        frustum.max_far_plane = -std::numeric_limits<float>::max();
+        frustum.valid = true;
+        for (int lane=0; lane<Size; lane++) {
+            if (!(mask & (1u << lane))) continue;
+            glm::vec3 inverse = glm::vec3(lanes.inverse_x[lane], lanes.inverse_y[lane], lanes.inverse_z[lane]);
+            if (!std::isfinite(inverse.x) || !std::isfinite(inverse.y) || !std::isfinite(inverse.z))
+                frustum.valid = false;
+            frustum.min_origin = glm::min(frustum.min_origin, get_origin(lane));
+            frustum.max_origin = glm::max(frustum.max_origin, get_origin(lane));
+            frustum.min_inverse = glm::min(frustum.min_inverse, inverse);
+            frustum.max_inverse = glm::max(frustum.max_inverse, inverse);
+            frustum.min_near_plane = std::min(frustum.min_near_plane, lanes.near_plane[lane]);
+            frustum.max_far_plane = std::max(frustum.max_far_plane, lanes.far_plane[lane]);
+        }
+        return frustum;
+    }
+
+    template <int Size>
+    bool RayPacket<Size>::frustum_misses(const Frustum& frustum, const AABB& bounds) {
+        if (!frustum.valid) return false;
+
+        // (bounds - origin) * inverse_direction over the intervals of origin and inverse_direction
+        // Rounding never reverses the order of two results so every lane's t0/t1 lies within
+        // the interval's bounds even though they are rounded too
+        float enter = frustum.min_near_plane;
+        float exit = frustum.max_far_plane;
+        for (int axis=0; axis<3; axis++) {
+            float t_lower[2], t_upper[2];
+            float planes[2] = {bounds.min[axis], bounds.max[axis]};
+            for (int p=0; p<2; p++) {
+                float lower = planes[p] - frustum.max_origin[axis];
+                float upper = planes[p] - frustum.min_origin[axis];
+                float corners[4] = {
+                    lower * frustum.min_inverse[axis], lower * frustum.max_inverse[axis],
+                    upper * frustum.min_inverse[axis], upper * frustum.max_inverse[axis]
+                };
+                t_lower[p] = *std::min_element(corners, corners+4);
+                t_upper[p] = *std::max_element(corners, corners+4);
+            }
+            // Every lane enters the slab after the lower of the two lower bounds
+            // and leaves it before the higher of the two upper bounds
+            enter = std::max(enter, std::min(t_lower[0], t_lower[1]));
+            exit = std::min(exit, std::max(t_upper[0], t_upper[1]));
+        }
+        return enter > exit;
+    }
+
+    template <int Size>
+    uint32_t RayPacket<Size>::intersect_box(const AABB& bounds, uint32_t mask, float distances[Size]) const {
+        uint32_t hit = 0;
+#if defined(RT_SIMD_AVX2)
+        if constexpr (Size >= 8) {
+            if (simd_level >= SIMDLevel::AVX2) {
+                for (int first=0; first<Size; first+=8) {
+                    if (!((mask >> first) & 0xFF)) continue;
+                    hit |= intersect_box_avx2(
+                        lanes.origin_x+first, lanes.origin_y+first, lanes.origin_z+first,
+                        lanes.inverse_x+first, lanes.inverse_y+first, lanes.inverse_z+first,
+                        lanes.near_plane+first, lanes.far_plane+first, bounds, distances+first
+                    ) << first;
+                }
+                return hit & mask;
+            }
+        }
+#endif
+#if defined(RT_SIMD_SSE)
+        if (simd_level >= SIMDLevel::SSE) {
+            for (int first=0; first<Size; first+=4) {
+                if (!((mask >> first) & 0xF)) continue;
+                hit |= intersect_box_sse(
+                    lanes.origin_x+first, lanes.origin_y+first, lanes.origin_z+first,
+                    lanes.inverse_x+first, lanes.inverse_y+first, lanes.inverse_z+first,
+                    lanes.near_plane+first, lanes.far_plane+first, bounds, distances+first
+                ) << first;
+            }
+            return hit & mask;
+        }
+#endif
+        for (int lane=0; lane<Size; lane++) {
+            if (!(mask & (1u << lane))) continue;
+            glm::vec3 inverse = glm::vec3(lanes.inverse_x[lane], lanes.inverse_y[lane], lanes.inverse_z[lane]);
+            distances[lane] = bounds.intersect(get_origin(lane), inverse, lanes.near_plane[lane], lanes.far_plane[lane]);
+            if (distances[lane] >= 0.0f) hit |= 1u << lane;
+        }
+        return hit;
+    }
+
+    template <int Size>
+    uint32_t RayPacket<Size>::test_triangle(const glm::vec3& tri0, const glm::vec3& tri1, const glm::vec3& tri2, uint32_t mask, float dist[Size], float u[Size], float v[Size], float w[Size]) const {
+        uint32_t hit = 0;
+        bool vectorized = false;
+#if defined(RT_SIMD_AVX2)
+        if constexpr (Size >= 8) {
+            if (simd_level >= SIMDLevel::AVX2) {
+                for (int first=0; first<Size; first+=8) {
+                    if (!((mask >> first) & 0xFF)) continue;
+                    hit |= intersect_triangle_avx2(
+                        lanes.origin_x+first, lanes.origin_y+first, lanes.origin_z+first,
+                        lanes.kx+first, lanes.ky+first, lanes.kz+first,
+                        lanes.Sx+first, lanes.Sy+first, lanes.Sz+first,
+                        lanes.near_plane+first, lanes.far_plane+first, tri0, tri1, tri2,
+                        dist+first, u+first, v+first, w+first
+                    ) << first;
+                }
+                vectorized = true;
+            }
+        }
+#endif
+#if defined(RT_SIMD_SSE)
+        if (!vectorized && simd_level >= SIMDLevel::SSE) {
+            for (int first=0; first<Size; first+=4) {
+                if (!((mask >> first) & 0xF)) continue;
+                hit |= intersect_triangle_sse(
+                    lanes.origin_x+first, lanes.origin_y+first, lanes.origin_z+first,
+                    lanes.kx+first, lanes.ky+first, lanes.kz+first,
+                    lanes.Sx+first, lanes.Sy+first, lanes.Sz+first,
+                    lanes.near_plane+first, lanes.far_plane+first, tri0, tri1, tri2,
+                    dist+first, u+first, v+first, w+first
+                ) << first;
+            }
+            vectorized = true;
+        }
+#endif
+        if (!vectorized) {
+            // Same as ray_triangle_int_watertight with the axes and shear constants of set_ray()
+            for (int lane=0; lane<Size; lane++) {
+                if (!(mask & (1u << lane))) continue;
+                int kx = lanes.kx[lane];
+                int ky = lanes.ky[lane];
+                int kz = lanes.kz[lane];
+                float Sx = lanes.Sx[lane];
+                float Sy = lanes.Sy[lane];
+                float Sz = lanes.Sz[lane];
+
+                glm::vec3 origin = get_origin(lane);
+                glm::vec3 A = tri0 - origin;
+                glm::vec3 B = tri1 - origin;
+                glm::vec3 C = tri2 - origin;
+                float Ax = A[kx] - Sx*A[kz];
+                float Ay = A[ky] - Sy*A[kz];
+                float Bx = B[kx] - Sx*B[kz];
+                float By = B[ky] - Sy*B[kz];
+                float Cx = C[kx] - Sx*C[kz];
+                float Cy = C[ky] - Sy*C[kz];
+
+                float U = Cx*By - Cy*Bx;
+                float V = Ax*Cy - Ay*Cx;
+                float W = Bx*Ay - By*Ax;
+                if ((U < 0.0f || V < 0.0f || W < 0.0f) && (U > 0.0f || V > 0.0f || W > 0.0f)) continue;
+                float det = U + V + W;
+                if (det == 0.0f) continue;
+
+                float T = Sz * (U*A[kz] + V*B[kz] + W*C[kz]);
+                dist[lane] = T / det;
+                if (dist[lane] >= lanes.near_plane[lane] && dist[lane] <= lanes.far_plane[lane]) {
+                    u[lane] = U / det;
+                    v[lane] = V / det;
+                    w[lane] = W / det;
+                    hit |= 1u << lane;
+                }
+            }
+        }
+
+        return hit & mask;
+    }
+
+    template <int Size>
+    uint32_t RayPacket<Size>::intersect_triangle(const glm::vec3& tri0, const glm::vec3& tri1, const glm::vec3& tri2, uint32_t mask, glm::vec3 bc[Size]) {
+        alignas(64) float dist[Size];
+        alignas(64) float u[Size];
+        alignas(64) float v[Size];
+        alignas(64) float w[Size];
+        uint32_t hit = test_triangle(tri0, tri1, tri2, mask, dist, u, v, w);
+        for (int lane=0; lane<Size; lane++) {
+            if (!(hit & (1u << lane))) continue;
+            lanes.far_plane[lane] = dist[lane];
+            bc[lane] = glm::vec3(u[lane], v[lane], w[lane]);
+        }
+        return hit;
+    }
+
+    template <int Size>
+    uint32_t RayPacket<Size>::occludes_triangle(const glm::vec3& tri0, const glm::vec3& tri1, const glm::vec3& tri2, uint32_t mask) const {
+        alignas(64) float dist[Size];
+        alignas(64) float u[Size];
+        alignas(64) float v[Size];
+        alignas(64) float w[Size];
+        return test_triangle(tri0, tri1, tri2, mask, dist, u, v, w);
+    }
+
+    template <int Size>
+    void RayPacket<Size>::traverse(const BVH& bvh, uint32_t mask, const PacketLeafIntersector& intersect_leaf) {
+        const std::vector<BVHNode>& nodes = bvh.get_nodes();
+        mask &= active_lanes;
+        if (nodes.empty() || mask == 0) return;
+
+        Frustum frustum = get_frustum(mask);
+        alignas(64) float left_distances[Size];
+        alignas(64) float right_distances[Size];
+        if (frustum_misses(frustum, nodes[0].bounds)) return;
+        uint32_t root_lanes = intersect_box(nodes[0].bounds, mask, left_distances);
+        if (root_lanes == 0) return;
+
+        // Every entry is a node with the lanes which reached it
+        // The children are visited in the order of BVH::traverse for the first lane reaching both
+        uint32_t stack[BVH::traversal_stack_size];
+        uint32_t stack_lanes[BVH::traversal_stack_size];
+        int stack_size = 0;
+        stack[stack_size] = 0;
+        stack_lanes[stack_size++] = root_lanes;
+        while (stack_size > 0) {
+            stack_size--;
+            const BVHNode& node = nodes[stack[stack_size]];
+            uint32_t node_lanes = stack_lanes[stack_size];
+            if (node.is_leaf()) {
+                intersect_leaf(node.left_or_first, node.count, node_lanes);
+                // Hits only ever move the far planes closer
+                frustum.max_far_plane = -std::numeric_limits<float>::max();
+                for (int lane=0; lane<Size; lane++) {
+                    if (mask & (1u << lane))
+                        frustum.max_far_plane = std::max(frustum.max_far_plane, lanes.far_plane[lane]);
+                }
+                continue;
+            }
+
+            uint32_t left = node.left_or_first;
+            uint32_t right = left + 1;
+            uint32_t left_lanes = frustum_misses(frustum, nodes[left].bounds) ? 0 : intersect_box(nodes[left].bounds, node_lanes, left_distances);
+            uint32_t right_lanes = frustum_misses(frustum, nodes[right].bounds) ? 0 : intersect_box(nodes[right].bounds, node_lanes, right_distances);
+            if (left_lanes && right_lanes && stack_size+2 <= BVH::traversal_stack_size) {
+                int lane = (left_lanes & right_lanes) ? first_lane(left_lanes & right_lanes) : -1;
+                bool left_first = lane != -1 ? left_distances[lane] <= right_distances[lane] : first_lane(left_lanes) <= first_lane(right_lanes);
+                stack[stack_size] = left_first ? right : left;
+                stack_lanes[stack_size++] = left_first ? right_lanes : left_lanes;
+                stack[stack_size] = left_first ? left : right;
+                stack_lanes[stack_size++] = left_first ? left_lanes : right_lanes;
+            } else if (left_lanes && stack_size < BVH::traversal_stack_size) {
+                stack[stack_size] = left;
+                stack_lanes[stack_size++] = left_lanes;
+            } else if (right_lanes && stack_size < BVH::traversal_stack_size) {
+                stack[stack_size] = right;
+                stack_lanes[stack_size++] = right_lanes;
+            }
+        }
+    }
+
+    template <int Size>
+    uint32_t RayPacket<Size>::occluded(const BVH& bvh, uint32_t mask, const PacketLeafOcclusionTest& is_leaf_occluded) const {
+        const std::vector<BVHNode>& nodes = bvh.get_nodes();
+        mask &= active_lanes;
+        if (nodes.empty() || mask == 0) return 0;
+
+        Frustum frustum = get_frustum(mask);
+        alignas(64) float distances[Size];
+        if (frustum_misses(frustum, nodes[0].bounds)) return 0;
+        uint32_t root_lanes = intersect_box(nodes[0].bounds, mask, distances);
+        if (root_lanes == 0) return 0;
+
+        // Lanes drop out as soon as they are occluded; any hit will do so the order doesn't matter
+        uint32_t occluded_lanes = 0;
+        uint32_t stack[BVH::traversal_stack_size];
+        uint32_t stack_lanes[BVH::traversal_stack_size];
+        int stack_size = 0;
+        stack[stack_size] = 0;
+        stack_lanes[stack_size++] = root_lanes;
+        while (stack_size > 0 && occluded_lanes != root_lanes) {
+            stack_size--;
+            const BVHNode& node = nodes[stack[stack_size]];
+            uint32_t node_lanes = stack_lanes[stack_size] & ~occluded_lanes;
+            if (node_lanes == 0) continue;
+            if (node.is_leaf()) {
+                occluded_lanes |= is_leaf_occluded(node.left_or_first, node.count, node_lanes) & node_lanes;
+                continue;
+            }
+
+            for (uint32_t child=node.left_or_first; child<node.left_or_first+2; child++) {
+                if (frustum_misses(frustum, nodes[child].bounds)) continue;
+                uint32_t child_lanes = intersect_box(nodes[child].bounds, node_lanes, distances);
+                if (child_lanes && stack_size < BVH::traversal_stack_size) {
+                    stack[stack_size] = child;
+                    stack_lanes[stack_size++] = child_lanes;
+                }
+            }
+        }
+        return occluded_lanes;
+    }
+
+    template class RAYTRACER_LIB_EXPORT RayPacket<4>;
+    template class RAYTRACER_LIB_EXPORT RayPacket<8>;
+    template class RAYTRACER_LIB_EXPORT RayPacket<16>;
+
+}
@@ -0,0 +1,126 @@
+#ifndef RT_RAY_PACKET_HPP
+#define RT_RAY_PACKET_HPP
+
+#include <QtGlobal>
+#include <glm/glm.hpp>
+#include <functional>
+
+#include "RaytracerGlobals.hpp"
+#include "BVH.hpp"
+#include "SIMD.hpp"
+
+namespace Rt {
+
+    // Called by RayPacket::traverse for every leaf any ray of the packet reaches with the leaf's
+    // range of primitive indices and the mask of the lanes which reached it
+    // Hits are recorded by lowering the far planes of the lanes (e.g. with RayPacket::intersect_triangle)
+    using PacketLeafIntersector = std::function<void(uint32_t first, uint32_t count, uint32_t lanes)>;
+
+    // Called by RayPacket::occluded for every leaf any ray of the packet reaches
+    // Returns the mask of the lanes for which any of the leaf's primitives blocks the ray
+    using PacketLeafOcclusionTest = std::function<uint32_t(uint32_t first, uint32_t count, uint32_t lanes)>;
+
+    // Size rays which are traced through a BVH together, one per lane
+    // Coherent rays (e.g. the primary rays of neighbouring pixels or the shadow rays towards a
+    // directional light) mostly visit the same nodes so every node is tested against all of them
+    // at once with SSE/AVX2 and skipped without looking at the lanes if the interval bounds of
+    // the packet's origins and directions (its frustum) miss the node
+    // Every lane gets exactly the same results as the scalar traversal and triangle test
+    template <int Size>
+    class RayPacket {
+        static_assert(Size == 4 || Size == 8 || Size == 16, "Only packets of 4, 8 and 16 rays are supported");
+
+    public:
+        // Creates a packet without active lanes
+        RayPacket();
+
+        // Defaults to get_simd_level(); levels the CPU doesn't support fall back to the best one it does
+        void set_simd_level(SIMDLevel new_simd_level);
+        SIMDLevel get_simd_level() const;
+
+        // Makes lane active with the ray origin + t*direction for t in [near_plane, far_plane]
+        void set_ray(int lane, const glm::vec3& origin, const glm::vec3& direction, float near_plane, float far_plane);
+        uint32_t get_active_lanes() const;
+
+        glm::vec3 get_origin(int lane) const;
+        glm::vec3 get_direction(int lane) const;
+        float get_near_plane(int lane) const;
+        // The distance to the nearest hit after traverse()
+        float get_far_plane(int lane) const;
+        void set_far_plane(int lane, float far_plane);
+
+        // Returns the lanes in mask with their rays moved into another space the same way
+        // raytrace.glsl moves rays into the object space of a mesh instance
+        RayPacket transformed(const glm::mat4& transformation, uint32_t mask) const;
+
+        // Same as BVH::traverse for every lane in mask
+        void traverse(const BVH& bvh, uint32_t mask, const PacketLeafIntersector& intersect_leaf);
+        // Same as BVH::occluded for every lane in mask; returns the mask of the occluded lanes
+        uint32_t occluded(const BVH& bvh, uint32_t mask, const PacketLeafOcclusionTest& is_leaf_occluded) const;
+
+        // Watertight ray triangle test (ray_triangle_int_watertight in raytrace.glsl) of the lanes in mask
+        // Lanes which hit the triangle within their [near_plane, far_plane] get their far plane moved
+        // to the hit and the barycentric coordinates written to bc; returns the mask of those lanes
+        uint32_t intersect_triangle(const glm::vec3& tri0, const glm::vec3& tri1, const glm::vec3& tri2, uint32_t mask, glm::vec3 bc[Size]);
+        // Same test for occlusion queries; returns the mask of the lanes which hit the triangle without moving their far planes
+        uint32_t occludes_triangle(const glm::vec3& tri0, const glm::vec3& tri1, const glm::vec3& tri2, uint32_t mask) const;
+
+    private:
+        // Lanes in structure of arrays order so SSE/AVX2 can load several at once
+        struct alignas(64) Lanes {
+            float origin_x[Size];
+            float origin_y[Size];
+            float origin_z[Size];
+            float direction_x[Size];
+            float direction_y[Size];
+            float direction_z[Size];
+            float inverse_x[Size];
+            float inverse_y[Size];
+            float inverse_z[Size];
+            float near_plane[Size];
+            float far_plane[Size];
+
+            // Axes and shear constants of the watertight triangle test (the same for every triangle)
+            int32_t kx[Size];
+            int32_t ky[Size];
+            int32_t kz[Size];
+            float Sx[Size];
+            float Sy[Size];
+            float Sz[Size];
+        };
+
+        Lanes lanes;
+        uint32_t active_lanes;
+        SIMDLevel simd_level;
+
+        // Interval bounds of the lanes' origins, inverse directions and planes
+        struct Frustum {
+            glm::vec3 min_origin;
+            glm::vec3 max_origin;
+            glm::vec3 min_inverse;
+            glm::vec3 max_inverse;
+            float min_near_plane;
+            float max_far_plane;
+            // False if an inverse direction is infinite which makes the bounds useless
+            bool valid;
+        };
+        Frustum get_frustum(uint32_t mask) const;
+        // True if none of the lanes within the frustum can hit bounds
+        static bool frustum_misses(const Frustum& frustum, const AABB& bounds);
+
+        // Slab test of AABB::intersect for the lanes in mask
+        // Returns the mask of the lanes which hit bounds and the distance at which each of them enters it
+        uint32_t intersect_box(const AABB& bounds, uint32_t mask, float distances[Size]) const;
+
+        // Triangle test shared by intersect_triangle and occludes_triangle
+        // Writes the distance and barycentric coordinates of every tested lane (only meaningful for hits)
+        uint32_t test_triangle(const glm::vec3& tri0, const glm::vec3& tri1, const glm::vec3& tri2, uint32_t mask, float dist[Size], float u[Size], float v[Size], float w[Size]) const;
+    };
+
+    extern template class RAYTRACER_LIB_EXPORT RayPacket<4>;
+    extern template class RAYTRACER_LIB_EXPORT RayPacket<8>;
+    extern template class RAYTRACER_LIB_EXPORT RayPacket<16>;
+
+}
+
+#endif
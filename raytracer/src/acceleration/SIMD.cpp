@@ -0,0 +1,21 @@
+#include "SIMD.hpp"
+
+namespace Rt {
+
+    SIMDLevel get_simd_level() {
+        static const SIMDLevel level = []() {
+#if defined(RT_SIMD_AVX2)
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2"))
+                return SIMDLevel::AVX2;
+#endif
+#if defined(RT_SIMD_SSE)
+            return SIMDLevel::SSE;
+#else
+            return SIMDLevel::SCALAR;
+#endif
+        }();
+        return level;
+    }
+
+}
@@ -0,0 +1,34 @@
+#ifndef RT_SIMD_HPP
+#define RT_SIMD_HPP
+
+#include <QtGlobal>
+#include <cstdint>
+
+#include "RaytracerGlobals.hpp"
+
+// SSE(2) is part of every x86-64 CPU so it only needs to be checked for at compile time
+#if defined(__x86_64__) || defined(_M_X64) || (defined(__i386__) && defined(__SSE2__))
+    #define RT_SIMD_SSE 1
+#endif
+
+// AVX2 code is compiled with a per function target attribute and only run after a runtime check
+#if defined(RT_SIMD_SSE) && (defined(__GNUC__) || defined(__clang__))
+    #define RT_SIMD_AVX2 1
+    #define RT_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace Rt {
+
+    // Vector instruction sets used by the CPU side traversals
+    enum SIMDLevel : int32_t {
+        SCALAR = 0,
+        SSE = 1,
+        AVX2 = 2
+    };
+
+    // Best level supported by both this build and the CPU it runs on
+    RAYTRACER_LIB_EXPORT SIMDLevel get_simd_level();
+
+}
+
+#endif
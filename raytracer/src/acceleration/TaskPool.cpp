@@ -0,0 +1,72 @@
+#include "TaskPool.hpp"
+
+#include <algorithm>
+
+namespace Rt {
+
+    TaskPool::TaskPool(unsigned int nr_threads) {
+        stopping = false;
+        if (nr_threads == 0) nr_threads = std::max(std::thread::hardware_concurrency(), 1u);
+        for (unsigned int i=1; i<nr_threads; i++) threads.emplace_back(&TaskPool::work, this);
+    }
+
+    TaskPool::~TaskPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        changed.notify_all();
+        for (std::thread& thread : threads) thread.join();
+    }
+
+    TaskPool& TaskPool::get_shared() {
+        static TaskPool shared;
+        return shared;
+    }
+
+    unsigned int TaskPool::get_nr_threads() const {
+        return threads.size() + 1;
+    }
+
+    void TaskPool::run(unsigned int nr_tasks, const std::function<void(unsigned int)>& task) {
+        if (nr_tasks == 0) return;
+
+        Group group{nr_tasks-1};
+        if (nr_tasks > 1) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                for (unsigned int i=1; i<nr_tasks; i++) tasks.push_back(Task{&task, i, &group});
+            }
+            changed.notify_all();
+        }
+
+        task(0);
+
+        // Help out until the other tasks are done; the queue may hold tasks of other groups
+        // (e.g. the subtree of a sibling) which also keeps nested run() calls moving
+        std::unique_lock<std::mutex> lock(mutex);
+        while (group.nr_unfinished > 0) {
+            if (!tasks.empty()) run_front_task(lock);
+            else changed.wait(lock);
+        }
+    }
+
+    void TaskPool::run_front_task(std::unique_lock<std::mutex>& lock) {
+        Task task = tasks.front();
+        tasks.pop_front();
+        lock.unlock();
+        (*task.function)(task.index);
+        lock.lock();
+        if (--task.group->nr_unfinished == 0) changed.notify_all();
+    }
+
+    void TaskPool::work() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            if (!tasks.empty()) run_front_task(lock);
+            else if (stopping) return;
+            else changed.wait(lock);
+        }
+    }
+
+}
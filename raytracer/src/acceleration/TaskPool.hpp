@@ -0,0 +1,62 @@
+#ifndef RT_TASK_POOL_HPP
+#define RT_TASK_POOL_HPP
+
+#include <QtGlobal>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "RaytracerGlobals.hpp"
+
+namespace Rt {
+
+    // Threads which are started once and then run the tasks of every parallel BVH build
+    // A thread waiting for its tasks runs queued tasks (its own or anyone else's) instead of
+    // blocking so nested run() calls from within tasks can't deadlock the pool
+    class RAYTRACER_LIB_EXPORT TaskPool {
+    public:
+        // Starts nr_threads-1 threads; the thread calling run() is the last one
+        // nr_threads=0 uses every hardware thread
+        TaskPool(unsigned int nr_threads=0);
+        ~TaskPool();
+
+        // The pool shared by every BVH build, started on first use with every hardware thread
+        static TaskPool& get_shared();
+
+        // Including the thread calling run()
+        unsigned int get_nr_threads() const;
+
+        // Runs task(0) ... task(nr_tasks-1) and returns once all of them have finished
+        // The calling thread runs task(0) itself and the others go to whichever threads are idle
+        void run(unsigned int nr_tasks, const std::function<void(unsigned int)>& task);
+
+    private:
+        // Tasks of one run() call which haven't finished yet
+        struct Group {
+            unsigned int nr_unfinished;
+        };
+
+        struct Task {
+            const std::function<void(unsigned int)>* function;
+            unsigned int index;
+            Group* group;
+        };
+
+        std::vector<std::thread> threads;
+        std::mutex mutex;
+        std::deque<Task> tasks;
+        // Signalled when a task is queued, when a group finishes and when the pool stops
+        std::condition_variable changed;
+        bool stopping;
+
+        // Runs the front task with mutex unlocked while running it
+        void run_front_task(std::unique_lock<std::mutex>& lock);
+        void work();
+    };
+
+}
+
+#endif
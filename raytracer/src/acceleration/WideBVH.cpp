@@ -0,0 +1,281 @@
+#include "WideBVH.hpp"
+
+#include <algorithm>
+
+#if defined(RT_SIMD_SSE)
+    #include <immintrin.h>
+#endif
+
+namespace Rt {
+
+    namespace {
+
+        // Scalar version of the slab test in AABB::intersect for lanes [first, last)
+        template <int Width>
+        uint32_t intersect_children_scalar(const WideBVHNode<Width>& node, int first, int last, const glm::vec3& origin, const glm::vec3& inverse_direction, float near_plane, float far_plane, float distances[Width]) {
+            uint32_t mask = 0;
+            for (int c=first; c<last; c++) {
+                AABB bounds(
+                    glm::vec3(node.min_x[c], node.min_y[c], node.min_z[c]),
+                    glm::vec3(node.max_x[c], node.max_y[c], node.max_z[c])
+                );
+                distances[c] = bounds.intersect(origin, inverse_direction, near_plane, far_plane);
+                if (distances[c] >= 0.0f) mask |= 1u << c;
+            }
+            return mask;
+        }
+
+#if defined(RT_SIMD_SSE)
+        // Tests 4 lanes starting at first; the same operations as AABB::intersect in the same order
+        template <int Width>
+        uint32_t intersect_children_sse(const WideBVHNode<Width>& node, int first, const glm::vec3& origin, const glm::vec3& inverse_direction, float near_plane, float far_plane, float distances[Width]) {
+            __m128 origin_x = _mm_set1_ps(origin.x);
+            __m128 origin_y = _mm_set1_ps(origin.y);
+            __m128 origin_z = _mm_set1_ps(origin.z);
+            __m128 inverse_x = _mm_set1_ps(inverse_direction.x);
+            __m128 inverse_y = _mm_set1_ps(inverse_direction.y);
+            __m128 inverse_z = _mm_set1_ps(inverse_direction.z);
+
+            __m128 t0_x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.min_x+first), origin_x), inverse_x);
+            __m128 t0_y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.min_y+first), origin_y), inverse_y);
+            __m128 t0_z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.min_z+first), origin_z), inverse_z);
+            __m128 t1_x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.max_x+first), origin_x), inverse_x);
+            __m128 t1_y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.max_y+first), origin_y), inverse_y);
+            __m128 t1_z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.max_z+first), origin_z), inverse_z);
+
+            __m128 t_enter = _mm_max_ps(
+                _mm_max_ps(_mm_min_ps(t0_x, t1_x), _mm_min_ps(t0_y, t1_y)),
+                _mm_max_ps(_mm_min_ps(t0_z, t1_z), _mm_set1_ps(near_plane))
+            );
+            __m128 t_exit = _mm_min_ps(
+                _mm_min_ps(_mm_max_ps(t0_x, t1_x), _mm_max_ps(t0_y, t1_y)),
+                _mm_min_ps(_mm_max_ps(t0_z, t1_z), _mm_set1_ps(far_plane))
+            );
+
+            _mm_store_ps(distances+first, t_enter);
+            return uint32_t(_mm_movemask_ps(_mm_cmple_ps(t_enter, t_exit))) << first;
+        }
+#endif
+
+#if defined(RT_SIMD_AVX2)
+        // Tests all 8 lanes of an 8 wide node
+        RT_TARGET_AVX2
+        uint32_t intersect_children_avx2(const WideBVHNode<8>& node, const glm::vec3& origin, const glm::vec3& inverse_direction, float near_plane, float far_plane, float distances[8]) {
+            __m256 origin_x = _mm256_set1_ps(origin.x);
+            __m256 origin_y = _mm256_set1_ps(origin.y);
+            __m256 origin_z = _mm256_set1_ps(origin.z);
+            __m256 inverse_x = _mm256_set1_ps(inverse_direction.x);
+            __m256 inverse_y = _mm256_set1_ps(inverse_direction.y);
+            __m256 inverse_z = _mm256_set1_ps(inverse_direction.z);
+
+            __m256 t0_x = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.min_x), origin_x), inverse_x);
+            __m256 t0_y = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.min_y), origin_y), inverse_y);
+            __m256 t0_z = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.min_z), origin_z), inverse_z);
+            __m256 t1_x = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.max_x), origin_x), inverse_x);
+            __m256 t1_y = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.max_y), origin_y), inverse_y);
+            __m256 t1_z = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.max_z), origin_z), inverse_z);
+
+            __m256 t_enter = _mm256_max_ps(
+                _mm256_max_ps(_mm256_min_ps(t0_x, t1_x), _mm256_min_ps(t0_y, t1_y)),
+                _mm256_max_ps(_mm256_min_ps(t0_z, t1_z), _mm256_set1_ps(near_plane))
+            );
+            __m256 t_exit = _mm256_min_ps(
+                _mm256_min_ps(_mm256_max_ps(t0_x, t1_x), _mm256_max_ps(t0_y, t1_y)),
+                _mm256_min_ps(_mm256_max_ps(t0_z, t1_z), _mm256_set1_ps(far_plane))
+            );
+
+            _mm256_store_ps(distances, t_enter);
+            return uint32_t(_mm256_movemask_ps(_mm256_cmp_ps(t_enter, t_exit, _CMP_LE_OQ)));
+        }
+#endif
+
+    }
+
+    template <int Width>
+    WideBVH<Width>::WideBVH() {
+        simd_level = Rt::get_simd_level();
+    }
+
+    template <int Width>
+    void WideBVH<Width>::build(const BVH& bvh) {
+        nodes.clear();
+        const std::vector<BVHNode>& bvh_nodes = bvh.get_nodes();
+        if (bvh_nodes.empty()) return;
+
+        // Pairs of a wide node and the binary node whose subtree it has to hold
+        std::vector<std::pair<uint32_t, uint32_t>> to_collapse{{0, 0}};
+        nodes.emplace_back();
+        while (!to_collapse.empty()) {
+            auto [node_index, bvh_node_index] = to_collapse.back();
+            to_collapse.pop_back();
+
+            std::vector<uint32_t> children;
+            const BVHNode& bvh_node = bvh_nodes[bvh_node_index];
+            if (bvh_node.is_leaf()) {
+                children.push_back(bvh_node_index);
+            } else {
+                children.push_back(bvh_node.left_or_first);
+                children.push_back(bvh_node.left_or_first+1);
+            }
+
+            // Open up the largest interior children until the node is full
+            while (children.size() < Width) {
+                int largest = -1;
+                float largest_area = -1.0f;
+                for (int c=0; c<int(children.size()); c++) {
+                    const BVHNode& child = bvh_nodes[children[c]];
+                    if (!child.is_leaf() && child.bounds.surface_area() > largest_area) {
+                        largest = c;
+                        largest_area = child.bounds.surface_area();
+                    }
+                }
+                if (largest == -1) break;
+
+                uint32_t opened = children[largest];
+                children[largest] = bvh_nodes[opened].left_or_first;
+                children.push_back(bvh_nodes[opened].left_or_first+1);
+            }
+
+            WideBVHNode<Width> node;
+            node.nr_children = children.size();
+            for (int c=0; c<Width; c++) {
+                // Unused lanes get an inverted box and are masked out by nr_children anyway
+                AABB bounds;
+                node.children[c] = 0;
+                node.counts[c] = 0;
+                if (c < int(children.size())) {
+                    const BVHNode& child = bvh_nodes[children[c]];
+                    bounds = child.bounds;
+                    if (child.is_leaf()) {
+                        node.children[c] = child.left_or_first;
+                        node.counts[c] = child.count;
+                    } else {
+                        node.children[c] = nodes.size();
+                        nodes.emplace_back();
+                        to_collapse.emplace_back(node.children[c], children[c]);
+                    }
+                }
+                node.min_x[c] = bounds.min.x;
+                node.min_y[c] = bounds.min.y;
+                node.min_z[c] = bounds.min.z;
+                node.max_x[c] = bounds.max.x;
+                node.max_y[c] = bounds.max.y;
+                node.max_z[c] = bounds.max.z;
+            }
+            nodes[node_index] = node;
+        }
+    }
+
+    template <int Width>
+    const std::vector<WideBVHNode<Width>>& WideBVH<Width>::get_nodes() const {
+        return nodes;
+    }
+
+    template <int Width>
+    bool WideBVH<Width>::is_empty() const {
+        return nodes.empty();
+    }
+
+    template <int Width>
+    void WideBVH<Width>::set_simd_level(SIMDLevel new_simd_level) {
+        simd_level = std::min(new_simd_level, Rt::get_simd_level());
+    }
+
+    template <int Width>
+    SIMDLevel WideBVH<Width>::get_simd_level() const {
+        return simd_level;
+    }
+
+    template <int Width>
+    uint32_t WideBVH<Width>::intersect_children(const WideBVHNode<Width>& node, const glm::vec3& origin, const glm::vec3& inverse_direction, float near_plane, float far_plane, float distances[Width]) const {
+        uint32_t mask = 0;
+#if defined(RT_SIMD_AVX2)
+        if constexpr (Width == 8) {
+            if (simd_level >= SIMDLevel::AVX2)
+                return intersect_children_avx2(node, origin, inverse_direction, near_plane, far_plane, distances) & ((1u << node.nr_children) - 1);
+        }
+#endif
+#if defined(RT_SIMD_SSE)
+        if (simd_level >= SIMDLevel::SSE) {
+            for (int first=0; first<Width; first+=4)
+                mask |= intersect_children_sse(node, first, origin, inverse_direction, near_plane, far_plane, distances);
+            return mask & ((1u << node.nr_children) - 1);
+        }
+#endif
+        return intersect_children_scalar(node, 0, node.nr_children, origin, inverse_direction, near_plane, far_plane, distances);
+    }
+
+    template <int Width>
+    float WideBVH<Width>::traverse(const glm::vec3& origin, const glm::vec3& direction, float near_plane, float far_plane, const LeafIntersector& intersect_leaf) const {
+        if (nodes.empty()) return far_plane;
+        glm::vec3 inverse_direction = 1.0f / direction;
+
+        // Every level can leave up to Width-1 children on the stack
+        constexpr int stack_capacity = BVH::traversal_stack_size * (Width-1);
+        uint32_t stack[stack_capacity];
+        int stack_size = 0;
+        stack[stack_size++] = 0;
+
+        alignas(4*Width) float distances[Width];
+        while (stack_size > 0) {
+            const WideBVHNode<Width>& node = nodes[stack[--stack_size]];
+            uint32_t mask = intersect_children(node, origin, inverse_direction, near_plane, far_plane, distances);
+
+            // Sort the children that were hit nearest first
+            int order[Width];
+            int nr_hit = 0;
+            for (int c=0; c<Width; c++) {
+                if (!(mask & (1u << c))) continue;
+                int i = nr_hit++;
+                for (; i>0 && distances[order[i-1]] > distances[c]; i--) order[i] = order[i-1];
+                order[i] = c;
+            }
+
+            // Same as QuantizedBVH::traverse: leaves straight away, then the interior children
+            // pushed so the nearest is popped first
+            for (int i=0; i<nr_hit; i++) {
+                int c = order[i];
+                if (node.counts[c] > 0 && distances[c] <= far_plane)
+                    far_plane = intersect_leaf(node.children[c], node.counts[c], far_plane);
+            }
+            for (int i=nr_hit-1; i>=0; i--) {
+                int c = order[i];
+                if (node.counts[c] == 0 && stack_size < stack_capacity)
+                    stack[stack_size++] = node.children[c];
+            }
+        }
+        return far_plane;
+    }
+
+    template <int Width>
+    bool WideBVH<Width>::occluded(const glm::vec3& origin, const glm::vec3& direction, float near_plane, float far_plane, const LeafOcclusionTest& is_leaf_occluded) const {
+        if (nodes.empty()) return false;
+        glm::vec3 inverse_direction = 1.0f / direction;
+
+        constexpr int stack_capacity = BVH::traversal_stack_size * (Width-1);
+        uint32_t stack[stack_capacity];
+        int stack_size = 0;
+        stack[stack_size++] = 0;
+
+        alignas(4*Width) float distances[Width];
+        while (stack_size > 0) {
+            const WideBVHNode<Width>& node = nodes[stack[--stack_size]];
+            uint32_t mask = intersect_children(node, origin, inverse_direction, near_plane, far_plane, distances);
+
+            // No need to sort the children since any hit will do
+            for (int c=0; c<Width; c++) {
+                if (!(mask & (1u << c))) continue;
+                if (node.counts[c] > 0) {
+                    if (is_leaf_occluded(node.children[c], node.counts[c])) return true;
+                } else if (stack_size < stack_capacity) {
+                    stack[stack_size++] = node.children[c];
+                }
+            }
+        }
+        return false;
+    }
+
+    template class RAYTRACER_LIB_EXPORT WideBVH<4>;
+    template class RAYTRACER_LIB_EXPORT WideBVH<8>;
+
+}
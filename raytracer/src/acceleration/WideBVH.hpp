@@ -0,0 +1,75 @@
+#ifndef RT_WIDE_BVH_HPP
+#define RT_WIDE_BVH_HPP
+
+#include <QtGlobal>
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "RaytracerGlobals.hpp"
+#include "BVH.hpp"
+#include "SIMD.hpp"
+
+namespace Rt {
+
+    // Node with up to Width children whose bounds are stored as structure of arrays
+    // so every child can be tested against a ray at once
+    template <int Width>
+    struct alignas(4*Width) WideBVHNode {
+        float min_x[Width];
+        float min_y[Width];
+        float min_z[Width];
+        float max_x[Width];
+        float max_y[Width];
+        float max_z[Width];
+
+        // Interior children: index of the child's node
+        // Leaf children: index of the first primitive in BVH::get_primitive_indices()
+        uint32_t children[Width];
+        // Number of primitives in leaf children; 0 for interior children
+        uint32_t counts[Width];
+
+        // Lanes past nr_children are unused
+        uint32_t nr_children;
+    };
+
+    // BVH with 4 or 8 children per node made by collapsing a binary BVH
+    // Used by CPU side traversals which test all children of a node with SSE/AVX2
+    template <int Width>
+    class WideBVH {
+        static_assert(Width == 4 || Width == 8, "Only 4 and 8 wide BVHs are supported");
+
+    public:
+        WideBVH();
+
+        // Repeatedly replaces the interior child with the largest surface area by its
+        // children until a node has Width children (or only leaves)
+        // The leaves refer to the same primitive ranges as in bvh
+        void build(const BVH& bvh);
+
+        const std::vector<WideBVHNode<Width>>& get_nodes() const;
+        bool is_empty() const;
+
+        // Defaults to get_simd_level(); levels the CPU doesn't support fall back to the best one it does
+        void set_simd_level(SIMDLevel new_simd_level);
+        SIMDLevel get_simd_level() const;
+
+        // Same as BVH::traverse
+        float traverse(const glm::vec3& origin, const glm::vec3& direction, float near_plane, float far_plane, const LeafIntersector& intersect_leaf) const;
+        // Same as BVH::occluded
+        bool occluded(const glm::vec3& origin, const glm::vec3& direction, float near_plane, float far_plane, const LeafOcclusionTest& is_leaf_occluded) const;
+
+    private:
+        std::vector<WideBVHNode<Width>> nodes;
+        SIMDLevel simd_level;
+
+        // Returns a mask of the children the ray enters within [near_plane, far_plane]
+        // and the distance at which it enters each of them
+        uint32_t intersect_children(const WideBVHNode<Width>& node, const glm::vec3& origin, const glm::vec3& inverse_direction, float near_plane, float far_plane, float distances[Width]) const;
+    };
+
+    extern template class RAYTRACER_LIB_EXPORT WideBVH<4>;
+    extern template class RAYTRACER_LIB_EXPORT WideBVH<8>;
+
+}
+
+#endif
@@ -51,7 +51,10 @@ namespace Rt {
     }
     
 
-    Texture::Texture(QObject* parent) : QObject(parent) {}
+    Texture::Texture(QObject* parent) : QObject(parent) {
+        id = 0;
+        gl = nullptr;
+    }
 
     Texture::~Texture() {
         glDeleteTextures(1, &id);
@@ -95,6 +98,22 @@ namespace Rt {
         set_params();
     }
 
+    void Texture::upload(const FloatImage& image) {
+        gl->make_current();
+        gl->glTextureSubImage2D(id, 0, 0, 0, image.get_width(), image.get_height(), GL_RGBA, GL_FLOAT, image.get_data().data());
+    }
+
+    void Texture::download(FloatImage* image) {
+        gl->make_current();
+        int width, height;
+        gl->glGetTextureLevelParameteriv(id, 0, GL_TEXTURE_WIDTH, &width);
+        gl->glGetTextureLevelParameteriv(id, 0, GL_TEXTURE_HEIGHT, &height);
+        image->resize(width, height);
+        // Compute shaders write render results with image stores
+        gl->glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+        gl->glGetTextureImage(id, 0, GL_RGBA, GL_FLOAT, image->get_data().size()*sizeof(float), image->get_data().data());
+    }
+
     unsigned int Texture::get_id() {
         return id;
     }
@@ -6,6 +6,7 @@
 
 #include "RaytracerGlobals.hpp"
 #include "rendering/OpenGLFunctions.hpp"
+#include "rendering/FloatImage.hpp"
 
 namespace Rt {
 
@@ -43,6 +44,13 @@ namespace Rt {
         // Warning: This WILL clear the image
         void resize(unsigned int width, unsigned int height);
 
+        // Copies the pixels of image into the texture (e.g. a frame rendered by CPURenderer)
+        // The texture must have been created with the same size as the image
+        void upload(const FloatImage& image);
+        // Copies the first level of a 2D texture back into image (resized to the texture's size)
+        // Waits for everything rendering into the texture to finish
+        void download(FloatImage* image);
+
         unsigned int get_id();
 
     private:
@@ -0,0 +1,1235 @@
+#include "CPURenderer.hpp"
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QTextStream>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+
+#include "scene/lights/AbstractLight.hpp"
+#include "scene/lights/PointLight.hpp"
+
+namespace Rt {
+
+    namespace {
+
+        // These MUST match their namesakes in raytrace.glsl
+        constexpr float EPSILON = 0.000001f;
+        constexpr float NEAR_PLANE = 0.1f;
+        constexpr float FAR_PLANE = 100.0f;
+        constexpr float BIAS = 0.0001f;
+        constexpr float PI = 3.1415926535f;
+        constexpr unsigned int LIGHT_CANDIDATES = 8;
+
+        template <typename T>
+        T read(const unsigned char* bytes) {
+            T value;
+            std::memcpy(&value, bytes, sizeof(T));
+            return value;
+        }
+
+        float ray_plane_int(const glm::vec3& ray_origin, const glm::vec3& ray_dir, const glm::vec3& plane_point, const glm::vec3& plane_normal) {
+            float denom = glm::dot(plane_normal, ray_dir);
+            if (std::abs(denom) <= EPSILON) {
+                // The ray is parallel to the plane
+                return -1.0f;
+            }
+            float D = -glm::dot(plane_normal, plane_point);
+            float numer = -(glm::dot(plane_normal, ray_origin) + D);
+            return numer/denom;
+        }
+
+        float ray_sphere_int(const glm::vec3& ray_origin, const glm::vec3& ray_dir, const glm::vec3& sphere_origin, float sphere_radius, bool& intersected) {
+            // Assumes ray_dir is normalized
+            float a = 1.0f;
+            float b = 2.0f*glm::dot(ray_origin-sphere_origin, ray_dir);
+            float c = glm::dot(ray_origin-sphere_origin, ray_origin-sphere_origin) - sphere_radius*sphere_radius;
+
+            float inside_sqrt = b*b - 4.0f*a*c;
+            if (inside_sqrt <= 0.0f) {
+                intersected = false;
+                return FAR_PLANE;
+            }
+            intersected = true;
+            return 2.0f*c / (-b + std::sqrt(inside_sqrt));
+        }
+
+        glm::vec4 barycentric_coordinates(const glm::vec3& point, const glm::vec3& tri0, const glm::vec3& tri1, const glm::vec3& tri2) {
+            float double_area_tri = glm::length(glm::cross(tri1-tri0, tri2-tri0));
+
+            float area0 = glm::length(glm::cross(tri1-point, tri2-point)) / double_area_tri;
+            float area1 = glm::length(glm::cross(tri0-point, tri2-point)) / double_area_tri;
+            float area2 = glm::length(glm::cross(tri0-point, tri1-point)) / double_area_tri;
+
+            return glm::vec4(area0, area1, area2, area0+area1+area2-1.0f <= EPSILON ? 1.0f : -1.0f);
+        }
+
+        bool ray_triangle_int_watertight(const glm::vec3& ray_origin, const glm::vec3& ray_dir, const glm::vec3& tri0, const glm::vec3& tri1, const glm::vec3& tri2, float near_plane, float& depth, glm::vec3& bc) {
+            glm::vec3 abs_dir = glm::abs(ray_dir);
+            int kz = abs_dir.x > abs_dir.y ? (abs_dir.x > abs_dir.z ? 0 : 2) : (abs_dir.y > abs_dir.z ? 1 : 2);
+            int kx = kz == 2 ? 0 : kz + 1;
+            int ky = kx == 2 ? 0 : kx + 1;
+            if (ray_dir[kz] < 0.0f) std::swap(kx, ky);
+            float Sz = 1.0f / ray_dir[kz];
+            float Sx = ray_dir[kx] * Sz;
+            float Sy = ray_dir[ky] * Sz;
+
+            glm::vec3 A = tri0 - ray_origin;
+            glm::vec3 B = tri1 - ray_origin;
+            glm::vec3 C = tri2 - ray_origin;
+            float Ax = A[kx] - Sx*A[kz];
+            float Ay = A[ky] - Sy*A[kz];
+            float Bx = B[kx] - Sx*B[kz];
+            float By = B[ky] - Sy*B[kz];
+            float Cx = C[kx] - Sx*C[kz];
+            float Cy = C[ky] - Sy*C[kz];
+
+            float U = Cx*By - Cy*Bx;
+            float V = Ax*Cy - Ay*Cx;
+            float W = Bx*Ay - By*Ax;
+            if ((U < 0.0f || V < 0.0f || W < 0.0f) && (U > 0.0f || V > 0.0f || W > 0.0f)) {
+                return false;
+            }
+            float det = U + V + W;
+            if (det == 0.0f) {
+                return false;
+            }
+
+            float T = Sz * (U*A[kz] + V*B[kz] + W*C[kz]);
+            float dist = T / det;
+            if (dist >= near_plane && dist <= depth) {
+                depth = dist;
+                bc = glm::vec3(U, V, W) / det;
+                return true;
+            }
+            return false;
+        }
+
+        bool ray_triangle_int_legacy(const glm::vec3& ray_origin, const glm::vec3& ray_dir, const glm::vec3& tri0, const glm::vec3& tri1, const glm::vec3& tri2, float near_plane, float& depth, glm::vec3& bc) {
+            glm::vec3 normal = glm::cross(tri1-tri0, tri2-tri0);
+            float dist = ray_plane_int(ray_origin, ray_dir, tri0, glm::normalize(normal));
+
+            if (dist >= near_plane && dist <= depth) {
+                glm::vec4 bcw = barycentric_coordinates(ray_origin + dist*ray_dir, tri0, tri1, tri2);
+                if (bcw.w > 0.0f) {
+                    depth = dist;
+                    bc = glm::vec3(bcw);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        float NDF_trowbridge_reitz_GGX(const glm::vec3& normal, const glm::vec3& halfway, float alpha) {
+            float a2 = alpha * alpha;
+            return a2 / (PI * std::pow(std::pow(std::max(glm::dot(normal, halfway), 0.0f), 2.0f) * (a2 - 1.0f) + 1.0f, 2.0f));
+        }
+
+        float GF_schlick_GGX(float n_dot_v, float roughness) {
+            float k = (roughness+1.0f)*(roughness+1.0f) / 8.0f;
+            return n_dot_v / (n_dot_v * (1.0f-k) + k);
+        }
+
+        float GF_smith(const glm::vec3& view, const glm::vec3& normal, const glm::vec3& light, float alpha) {
+            float n_dot_v = std::max(glm::dot(normal, view), 0.0f);
+            float n_dot_l = std::max(glm::dot(normal, light), 0.0f);
+            return GF_schlick_GGX(n_dot_v, alpha) * GF_schlick_GGX(n_dot_l, alpha);
+        }
+
+        glm::vec3 F_schlick(const glm::vec3& v1, const glm::vec3& v2, const glm::vec3& F0) {
+            return F0 + (1.0f - F0) * std::pow(1.0f - std::max(glm::dot(v1, v2), 0.0f), 5.0f);
+        }
+
+        uint32_t pcg_hash(uint32_t x) {
+            uint32_t state = x * 747796405u + 2891336453u;
+            uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+            return (word >> 22u) ^ word;
+        }
+
+        float random_float(uint32_t& rng_state) {
+            // Uniform in [0,1)
+            rng_state = pcg_hash(rng_state);
+            return float(rng_state >> 8) * (1.0f / 16777216.0f);
+        }
+
+        // Interleaves the bits of x (even bits) and y (odd bits)
+        uint32_t morton_code(uint32_t x, uint32_t y) {
+            uint32_t code = 0;
+            for (int bit=0; bit<16; bit++) {
+                code |= ((x >> bit) & 1u) << (2*bit);
+                code |= ((y >> bit) & 1u) << (2*bit+1);
+            }
+            return code;
+        }
+
+        // Returns the indices of the nr_tiles_x*nr_tiles_y tiles (row by row) in the given order
+        std::vector<unsigned int> order_tiles(unsigned int nr_tiles_x, unsigned int nr_tiles_y, CPURenderer::TileOrder order) {
+            std::vector<unsigned int> tiles(nr_tiles_x*nr_tiles_y);
+            std::iota(tiles.begin(), tiles.end(), 0u);
+
+            if (order == CPURenderer::TileOrder::MORTON) {
+                std::stable_sort(tiles.begin(), tiles.end(), [&](unsigned int a, unsigned int b) {
+                    return morton_code(a % nr_tiles_x, a / nr_tiles_x) < morton_code(b % nr_tiles_x, b / nr_tiles_x);
+                });
+            } else if (order == CPURenderer::TileOrder::SPIRAL) {
+                // Rings of tiles around the center (in doubled coordinates so the center can be between tiles)
+                // each walked around by angle
+                auto ring = [&](unsigned int tile) {
+                    int x = 2*int(tile % nr_tiles_x) - int(nr_tiles_x-1);
+                    int y = 2*int(tile / nr_tiles_x) - int(nr_tiles_y-1);
+                    return std::max(std::abs(x), std::abs(y));
+                };
+                auto angle = [&](unsigned int tile) {
+                    float x = 2.0f*(tile % nr_tiles_x) - (nr_tiles_x-1);
+                    float y = 2.0f*(tile / nr_tiles_x) - (nr_tiles_y-1);
+                    return std::atan2(y, x);
+                };
+                std::stable_sort(tiles.begin(), tiles.end(), [&](unsigned int a, unsigned int b) {
+                    if (ring(a) != ring(b)) return ring(a) < ring(b);
+                    return angle(a) < angle(b);
+                });
+            }
+            return tiles;
+        }
+
+    }
+
+    CPURenderer::CPURenderer(QObject* parent) : QObject(parent) {
+        camera = nullptr;
+        scene = nullptr;
+        prev_width = 0;
+        prev_height = 0;
+        triangle_intersection = Renderer::TriangleIntersection::WATERTIGHT;
+        nr_static_indices = 0;
+        nr_static_meshes = 0;
+        material_textures = nullptr;
+        texture_width = 0;
+        texture_height = 0;
+        nr_light_samples = 0;
+        light_culling = true;
+        use_light_grid = false;
+        frame_index = 0;
+        frame_result = nullptr;
+        frame_nr_tiles_x = 0;
+        frame_nr_tiles = 0;
+        frame_seed = 0;
+        nr_threads = 0;
+        tile_size = 16;
+        tile_order = TileOrder::MORTON;
+        ordered_tiles_x = 0;
+        ordered_tiles_y = 0;
+        ordered_tiles_order = tile_order;
+        packet_size = 16;
+        simd_level = Rt::get_simd_level();
+        work_generation = 0;
+        nr_busy_workers = 0;
+        stop_workers = false;
+        start_workers();
+    }
+
+    CPURenderer::~CPURenderer() {
+        join_workers();
+    }
+
+    void CPURenderer::set_nr_threads(unsigned int new_nr_threads) {
+        join_workers();
+        nr_threads = new_nr_threads;
+        start_workers();
+    }
+
+    unsigned int CPURenderer::get_nr_threads() const {
+        return nr_threads;
+    }
+
+    void CPURenderer::set_tile_size(unsigned int new_tile_size) {
+        tile_size = std::max(new_tile_size, 1u);
+    }
+
+    unsigned int CPURenderer::get_tile_size() const {
+        return tile_size;
+    }
+
+    void CPURenderer::set_tile_order(TileOrder new_tile_order) {
+        tile_order = new_tile_order;
+    }
+
+    CPURenderer::TileOrder CPURenderer::get_tile_order() const {
+        return tile_order;
+    }
+
+    void CPURenderer::set_work_stealing(bool new_work_stealing) {
+        tile_scheduler.set_work_stealing(new_work_stealing);
+    }
+
+    bool CPURenderer::get_work_stealing() const {
+        return tile_scheduler.get_work_stealing();
+    }
+
+    const std::vector<TileStatistics>& CPURenderer::get_tile_statistics() const {
+        return tile_statistics;
+    }
+
+    unsigned int CPURenderer::get_nr_steals() const {
+        return tile_scheduler.get_nr_steals();
+    }
+
+    bool CPURenderer::save_tile_statistics(const QString& path) const {
+        QFile file(path);
+        if (!file.open(QFile::WriteOnly | QFile::Text)) return false;
+        QTextStream out(&file);
+        out << "x,y,width,height,render_time_ms,thread,stolen\n";
+        for (const TileStatistics& tile : tile_statistics) {
+            out << tile.x << "," << tile.y << "," << tile.width << "," << tile.height << ","
+                << tile.render_time << "," << tile.thread << "," << (tile.stolen ? 1 : 0) << "\n";
+        }
+        return true;
+    }
+
+    void CPURenderer::set_packet_size(unsigned int new_packet_size) {
+        if (new_packet_size >= 16) packet_size = 16;
+        else if (new_packet_size >= 8) packet_size = 8;
+        else if (new_packet_size >= 4) packet_size = 4;
+        else packet_size = 1;
+    }
+
+    unsigned int CPURenderer::get_packet_size() const {
+        return packet_size;
+    }
+
+    void CPURenderer::set_simd_level(SIMDLevel new_simd_level) {
+        simd_level = std::min(new_simd_level, Rt::get_simd_level());
+    }
+
+    SIMDLevel CPURenderer::get_simd_level() const {
+        return simd_level;
+    }
+
+    void CPURenderer::set_triangle_intersection(Renderer::TriangleIntersection new_triangle_intersection) {
+        triangle_intersection = new_triangle_intersection;
+    }
+
+    Renderer::TriangleIntersection CPURenderer::get_triangle_intersection() const {
+        return triangle_intersection;
+    }
+
+    void CPURenderer::set_light_samples(unsigned int new_light_samples) {
+        nr_light_samples = new_light_samples;
+    }
+
+    unsigned int CPURenderer::get_light_samples() const {
+        return nr_light_samples;
+    }
+
+    void CPURenderer::set_light_culling(bool new_light_culling) {
+        light_culling = new_light_culling;
+    }
+
+    bool CPURenderer::get_light_culling() const {
+        return light_culling;
+    }
+
+    bool CPURenderer::update() {
+        if (scene) {
+            dynamic_vertices.clear();
+            dynamic_indices.clear();
+            mesh_bvhs.assign(nr_static_meshes, nullptr);
+            dynamic_meshes.clear();
+            instance_bounds.clear();
+            instance_meshes.clear();
+            lights.clear();
+            light_weights.clear();
+            light_spheres.clear();
+            light_sphere_bounds.clear();
+            light_sphere_indices.clear();
+            meshes = scene->get_static_meshes();
+            traverse_node_tree(scene);
+            tlas.build(instance_bounds, 1);
+            light_bvh.build(light_sphere_bounds, 1);
+
+            mesh_data.resize(meshes.size() / mesh_size_in_opengl);
+            for (size_t i=0; i<mesh_data.size(); i++) {
+                const unsigned char* mesh = meshes.data() + i*mesh_size_in_opengl;
+                mesh_data[i].transformation = read<glm::mat4>(mesh);
+                mesh_data[i].inverse_transformation = read<glm::mat4>(mesh+64);
+                mesh_data[i].vertex_offset = read<uint32_t>(mesh+128);
+                mesh_data[i].index_offset = read<uint32_t>(mesh+132);
+                mesh_data[i].nr_indices = read<uint32_t>(mesh+136);
+                mesh_data[i].material_index = read<MaterialIndex>(mesh+140);
+            }
+
+            unpacked_lights.resize(lights.size() / light_size_in_opengl);
+            for (size_t i=0; i<unpacked_lights.size(); i++) {
+                const unsigned char* light = lights.data() + i*light_size_in_opengl;
+                unpacked_lights[i].position = read<glm::vec3>(light);
+                unpacked_lights[i].type = read<int32_t>(light+12);
+                unpacked_lights[i].direction = read<glm::vec3>(light+16);
+                unpacked_lights[i].radiance = read<glm::vec3>(light+32);
+                unpacked_lights[i].ambient_multiplier = read<float>(light+44);
+                unpacked_lights[i].cutoff_radius = read<float>(light+48);
+                unpacked_lights[i].shadow_slot = -1;
+            }
+            directional_lights.clear();
+            for (uint32_t i=0; i<unpacked_lights.size() && directional_lights.size()<32; i++) {
+                if (unpacked_lights[i].type == 0) {
+                    unpacked_lights[i].shadow_slot = directional_lights.size();
+                    directional_lights.push_back(i);
+                }
+            }
+
+            if (nr_light_samples > 0) {
+                light_sampler.build(light_weights);
+                light_samples.clear();
+                light_sampler.as_byte_array(light_samples);
+                unsampled_lights.clear();
+                for (uint32_t i=light_sampler.get_nr_sampled_lights(); i<light_samples.size()/light_sample_size_in_opengl; i++) {
+                    unsampled_lights.push_back(read<uint32_t>(light_samples.data() + i*light_sample_size_in_opengl + 12));
+                }
+            }
+            if (light_culling && nr_light_samples == 0) {
+                light_grid.build(light_spheres);
+                light_grid_cells.clear();
+                light_grid.as_byte_array(light_grid_cells);
+                light_grid_indices.resize(light_grid_cells.size() / sizeof(uint32_t));
+                std::memcpy(light_grid_indices.data(), light_grid_cells.data(), light_grid_cells.size());
+            }
+            use_light_grid = light_culling && nr_light_samples == 0 && !light_grid.is_empty();
+
+            MaterialManager& material_manager = scene->get_material_manager();
+            const std::vector<unsigned char>& material_bytes = material_manager.get_materials();
+            materials.resize(material_bytes.size() / material_size_in_opengl);
+            for (size_t i=0; i<materials.size(); i++) {
+                const unsigned char* material = material_bytes.data() + i*material_size_in_opengl;
+                materials[i].albedo = read<glm::vec4>(material);
+                materials[i].F0 = read<glm::vec4>(material+16);
+                materials[i].roughness = read<float>(material+32);
+                materials[i].metalness = read<float>(material+36);
+                materials[i].AO = read<float>(material+40);
+                materials[i].albedo_ti = read<int32_t>(material+44);
+                materials[i].F0_ti = read<int32_t>(material+48);
+                materials[i].roughness_ti = read<int32_t>(material+52);
+                materials[i].metalness_ti = read<int32_t>(material+56);
+                materials[i].AO_ti = read<int32_t>(material+60);
+                materials[i].normal_ti = read<int32_t>(material+64);
+            }
+            material_textures = &material_manager.get_material_textures();
+            texture_width = material_manager.get_texture_width();
+            texture_height = material_manager.get_texture_height();
+
+            return true;
+        }
+        return false;
+    }
+
+    bool CPURenderer::render(FloatImage* render_result, unsigned int width, unsigned int height) {
+        if (camera && scene) {
+            update();
+
+            if (prev_width != width || prev_height != height) {
+                prev_width = width;
+                prev_height = height;
+                camera->update_perspective(float(width)/height);
+            }
+            camera->update_view();
+
+            if (render_result->get_width() != width || render_result->get_height() != height)
+                render_result->resize(width, height);
+
+            frame_result = render_result;
+            frame_eye = camera->get_position();
+            frame_rays = camera->get_corner_rays();
+            frame_nr_tiles_x = (width + tile_size - 1) / tile_size;
+            unsigned int nr_tiles_y = (height + tile_size - 1) / tile_size;
+            frame_nr_tiles = frame_nr_tiles_x * nr_tiles_y;
+            frame_seed = frame_index++;
+
+            // Neighbouring frames look alike so the last one's tile times predict this one's
+            tile_costs.clear();
+            if (ordered_tiles_x == frame_nr_tiles_x && ordered_tiles_y == nr_tiles_y && tile_statistics.size() == frame_nr_tiles) {
+                for (const TileStatistics& statistics : tile_statistics) tile_costs.push_back(statistics.render_time);
+            }
+            if (ordered_tiles_x != frame_nr_tiles_x || ordered_tiles_y != nr_tiles_y || ordered_tiles_order != tile_order) {
+                ordered_tiles = order_tiles(frame_nr_tiles_x, nr_tiles_y, tile_order);
+                ordered_tiles_x = frame_nr_tiles_x;
+                ordered_tiles_y = nr_tiles_y;
+                ordered_tiles_order = tile_order;
+            }
+            tile_scheduler.reset(ordered_tiles, workers.size()+1, tile_costs);
+            tile_statistics.resize(frame_nr_tiles);
+
+            {
+                std::lock_guard<std::mutex> lock(worker_mutex);
+                work_generation++;
+                nr_busy_workers = workers.size();
+            }
+            work_available.notify_all();
+            render_tiles(0);
+            std::unique_lock<std::mutex> lock(worker_mutex);
+            work_done.wait(lock, [this]() { return nr_busy_workers == 0; });
+
+            return true;
+        }
+        return false;
+    }
+
+    void CPURenderer::set_camera(AbstractCamera* new_camera) {
+        camera = new_camera;
+        camera->update_perspective(float(prev_width)/prev_height);
+    }
+
+    AbstractCamera* CPURenderer::get_camera() {
+        return camera;
+    }
+
+    void CPURenderer::set_scene(Scene* new_scene) {
+        scene = new_scene;
+
+        const std::vector<unsigned char>& vertex_bytes = scene->get_static_vertices();
+        static_vertices.resize(vertex_bytes.size() / vertex_size_in_opengl);
+        for (size_t i=0; i<static_vertices.size(); i++) {
+            const unsigned char* vertex = vertex_bytes.data() + i*vertex_size_in_opengl;
+            static_vertices[i].position = read<glm::vec4>(vertex);
+            static_vertices[i].normal = read<glm::vec4>(vertex+16);
+            static_vertices[i].tangent = read<glm::vec4>(vertex+32);
+            static_vertices[i].tex_coords = read<glm::vec2>(vertex+48);
+        }
+
+        const std::vector<unsigned char>& record_bytes = scene->get_static_triangle_records();
+        static_triangle_records.resize(record_bytes.size() / triangle_record_size_in_opengl);
+        for (size_t i=0; i<static_triangle_records.size(); i++) {
+            const unsigned char* record = record_bytes.data() + i*triangle_record_size_in_opengl;
+            static_triangle_records[i].positions[0] = read<glm::vec3>(record);
+            static_triangle_records[i].first_index = read<uint32_t>(record+12);
+            static_triangle_records[i].positions[1] = read<glm::vec3>(record+16);
+            static_triangle_records[i].mesh_index = read<uint32_t>(record+28);
+            static_triangle_records[i].positions[2] = read<glm::vec3>(record+32);
+        }
+
+        nr_static_indices = scene->get_static_indices().size();
+        nr_static_meshes = scene->get_static_meshes().size() / mesh_size_in_opengl;
+    }
+
+    Scene* CPURenderer::get_scene() {
+        return scene;
+    }
+
+    void CPURenderer::traverse_node_tree(Node* node, glm::mat4 transformation) {
+        // Same as Renderer::traverse_node_tree with DynamicGeometry::INSTANCED
+        transformation *= node->get_transformation();
+
+        if (node->get_node_type() == Node::NodeType::LIGHT) {
+            size_t light_offset = lights.size();
+            lights.resize(light_offset + light_size_in_opengl);
+            AbstractLight* light = reinterpret_cast<AbstractLight*>(node);
+            light->as_byte_array(lights.data()+light_offset, transformation);
+            if (light->get_light_type() == AbstractLight::LightType::POINTLIGHT)
+                light_weights.push_back(LightSampler::luminance(light->get_radiance()));
+            else
+                light_weights.push_back(0.0f);
+            float cutoff_radius = 0.0f;
+            if (light->get_light_type() == AbstractLight::LightType::POINTLIGHT)
+                cutoff_radius = static_cast<PointLight*>(light)->get_cutoff_radius();
+            light_spheres.push_back(glm::vec4(glm::vec3(transformation[3]), cutoff_radius));
+
+            if (light->get_visibility() == AbstractLight::Visibility::SPHERE) {
+                glm::vec3 position = glm::vec3(transformation[3]);
+                light_sphere_bounds.push_back(AABB(position - light_sphere_radius, position + light_sphere_radius));
+                light_sphere_indices.push_back(light_offset / light_size_in_opengl);
+            }
+        }
+
+        MaterialManager& material_manager = scene->get_material_manager();
+        const std::vector<std::shared_ptr<Mesh>>& node_meshes = node->get_child_meshes();
+        MeshIndex mesh_offset = meshes.size();
+        meshes.resize(meshes.size() + node_meshes.size()*mesh_size_in_opengl);
+        for (auto m : node_meshes) {
+            Index vertex_offset = dynamic_vertices.size();
+            Index index_offset = dynamic_indices.size() + nr_static_indices;
+            MaterialIndex material_index = material_manager.get_material_index(m->get_material().get());
+
+            const std::vector<Vertex>& mesh_vertices = m->get_vertices();
+            dynamic_vertices.insert(std::end(dynamic_vertices), std::begin(mesh_vertices), std::end(mesh_vertices));
+
+            // The triangles are stored in the order of the BVH's leaves
+            const std::vector<Index>& mesh_indices = m->get_indices();
+            const BVH& mesh_bvh = m->get_bvh();
+            for (uint32_t triangle : mesh_bvh.get_primitive_indices()) {
+                auto triangle_indices = std::begin(mesh_indices) + 3*triangle;
+                dynamic_indices.insert(std::end(dynamic_indices), triangle_indices, triangle_indices+3);
+            }
+
+            if (!mesh_bvh.is_empty()) {
+                mesh_bvhs.push_back(&mesh_bvh);
+                instance_bounds.push_back(mesh_bvh.get_bounds().transformed(transformation));
+                instance_meshes.push_back(mesh_offset / mesh_size_in_opengl);
+            } else {
+                mesh_bvhs.push_back(nullptr);
+            }
+            dynamic_meshes.push_back(m);
+
+            // The BVH is looked up through mesh_bvhs instead of an offset
+            m->as_byte_array(meshes.data()+mesh_offset, transformation, vertex_offset, index_offset, material_index, -1);
+            mesh_offset += mesh_size_in_opengl;
+        }
+
+        const std::vector<std::shared_ptr<Node>>& node_child_nodes = node->get_child_nodes();
+        for (auto n : node_child_nodes) {
+            traverse_node_tree(n.get(), transformation);
+        }
+    }
+
+    bool CPURenderer::ray_triangle_int(const glm::vec3& ray_origin, const glm::vec3& ray_dir, const glm::vec3& tri0, const glm::vec3& tri1, const glm::vec3& tri2, float near_plane, float& depth, glm::vec3& bc) const {
+        if (triangle_intersection == Renderer::TriangleIntersection::WATERTIGHT)
+            return ray_triangle_int_watertight(ray_origin, ray_dir, tri0, tri1, tri2, near_plane, depth, bc);
+        return ray_triangle_int_legacy(ray_origin, ray_dir, tri0, tri1, tri2, near_plane, depth, bc);
+    }
+
+    bool CPURenderer::static_triangle_int(const glm::vec3& ray_origin, const glm::vec3& ray_dir, uint32_t ti, float near_plane, float& depth, uint32_t& first_index, uint32_t& mesh_index, glm::vec3& bc) const {
+        const TriangleRecord& tri = static_triangle_records[ti];
+        first_index = tri.first_index;
+        mesh_index = tri.mesh_index;
+        if (triangle_intersection == Renderer::TriangleIntersection::WATERTIGHT)
+            return ray_triangle_int_watertight(ray_origin, ray_dir, tri.positions[0], tri.positions[1], tri.positions[2], near_plane, depth, bc);
+        glm::vec3 p0 = glm::vec3(get_vertex(tri.first_index+0, tri.mesh_index).position);
+        glm::vec3 p1 = glm::vec3(get_vertex(tri.first_index+1, tri.mesh_index).position);
+        glm::vec3 p2 = glm::vec3(get_vertex(tri.first_index+2, tri.mesh_index).position);
+        return ray_triangle_int_legacy(ray_origin, ray_dir, p0, p1, p2, near_plane, depth, bc);
+    }
+
+    const Vertex& CPURenderer::get_vertex(uint32_t i, uint32_t mi) const {
+        // Static meshes only; the dynamic ones are never transformed
+        return static_vertices[scene->get_static_indices()[i] + mesh_data[mi].vertex_offset];
+    }
+
+    const Vertex& CPURenderer::get_dynamic_vertex(uint32_t i, uint32_t mi) const {
+        return dynamic_vertices[dynamic_indices[i-nr_static_indices] + mesh_data[mi].vertex_offset];
+    }
+
+    bool CPURenderer::ray_instance_int(const glm::vec3& ray_origin, const glm::vec3& ray_dir, uint32_t mi, float near_plane, float& depth, uint32_t& hit_index, glm::vec3& hit_bc) const {
+        const glm::mat4& inverse_transformation = mesh_data[mi].inverse_transformation;
+        glm::vec3 origin = glm::vec3(inverse_transformation * glm::vec4(ray_origin, 1.0f));
+        glm::vec3 dir = glm::mat3(inverse_transformation) * ray_dir;
+        uint32_t index_offset = mesh_data[mi].index_offset;
+
+        bool hit = false;
+        depth = mesh_bvhs[mi]->traverse(origin, dir, near_plane, depth, [&](uint32_t first, uint32_t count, float far_plane) {
+            for (uint32_t i=index_offset+3*first; i<index_offset+3*(first+count); i+=3) {
+                glm::vec3 p0 = glm::vec3(get_dynamic_vertex(i+0, mi).position);
+                glm::vec3 p1 = glm::vec3(get_dynamic_vertex(i+1, mi).position);
+                glm::vec3 p2 = glm::vec3(get_dynamic_vertex(i+2, mi).position);
+                glm::vec3 bc;
+                if (ray_triangle_int(origin, dir, p0, p1, p2, near_plane, far_plane, bc)) {
+                    hit = true;
+                    hit_index = i;
+                    hit_bc = bc;
+                }
+            }
+            return far_plane;
+        });
+        return hit;
+    }
+
+    Vertex CPURenderer::cast_ray(const glm::vec3& ray_origin, const glm::vec3& ray_dir, float near_plane, float far_plane, int32_t& mesh_index) const {
+        mesh_index = -1;
+        uint32_t hit_index = 0;
+        glm::vec3 hit_bc = glm::vec3(0.0f);
+
+        float depth = scene->get_static_bvh().traverse(ray_origin, ray_dir, near_plane, far_plane, [&](uint32_t first, uint32_t count, float far_plane) {
+            for (uint32_t ti=first; ti<first+count; ti++) {
+                uint32_t first_index, tri_mesh_index;
+                glm::vec3 bc;
+                if (static_triangle_int(ray_origin, ray_dir, ti, near_plane, far_plane, first_index, tri_mesh_index, bc)) {
+                    mesh_index = int32_t(tri_mesh_index);
+                    hit_index = first_index;
+                    hit_bc = bc;
+                }
+            }
+            return far_plane;
+        });
+
+        const std::vector<uint32_t>& instance_order = tlas.get_primitive_indices();
+        depth = tlas.traverse(ray_origin, ray_dir, near_plane, depth, [&](uint32_t first, uint32_t count, float far_plane) {
+            for (uint32_t i=first; i<first+count; i++) {
+                MeshIndex mi = instance_meshes[instance_order[i]];
+                if (ray_instance_int(ray_origin, ray_dir, mi, near_plane, far_plane, hit_index, hit_bc))
+                    mesh_index = int32_t(mi);
+            }
+            return far_plane;
+        });
+
+        return get_hit_vertex(ray_origin, ray_dir, depth, mesh_index, hit_index, hit_bc);
+    }
+
+    Vertex CPURenderer::get_hit_vertex(const glm::vec3& ray_origin, const glm::vec3& ray_dir, float depth, int32_t mesh_index, uint32_t hit_index, const glm::vec3& hit_bc) const {
+        Vertex vert(glm::vec4(0.0f,0.0f,0.0f,-1.0f));
+        // Only interpolate the attributes of the nearest triangle
+        if (mesh_index != -1) {
+            vert.position = glm::vec4(ray_origin + depth*ray_dir, 1.0f);
+
+            if (uint32_t(mesh_index) >= nr_static_meshes) {
+                // The vertices are still in object space
+                const Vertex& v0 = get_dynamic_vertex(hit_index+0, mesh_index);
+                const Vertex& v1 = get_dynamic_vertex(hit_index+1, mesh_index);
+                const Vertex& v2 = get_dynamic_vertex(hit_index+2, mesh_index);
+
+                glm::mat3 ti_model = glm::transpose(glm::mat3(mesh_data[mesh_index].inverse_transformation));
+                glm::vec3 normal = hit_bc.x*glm::vec3(v0.normal) + hit_bc.y*glm::vec3(v1.normal) + hit_bc.z*glm::vec3(v2.normal);
+                glm::vec4 tangent = hit_bc.x*v0.tangent + hit_bc.y*v1.tangent + hit_bc.z*v2.tangent;
+                vert.normal = glm::vec4(ti_model * normal, 0.0f);
+                vert.tangent = glm::vec4(ti_model * glm::vec3(tangent), tangent.w);
+                vert.tex_coords = hit_bc.x*v0.tex_coords + hit_bc.y*v1.tex_coords + hit_bc.z*v2.tex_coords;
+            } else {
+                // Static meshes have identity transformations
+                const Vertex& v0 = get_vertex(hit_index+0, mesh_index);
+                const Vertex& v1 = get_vertex(hit_index+1, mesh_index);
+                const Vertex& v2 = get_vertex(hit_index+2, mesh_index);
+
+                vert.normal = hit_bc.x*glm::vec4(glm::vec3(v0.normal), 0.0f) + hit_bc.y*glm::vec4(glm::vec3(v1.normal), 0.0f) + hit_bc.z*glm::vec4(glm::vec3(v2.normal), 0.0f);
+                vert.tangent = hit_bc.x*v0.tangent + hit_bc.y*v1.tangent + hit_bc.z*v2.tangent;
+                vert.tex_coords = hit_bc.x*v0.tex_coords + hit_bc.y*v1.tex_coords + hit_bc.z*v2.tex_coords;
+            }
+        }
+        vert.normal = glm::vec4(glm::normalize(glm::vec3(vert.normal)), 0.0f);
+        return vert;
+    }
+
+    bool CPURenderer::instance_occludes(const glm::vec3& ray_origin, const glm::vec3& ray_dir, uint32_t mi, float near_plane, float far_plane) const {
+        const glm::mat4& inverse_transformation = mesh_data[mi].inverse_transformation;
+        glm::vec3 origin = glm::vec3(inverse_transformation * glm::vec4(ray_origin, 1.0f));
+        glm::vec3 dir = glm::mat3(inverse_transformation) * ray_dir;
+        uint32_t index_offset = mesh_data[mi].index_offset;
+
+        return mesh_bvhs[mi]->occluded(origin, dir, near_plane, far_plane, [&](uint32_t first, uint32_t count) {
+            for (uint32_t i=index_offset+3*first; i<index_offset+3*(first+count); i+=3) {
+                glm::vec3 p0 = glm::vec3(get_dynamic_vertex(i+0, mi).position);
+                glm::vec3 p1 = glm::vec3(get_dynamic_vertex(i+1, mi).position);
+                glm::vec3 p2 = glm::vec3(get_dynamic_vertex(i+2, mi).position);
+                float depth = far_plane;
+                glm::vec3 bc;
+                if (ray_triangle_int(origin, dir, p0, p1, p2, near_plane, depth, bc)) return true;
+            }
+            return false;
+        });
+    }
+
+    bool CPURenderer::occluded(const glm::vec3& ray_origin, const glm::vec3& ray_dir, float near_plane, float far_plane) const {
+        bool static_occluded = scene->get_static_bvh().occluded(ray_origin, ray_dir, near_plane, far_plane, [&](uint32_t first, uint32_t count) {
+            for (uint32_t ti=first; ti<first+count; ti++) {
+                float depth = far_plane;
+                uint32_t first_index, mesh_index;
+                glm::vec3 bc;
+                if (static_triangle_int(ray_origin, ray_dir, ti, near_plane, depth, first_index, mesh_index, bc)) return true;
+            }
+            return false;
+        });
+        if (static_occluded) return true;
+
+        const std::vector<uint32_t>& instance_order = tlas.get_primitive_indices();
+        return tlas.occluded(ray_origin, ray_dir, near_plane, far_plane, [&](uint32_t first, uint32_t count) {
+            for (uint32_t i=first; i<first+count; i++) {
+                if (instance_occludes(ray_origin, ray_dir, instance_meshes[instance_order[i]], near_plane, far_plane)) return true;
+            }
+            return false;
+        });
+    }
+
+    template <int Size>
+    void CPURenderer::cast_ray_packet(RayPacket<Size>& packet, Vertex verts[Size], int32_t mesh_indices[Size]) const {
+        uint32_t hit_index[Size] = {};
+        glm::vec3 hit_bc[Size];
+        glm::vec3 bc[Size];
+        for (int lane=0; lane<Size; lane++) mesh_indices[lane] = -1;
+
+        // Every lane keeps the hit the scalar traversal would pick since the triangles are tested
+        // the same way and far planes are only moved by nearer (or equally near later) hits
+        auto record_hits = [&](uint32_t hits, int32_t mesh_index, uint32_t index) {
+            for (int lane=0; lane<Size; lane++) {
+                if (!(hits & (1u << lane))) continue;
+                mesh_indices[lane] = mesh_index;
+                hit_index[lane] = index;
+                hit_bc[lane] = bc[lane];
+            }
+        };
+
+        packet.traverse(scene->get_static_bvh(), packet.get_active_lanes(), [&](uint32_t first, uint32_t count, uint32_t lanes) {
+            for (uint32_t ti=first; ti<first+count; ti++) {
+                const TriangleRecord& tri = static_triangle_records[ti];
+                uint32_t hits = 0;
+                if (triangle_intersection == Renderer::TriangleIntersection::WATERTIGHT) {
+                    hits = packet.intersect_triangle(tri.positions[0], tri.positions[1], tri.positions[2], lanes, bc);
+                } else {
+                    for (int lane=0; lane<Size; lane++) {
+                        if (!(lanes & (1u << lane))) continue;
+                        float depth = packet.get_far_plane(lane);
+                        uint32_t first_index, mesh_index;
+                        if (static_triangle_int(packet.get_origin(lane), packet.get_direction(lane), ti, packet.get_near_plane(lane), depth, first_index, mesh_index, bc[lane])) {
+                            packet.set_far_plane(lane, depth);
+                            hits |= 1u << lane;
+                        }
+                    }
+                }
+                record_hits(hits, int32_t(tri.mesh_index), tri.first_index);
+            }
+        });
+
+        const std::vector<uint32_t>& instance_order = tlas.get_primitive_indices();
+        packet.traverse(tlas, packet.get_active_lanes(), [&](uint32_t first, uint32_t count, uint32_t lanes) {
+            for (uint32_t i=first; i<first+count; i++) {
+                MeshIndex mi = instance_meshes[instance_order[i]];
+                RayPacket<Size> instance_packet = packet.transformed(mesh_data[mi].inverse_transformation, lanes);
+                uint32_t index_offset = mesh_data[mi].index_offset;
+
+                instance_packet.traverse(*mesh_bvhs[mi], lanes, [&](uint32_t first, uint32_t count, uint32_t instance_lanes) {
+                    for (uint32_t i=index_offset+3*first; i<index_offset+3*(first+count); i+=3) {
+                        glm::vec3 p0 = glm::vec3(get_dynamic_vertex(i+0, mi).position);
+                        glm::vec3 p1 = glm::vec3(get_dynamic_vertex(i+1, mi).position);
+                        glm::vec3 p2 = glm::vec3(get_dynamic_vertex(i+2, mi).position);
+                        uint32_t hits = 0;
+                        if (triangle_intersection == Renderer::TriangleIntersection::WATERTIGHT) {
+                            hits = instance_packet.intersect_triangle(p0, p1, p2, instance_lanes, bc);
+                        } else {
+                            for (int lane=0; lane<Size; lane++) {
+                                if (!(instance_lanes & (1u << lane))) continue;
+                                float depth = instance_packet.get_far_plane(lane);
+                                if (ray_triangle_int(instance_packet.get_origin(lane), instance_packet.get_direction(lane), p0, p1, p2, instance_packet.get_near_plane(lane), depth, bc[lane])) {
+                                    instance_packet.set_far_plane(lane, depth);
+                                    hits |= 1u << lane;
+                                }
+                            }
+                        }
+                        record_hits(hits, int32_t(mi), i);
+                    }
+                });
+
+                for (int lane=0; lane<Size; lane++) {
+                    if (lanes & (1u << lane)) packet.set_far_plane(lane, instance_packet.get_far_plane(lane));
+                }
+            }
+        });
+
+        for (int lane=0; lane<Size; lane++) {
+            if (packet.get_active_lanes() & (1u << lane))
+                verts[lane] = get_hit_vertex(packet.get_origin(lane), packet.get_direction(lane), packet.get_far_plane(lane), mesh_indices[lane], hit_index[lane], hit_bc[lane]);
+        }
+    }
+
+    template <int Size>
+    uint32_t CPURenderer::occluded_packet(const RayPacket<Size>& packet) const {
+        uint32_t occluded_lanes = packet.occluded(scene->get_static_bvh(), packet.get_active_lanes(), [&](uint32_t first, uint32_t count, uint32_t lanes) {
+            uint32_t hits = 0;
+            for (uint32_t ti=first; ti<first+count && hits!=lanes; ti++) {
+                const TriangleRecord& tri = static_triangle_records[ti];
+                if (triangle_intersection == Renderer::TriangleIntersection::WATERTIGHT) {
+                    hits |= packet.occludes_triangle(tri.positions[0], tri.positions[1], tri.positions[2], lanes & ~hits);
+                    continue;
+                }
+                for (int lane=0; lane<Size; lane++) {
+                    if (!((lanes & ~hits) & (1u << lane))) continue;
+                    float depth = packet.get_far_plane(lane);
+                    uint32_t first_index, mesh_index;
+                    glm::vec3 bc;
+                    if (static_triangle_int(packet.get_origin(lane), packet.get_direction(lane), ti, packet.get_near_plane(lane), depth, first_index, mesh_index, bc))
+                        hits |= 1u << lane;
+                }
+            }
+            return hits;
+        });
+
+        const std::vector<uint32_t>& instance_order = tlas.get_primitive_indices();
+        occluded_lanes |= packet.occluded(tlas, packet.get_active_lanes() & ~occluded_lanes, [&](uint32_t first, uint32_t count, uint32_t lanes) {
+            uint32_t hits = 0;
+            for (uint32_t i=first; i<first+count && hits!=lanes; i++) {
+                MeshIndex mi = instance_meshes[instance_order[i]];
+                RayPacket<Size> instance_packet = packet.transformed(mesh_data[mi].inverse_transformation, lanes & ~hits);
+                uint32_t index_offset = mesh_data[mi].index_offset;
+
+                hits |= instance_packet.occluded(*mesh_bvhs[mi], instance_packet.get_active_lanes(), [&](uint32_t first, uint32_t count, uint32_t instance_lanes) {
+                    uint32_t instance_hits = 0;
+                    for (uint32_t i=index_offset+3*first; i<index_offset+3*(first+count) && instance_hits!=instance_lanes; i+=3) {
+                        glm::vec3 p0 = glm::vec3(get_dynamic_vertex(i+0, mi).position);
+                        glm::vec3 p1 = glm::vec3(get_dynamic_vertex(i+1, mi).position);
+                        glm::vec3 p2 = glm::vec3(get_dynamic_vertex(i+2, mi).position);
+                        if (triangle_intersection == Renderer::TriangleIntersection::WATERTIGHT) {
+                            instance_hits |= instance_packet.occludes_triangle(p0, p1, p2, instance_lanes & ~instance_hits);
+                            continue;
+                        }
+                        for (int lane=0; lane<Size; lane++) {
+                            if (!((instance_lanes & ~instance_hits) & (1u << lane))) continue;
+                            float depth = instance_packet.get_far_plane(lane);
+                            glm::vec3 bc;
+                            if (ray_triangle_int(instance_packet.get_origin(lane), instance_packet.get_direction(lane), p0, p1, p2, instance_packet.get_near_plane(lane), depth, bc))
+                                instance_hits |= 1u << lane;
+                        }
+                    }
+                    return instance_hits;
+                });
+            }
+            return hits;
+        });
+        return occluded_lanes;
+    }
+
+    int32_t CPURenderer::cast_ray_for_lights(const glm::vec3& ray_origin, const glm::vec3& ray_dir, float near_plane, float far_plane, float& depth) const {
+        int32_t closest_light_index = -1;
+        const std::vector<uint32_t>& light_order = light_bvh.get_primitive_indices();
+        depth = light_bvh.traverse(ray_origin, ray_dir, near_plane, far_plane, [&](uint32_t first, uint32_t count, float closest_depth) {
+            for (uint32_t i=first; i<first+count; i++) {
+                uint32_t light_index = light_sphere_indices[light_order[i]];
+                bool intersected;
+                float current_depth = ray_sphere_int(ray_origin, ray_dir, unpacked_lights[light_index].position, light_sphere_radius, intersected);
+                if (intersected && current_depth > near_plane && current_depth < closest_depth) {
+                    closest_depth = current_depth;
+                    closest_light_index = int32_t(light_index);
+                }
+            }
+            return closest_depth;
+        });
+        return closest_light_index;
+    }
+
+    glm::vec4 CPURenderer::sample_texture(int32_t texture_index, const glm::vec2& tex_coords) const {
+        const unsigned char* image = material_textures->data() + size_t(texture_index)*texture_width*texture_height*4;
+        auto texel = [&](int x, int y) {
+            const unsigned char* pixel = image + (size_t(y)*texture_width + x)*4;
+            return glm::vec4(pixel[0], pixel[1], pixel[2], pixel[3]) / 255.0f;
+        };
+
+        // Texel centers are at half integer coordinates
+        glm::vec2 size = glm::vec2(texture_width, texture_height);
+        glm::vec2 coords = glm::clamp(tex_coords*size - 0.5f, glm::vec2(-1.0f), size);
+        glm::vec2 lower = glm::floor(coords);
+        glm::vec2 weight = coords - lower;
+        int x0 = glm::clamp(int(lower.x), 0, int(texture_width)-1);
+        int x1 = glm::clamp(int(lower.x)+1, 0, int(texture_width)-1);
+        int y0 = glm::clamp(int(lower.y), 0, int(texture_height)-1);
+        int y1 = glm::clamp(int(lower.y)+1, 0, int(texture_height)-1);
+        return glm::mix(
+            glm::mix(texel(x0, y0), texel(x1, y0), weight.x),
+            glm::mix(texel(x0, y1), texel(x1, y1), weight.x),
+            weight.y
+        );
+    }
+
+    CPURenderer::MaterialData CPURenderer::get_material_data(const MaterialData& material, const glm::vec2& tex_coords) const {
+        MaterialData material_data = material;
+        if (material.albedo_ti != -1) {
+            material_data.albedo *= glm::pow(sample_texture(material.albedo_ti, tex_coords), glm::vec4(2.2f));
+        }
+        if (material.F0_ti != -1) {
+            material_data.F0 *= sample_texture(material.F0_ti, tex_coords);
+        }
+        if (material.roughness_ti != -1) {
+            material_data.roughness *= sample_texture(material.roughness_ti, tex_coords).x;
+        }
+        if (material.metalness_ti != -1) {
+            material_data.metalness *= sample_texture(material.metalness_ti, tex_coords).x;
+        }
+        if (material.AO_ti != -1) {
+            material_data.AO *= sample_texture(material.AO_ti, tex_coords).x;
+        }
+        return material_data;
+    }
+
+    CPURenderer::LightData CPURenderer::get_light_data(const Light& light, const glm::vec3& at) const {
+        LightData light_data = {
+            glm::vec3(1.0f), -1.0f, glm::vec3(1.0f,0.0f,1.0f), 1.0f
+        };
+
+        if (light.type == 0) {
+            light_data.direction = glm::normalize(light.direction);
+            light_data.light_distance = -1.0f;
+            light_data.radiance = light.radiance;
+            light_data.ambient_multiplier = light.ambient_multiplier;
+        } else if (light.type == 1) {
+            light_data.direction = glm::normalize(at - light.position);
+            light_data.light_distance = glm::distance(light.position, at);
+            float falloff = 1.0f / (1.0f + light_data.light_distance*light_data.light_distance);
+            if (light.cutoff_radius > 0.0f) {
+                float ratio = light_data.light_distance / light.cutoff_radius;
+                float window = glm::clamp(1.0f - ratio*ratio*ratio*ratio, 0.0f, 1.0f);
+                falloff *= window*window;
+            }
+            light_data.radiance = light.radiance * falloff;
+            light_data.ambient_multiplier = light.ambient_multiplier * falloff;
+        }
+
+        return light_data;
+    }
+
+    glm::vec3 CPURenderer::cook_torrance_BRDF(const glm::vec3& view, const glm::vec3& normal, const glm::vec3& light, const MaterialData& material) const {
+        glm::vec3 albedo = glm::vec3(material.albedo);
+        glm::vec3 lambertian_diffuse = albedo / PI;
+
+        float alpha = material.roughness * material.roughness;
+        glm::vec3 F0 = glm::mix(glm::vec3(material.F0), albedo, material.metalness);
+        glm::vec3 halfway = glm::normalize(view + light);
+
+        float NDF = NDF_trowbridge_reitz_GGX(normal, halfway, alpha);
+        float GF = GF_smith(view, normal, light, material.roughness);
+        glm::vec3 F = F_schlick(light, halfway, F0);
+
+        glm::vec3 kD = (1.0f - F_schlick(normal, light, F0))*(1.0f - F_schlick(normal, view, F0));
+        kD *= (1.0f - material.metalness);
+
+        glm::vec3 numer = NDF * GF * F;
+        float denom = 4.0f * std::max(glm::dot(normal, view), 0.0f) * std::max(glm::dot(normal, light), 0.0f);
+
+        return kD*lambertian_diffuse + numer/std::max(denom, 0.001f);
+    }
+
+    glm::vec3 CPURenderer::calculate_light(const glm::vec3& position, const glm::vec3& normal, const glm::vec3& ray_dir, const MaterialData& material, const Light& light, const SunShadows* sun_shadows) const {
+        LightData light_data = get_light_data(light, position);
+        float light_distance = light_data.light_distance;
+        if (light_distance < -EPSILON) light_distance = FAR_PLANE;
+        glm::vec3 ambient = glm::vec3(material.albedo) * material.AO * light_data.radiance * light_data.ambient_multiplier;
+        bool is_occluded;
+        if (sun_shadows && light.shadow_slot != -1 && (sun_shadows->known & (1u << light.shadow_slot)))
+            is_occluded = sun_shadows->occluded & (1u << light.shadow_slot);
+        else
+            is_occluded = occluded(position, -light_data.direction, BIAS, light_distance);
+        if (is_occluded) {
+            return ambient;
+        }
+        glm::vec3 color = cook_torrance_BRDF(-ray_dir, normal, -light_data.direction, material);
+        color *= light_data.radiance * std::max(glm::dot(normal, -light_data.direction), 0.0f);
+        return color + ambient;
+    }
+
+    glm::vec3 CPURenderer::sample_lights(const glm::vec3& position, const glm::vec3& normal, const glm::vec3& ray_dir, const MaterialData& material, uint32_t& rng_state) const {
+        glm::vec3 color = glm::vec3(0.0f);
+        for (unsigned int s=0; s<nr_light_samples; s++) {
+            float weight_sum = 0.0f;
+            uint32_t chosen = 0;
+            float chosen_target = 0.0f;
+            for (unsigned int c=0; c<LIGHT_CANDIDATES; c++) {
+                float pmf;
+                uint32_t candidate = light_sampler.sample(random_float(rng_state), pmf);
+                float target = LightSampler::luminance(get_light_data(unpacked_lights[candidate], position).radiance);
+                float weight = target / pmf;
+                weight_sum += weight;
+                if (random_float(rng_state) * weight_sum < weight) {
+                    chosen = candidate;
+                    chosen_target = target;
+                }
+            }
+            if (chosen_target > 0.0f) {
+                float contribution_weight = weight_sum / (float(LIGHT_CANDIDATES) * chosen_target);
+                color += calculate_light(position, normal, ray_dir, material, unpacked_lights[chosen]) * contribution_weight;
+            }
+        }
+        return color / float(nr_light_samples);
+    }
+
+    glm::vec4 CPURenderer::trace(const glm::vec3& ray_origin, glm::vec3 ray_dir, uint32_t& rng_state) const {
+        ray_dir = glm::normalize(ray_dir);
+        int32_t mesh_index;
+        Vertex vert = cast_ray(ray_origin, ray_dir, NEAR_PLANE, FAR_PLANE, mesh_index);
+        return shade(ray_origin, ray_dir, vert, mesh_index, rng_state, nullptr);
+    }
+
+    glm::vec4 CPURenderer::shade(const glm::vec3& ray_origin, const glm::vec3& ray_dir, const Vertex& vert, int32_t mesh_index, uint32_t& rng_state, const SunShadows* sun_shadows) const {
+        float vertex_depth = mesh_index == -1 ? FAR_PLANE : glm::length(glm::vec3(vert.position)-ray_origin);
+        float lights_depth;
+        int32_t light_index = cast_ray_for_lights(ray_origin, ray_dir, NEAR_PLANE, vertex_depth, lights_depth);
+        if (light_index != -1) {
+            return glm::vec4(unpacked_lights[light_index].radiance, 1.0f);
+        }
+
+        if (mesh_index == -1) return glm::vec4(0.0f,0.0f,0.0f,1.0f);
+
+        glm::vec3 normal = glm::normalize(glm::vec3(vert.normal));
+        float normal_sign = glm::sign(glm::dot(normal, -ray_dir));
+        normal *= normal_sign;
+
+        const MaterialData& material = materials[mesh_data[mesh_index].material_index];
+        if (material.normal_ti != -1) {
+            glm::vec3 tex_normal = glm::vec3(sample_texture(material.normal_ti, vert.tex_coords)) * 2.0f - 1.0f;
+            glm::vec3 tang = glm::vec3(vert.tangent);
+            tang -= glm::dot(tang, normal)*normal;
+            tang = glm::normalize(tang);
+            glm::vec3 bitang = glm::normalize(glm::cross(normal, tang)) * vert.tangent.w * normal_sign;
+
+            normal = glm::normalize(glm::mat3(tang, bitang, normal) * tex_normal);
+        }
+
+        MaterialData mat = get_material_data(material, vert.tex_coords);
+        glm::vec3 position = glm::vec3(vert.position);
+        glm::vec3 color = glm::vec3(0.0f);
+        if (use_light_grid) {
+            constexpr uint32_t global_lights = 2*light_grid_resolution*light_grid_resolution*light_grid_resolution;
+            for (uint32_t i=global_lights; i<global_lights+light_grid.get_nr_global_lights(); i++) {
+                color += calculate_light(position, normal, ray_dir, mat, unpacked_lights[light_grid_indices[i]], sun_shadows);
+            }
+            // Points outside of the grid are out of reach of every light with a cutoff radius
+            glm::ivec3 cell = glm::ivec3(glm::floor((position - light_grid.get_min()) / light_grid.get_cell_size()));
+            if (glm::all(glm::greaterThanEqual(cell, glm::ivec3(0))) && glm::all(glm::lessThan(cell, glm::ivec3(light_grid_resolution)))) {
+                uint32_t cell_index = (cell.z*light_grid_resolution + cell.y)*light_grid_resolution + cell.x;
+                uint32_t offset = light_grid_indices[2*cell_index];
+                uint32_t count = light_grid_indices[2*cell_index+1];
+                for (uint32_t i=offset; i<offset+count; i++) {
+                    color += calculate_light(position, normal, ray_dir, mat, unpacked_lights[light_grid_indices[i]]);
+                }
+            }
+        } else if (nr_light_samples == 0) {
+            for (const Light& light : unpacked_lights) {
+                color += calculate_light(position, normal, ray_dir, mat, light, sun_shadows);
+            }
+        } else {
+            for (uint32_t light_index : unsampled_lights) {
+                color += calculate_light(position, normal, ray_dir, mat, unpacked_lights[light_index], sun_shadows);
+            }
+            if (light_sampler.get_nr_sampled_lights() > 0) {
+                color += sample_lights(position, normal, ray_dir, mat, rng_state);
+            }
+        }
+        return glm::vec4(color, 1.0f);
+    }
+
+    void CPURenderer::render_tile(unsigned int tile) {
+        if (simd_level != SIMDLevel::SCALAR) {
+            switch (packet_size) {
+                case 4: render_tile_packets<4>(tile); return;
+                case 8: render_tile_packets<8>(tile); return;
+                case 16: render_tile_packets<16>(tile); return;
+            }
+        }
+
+        unsigned int width = frame_result->get_width();
+        unsigned int height = frame_result->get_height();
+        unsigned int x_begin = (tile % frame_nr_tiles_x) * tile_size;
+        unsigned int y_begin = (tile / frame_nr_tiles_x) * tile_size;
+        unsigned int x_end = std::min(x_begin + tile_size, width);
+        unsigned int y_end = std::min(y_begin + tile_size, height);
+
+        for (unsigned int y=y_begin; y<y_end; y++) {
+            for (unsigned int x=x_begin; x<x_end; x++) {
+                // Same random numbers as the pixel's invocation of raytrace.glsl
+                uint32_t rng_state = pcg_hash(x + pcg_hash(y + pcg_hash(frame_seed)));
+
+                glm::vec2 tex_coords = glm::vec2(x, y) / glm::vec2(width, height);
+                glm::vec3 ray = glm::mix(glm::mix(frame_rays.r00, frame_rays.r10, tex_coords.x), glm::mix(frame_rays.r01, frame_rays.r11, tex_coords.x), tex_coords.y);
+
+                frame_result->set_pixel(x, y, trace(frame_eye, ray, rng_state));
+            }
+        }
+    }
+
+    template <int Size>
+    void CPURenderer::render_tile_packets(unsigned int tile) {
+        constexpr unsigned int packet_width = Size == 4 ? 2 : 4;
+        constexpr unsigned int packet_height = Size / packet_width;
+
+        unsigned int width = frame_result->get_width();
+        unsigned int height = frame_result->get_height();
+        unsigned int x_begin = (tile % frame_nr_tiles_x) * tile_size;
+        unsigned int y_begin = (tile / frame_nr_tiles_x) * tile_size;
+        unsigned int x_end = std::min(x_begin + tile_size, width);
+        unsigned int y_end = std::min(y_begin + tile_size, height);
+
+        for (unsigned int y=y_begin; y<y_end; y+=packet_height) {
+            for (unsigned int x=x_begin; x<x_end; x+=packet_width) {
+                // Lanes of pixels outside of the tile are left inactive
+                RayPacket<Size> packet;
+                packet.set_simd_level(simd_level);
+                uint32_t rng_states[Size];
+                for (int lane=0; lane<Size; lane++) {
+                    unsigned int pixel_x = x + lane % packet_width;
+                    unsigned int pixel_y = y + lane / packet_width;
+                    if (pixel_x >= x_end || pixel_y >= y_end) continue;
+                    rng_states[lane] = pcg_hash(pixel_x + pcg_hash(pixel_y + pcg_hash(frame_seed)));
+
+                    glm::vec2 tex_coords = glm::vec2(pixel_x, pixel_y) / glm::vec2(width, height);
+                    glm::vec3 ray = glm::mix(glm::mix(frame_rays.r00, frame_rays.r10, tex_coords.x), glm::mix(frame_rays.r01, frame_rays.r11, tex_coords.x), tex_coords.y);
+                    packet.set_ray(lane, frame_eye, glm::normalize(ray), NEAR_PLANE, FAR_PLANE);
+                }
+
+                Vertex verts[Size];
+                int32_t mesh_indices[Size];
+                cast_ray_packet(packet, verts, mesh_indices);
+
+                // Every hit is lit by every directional light so their shadow rays are traced up front
+                // with the same origin, direction and planes calculate_light would use
+                SunShadows sun_shadows[Size] = {};
+                for (uint32_t light_index : directional_lights) {
+                    const Light& light = unpacked_lights[light_index];
+                    RayPacket<Size> shadow_packet;
+                    shadow_packet.set_simd_level(simd_level);
+                    for (int lane=0; lane<Size; lane++) {
+                        if (!(packet.get_active_lanes() & (1u << lane)) || mesh_indices[lane] == -1) continue;
+                        glm::vec3 position = glm::vec3(verts[lane].position);
+                        shadow_packet.set_ray(lane, position, -get_light_data(light, position).direction, BIAS, FAR_PLANE);
+                    }
+                    uint32_t occluded_lanes = occluded_packet(shadow_packet);
+                    for (int lane=0; lane<Size; lane++) {
+                        if (!(shadow_packet.get_active_lanes() & (1u << lane))) continue;
+                        sun_shadows[lane].known |= 1u << light.shadow_slot;
+                        if (occluded_lanes & (1u << lane)) sun_shadows[lane].occluded |= 1u << light.shadow_slot;
+                    }
+                }
+
+                for (int lane=0; lane<Size; lane++) {
+                    if (!(packet.get_active_lanes() & (1u << lane))) continue;
+                    glm::vec4 color = shade(frame_eye, packet.get_direction(lane), verts[lane], mesh_indices[lane], rng_states[lane], &sun_shadows[lane]);
+                    frame_result->set_pixel(x + lane % packet_width, y + lane / packet_width, color);
+                }
+            }
+        }
+    }
+
+    void CPURenderer::render_tiles(unsigned int thread) {
+        unsigned int width = frame_result->get_width();
+        unsigned int height = frame_result->get_height();
+        unsigned int tile;
+        bool stolen;
+        while (tile_scheduler.next_tile(thread, tile, stolen)) {
+            QElapsedTimer timer;
+            timer.start();
+            render_tile(tile);
+
+            TileStatistics& statistics = tile_statistics[tile];
+            statistics.x = (tile % frame_nr_tiles_x) * tile_size;
+            statistics.y = (tile / frame_nr_tiles_x) * tile_size;
+            statistics.width = std::min(statistics.x + tile_size, width) - statistics.x;
+            statistics.height = std::min(statistics.y + tile_size, height) - statistics.y;
+            statistics.render_time = timer.nsecsElapsed() / 1e6;
+            statistics.thread = thread;
+            statistics.stolen = stolen;
+        }
+    }
+
+    void CPURenderer::worker_loop(uint64_t generation, unsigned int thread) {
+        std::unique_lock<std::mutex> lock(worker_mutex);
+        while (true) {
+            work_available.wait(lock, [&]() { return stop_workers || work_generation != generation; });
+            if (stop_workers) return;
+            generation = work_generation;
+
+            lock.unlock();
+            render_tiles(thread);
+            lock.lock();
+
+            if (--nr_busy_workers == 0) work_done.notify_one();
+        }
+    }
+
+    void CPURenderer::start_workers() {
+        unsigned int nr_workers = nr_threads > 0 ? nr_threads : std::max(std::thread::hardware_concurrency(), 1u);
+        stop_workers = false;
+        // The workers are started between frames so they can't miss the next one
+        for (unsigned int i=1; i<nr_workers; i++) {
+            workers.emplace_back(&CPURenderer::worker_loop, this, work_generation, i);
+        }
+    }
+
+    void CPURenderer::join_workers() {
+        {
+            std::lock_guard<std::mutex> lock(worker_mutex);
+            stop_workers = true;
+        }
+        work_available.notify_all();
+        for (std::thread& worker : workers) worker.join();
+        workers.clear();
+    }
+
+}
@@ -0,0 +1,315 @@
+#ifndef RT_CPU_RENDERER_HPP
+#define RT_CPU_RENDERER_HPP
+
+#include <QObject>
+#include <QString>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "RaytracerGlobals.hpp"
+
+#include "rendering/AbstractCamera.hpp"
+#include "rendering/FloatImage.hpp"
+#include "rendering/Renderer.hpp"
+#include "rendering/TileScheduler.hpp"
+#include "materials/Material.hpp"
+#include "materials/MaterialManager.hpp"
+#include "scene/Vertex.hpp"
+#include "scene/Node.hpp"
+#include "scene/Mesh.hpp"
+#include "scene/Scene.hpp"
+#include "acceleration/BVH.hpp"
+#include "acceleration/RayPacket.hpp"
+#include "scene/lights/LightSampler.hpp"
+#include "scene/lights/LightGrid.hpp"
+
+namespace Rt {
+
+    struct RAYTRACER_LIB_EXPORT TileStatistics {
+        // Pixels covered by the tile
+        unsigned int x;
+        unsigned int y;
+        unsigned int width;
+        unsigned int height;
+        // Wall clock time spent rendering the tile in milliseconds
+        double render_time;
+        // Thread which rendered the tile (0 is the one calling render())
+        unsigned int thread;
+        // True if the thread stole the tile from another thread's deque
+        bool stolen;
+    };
+
+    // Renders the same image as Renderer without OpenGL by running raytrace.glsl on the CPU
+    // The scene is read through the same byte arrays that Renderer uploads and the image is
+    // split into square tiles which are rendered by a pool of threads
+    // Dynamic meshes are always intersected like Renderer::DynamicGeometry::INSTANCED and the
+    // static geometry through the Scene's full BVH; the other modes render the same image
+    class RAYTRACER_LIB_EXPORT CPURenderer : public QObject {
+        Q_OBJECT;
+
+    public:
+        CPURenderer(QObject* parent=nullptr);
+        ~CPURenderer();
+
+        // Number of threads rendering tiles, including the one calling render()
+        // 0 (default) uses every hardware thread
+        void set_nr_threads(unsigned int new_nr_threads);
+        unsigned int get_nr_threads() const;
+
+        // Width and height of the tiles in pixels (default 16)
+        void set_tile_size(unsigned int new_tile_size);
+        unsigned int get_tile_size() const;
+
+        // Order in which the tiles are dealt out to the threads' deques
+        // Every thread starts on a contiguous run of them so orders keeping consecutive tiles close
+        // together keep each thread's rays (and the BVH nodes and textures they touch) close together
+        enum TileOrder : int32_t {
+            // Row by row
+            SCANLINE = 0,
+            // Along a Z-order curve so every run of tiles covers a compact block of the image
+            MORTON = 1,
+            // Outwards from the center so the middle of the image (usually the subject) is rendered first
+            SPIRAL = 2
+        };
+        Q_ENUM(TileOrder);
+        // MORTON by default
+        void set_tile_order(TileOrder new_tile_order);
+        TileOrder get_tile_order() const;
+
+        // Threads which run out of tiles steal from the others (default)
+        // Without it every thread renders an equal, fixed share of the tiles
+        void set_work_stealing(bool new_work_stealing);
+        bool get_work_stealing() const;
+
+        // Statistics of every tile of the last render() in scanline order
+        const std::vector<TileStatistics>& get_tile_statistics() const;
+        // Number of times a thread ran out of tiles and stole from another during the last render()
+        unsigned int get_nr_steals() const;
+        // Writes get_tile_statistics() as CSV (one line per tile); returns false if the file can't be written
+        bool save_tile_statistics(const QString& path) const;
+
+        // Number of rays traced through the BVHs together
+        // 1 traces every ray on its own; 4, 8 and 16 (default) trace the primary rays of 2x2, 4x2 and 4x4
+        // pixels and their shadow rays towards the directional lights as RayPackets
+        // Other sizes are rounded down to one of these
+        void set_packet_size(unsigned int new_packet_size);
+        unsigned int get_packet_size() const;
+
+        // Instruction set of the RayPackets; defaults to get_simd_level()
+        // Levels the CPU doesn't support fall back to the best one it does and without SSE/AVX2
+        // every ray is traced on its own since packets are only faster with them
+        void set_simd_level(SIMDLevel new_simd_level);
+        SIMDLevel get_simd_level() const;
+
+        // These behave like their counterparts in Renderer
+        void set_triangle_intersection(Renderer::TriangleIntersection new_triangle_intersection);
+        Renderer::TriangleIntersection get_triangle_intersection() const;
+        void set_light_samples(unsigned int new_light_samples);
+        unsigned int get_light_samples() const;
+        void set_light_culling(bool new_light_culling);
+        bool get_light_culling() const;
+
+        bool update();
+
+        // Returns true for a successful render
+        // and false for an unsuccessful render (render_result will be unchanged)
+        // render_result is resized to width x height if it has a different size
+        bool render(FloatImage* render_result, unsigned int width, unsigned int height);
+
+        void set_camera(AbstractCamera* new_camera);
+        AbstractCamera* get_camera();
+
+        void set_scene(Scene* new_scene);
+        Scene* get_scene();
+
+    private:
+        AbstractCamera* camera;
+
+        Scene* scene;
+
+        unsigned int prev_width;
+        unsigned int prev_height;
+
+        Renderer::TriangleIntersection triangle_intersection;
+        unsigned int packet_size;
+        SIMDLevel simd_level;
+
+        // Unpacked copies of the byte arrays raytrace.glsl reads (see the structs there)
+        struct MeshData {
+            glm::mat4 transformation;
+            glm::mat4 inverse_transformation;
+            uint32_t vertex_offset;
+            uint32_t index_offset;
+            uint32_t nr_indices;
+            MaterialIndex material_index;
+        };
+        struct TriangleRecord {
+            glm::vec3 positions[3];
+            uint32_t first_index;
+            uint32_t mesh_index;
+        };
+        struct MaterialData {
+            glm::vec4 albedo;
+            glm::vec4 F0;
+            float roughness;
+            float metalness;
+            float AO;
+            int32_t albedo_ti;
+            int32_t F0_ti;
+            int32_t roughness_ti;
+            int32_t metalness_ti;
+            int32_t AO_ti;
+            int32_t normal_ti;
+        };
+        struct Light {
+            glm::vec3 position;
+            int32_t type;
+            glm::vec3 direction;
+            glm::vec3 radiance;
+            float ambient_multiplier;
+            float cutoff_radius;
+            // Bit of the directional light in SunShadows (-1 for the other lights)
+            int32_t shadow_slot;
+        };
+        // A light as seen from a point
+        struct LightData {
+            glm::vec3 direction;
+            // Negative distance (-1) means infinitely far away
+            float light_distance;
+            glm::vec3 radiance;
+            float ambient_multiplier;
+        };
+        // Shadow rays towards the directional lights which were already traced as a packet
+        struct SunShadows {
+            uint32_t known;
+            uint32_t occluded;
+        };
+
+        std::vector<Vertex> static_vertices;
+        std::vector<TriangleRecord> static_triangle_records;
+        unsigned int nr_static_indices;
+        unsigned int nr_static_meshes;
+
+        std::vector<Vertex> dynamic_vertices;
+        std::vector<Index> dynamic_indices;
+        std::vector<unsigned char> meshes;
+        std::vector<MeshData> mesh_data;
+        // The object space BVH of every mesh (nullptr for the static meshes and empty meshes)
+        std::vector<const BVH*> mesh_bvhs;
+        // Keeps the meshes of mesh_bvhs alive while they are being rendered
+        std::vector<std::shared_ptr<Mesh>> dynamic_meshes;
+        void traverse_node_tree(Node* node, glm::mat4 transformation=glm::mat4(1.0f));
+
+        // Top level BVH over the world space bounds of the dynamic mesh instances
+        BVH tlas;
+        std::vector<AABB> instance_bounds;
+        std::vector<MeshIndex> instance_meshes;
+
+        std::vector<MaterialData> materials;
+        // RGBA8 images of the MaterialManager (texture_width*texture_height pixels each)
+        const std::vector<unsigned char>* material_textures;
+        unsigned int texture_width;
+        unsigned int texture_height;
+
+        std::vector<unsigned char> lights;
+        std::vector<Light> unpacked_lights;
+        std::vector<float> light_weights;
+        // The first 32 directional lights (the ones with a shadow slot)
+        std::vector<uint32_t> directional_lights;
+        std::vector<glm::vec4> light_spheres;
+
+        // BVH over the spheres of the visible lights
+        BVH light_bvh;
+        std::vector<AABB> light_sphere_bounds;
+        std::vector<uint32_t> light_sphere_indices;
+
+        unsigned int nr_light_samples;
+        LightSampler light_sampler;
+        std::vector<unsigned char> light_samples;
+        // Lights which aren't part of the alias table and are always evaluated
+        std::vector<uint32_t> unsampled_lights;
+
+        bool light_culling;
+        LightGrid light_grid;
+        std::vector<unsigned char> light_grid_cells;
+        // light_grid_cells as the uint array raytrace.glsl reads
+        std::vector<uint32_t> light_grid_indices;
+        bool use_light_grid;
+
+        unsigned int frame_index;
+
+        // The tracing functions mirror their namesakes in raytrace.glsl
+        bool ray_triangle_int(const glm::vec3& ray_origin, const glm::vec3& ray_dir, const glm::vec3& tri0, const glm::vec3& tri1, const glm::vec3& tri2, float near_plane, float& depth, glm::vec3& bc) const;
+        bool static_triangle_int(const glm::vec3& ray_origin, const glm::vec3& ray_dir, uint32_t ti, float near_plane, float& depth, uint32_t& first_index, uint32_t& mesh_index, glm::vec3& bc) const;
+        const Vertex& get_vertex(uint32_t i, uint32_t mi) const;
+        const Vertex& get_dynamic_vertex(uint32_t i, uint32_t mi) const;
+        bool ray_instance_int(const glm::vec3& ray_origin, const glm::vec3& ray_dir, uint32_t mi, float near_plane, float& depth, uint32_t& hit_index, glm::vec3& hit_bc) const;
+        Vertex cast_ray(const glm::vec3& ray_origin, const glm::vec3& ray_dir, float near_plane, float far_plane, int32_t& mesh_index) const;
+        // The end of cast_ray: interpolates the attributes of the hit triangle
+        Vertex get_hit_vertex(const glm::vec3& ray_origin, const glm::vec3& ray_dir, float depth, int32_t mesh_index, uint32_t hit_index, const glm::vec3& hit_bc) const;
+        bool instance_occludes(const glm::vec3& ray_origin, const glm::vec3& ray_dir, uint32_t mi, float near_plane, float far_plane) const;
+        bool occluded(const glm::vec3& ray_origin, const glm::vec3& ray_dir, float near_plane, float far_plane) const;
+        int32_t cast_ray_for_lights(const glm::vec3& ray_origin, const glm::vec3& ray_dir, float near_plane, float far_plane, float& depth) const;
+
+        // Bilinear lookup with clamped edges like the GL_LINEAR sampling of the texture array
+        glm::vec4 sample_texture(int32_t texture_index, const glm::vec2& tex_coords) const;
+        MaterialData get_material_data(const MaterialData& material, const glm::vec2& tex_coords) const;
+        LightData get_light_data(const Light& light, const glm::vec3& at) const;
+        glm::vec3 cook_torrance_BRDF(const glm::vec3& view, const glm::vec3& normal, const glm::vec3& light, const MaterialData& material) const;
+        // Shadow rays already in sun_shadows (if given) aren't traced again
+        glm::vec3 calculate_light(const glm::vec3& position, const glm::vec3& normal, const glm::vec3& ray_dir, const MaterialData& material, const Light& light, const SunShadows* sun_shadows=nullptr) const;
+        glm::vec3 sample_lights(const glm::vec3& position, const glm::vec3& normal, const glm::vec3& ray_dir, const MaterialData& material, uint32_t& rng_state) const;
+        glm::vec4 trace(const glm::vec3& ray_origin, glm::vec3 ray_dir, uint32_t& rng_state) const;
+        // The part of trace after cast_ray; ray_dir must be normalized
+        glm::vec4 shade(const glm::vec3& ray_origin, const glm::vec3& ray_dir, const Vertex& vert, int32_t mesh_index, uint32_t& rng_state, const SunShadows* sun_shadows) const;
+
+        // Packet versions of cast_ray and occluded giving every lane the same result as the scalar ones
+        template <int Size>
+        void cast_ray_packet(RayPacket<Size>& packet, Vertex verts[Size], int32_t mesh_indices[Size]) const;
+        template <int Size>
+        uint32_t occluded_packet(const RayPacket<Size>& packet) const;
+
+        // The frame render() is working on
+        FloatImage* frame_result;
+        glm::vec3 frame_eye;
+        CornerRays frame_rays;
+        unsigned int frame_nr_tiles_x;
+        unsigned int frame_nr_tiles;
+        unsigned int frame_seed;
+        std::vector<TileStatistics> tile_statistics;
+        // Render times of the previous frame's tiles which the threads' deques are balanced by
+        std::vector<double> tile_costs;
+        void render_tile(unsigned int tile);
+        template <int Size>
+        void render_tile_packets(unsigned int tile);
+        // Renders tiles from thread's deque (and the ones it steals) until every tile of the frame has been taken
+        void render_tiles(unsigned int thread);
+
+        // Thread pool; every render() wakes the workers up and renders tiles along with them
+        unsigned int nr_threads;
+        unsigned int tile_size;
+        TileOrder tile_order;
+        TileScheduler tile_scheduler;
+        // The tiles of the frame in tile_order (kept until the number of tiles or the order changes)
+        std::vector<unsigned int> ordered_tiles;
+        unsigned int ordered_tiles_x;
+        unsigned int ordered_tiles_y;
+        TileOrder ordered_tiles_order;
+        std::vector<std::thread> workers;
+        std::mutex worker_mutex;
+        std::condition_variable work_available;
+        std::condition_variable work_done;
+        // Incremented for every frame so the workers know there is new work
+        uint64_t work_generation;
+        unsigned int nr_busy_workers;
+        bool stop_workers;
+        void worker_loop(uint64_t generation, unsigned int thread);
+        void start_workers();
+        void join_workers();
+    };
+
+}
+
+#endif
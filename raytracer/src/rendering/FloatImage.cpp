@@ -0,0 +1,57 @@
+#include "FloatImage.hpp"
+
+namespace Rt {
+
+    FloatImage::FloatImage(unsigned int width, unsigned int height) {
+        resize(width, height);
+    }
+
+    void FloatImage::resize(unsigned int width, unsigned int height) {
+        this->width = width;
+        this->height = height;
+        data.assign(size_t(width)*height*4, 0.0f);
+    }
+
+    unsigned int FloatImage::get_width() const {
+        return width;
+    }
+
+    unsigned int FloatImage::get_height() const {
+        return height;
+    }
+
+    glm::vec4 FloatImage::get_pixel(unsigned int x, unsigned int y) const {
+        const float* pixel = data.data() + (size_t(y)*width + x)*4;
+        return glm::vec4(pixel[0], pixel[1], pixel[2], pixel[3]);
+    }
+
+    void FloatImage::set_pixel(unsigned int x, unsigned int y, const glm::vec4& color) {
+        float* pixel = data.data() + (size_t(y)*width + x)*4;
+        pixel[0] = color.x;
+        pixel[1] = color.y;
+        pixel[2] = color.z;
+        pixel[3] = color.w;
+    }
+
+    const std::vector<float>& FloatImage::get_data() const {
+        return data;
+    }
+
+    std::vector<float>& FloatImage::get_data() {
+        return data;
+    }
+
+    QImage FloatImage::to_image(float gamma) const {
+        QImage image(width, height, QImage::Format_RGB888);
+        for (unsigned int y=0; y<height; y++) {
+            uchar* line = image.scanLine(height-1-y);
+            for (unsigned int x=0; x<width; x++) {
+                glm::vec3 color = glm::clamp(glm::vec3(get_pixel(x, y)), 0.0f, 1.0f);
+                color = glm::pow(color, glm::vec3(1.0f/gamma));
+                for (int c=0; c<3; c++) line[x*3+c] = uchar(color[c]*255.0f + 0.5f);
+            }
+        }
+        return image;
+    }
+
+}
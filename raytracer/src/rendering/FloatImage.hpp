@@ -0,0 +1,45 @@
+#ifndef RT_FLOAT_IMAGE_HPP
+#define RT_FLOAT_IMAGE_HPP
+
+#include <QtGlobal>
+#include <QImage>
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "RaytracerGlobals.hpp"
+
+namespace Rt {
+
+    // RGBA32F image in system memory which CPURenderer renders into instead of a Texture
+    // Pixels are stored row by row starting with y=0 (the bottom row) like the rows of an
+    // OpenGL texture so the image can be copied into one as is (see Texture::upload)
+    class RAYTRACER_LIB_EXPORT FloatImage {
+    public:
+        FloatImage(unsigned int width=0, unsigned int height=0);
+
+        // Warning: This WILL clear the image
+        void resize(unsigned int width, unsigned int height);
+
+        unsigned int get_width() const;
+        unsigned int get_height() const;
+
+        glm::vec4 get_pixel(unsigned int x, unsigned int y) const;
+        void set_pixel(unsigned int x, unsigned int y, const glm::vec4& color);
+
+        // width*height*4 floats
+        const std::vector<float>& get_data() const;
+        std::vector<float>& get_data();
+
+        // 8 bit copy for saving to disk, gamma corrected like framebuffer_fs.glsl draws render
+        // results and flipped so the first row is the top one
+        QImage to_image(float gamma=2.2f) const;
+
+    private:
+        unsigned int width;
+        unsigned int height;
+        std::vector<float> data;
+    };
+
+}
+
+#endif
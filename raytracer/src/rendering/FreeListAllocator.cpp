@@ -0,0 +1,103 @@
+#include "FreeListAllocator.hpp"
+
+#include <iterator>
+
+namespace Rt {
+
+    FreeListAllocator::FreeListAllocator() {
+        end = 0;
+        nr_allocated = 0;
+    }
+
+    size_t FreeListAllocator::allocate(size_t size) {
+        size_t offset = end;
+        auto range = free_ranges.begin();
+        while (range != free_ranges.end() && range->second < size) range++;
+        if (range != free_ranges.end()) {
+            offset = range->first;
+            size_t remaining = range->second - size;
+            free_ranges.erase(range);
+            if (remaining > 0) free_ranges[offset + size] = remaining;
+        } else {
+            end += size;
+        }
+        allocations[offset] = size;
+        nr_allocated += size;
+        return offset;
+    }
+
+    void FreeListAllocator::free(size_t offset) {
+        auto allocation = allocations.find(offset);
+        if (allocation == allocations.end()) return;
+        size_t size = allocation->second;
+        allocations.erase(allocation);
+        nr_allocated -= size;
+
+        // Merge with the free neighbours
+        auto next = free_ranges.lower_bound(offset);
+        if (next != free_ranges.end() && next->first == offset + size) {
+            size += next->second;
+            next = free_ranges.erase(next);
+        }
+        if (next != free_ranges.begin()) {
+            auto previous = std::prev(next);
+            if (previous->first + previous->second == offset) {
+                offset = previous->first;
+                size += previous->second;
+                free_ranges.erase(previous);
+            }
+        }
+
+        // A free range at the end just moves the end back
+        if (offset + size == end)
+            end = offset;
+        else
+            free_ranges[offset] = size;
+    }
+
+    void FreeListAllocator::clear() {
+        free_ranges.clear();
+        allocations.clear();
+        end = 0;
+        nr_allocated = 0;
+    }
+
+    size_t FreeListAllocator::get_end() const {
+        return end;
+    }
+
+    size_t FreeListAllocator::get_nr_allocated() const {
+        return nr_allocated;
+    }
+
+    bool FreeListAllocator::find_move(size_t& from, size_t& to, size_t& size) const {
+        if (allocations.empty()) return false;
+        // Only moving the last allocation shrinks the end
+        auto last = std::prev(allocations.end());
+        for (const std::pair<const size_t, size_t>& range : free_ranges) {
+            if (range.first >= last->first) break;
+            if (range.second >= last->second) {
+                from = last->first;
+                to = range.first;
+                size = last->second;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void FreeListAllocator::move(size_t from, size_t to) {
+        auto allocation = allocations.find(from);
+        auto range = free_ranges.find(to);
+        if (allocation == allocations.end() || range == free_ranges.end() || range->second < allocation->second) return;
+
+        size_t size = allocation->second;
+        size_t remaining = range->second - size;
+        free_ranges.erase(range);
+        if (remaining > 0) free_ranges[to + size] = remaining;
+        allocations[to] = size;
+        nr_allocated += size;
+        free(from);
+    }
+
+}
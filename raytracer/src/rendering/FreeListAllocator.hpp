@@ -0,0 +1,47 @@
+#ifndef RT_FREE_LIST_ALLOCATOR_HPP
+#define RT_FREE_LIST_ALLOCATOR_HPP
+
+#include <QtGlobal>
+#include <map>
+
+#include "RaytracerGlobals.hpp"
+
+namespace Rt {
+
+    // Hands out ranges of a buffer (in any unit, e.g. vertices or indices) without touching the
+    // buffer itself
+    // Freed ranges are merged with their free neighbours and reused first fit; an allocation which
+    // fits in none of them goes at the end, which moves the end of the used part of the buffer
+    class RAYTRACER_LIB_EXPORT FreeListAllocator {
+    public:
+        FreeListAllocator();
+
+        // Returns the offset of a new range of size units (size must be positive)
+        size_t allocate(size_t size);
+        // Frees the range allocated at offset
+        void free(size_t offset);
+        // Frees every range
+        void clear();
+
+        // One past the last allocated unit; the buffer must be at least this large
+        size_t get_end() const;
+        // Number of allocated units (the rest of [0, get_end()) is free)
+        size_t get_nr_allocated() const;
+
+        // Compaction moves the highest allocations into free ranges below them so the end shrinks
+        // Returns false if no allocation can be moved; otherwise the size units at from should be
+        // copied to to (the two ranges never overlap) and move() called
+        bool find_move(size_t& from, size_t& to, size_t& size) const;
+        void move(size_t from, size_t to);
+
+    private:
+        // Offset to size of the free ranges below end and of the allocations
+        std::map<size_t, size_t> free_ranges;
+        std::map<size_t, size_t> allocations;
+        size_t end;
+        size_t nr_allocated;
+    };
+
+}
+
+#endif
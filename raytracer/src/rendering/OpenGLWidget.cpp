@@ -108,11 +108,13 @@ namespace Rt {
         glClear(GL_COLOR_BUFFER_BIT);
 
         // Draw the render result to the screen
+        renderer.begin_stage(Renderer::Stage::BLIT);
         glUseProgram(frame_shader.get_id());
         glBindTextureUnit(0, render_result.get_id());
         frame_shader.set_int("render", 0);
         glBindVertexArray(frame_vao);
         glDrawArrays(GL_TRIANGLES, 0, 6);
+        renderer.end_stage(Renderer::Stage::BLIT);
 
         // Clean up
         glBindVertexArray(0);
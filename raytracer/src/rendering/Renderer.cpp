@@ -1,8 +1,12 @@
 #include "Renderer.hpp"
 
 #include <QDebug>
+#include <QElapsedTimer>
+#include <algorithm>
+#include <cstring>
 
 #include "scene/lights/AbstractLight.hpp"
+#include "scene/lights/PointLight.hpp"
 
 namespace Rt {
 
@@ -24,21 +28,60 @@ namespace Rt {
     }
 
     Renderer::Renderer(QObject* parent) : QObject(parent) {
+        gl = nullptr;
         camera = nullptr;
         scene = nullptr;
+        dynamic_geometry = DynamicGeometry::INSTANCED;
+        quantized_static_bvh = false;
+        triangle_intersection = TriangleIntersection::WATERTIGHT;
+        vertex_format = VertexFormat::FULL;
+        gpu_refit = true;
+        refit_rebuild_ratio = 1.5f;
+        refit_bvh_build_cost = 0.0f;
+        refit_bvh_cost = 0.0f;
+        nr_refit_rebuilds = 0;
+        refit_cost_fence = nullptr;
+        light_bvh_offset = 0;
+        nr_light_bvh_nodes = 0;
+        nr_light_samples = 0;
+        light_culling = true;
+        stage_timing = false;
+        scene_dirty = true;
+        lights_dirty = true;
+        nr_uploads = 0;
+        uploaded_bytes = 0;
+        uploaded_material_bytes = 0;
+        dynamic_vertex_capacity = 0;
+        dynamic_index_capacity = 0;
+        dynamic_bvh_capacity = 0;
+        frame_index = 0;
         prev_width = 0;
         prev_height = 0;
     }
 
     Renderer::~Renderer() {
+        // Never initialized (e.g. no OpenGL context could be created)
+        if (!gl) return;
         gl->make_current();
-        gl->glDeleteBuffers(1, &vertex_ssbo);
+        gl->glDeleteBuffers(1, &vertex_position_ssbo);
+        gl->glDeleteBuffers(1, &vertex_attribute_ssbo);
+        gl->glDeleteBuffers(1, &vertex_mesh_ssbo);
         gl->glDeleteBuffers(1, &static_vertex_ssbo);
         gl->glDeleteBuffers(1, &static_index_ssbo);
+        gl->glDeleteBuffers(1, &static_bvh_ssbo);
+        gl->glDeleteBuffers(1, &static_triangle_record_ssbo);
+        gl->glDeleteBuffers(1, &quantized_static_bvh_ssbo);
         gl->glDeleteBuffers(1, &dynamic_vertex_ssbo);
         gl->glDeleteBuffers(1, &dynamic_index_ssbo);
-        gl->glDeleteBuffers(1, &mesh_ssbo);
+        gl->glDeleteBuffers(1, &dynamic_bvh_ssbo);
+        gl->glDeleteBuffers(1, &dynamic_bvh_triangle_ssbo);
+        gl->glDeleteBuffers(1, &refit_ssbo);
+        gl->glDeleteBuffers(1, &lbvh_triangle_ssbo);
+        gl->glDeleteBuffers(1, &lbvh_sort_ssbo);
+        if (refit_cost_fence) gl->glDeleteSync(refit_cost_fence);
         gl->glDeleteBuffers(1, &material_ssbo);
+        gl->glDeleteBuffers(1, &light_sampler_ssbo);
+        gl->glDeleteBuffers(1, &light_grid_ssbo);
     }
 
     void Renderer::initialize(OpenGLFunctions* gl) {
@@ -55,14 +98,34 @@ namespace Rt {
         vertex_shader.initialize(gl);
         ShaderStage vert_shader{GL_COMPUTE_SHADER, ":/src/rendering/shaders/vertex_shader.glsl"};
         vertex_shader.load_shaders(&vert_shader, 1);
+        gl->glGetProgramiv(vertex_shader.get_id(), GL_COMPUTE_WORK_GROUP_SIZE, vertex_shader_work_group_size);
+
+        refit_shader.initialize(gl);
+        ShaderStage bvh_refit_shader{GL_COMPUTE_SHADER, ":/src/rendering/shaders/bvh_refit.glsl"};
+        refit_shader.load_shaders(&bvh_refit_shader, 1);
+
+        lbvh_shader.initialize(gl);
+        ShaderStage lbvh_build_shader{GL_COMPUTE_SHADER, ":/src/rendering/shaders/lbvh.glsl"};
+        lbvh_shader.load_shaders(&lbvh_build_shader, 1);
 
         gl->glGetProgramiv(render_shader.get_id(), GL_COMPUTE_WORK_GROUP_SIZE, work_group_size);
 
         // Set up the SSBOs
-        gl->glCreateBuffers(1, &vertex_ssbo);
-        gl->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, vertex_ssbo);
-        gl->glNamedBufferData(vertex_ssbo, 0, nullptr, GL_STREAM_DRAW);
+        gl->glCreateBuffers(1, &vertex_position_ssbo);
+        gl->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, vertex_position_ssbo);
+        gl->glNamedBufferData(vertex_position_ssbo, 0, nullptr, GL_STREAM_DRAW);
+
+        gl->glCreateBuffers(1, &vertex_attribute_ssbo);
+        gl->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 20, vertex_attribute_ssbo);
+        gl->glNamedBufferData(vertex_attribute_ssbo, 0, nullptr, GL_STREAM_DRAW);
         vertex_ssbo_size = 0;
+        vertex_capacity = 0;
+        static_vertices_transformed = false;
+
+        gl->glCreateBuffers(1, &vertex_mesh_ssbo);
+        gl->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 21, vertex_mesh_ssbo);
+        gl->glNamedBufferData(vertex_mesh_ssbo, 0, nullptr, GL_STREAM_DRAW);
+        vertex_mesh_ssbo_size = 0;
 
         gl->glCreateBuffers(1, &static_vertex_ssbo);
         gl->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, static_vertex_ssbo);
@@ -73,6 +136,22 @@ namespace Rt {
         gl->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, static_index_ssbo);
         gl->glNamedBufferData(static_index_ssbo, 0, nullptr, GL_STATIC_DRAW);
         static_index_ssbo_size = 0;
+
+        gl->glCreateBuffers(1, &static_bvh_ssbo);
+        gl->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, static_bvh_ssbo);
+        gl->glNamedBufferData(static_bvh_ssbo, 0, nullptr, GL_STATIC_DRAW);
+        static_bvh_ssbo_size = 0;
+
+        nr_static_meshes = 0;
+
+        gl->glCreateBuffers(1, &static_triangle_record_ssbo);
+        gl->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 19, static_triangle_record_ssbo);
+        gl->glNamedBufferData(static_triangle_record_ssbo, 0, nullptr, GL_STATIC_DRAW);
+
+        gl->glCreateBuffers(1, &quantized_static_bvh_ssbo);
+        gl->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 16, quantized_static_bvh_ssbo);
+        gl->glNamedBufferData(quantized_static_bvh_ssbo, 0, nullptr, GL_STATIC_DRAW);
+        quantized_static_bvh_ssbo_size = 0;
         
         gl->glCreateBuffers(1, &dynamic_vertex_ssbo);
         gl->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, dynamic_vertex_ssbo);
@@ -84,9 +163,31 @@ namespace Rt {
         gl->glNamedBufferData(dynamic_index_ssbo, 0, nullptr, GL_STREAM_DRAW);
         dynamic_index_ssbo_size = 0;
 
-        gl->glCreateBuffers(1, &mesh_ssbo);
-        gl->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, mesh_ssbo);
-        gl->glNamedBufferData(mesh_ssbo, 0, nullptr, GL_STREAM_DRAW);
+        gl->glCreateBuffers(1, &dynamic_bvh_ssbo);
+        gl->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, dynamic_bvh_ssbo);
+        gl->glNamedBufferData(dynamic_bvh_ssbo, 0, nullptr, GL_STREAM_DRAW);
+        dynamic_bvh_ssbo_size = 0;
+
+        tlas_ssbo.initialize(gl, 11);
+        tlas_ssbo_size = 0;
+
+        gl->glCreateBuffers(1, &dynamic_bvh_triangle_ssbo);
+        gl->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 12, dynamic_bvh_triangle_ssbo);
+        gl->glNamedBufferData(dynamic_bvh_triangle_ssbo, 0, nullptr, GL_STREAM_DRAW);
+
+        gl->glCreateBuffers(1, &refit_ssbo);
+        gl->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 13, refit_ssbo);
+        gl->glNamedBufferData(refit_ssbo, 0, nullptr, GL_STREAM_DRAW);
+
+        gl->glCreateBuffers(1, &lbvh_triangle_ssbo);
+        gl->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 14, lbvh_triangle_ssbo);
+        gl->glNamedBufferData(lbvh_triangle_ssbo, 0, nullptr, GL_STREAM_DRAW);
+
+        gl->glCreateBuffers(1, &lbvh_sort_ssbo);
+        gl->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 15, lbvh_sort_ssbo);
+        gl->glNamedBufferData(lbvh_sort_ssbo, 0, nullptr, GL_STREAM_DRAW);
+
+        mesh_ssbo.initialize(gl, 5);
         mesh_ssbo_size = 0;
 
         gl->glCreateBuffers(1, &material_ssbo);
@@ -94,44 +195,206 @@ namespace Rt {
         gl->glNamedBufferData(material_ssbo, 0, nullptr, GL_STREAM_DRAW);
         material_ssbo_size = 0;
 
-        gl->glCreateBuffers(1, &light_ssbo);
-        gl->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, light_ssbo);
-        gl->glNamedBufferData(light_ssbo, 0, nullptr, GL_STREAM_DRAW);
+        light_ssbo.initialize(gl, 7);
         light_ssbo_size = 0;
 
+        gl->glCreateBuffers(1, &light_sampler_ssbo);
+        gl->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 17, light_sampler_ssbo);
+        gl->glNamedBufferData(light_sampler_ssbo, 0, nullptr, GL_STREAM_DRAW);
+
+        gl->glCreateBuffers(1, &light_grid_ssbo);
+        gl->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 18, light_grid_ssbo);
+        gl->glNamedBufferData(light_grid_ssbo, 0, nullptr, GL_STREAM_DRAW);
+
         // We need to create the texture here just in case there are no material textures
         gl->glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &material_texture_array);
         nr_material_textures = 0;
+
+        stage_timer.initialize(gl, nr_stages);
+    }
+
+    void Renderer::set_persistent_buffers(bool new_persistent_buffers) {
+        gl->make_current();
+        for (RingBuffer* buffer : {&mesh_ssbo, &light_ssbo, &tlas_ssbo}) buffer->set_persistent(new_persistent_buffers);
+        // The recreated buffers are empty until the next update() writes everything again
+        scene_dirty = true;
+    }
+
+    bool Renderer::get_persistent_buffers() const {
+        return mesh_ssbo.get_persistent();
+    }
+
+    unsigned int Renderer::get_nr_uploads() const {
+        return nr_uploads;
+    }
+
+    size_t Renderer::get_uploaded_bytes() const {
+        return uploaded_bytes;
     }
 
     bool Renderer::update() {
         if (scene) {
             gl->make_current();
 
-            dynamic_vertices.clear();
-            dynamic_indices.clear();
-            lights.clear();
-            meshes = scene->get_static_meshes();
-            traverse_node_tree(scene);
-
-            gl->glNamedBufferData(dynamic_vertex_ssbo, dynamic_vertices.size(), dynamic_vertices.data(), GL_STREAM_DRAW);
-            dynamic_vertex_ssbo_size = dynamic_vertices.size() / vertex_size_in_opengl;
-            gl->glNamedBufferData(dynamic_index_ssbo, dynamic_indices.size()*sizeof(Index), dynamic_indices.data(), GL_STREAM_DRAW);
-            dynamic_index_ssbo_size = dynamic_indices.size();
-            gl->glNamedBufferData(mesh_ssbo, meshes.size(), meshes.data(), GL_STREAM_DRAW);
-            mesh_ssbo_size = meshes.size() / mesh_size_in_opengl;
-            gl->glNamedBufferData(light_ssbo, lights.size(), lights.data(), GL_STREAM_DRAW);
-            light_ssbo_size = lights.size() / light_size_in_opengl;
+            if (stage_timing) stage_timer.collect();
+            nr_uploads = 0;
+            uploaded_bytes = 0;
+
+            QElapsedTimer traversal_timer;
+            traversal_timer.start();
+
+            // Byte ranges of meshes and lights which were re-packed
+            std::vector<std::pair<size_t, size_t>> mesh_ranges;
+            std::vector<std::pair<size_t, size_t>> light_ranges;
+            bool full_update = scene_dirty;
+            if (full_update) {
+                compact_dynamic_geometry();
+                for (auto& allocation : mesh_allocations) {
+                    allocation.second.used = false;
+                    allocation.second.records.clear();
+                }
+
+                instance_bounds.clear();
+                instance_meshes.clear();
+                dynamic_triangles.clear();
+                dynamic_triangle_vertices.clear();
+                lights.clear();
+                light_weights.clear();
+                light_spheres.clear();
+                packed_nodes.clear();
+                packed_meshes.clear();
+                packed_lights.clear();
+                vertex_meshes.clear();
+                meshes = scene->get_static_meshes();
+                traverse_node_tree(scene);
+                scene_dirty = false;
+                lights_dirty = true;
+
+                // Free the geometry of the meshes which were removed
+                for (auto allocation = mesh_allocations.begin(); allocation != mesh_allocations.end();) {
+                    if (allocation->second.used) {
+                        allocation++;
+                    } else {
+                        free_mesh(allocation->second);
+                        allocation = mesh_allocations.erase(allocation);
+                    }
+                }
+                dirty_meshes.clear();
+
+                std::sort(vertex_meshes.begin(), vertex_meshes.end(), [](const glm::uvec2& a, const glm::uvec2& b) {return a.x < b.x;});
+            }
+            else if (!dirty_nodes.empty()) {
+                std::sort(dirty_nodes.begin(), dirty_nodes.end());
+                dirty_nodes.erase(std::unique(dirty_nodes.begin(), dirty_nodes.end()), dirty_nodes.end());
+                for (Node* node : dirty_nodes) {
+                    // A node's subtree keeps its place so it is re-packed over its old records
+                    const PackedNode& packed = packed_nodes.at(node);
+                    repack_node_tree(node, packed.parent_transformation);
+                    if (packed.meshes_begin != packed.meshes_end) mesh_ranges.emplace_back(packed.meshes_begin, packed.meshes_end);
+                    if (packed.lights_begin != packed.lights_end) light_ranges.emplace_back(packed.lights_begin, packed.lights_end);
+                }
+                if (!light_ranges.empty()) lights_dirty = true;
+            }
+            dirty_nodes.clear();
+            bool meshes_moved = !mesh_ranges.empty();
+
+            // The light BVH's nodes are appended to the TLAS's
+            bool tlas_changed = full_update || meshes_moved || !light_ranges.empty();
+            if (tlas_changed) {
+                build_tlas();
+                gather_light_spheres();
+                build_light_bvh();
+            }
+
+            // Compacting only moves geometry (its bounds stay the same) so only the moved meshes'
+            // records are re-packed with their new offsets and the TLAS doesn't change
+            bool compacted = !full_update && needs_compaction();
+            if (compacted) move_mesh_records(compact_dynamic_geometry(), mesh_ranges);
+            if (stage_timing) stage_timer.add_sample(Stage::SCENE_TRAVERSAL, traversal_timer.nsecsElapsed() / 1.0e6);
+
+            begin_stage(Stage::UPLOAD);
+            if (full_update) {
+                upload_pending_meshes();
+                dynamic_vertex_ssbo_size = vertex_allocator.get_end();
+                dynamic_index_ssbo_size = index_allocator.get_end();
+                uploaded_bytes += mesh_ssbo.write(meshes.data(), meshes.size());
+                nr_uploads++;
+                mesh_ssbo_size = meshes.size() / mesh_size_in_opengl;
+                uploaded_bytes += light_ssbo.write(lights.data(), lights.size());
+                nr_uploads++;
+                light_ssbo_size = lights.size() / light_size_in_opengl;
+                // Instanced meshes' vertices aren't transformed so they don't need the vertex meshes
+                if (dynamic_geometry == DynamicGeometry::INSTANCED) {
+                    dynamic_bvh_ssbo_size = bvh_allocator.get_end();
+                    vertex_mesh_ssbo_size = 0;
+                } else {
+                    upload(vertex_mesh_ssbo, vertex_meshes.data(), vertex_meshes.size()*sizeof(glm::uvec2));
+                    vertex_mesh_ssbo_size = vertex_meshes.size();
+                }
+            }
+            else {
+                if (compacted) {
+                    dynamic_vertex_ssbo_size = vertex_allocator.get_end();
+                    dynamic_index_ssbo_size = index_allocator.get_end();
+                    if (dynamic_geometry == DynamicGeometry::INSTANCED) {
+                        dynamic_bvh_ssbo_size = bvh_allocator.get_end();
+                    } else {
+                        vertex_ssbo_size = static_vertex_ssbo_size + dynamic_vertex_ssbo_size;
+                        upload(vertex_mesh_ssbo, vertex_meshes.data(), vertex_meshes.size()*sizeof(glm::uvec2));
+                    }
+                }
+                if (!mesh_ranges.empty()) {
+                    uploaded_bytes += mesh_ssbo.write(meshes.data(), meshes.size(), mesh_ranges);
+                    nr_uploads++;
+                }
+                if (!light_ranges.empty()) {
+                    uploaded_bytes += light_ssbo.write(lights.data(), lights.size(), light_ranges);
+                    nr_uploads++;
+                }
+            }
+            if (lights_dirty) {
+                if (nr_light_samples > 0) {
+                    light_sampler.build(light_weights);
+                    light_samples.clear();
+                    light_sampler.as_byte_array(light_samples);
+                    upload(light_sampler_ssbo, light_samples.data(), light_samples.size());
+                }
+                if (light_culling && nr_light_samples == 0) {
+                    light_grid.build(light_spheres);
+                    light_grid_cells.clear();
+                    light_grid.as_byte_array(light_grid_cells);
+                    upload(light_grid_ssbo, light_grid_cells.data(), light_grid_cells.size());
+                }
+                lights_dirty = false;
+            }
+            if (tlas_changed) {
+                uploaded_bytes += tlas_ssbo.write(tlas_nodes.data(), tlas_nodes.size());
+                nr_uploads++;
+                tlas_ssbo_size = tlas_nodes.size() / bvh_node_size_in_opengl;
+            }
 
             // Allocate enough space for the vertex buffer
-            vertex_ssbo_size = dynamic_vertex_ssbo_size+static_vertex_ssbo_size;
-            gl->glNamedBufferData(vertex_ssbo, vertex_ssbo_size*vertex_size_in_opengl, nullptr, GL_STREAM_DRAW);
+            // Instanced meshes are intersected in object space so only the static vertices need to be copied over
+            if (full_update) {
+                vertex_ssbo_size = static_vertex_ssbo_size;
+                if (dynamic_geometry != DynamicGeometry::INSTANCED)
+                    vertex_ssbo_size += dynamic_vertex_ssbo_size;
+                if (vertex_ssbo_size > vertex_capacity) {
+                    vertex_capacity = std::max<size_t>(vertex_ssbo_size, 2*vertex_capacity);
+                    gl->glNamedBufferData(vertex_position_ssbo, vertex_capacity*vertex_position_size_in_opengl, nullptr, GL_STREAM_DRAW);
+                    gl->glNamedBufferData(vertex_attribute_ssbo, vertex_capacity*vertex_attribute_size_in_opengl, nullptr, GL_STREAM_DRAW);
+                    static_vertices_transformed = false;
+                }
+            }
 
+            // Materials are only ever appended
             MaterialManager& material_manager = scene->get_material_manager();
             const std::vector<unsigned char>& materials = material_manager.get_materials();
-
-            gl->glNamedBufferData(material_ssbo, materials.size(), materials.data(), GL_STREAM_DRAW);
-            material_ssbo_size = materials.size()/material_size_in_opengl;
+            if (materials.size() != uploaded_material_bytes) {
+                upload_range(material_ssbo, materials.data(), materials.size(), std::min(uploaded_material_bytes, materials.size()), materials.size());
+                uploaded_material_bytes = materials.size();
+                material_ssbo_size = materials.size()/material_size_in_opengl;
+            }
 
             const std::vector<unsigned char>& mm_texture_array = material_manager.get_material_textures();
             TextureIndex new_nr_material_textures = mm_texture_array.size() / material_manager.bytes_per_image();
@@ -148,29 +411,60 @@ namespace Rt {
                 gl->glTextureParameteri(material_texture_array, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
                 gl->glTextureParameteri(material_texture_array, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
             }
+            end_stage(Stage::UPLOAD);
 
-            gl->glUseProgram(vertex_shader.get_id());
-
-            vertex_shader.set_uint("nr_vertices", vertex_ssbo_size);
-            vertex_shader.set_uint("nr_static_vertices", static_vertex_ssbo_size);
-            vertex_shader.set_uint("nr_dynamic_vertices", dynamic_vertex_ssbo_size);
-            vertex_shader.set_uint("nr_static_indices", static_index_ssbo_size);
-            vertex_shader.set_uint("nr_dynamic_indices", dynamic_index_ssbo_size);
-            vertex_shader.set_uint("nr_meshes", mesh_ssbo_size);
-
-            unsigned int worksize_x = round_up_to_pow_2(vertex_ssbo_size) / Y_SIZE + 1;
-            unsigned int worksize_y = Y_SIZE;
-            gl->glDispatchCompute(worksize_x, worksize_y, 1);
+            // The transformed vertices only change with the dynamic meshes' transformations
+            // (instanced meshes aren't transformed; only the static vertices are copied over once)
+            // Compaction copies the transformed vertices along with the untransformed ones
+            bool vertices_changed = full_update || (meshes_moved && dynamic_geometry != DynamicGeometry::INSTANCED);
+            // The linear BVH's leaves hold the moved triangles' old indices; it's built on the GPU
+            // every time anything moves anyway
+            bool lbvh_changed = compacted && dynamic_geometry == DynamicGeometry::REBUILT;
+            if (!vertices_changed && !lbvh_changed) return true;
+            if (vertices_changed) transform_vertices();
 
-            // Make sure the vertex shader has finished writing
-            gl->glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
-            gl->glUseProgram(0);
+            if (dynamic_geometry == DynamicGeometry::REFITTED || dynamic_geometry == DynamicGeometry::REBUILT) {
+                begin_stage(Stage::DYNAMIC_BVH);
+                if (dynamic_geometry == DynamicGeometry::REFITTED)
+                    update_refit_bvh();
+                else
+                    build_lbvh();
+                end_stage(Stage::DYNAMIC_BVH);
+            }
 
             return true;
         }
         return false;
     }
 
+    void Renderer::transform_vertices() {
+        unsigned int first_vertex = static_vertices_transformed ? static_vertex_ssbo_size : 0;
+
+        begin_stage(Stage::VERTEX_SHADER);
+        gl->glUseProgram(vertex_shader.get_id());
+
+        vertex_shader.set_uint("first_vertex", first_vertex);
+        vertex_shader.set_uint("nr_vertices", vertex_ssbo_size);
+        vertex_shader.set_uint("nr_static_vertices", static_vertex_ssbo_size);
+        vertex_shader.set_uint("nr_dynamic_vertices", dynamic_vertex_ssbo_size);
+        vertex_shader.set_uint("nr_static_indices", static_index_ssbo_size);
+        vertex_shader.set_uint("nr_dynamic_indices", dynamic_index_ssbo_size);
+        vertex_shader.set_uint("nr_vertex_meshes", vertex_mesh_ssbo_size);
+        vertex_shader.set_bool("compact_vertices", vertex_format == VertexFormat::COMPACT);
+
+        // One invocation per vertex; rows of max_work_groups groups when there are more groups
+        unsigned int nr_groups = (vertex_ssbo_size - std::min(first_vertex, vertex_ssbo_size) + vertex_shader_work_group_size[0] - 1) / vertex_shader_work_group_size[0];
+        unsigned int worksize_x = std::min(nr_groups, max_work_groups);
+        unsigned int worksize_y = worksize_x > 0 ? (nr_groups + worksize_x - 1) / worksize_x : 0;
+        if (nr_groups > 0) gl->glDispatchCompute(worksize_x, worksize_y, 1);
+        static_vertices_transformed = true;
+
+        // Make sure the vertex shader has finished writing
+        gl->glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        gl->glUseProgram(0);
+        end_stage(Stage::VERTEX_SHADER);
+    }
+
     bool Renderer::render(Texture* render_result, unsigned int width, unsigned int height) {
         if (camera && scene) {
             update();
@@ -198,9 +492,28 @@ namespace Rt {
             render_shader.set_uint("nr_dynamic_vertices", dynamic_vertex_ssbo_size);
             render_shader.set_uint("nr_static_indices", static_index_ssbo_size);
             render_shader.set_uint("nr_dynamic_indices", dynamic_index_ssbo_size);
+            render_shader.set_uint("nr_static_bvh_nodes", static_bvh_ssbo_size);
+            render_shader.set_uint("nr_quantized_static_bvh_nodes", quantized_static_bvh_ssbo_size);
+            render_shader.set_uint("nr_static_meshes", nr_static_meshes);
             render_shader.set_uint("nr_meshes", mesh_ssbo_size);
+            render_shader.set_uint("nr_tlas_nodes", light_bvh_offset);
+            render_shader.set_uint("light_bvh_offset", light_bvh_offset);
+            render_shader.set_uint("nr_light_bvh_nodes", nr_light_bvh_nodes);
+            render_shader.set_uint("nr_dynamic_bvh_nodes", dynamic_bvh_ssbo_size);
+            render_shader.set_uint("dynamic_geometry", dynamic_geometry);
+            render_shader.set_uint("triangle_intersection", triangle_intersection);
+            render_shader.set_bool("compact_vertices", vertex_format == VertexFormat::COMPACT);
             render_shader.set_uint("nr_materials", material_ssbo_size);
             render_shader.set_uint("nr_lights", light_ssbo_size);
+            render_shader.set_uint("nr_light_samples", nr_light_samples);
+            render_shader.set_uint("nr_sampled_lights", nr_light_samples > 0 ? light_sampler.get_nr_sampled_lights() : 0);
+            render_shader.set_uint("nr_unsampled_lights", nr_light_samples > 0 ? light_sampler.get_nr_unsampled_lights() : 0);
+            bool use_light_grid = light_culling && nr_light_samples == 0 && !light_grid.is_empty();
+            render_shader.set_bool("light_culling", use_light_grid);
+            render_shader.set_vec3("light_grid_min", use_light_grid ? light_grid.get_min() : glm::vec3(0.0f));
+            render_shader.set_vec3("light_grid_cell_size", use_light_grid ? light_grid.get_cell_size() : glm::vec3(0.0f));
+            render_shader.set_uint("nr_global_lights", use_light_grid ? light_grid.get_nr_global_lights() : 0);
+            render_shader.set_uint("frame_index", frame_index++);
 
             gl->glActiveTexture(GL_TEXTURE0);
             gl->glBindTexture(GL_TEXTURE_2D_ARRAY, material_texture_array);
@@ -209,7 +522,9 @@ namespace Rt {
 
             unsigned int worksize_x = round_up_to_pow_2(width);
             unsigned int worksize_y = round_up_to_pow_2(height);
+            begin_stage(Stage::RAYTRACE);
             gl->glDispatchCompute(worksize_x/work_group_size[0], worksize_y/work_group_size[1], 1);
+            end_stage(Stage::RAYTRACE);
 
             // Clean up & make sure the shader has finished writing to the image
             gl->glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
@@ -220,6 +535,137 @@ namespace Rt {
         return false;
     }
 
+    void Renderer::set_dynamic_geometry(DynamicGeometry new_dynamic_geometry) {
+        dynamic_geometry = new_dynamic_geometry;
+        // DynamicBVHBuffer is shared between modes so the refit BVH needs to be rebuilt
+        refit_bvh = BVH();
+        refit_bvh_triangles.clear();
+        refit_bvh_triangle_vertices.clear();
+        refit_bvh_triangle_slots.clear();
+        lbvh_triangles.clear();
+        scene_dirty = true;
+        // The BVH buffer is shared too and every mesh's indices are in a different order
+        free_all_meshes();
+        dynamic_bvh_capacity = 0;
+    }
+
+    Renderer::DynamicGeometry Renderer::get_dynamic_geometry() const {
+        return dynamic_geometry;
+    }
+
+    void Renderer::set_quantized_static_bvh(bool new_quantized_static_bvh) {
+        quantized_static_bvh = new_quantized_static_bvh;
+        if (scene) {
+            gl->make_current();
+            upload_static_bvh();
+        }
+    }
+
+    bool Renderer::get_quantized_static_bvh() const {
+        return quantized_static_bvh;
+    }
+
+    void Renderer::set_triangle_intersection(TriangleIntersection new_triangle_intersection) {
+        triangle_intersection = new_triangle_intersection;
+    }
+
+    Renderer::TriangleIntersection Renderer::get_triangle_intersection() const {
+        return triangle_intersection;
+    }
+
+    void Renderer::set_vertex_format(VertexFormat new_vertex_format) {
+        vertex_format = new_vertex_format;
+        // The dynamic vertices are uploaded in the new format by the next update()
+        scene_dirty = true;
+        free_all_meshes();
+        if (scene) {
+            gl->make_current();
+            upload_static_vertices();
+        }
+    }
+
+    Renderer::VertexFormat Renderer::get_vertex_format() const {
+        return vertex_format;
+    }
+
+    int Renderer::get_vertex_size_in_opengl() const {
+        return vertex_format == VertexFormat::COMPACT ? compact_vertex_size_in_opengl : vertex_size_in_opengl;
+    }
+
+    void Renderer::set_light_samples(unsigned int new_light_samples) {
+        nr_light_samples = new_light_samples;
+        lights_dirty = true;
+    }
+
+    unsigned int Renderer::get_light_samples() const {
+        return nr_light_samples;
+    }
+
+    void Renderer::set_light_culling(bool new_light_culling) {
+        light_culling = new_light_culling;
+        lights_dirty = true;
+    }
+
+    bool Renderer::get_light_culling() const {
+        return light_culling;
+    }
+
+    void Renderer::set_stage_timing(bool new_stage_timing) {
+        if (stage_timing && !new_stage_timing) {
+            gl->make_current();
+            stage_timer.clear();
+        }
+        stage_timing = new_stage_timing;
+    }
+
+    bool Renderer::get_stage_timing() const {
+        return stage_timing;
+    }
+
+    void Renderer::set_stage_timing_window(unsigned int new_stage_timing_window) {
+        stage_timer.set_window(new_stage_timing_window);
+    }
+
+    unsigned int Renderer::get_stage_timing_window() const {
+        return stage_timer.get_window();
+    }
+
+    TimingStatistics Renderer::get_stage_statistics(Stage stage) {
+        if (stage_timing) {
+            gl->make_current();
+            stage_timer.collect();
+        }
+        return stage_timer.get_statistics(stage);
+    }
+
+    void Renderer::begin_stage(Stage stage) {
+        if (stage_timing) stage_timer.begin(stage);
+    }
+
+    void Renderer::end_stage(Stage stage) {
+        if (stage_timing) stage_timer.end(stage);
+    }
+
+    void Renderer::set_gpu_refit(bool new_gpu_refit) {
+        gpu_refit = new_gpu_refit;
+    }
+
+    bool Renderer::get_gpu_refit() const {
+        return gpu_refit;
+    }
+
+    void Renderer::set_refit_rebuild_ratio(float new_refit_rebuild_ratio) {
+        refit_rebuild_ratio = new_refit_rebuild_ratio;
+    }
+
+    float Renderer::get_refit_rebuild_ratio() const {
+        return refit_rebuild_ratio;
+    }
+
+    unsigned int Renderer::get_nr_refit_rebuilds() const {
+        return nr_refit_rebuilds;
+    }
+
     void Renderer::set_camera(AbstractCamera* new_camera) {
         camera = new_camera;
         camera->update_perspective(float(prev_width)/prev_height);
@@ -231,17 +677,25 @@ namespace Rt {
 
     void Renderer::set_scene(Scene* new_scene) {
         scene = new_scene;
+        scene_dirty = true;
+        uploaded_material_bytes = 0;
+        free_all_meshes();
 
         gl->make_current();
 
-        const std::vector<unsigned char>& static_vertices = scene->get_static_vertices();
-        gl->glNamedBufferData(static_vertex_ssbo, static_vertices.size(), static_vertices.data(), GL_STATIC_DRAW);
-        static_vertex_ssbo_size = static_vertices.size() / vertex_size_in_opengl;
+        upload_static_vertices();
 
         const std::vector<Index>& static_indices = scene->get_static_indices();
         gl->glNamedBufferData(static_index_ssbo, static_indices.size()*sizeof(Index), static_indices.data(), GL_STATIC_DRAW);
         static_index_ssbo_size = static_indices.size();
 
+        upload_static_bvh();
+
+        const std::vector<unsigned char>& static_triangle_records = scene->get_static_triangle_records();
+        gl->glNamedBufferData(static_triangle_record_ssbo, static_triangle_records.size(), static_triangle_records.data(), GL_STATIC_DRAW);
+
+        nr_static_meshes = scene->get_static_meshes().size() / mesh_size_in_opengl;
+
         nr_material_textures = 0; // Will be updated later in update()
     }
 
@@ -249,15 +703,44 @@ namespace Rt {
         return scene;
     }
 
+    void Renderer::upload_static_vertices() {
+        const std::vector<unsigned char>& static_vertices = vertex_format == VertexFormat::COMPACT ? scene->get_static_compact_vertices() : scene->get_static_vertices();
+        gl->glNamedBufferData(static_vertex_ssbo, static_vertices.size(), static_vertices.data(), GL_STATIC_DRAW);
+        static_vertex_ssbo_size = static_vertices.size() / get_vertex_size_in_opengl();
+        static_vertices_transformed = false;
+    }
+
+    void Renderer::upload_static_bvh() {
+        // raytrace.glsl uses the quantized nodes whenever there are any
+        static const std::vector<unsigned char> no_nodes;
+        bool quantized = quantized_static_bvh && !scene->get_static_quantized_bvh().is_empty();
+        const std::vector<unsigned char>& static_bvh_nodes = quantized ? no_nodes : scene->get_static_bvh_nodes();
+        const std::vector<unsigned char>& quantized_static_bvh_nodes = quantized ? scene->get_static_quantized_bvh_nodes() : no_nodes;
+
+        gl->glNamedBufferData(static_bvh_ssbo, static_bvh_nodes.size(), static_bvh_nodes.data(), GL_STATIC_DRAW);
+        static_bvh_ssbo_size = static_bvh_nodes.size() / bvh_node_size_in_opengl;
+        gl->glNamedBufferData(quantized_static_bvh_ssbo, quantized_static_bvh_nodes.size(), quantized_static_bvh_nodes.data(), GL_STATIC_DRAW);
+        quantized_static_bvh_ssbo_size = quantized_static_bvh_nodes.size() / quantized_bvh_node_size_in_opengl;
+    }
+
     void Renderer::traverse_node_tree(Node* node, glm::mat4 transformation) {
+        connect_node(node);
+        PackedNode packed;
+        packed.parent_transformation = transformation;
+        packed.meshes_begin = meshes.size();
+        packed.lights_begin = lights.size();
+
         transformation *= node->get_transformation();
 
         // Check node type
         if (node->get_node_type() == Node::NodeType::LIGHT) {
-            size_t light_offset = lights.size();
-            lights.resize(light_offset + light_size_in_opengl);
+            size_t light_index = packed_lights.size();
             AbstractLight* light = reinterpret_cast<AbstractLight*>(node);
-            light->as_byte_array(lights.data()+light_offset, transformation);
+            packed_lights.push_back(light);
+            lights.resize(lights.size() + light_size_in_opengl);
+            light_weights.push_back(0.0f);
+            light_spheres.push_back(glm::vec4(0.0f));
+            pack_light(light, transformation, light_index);
         }
 
         // Add mesh data to buffers
@@ -266,25 +749,37 @@ namespace Rt {
         MeshIndex mesh_offset = meshes.size();
         meshes.resize(meshes.size() + node_meshes.size()*mesh_size_in_opengl);
         for (auto m : node_meshes) {
-            Index vertex_offset = dynamic_vertices.size()/vertex_size_in_opengl;
-            Index index_offset = dynamic_indices.size() + scene->get_static_indices().size();
+            MeshAllocation& allocation = allocate_mesh(node, m);
+            allocation.records.push_back(mesh_offset);
+            Index vertex_offset = allocation.vertex_offset;
+            if (allocation.nr_vertices > 0) vertex_meshes.emplace_back(vertex_offset, mesh_offset / mesh_size_in_opengl);
+            Index index_offset = allocation.index_offset + scene->get_static_indices().size();
             MaterialIndex material_index = material_manager.get_material_index(m->get_material().get());
 
-            const std::vector<Vertex>& mesh_vertices = m->get_vertices();
-            if (vertex_is_opengl_compatible) {
-                unsigned char const* mesh_vertex_data = reinterpret_cast<unsigned char const*>(mesh_vertices.data());
-                dynamic_vertices.insert(std::end(dynamic_vertices), mesh_vertex_data, mesh_vertex_data+vertex_size_in_opengl*mesh_vertices.size());
-            } else {
-                dynamic_vertices.resize(dynamic_vertices.size() + mesh_vertices.size()*vertex_size_in_opengl);
-                for (Index i=0; i<mesh_vertices.size(); i++) {
-                    mesh_vertices[i].as_byte_array(dynamic_vertices.data()+vertex_offset+i*vertex_size_in_opengl);
+            const std::vector<Index>& mesh_indices = m->get_indices();
+            int32_t bvh_offset = -1;
+            int32_t instance = -1;
+            uint32_t first_triangle = dynamic_triangles.size() / 2;
+            if (dynamic_geometry == DynamicGeometry::INSTANCED) {
+                const BVH& mesh_bvh = m->get_bvh();
+                if (!mesh_bvh.is_empty()) {
+                    bvh_offset = allocation.bvh_offset;
+                    instance = instance_bounds.size();
+                    instance_bounds.push_back(mesh_bvh.get_bounds().transformed(transformation));
+                    instance_meshes.push_back(mesh_offset / mesh_size_in_opengl);
+                }
+            } else if (dynamic_geometry == DynamicGeometry::REFITTED || dynamic_geometry == DynamicGeometry::REBUILT) {
+                for (Index i=0; i+2<mesh_indices.size(); i+=3) {
+                    dynamic_triangles.push_back(index_offset + i);
+                    dynamic_triangles.push_back(mesh_offset / mesh_size_in_opengl);
+                    dynamic_triangle_vertices.push_back(vertex_offset + mesh_indices[i+0]);
+                    dynamic_triangle_vertices.push_back(vertex_offset + mesh_indices[i+1]);
+                    dynamic_triangle_vertices.push_back(vertex_offset + mesh_indices[i+2]);
                 }
             }
 
-            const std::vector<Index>& mesh_indices = m->get_indices();
-            dynamic_indices.insert(std::end(dynamic_indices), std::begin(mesh_indices), std::end(mesh_indices));
-
-            m->as_byte_array(meshes.data()+mesh_offset, transformation, vertex_offset, index_offset, material_index);
+            m->as_byte_array(meshes.data()+mesh_offset, transformation, vertex_offset, index_offset, material_index, bvh_offset);
+            packed_meshes.push_back({vertex_offset, index_offset, material_index, bvh_offset, instance, first_triangle});
             mesh_offset += mesh_size_in_opengl;
         }
 
@@ -293,6 +788,639 @@ namespace Rt {
         for (auto n : node_child_nodes) {
             traverse_node_tree(n.get(), transformation);
         }
+
+        // Inserted last since the children's insertions may rehash packed_nodes
+        packed.meshes_end = meshes.size();
+        packed.lights_end = lights.size();
+        packed_nodes[node] = packed;
+    }
+
+    void Renderer::repack_node_tree(Node* node, glm::mat4 transformation) {
+        PackedNode& packed = packed_nodes.at(node);
+        packed.parent_transformation = transformation;
+        transformation *= node->get_transformation();
+
+        // A node's own light and meshes come first in its subtree's ranges
+        if (node->get_node_type() == Node::NodeType::LIGHT)
+            pack_light(reinterpret_cast<AbstractLight*>(node), transformation, packed.lights_begin / light_size_in_opengl);
+
+        size_t mesh_offset = packed.meshes_begin;
+        for (auto m : node->get_child_meshes()) {
+            const PackedMesh& packed_mesh = packed_meshes[mesh_offset / mesh_size_in_opengl - nr_static_meshes];
+            if (packed_mesh.instance >= 0)
+                instance_bounds[packed_mesh.instance] = m->get_bvh().get_bounds().transformed(transformation);
+            m->as_byte_array(meshes.data()+mesh_offset, transformation, packed_mesh.vertex_offset, packed_mesh.index_offset, packed_mesh.material_index, packed_mesh.bvh_offset);
+            mesh_offset += mesh_size_in_opengl;
+        }
+
+        for (auto n : node->get_child_nodes()) {
+            repack_node_tree(n.get(), transformation);
+        }
+    }
+
+    void Renderer::pack_light(AbstractLight* light, const glm::mat4& transformation, size_t light_index) {
+        light->as_byte_array(lights.data() + light_index*light_size_in_opengl, transformation);
+        // Only PointLights are sampled; SunLights reach every point anyway
+        if (light->get_light_type() == AbstractLight::LightType::POINTLIGHT)
+            light_weights[light_index] = LightSampler::luminance(light->get_radiance());
+        else
+            light_weights[light_index] = 0.0f;
+        // Lights without a cutoff radius (a radius of 0) are evaluated everywhere
+        float cutoff_radius = 0.0f;
+        if (light->get_light_type() == AbstractLight::LightType::POINTLIGHT)
+            cutoff_radius = static_cast<PointLight*>(light)->get_cutoff_radius();
+        light_spheres[light_index] = glm::vec4(glm::vec3(transformation[3]), cutoff_radius);
+    }
+
+    void Renderer::gather_light_spheres() {
+        light_sphere_bounds.clear();
+        light_sphere_indices.clear();
+        for (size_t i=0; i<packed_lights.size(); i++) {
+            if (packed_lights[i]->get_visibility() == AbstractLight::Visibility::SPHERE) {
+                glm::vec3 position = glm::vec3(light_spheres[i]);
+                light_sphere_bounds.push_back(AABB(position - light_sphere_radius, position + light_sphere_radius));
+                light_sphere_indices.push_back(i);
+            }
+        }
+    }
+
+    void Renderer::connect_node(Node* node) {
+        // Connecting again every full update is harmless with Qt::UniqueConnection
+        connect(node, &Node::translation_changed, this, &Renderer::mark_node_dirty, Qt::UniqueConnection);
+        connect(node, &Node::rotation_changed, this, &Renderer::mark_node_dirty, Qt::UniqueConnection);
+        connect(node, &Node::scale_changed, this, &Renderer::mark_node_dirty, Qt::UniqueConnection);
+        connect(node, &Node::transformation_changed, this, &Renderer::mark_node_dirty, Qt::UniqueConnection);
+        // Adding or removing geometry moves everything after it
+        connect(node, &Node::added_child_node, this, &Renderer::mark_scene_dirty, Qt::UniqueConnection);
+        connect(node, &Node::added_child_mesh, this, &Renderer::mark_scene_dirty, Qt::UniqueConnection);
+        connect(node, &Node::removed_child_node, this, &Renderer::mark_scene_dirty, Qt::UniqueConnection);
+        connect(node, &Node::removed_child_mesh, this, &Renderer::mark_scene_dirty, Qt::UniqueConnection);
+
+        if (node->get_node_type() == Node::NodeType::LIGHT) {
+            AbstractLight* light = reinterpret_cast<AbstractLight*>(node);
+            connect(light, &AbstractLight::radiance_changed, this, &Renderer::mark_node_dirty, Qt::UniqueConnection);
+            connect(light, &AbstractLight::ambient_multiplier_changed, this, &Renderer::mark_node_dirty, Qt::UniqueConnection);
+            connect(light, &AbstractLight::visibility_changed, this, &Renderer::mark_node_dirty, Qt::UniqueConnection);
+            if (light->get_light_type() == AbstractLight::LightType::POINTLIGHT)
+                connect(static_cast<PointLight*>(light), &PointLight::cutoff_radius_changed, this, &Renderer::mark_node_dirty, Qt::UniqueConnection);
+        }
+
+        for (auto m : node->get_child_meshes()) {
+            connect(m.get(), &Mesh::material_changed, this, &Renderer::mark_scene_dirty, Qt::UniqueConnection);
+            connect(m.get(), &Mesh::geometry_changed, this, &Renderer::mark_mesh_dirty, Qt::UniqueConnection);
+        }
+    }
+
+    void Renderer::mark_scene_dirty() {
+        scene_dirty = true;
+    }
+
+    void Renderer::mark_mesh_dirty() {
+        Mesh* mesh = qobject_cast<Mesh*>(sender());
+        if (mesh) dirty_meshes.insert(mesh);
+        scene_dirty = true;
+    }
+
+    void Renderer::mark_node_dirty() {
+        Node* node = qobject_cast<Node*>(sender());
+        if (node == nullptr) {
+            scene_dirty = true;
+            return;
+        }
+        // Nodes which aren't packed were removed from the scene (or belong to a replaced scene)
+        // which already caused a full update so moving them changes nothing
+        if (packed_nodes.find(node) != packed_nodes.end())
+            dirty_nodes.push_back(node);
+    }
+
+    Renderer::MeshAllocation& Renderer::allocate_mesh(const Node* node, const std::shared_ptr<Mesh>& mesh) {
+        MeshAllocation& allocation = mesh_allocations[{dynamic_geometry == DynamicGeometry::INSTANCED ? nullptr : node, mesh.get()}];
+        // Every instance of an instanced mesh shares its geometry and so does the same mesh twice
+        // in a node (it's transformed the same way)
+        if (allocation.used) return allocation;
+        allocation.used = true;
+        if (allocation.mesh.lock() == mesh && dirty_meshes.find(mesh.get()) == dirty_meshes.end())
+            return allocation;
+
+        free_mesh(allocation);
+        allocation.mesh = mesh;
+        allocation.nr_vertices = mesh->get_vertices().size();
+        allocation.nr_indices = mesh->get_indices().size();
+        allocation.nr_bvh_nodes = dynamic_geometry == DynamicGeometry::INSTANCED ? mesh->get_bvh().get_nodes().size() : 0;
+        if (allocation.nr_vertices > 0) {
+            allocation.vertex_offset = vertex_allocator.allocate(allocation.nr_vertices);
+            vertex_allocations[allocation.vertex_offset] = &allocation;
+        }
+        if (allocation.nr_indices > 0) {
+            allocation.index_offset = index_allocator.allocate(allocation.nr_indices);
+            index_allocations[allocation.index_offset] = &allocation;
+        }
+        if (allocation.nr_bvh_nodes > 0) {
+            allocation.bvh_offset = bvh_allocator.allocate(allocation.nr_bvh_nodes);
+            bvh_allocations[allocation.bvh_offset] = &allocation;
+        }
+        pending_mesh_uploads.emplace_back(&allocation, mesh);
+        return allocation;
+    }
+
+    void Renderer::free_mesh(MeshAllocation& allocation) {
+        if (allocation.nr_vertices > 0) {
+            vertex_allocator.free(allocation.vertex_offset);
+            vertex_allocations.erase(allocation.vertex_offset);
+        }
+        if (allocation.nr_indices > 0) {
+            index_allocator.free(allocation.index_offset);
+            index_allocations.erase(allocation.index_offset);
+        }
+        if (allocation.nr_bvh_nodes > 0) {
+            bvh_allocator.free(allocation.bvh_offset);
+            bvh_allocations.erase(allocation.bvh_offset);
+        }
+        allocation.vertex_offset = allocation.nr_vertices = 0;
+        allocation.index_offset = allocation.nr_indices = 0;
+        allocation.bvh_offset = allocation.nr_bvh_nodes = 0;
+    }
+
+    void Renderer::free_all_meshes() {
+        mesh_allocations.clear();
+        vertex_allocator.clear();
+        index_allocator.clear();
+        bvh_allocator.clear();
+        vertex_allocations.clear();
+        index_allocations.clear();
+        bvh_allocations.clear();
+        pending_mesh_uploads.clear();
+        dirty_meshes.clear();
+    }
+
+    void Renderer::upload_pending_meshes() {
+        unsigned int vertex_size = get_vertex_size_in_opengl();
+        reserve_dynamic_buffer(dynamic_vertex_ssbo, 4, dynamic_vertex_capacity, vertex_allocator.get_end()*vertex_size);
+        reserve_dynamic_buffer(dynamic_index_ssbo, 2, dynamic_index_capacity, index_allocator.get_end()*sizeof(Index));
+        if (dynamic_geometry == DynamicGeometry::INSTANCED)
+            reserve_dynamic_buffer(dynamic_bvh_ssbo, 10, dynamic_bvh_capacity, bvh_allocator.get_end()*bvh_node_size_in_opengl);
+
+        std::vector<unsigned char> bytes;
+        std::vector<Index> indices;
+        for (const std::pair<MeshAllocation*, std::shared_ptr<Mesh>>& pending : pending_mesh_uploads) {
+            const MeshAllocation& allocation = *pending.first;
+            Mesh& mesh = *pending.second;
+
+            const std::vector<Vertex>& mesh_vertices = mesh.get_vertices();
+            const unsigned char* vertex_data;
+            if (vertex_format == VertexFormat::COMPACT) {
+                // Encoded once per mesh rather than every upload
+                vertex_data = mesh.get_compact_vertices().data();
+            } else if (vertex_is_opengl_compatible) {
+                vertex_data = reinterpret_cast<const unsigned char*>(mesh_vertices.data());
+            } else {
+                bytes.resize(mesh_vertices.size()*vertex_size_in_opengl);
+                for (Index i=0; i<mesh_vertices.size(); i++)
+                    mesh_vertices[i].as_byte_array(bytes.data()+i*vertex_size_in_opengl);
+                vertex_data = bytes.data();
+            }
+            if (allocation.nr_vertices > 0) {
+                gl->glNamedBufferSubData(dynamic_vertex_ssbo, allocation.vertex_offset*vertex_size, allocation.nr_vertices*vertex_size, vertex_data);
+                nr_uploads++;
+                uploaded_bytes += allocation.nr_vertices*vertex_size;
+            }
+
+            const std::vector<Index>& mesh_indices = mesh.get_indices();
+            const Index* index_data = mesh_indices.data();
+            if (dynamic_geometry == DynamicGeometry::INSTANCED) {
+                // Store the triangles in the order of the BVH's leaves so the leaves can refer to them directly
+                indices.clear();
+                for (uint32_t triangle : mesh.get_bvh().get_primitive_indices()) {
+                    auto triangle_indices = std::begin(mesh_indices) + 3*triangle;
+                    indices.insert(std::end(indices), triangle_indices, triangle_indices+3);
+                }
+                indices.resize(mesh_indices.size());
+                index_data = indices.data();
+            }
+            if (allocation.nr_indices > 0) {
+                gl->glNamedBufferSubData(dynamic_index_ssbo, allocation.index_offset*sizeof(Index), allocation.nr_indices*sizeof(Index), index_data);
+                nr_uploads++;
+                uploaded_bytes += allocation.nr_indices*sizeof(Index);
+            }
+
+            if (allocation.nr_bvh_nodes > 0) {
+                bytes.clear();
+                mesh.get_bvh().nodes_as_byte_array(bytes);
+                gl->glNamedBufferSubData(dynamic_bvh_ssbo, allocation.bvh_offset*bvh_node_size_in_opengl, bytes.size(), bytes.data());
+                nr_uploads++;
+                uploaded_bytes += bytes.size();
+            }
+        }
+        pending_mesh_uploads.clear();
+    }
+
+    void Renderer::reserve_dynamic_buffer(unsigned int& buffer, unsigned int binding, size_t& capacity, size_t size) {
+        if (size <= capacity) return;
+        size_t new_capacity = std::max(size, 2*capacity);
+        unsigned int new_buffer;
+        gl->glCreateBuffers(1, &new_buffer);
+        gl->glNamedBufferData(new_buffer, new_capacity, nullptr, GL_DYNAMIC_DRAW);
+        // The resident geometry is copied on the GPU instead of being uploaded again
+        if (capacity > 0) gl->glCopyNamedBufferSubData(buffer, new_buffer, 0, 0, capacity);
+        gl->glDeleteBuffers(1, &buffer);
+        buffer = new_buffer;
+        gl->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, buffer);
+        capacity = new_capacity;
+    }
+
+    std::vector<Renderer::MeshAllocation*> Renderer::compact_dynamic_geometry() {
+        std::vector<MeshAllocation*> moved;
+        size_t budget = compaction_budget;
+        if (dynamic_geometry == DynamicGeometry::INSTANCED) {
+            compact(vertex_allocator, vertex_allocations, {{dynamic_vertex_ssbo, size_t(get_vertex_size_in_opengl()), 0}}, &MeshAllocation::vertex_offset, budget, moved);
+        } else {
+            // The transformed vertices move along so they don't have to be transformed again
+            compact(vertex_allocator, vertex_allocations, {
+                {dynamic_vertex_ssbo, size_t(get_vertex_size_in_opengl()), 0},
+                {vertex_position_ssbo, vertex_position_size_in_opengl, static_vertex_ssbo_size},
+                {vertex_attribute_ssbo, vertex_attribute_size_in_opengl, static_vertex_ssbo_size}
+            }, &MeshAllocation::vertex_offset, budget, moved);
+        }
+        compact(index_allocator, index_allocations, {{dynamic_index_ssbo, sizeof(Index), 0}}, &MeshAllocation::index_offset, budget, moved);
+        if (dynamic_geometry == DynamicGeometry::INSTANCED)
+            compact(bvh_allocator, bvh_allocations, {{dynamic_bvh_ssbo, bvh_node_size_in_opengl, 0}}, &MeshAllocation::bvh_offset, budget, moved);
+        // A mesh's vertices, indices and BVH nodes may all have moved
+        std::sort(moved.begin(), moved.end());
+        moved.erase(std::unique(moved.begin(), moved.end()), moved.end());
+        return moved;
+    }
+
+    void Renderer::compact(FreeListAllocator& allocator, std::unordered_map<size_t, MeshAllocation*>& allocations, std::initializer_list<CompactedBuffer> buffers, size_t MeshAllocation::* offset, size_t& budget, std::vector<MeshAllocation*>& moved) {
+        size_t from, to, size;
+        while (budget > 0 && allocator.find_move(from, to, size)) {
+            // The ranges never overlap so they can be copied within the buffer
+            for (const CompactedBuffer& buffer : buffers) {
+                gl->glCopyNamedBufferSubData(buffer.buffer, buffer.buffer, (buffer.first+from)*buffer.unit_size, (buffer.first+to)*buffer.unit_size, size*buffer.unit_size);
+                budget -= std::min(budget, size*buffer.unit_size);
+            }
+            allocator.move(from, to);
+            auto allocation = allocations.find(from);
+            if (allocation != allocations.end()) {
+                MeshAllocation* mesh_allocation = allocation->second;
+                allocations.erase(allocation);
+                mesh_allocation->*offset = to;
+                allocations[to] = mesh_allocation;
+                moved.push_back(mesh_allocation);
+            }
+        }
+    }
+
+    Index Renderer::repack_mesh_offsets(const MeshAllocation& allocation, size_t mesh_offset) {
+        PackedMesh& packed_mesh = packed_meshes[mesh_offset / mesh_size_in_opengl - nr_static_meshes];
+        Index old_vertex_offset = packed_mesh.vertex_offset;
+        std::shared_ptr<Mesh> mesh = allocation.mesh.lock();
+        if (!mesh) return old_vertex_offset;
+        packed_mesh.vertex_offset = allocation.vertex_offset;
+        packed_mesh.index_offset = allocation.index_offset + scene->get_static_indices().size();
+        if (packed_mesh.bvh_offset >= 0) packed_mesh.bvh_offset = allocation.bvh_offset;
+
+        // The record starts with its transformation, which stays the same
+        glm::mat4 transformation;
+        std::memcpy(&transformation, meshes.data()+mesh_offset, sizeof(glm::mat4));
+        mesh->as_byte_array(meshes.data()+mesh_offset, transformation, packed_mesh.vertex_offset, packed_mesh.index_offset, packed_mesh.material_index, packed_mesh.bvh_offset);
+
+        if (dynamic_geometry == DynamicGeometry::REFITTED || dynamic_geometry == DynamicGeometry::REBUILT) {
+            const std::vector<Index>& mesh_indices = mesh->get_indices();
+            uint32_t mesh_index = mesh_offset / mesh_size_in_opengl;
+            for (Index i=0; i+2<mesh_indices.size(); i+=3) {
+                uint32_t triangle = packed_mesh.first_triangle + i/3;
+                dynamic_triangles[2*triangle+0] = packed_mesh.index_offset + i;
+                dynamic_triangles[2*triangle+1] = mesh_index;
+                for (int j=0; j<3; j++)
+                    dynamic_triangle_vertices[3*triangle+j] = packed_mesh.vertex_offset + mesh_indices[i+j];
+            }
+        }
+        return old_vertex_offset;
+    }
+
+    void Renderer::move_mesh_records(const std::vector<MeshAllocation*>& moved, std::vector<std::pair<size_t, size_t>>& mesh_ranges) {
+        // The BVHs' topologies stay valid if they were built over the current triangles
+        bool refit_bvh_current = dynamic_geometry == DynamicGeometry::REFITTED && !refit_bvh.is_empty() && refit_bvh_triangles.size() == dynamic_triangles.size();
+        bool lbvh_current = dynamic_geometry == DynamicGeometry::REBUILT && lbvh_triangles.size() == dynamic_triangles.size();
+
+        // (old first vertex, mesh index, new first vertex) of the moved vertex meshes
+        std::vector<glm::uvec3> moved_vertex_meshes;
+        // Ranges of the moved meshes' triangles in dynamic_triangles
+        std::vector<std::pair<uint32_t, uint32_t>> moved_triangles;
+        for (MeshAllocation* allocation : moved) {
+            for (size_t record : allocation->records) {
+                Index old_vertex_offset = repack_mesh_offsets(*allocation, record);
+                mesh_ranges.emplace_back(record, record + mesh_size_in_opengl);
+
+                uint32_t mesh_index = record / mesh_size_in_opengl;
+                const PackedMesh& packed_mesh = packed_meshes[mesh_index - nr_static_meshes];
+                if (allocation->nr_vertices > 0 && old_vertex_offset != packed_mesh.vertex_offset)
+                    moved_vertex_meshes.emplace_back(old_vertex_offset, mesh_index, packed_mesh.vertex_offset);
+                if (refit_bvh_current || lbvh_current)
+                    moved_triangles.emplace_back(packed_mesh.first_triangle, packed_mesh.first_triangle + allocation->nr_indices/3);
+            }
+        }
+        if (dynamic_geometry == DynamicGeometry::INSTANCED) return;
+
+        // Find every moved entry while vertex_meshes is still sorted, then move them and sort again
+        std::vector<size_t> entries;
+        for (const glm::uvec3& moved_vertex_mesh : moved_vertex_meshes) {
+            auto entry = std::lower_bound(vertex_meshes.begin(), vertex_meshes.end(), moved_vertex_mesh.x, [](const glm::uvec2& a, uint32_t x) {return a.x < x;});
+            while (entry != vertex_meshes.end() && entry->x == moved_vertex_mesh.x && entry->y != moved_vertex_mesh.y) entry++;
+            entries.push_back(entry - vertex_meshes.begin());
+        }
+        for (size_t i=0; i<entries.size(); i++) {
+            if (entries[i] < vertex_meshes.size()) vertex_meshes[entries[i]].x = moved_vertex_meshes[i].z;
+        }
+        std::sort(vertex_meshes.begin(), vertex_meshes.end(), [](const glm::uvec2& a, const glm::uvec2& b) {return a.x < b.x;});
+
+        if (refit_bvh_current) {
+            // Only the moved triangles' leaf_slots in the BVH's leaf order are written again
+            std::vector<uint32_t> leaf_slots;
+            for (const std::pair<uint32_t, uint32_t>& range : moved_triangles) {
+                for (uint32_t triangle=range.first; triangle<range.second; triangle++) {
+                    refit_bvh_triangles[2*triangle+0] = dynamic_triangles[2*triangle+0];
+                    refit_bvh_triangles[2*triangle+1] = dynamic_triangles[2*triangle+1];
+                    for (int j=0; j<3; j++) refit_bvh_triangle_vertices[3*triangle+j] = dynamic_triangle_vertices[3*triangle+j];
+                    leaf_slots.push_back(refit_bvh_triangle_slots[triangle]);
+                }
+            }
+            std::sort(leaf_slots.begin(), leaf_slots.end());
+            const std::vector<uint32_t>& primitive_indices = refit_bvh.get_primitive_indices();
+            std::vector<uint32_t> triangles;
+            for (size_t i=0; i<leaf_slots.size();) {
+                size_t end = i+1;
+                while (end < leaf_slots.size() && leaf_slots[end] == leaf_slots[end-1]+1) end++;
+                triangles.clear();
+                for (size_t j=i; j<end; j++) {
+                    triangles.push_back(dynamic_triangles[2*primitive_indices[leaf_slots[j]]+0]);
+                    triangles.push_back(dynamic_triangles[2*primitive_indices[leaf_slots[j]]+1]);
+                }
+                gl->glNamedBufferSubData(dynamic_bvh_triangle_ssbo, 2*leaf_slots[i]*sizeof(uint32_t), triangles.size()*sizeof(uint32_t), triangles.data());
+                nr_uploads++;
+                uploaded_bytes += triangles.size()*sizeof(uint32_t);
+                i = end;
+            }
+        }
+
+        if (lbvh_current) {
+            // build_lbvh() sorts them into the leaves again
+            for (const std::pair<uint32_t, uint32_t>& range : moved_triangles) {
+                if (range.first == range.second) continue;
+                std::copy(dynamic_triangles.begin() + 2*range.first, dynamic_triangles.begin() + 2*range.second, lbvh_triangles.begin() + 2*range.first);
+                gl->glNamedBufferSubData(lbvh_triangle_ssbo, 2*range.first*sizeof(uint32_t), 2*(range.second-range.first)*sizeof(uint32_t), lbvh_triangles.data() + 2*range.first);
+                nr_uploads++;
+                uploaded_bytes += 2*(range.second-range.first)*sizeof(uint32_t);
+            }
+        }
+    }
+
+    bool Renderer::needs_compaction() const {
+        // Compacts once more than a quarter of the used part of a buffer is free
+        size_t from, to, size;
+        for (const FreeListAllocator* allocator : {&vertex_allocator, &index_allocator, &bvh_allocator}) {
+            if (allocator->get_end() - allocator->get_nr_allocated() > allocator->get_end()/4 && allocator->find_move(from, to, size))
+                return true;
+        }
+        return false;
+    }
+
+    void Renderer::upload_range(unsigned int buffer, const void* data, size_t size, size_t begin, size_t end) {
+        size_t& capacity = buffer_capacities[buffer];
+        if (size > capacity) {
+            capacity = std::max(size, 2*capacity);
+            gl->glNamedBufferData(buffer, capacity, nullptr, GL_DYNAMIC_DRAW);
+            begin = 0;
+            end = size;
+        }
+        if (begin >= end) return;
+        gl->glNamedBufferSubData(buffer, begin, end-begin, reinterpret_cast<const unsigned char*>(data) + begin);
+        nr_uploads++;
+        uploaded_bytes += end-begin;
+    }
+
+    void Renderer::upload(unsigned int buffer, const void* data, size_t size) {
+        upload_range(buffer, data, size, 0, size);
+    }
+
+    void Renderer::build_tlas() {
+        tlas.build(instance_bounds, 1);
+
+        tlas_nodes.clear();
+        tlas_nodes.resize(tlas.get_nodes().size() * bvh_node_size_in_opengl);
+        const std::vector<uint32_t>& instance_order = tlas.get_primitive_indices();
+        for (size_t i=0; i<tlas.get_nodes().size(); i++) {
+            BVHNode node = tlas.get_nodes()[i];
+            if (node.is_leaf()) {
+                node.left_or_first = instance_meshes[instance_order[node.left_or_first]];
+            }
+            node.as_byte_array(tlas_nodes.data() + i*bvh_node_size_in_opengl);
+        }
+    }
+
+    void Renderer::build_light_bvh() {
+        light_bvh_offset = tlas_nodes.size() / bvh_node_size_in_opengl;
+        if (light_sphere_bounds.empty()) {
+            nr_light_bvh_nodes = 0;
+            return;
+        }
+        light_bvh.build(light_sphere_bounds, 1);
+        nr_light_bvh_nodes = light_bvh.get_nodes().size();
+
+        tlas_nodes.resize(tlas_nodes.size() + nr_light_bvh_nodes * bvh_node_size_in_opengl);
+        const std::vector<uint32_t>& light_order = light_bvh.get_primitive_indices();
+        for (size_t i=0; i<nr_light_bvh_nodes; i++) {
+            BVHNode node = light_bvh.get_nodes()[i];
+            if (node.is_leaf())
+                node.left_or_first = light_sphere_indices[light_order[node.left_or_first]];
+            else
+                node.left_or_first += light_bvh_offset;
+            node.as_byte_array(tlas_nodes.data() + (light_bvh_offset+i)*bvh_node_size_in_opengl);
+        }
+    }
+
+    void Renderer::update_refit_bvh() {
+        if (dynamic_triangles.empty()) {
+            refit_bvh = BVH();
+            refit_bvh_triangles.clear();
+            refit_bvh_triangle_vertices.clear();
+            dynamic_bvh_ssbo_size = 0;
+            return;
+        }
+
+        // The hierarchy can only be refit if the triangles are the same as when it was built
+        if (refit_bvh.is_empty() || dynamic_triangles != refit_bvh_triangles || dynamic_triangle_vertices != refit_bvh_triangle_vertices) {
+            rebuild_refit_bvh(get_transformed_triangle_bounds());
+            return;
+        }
+
+        if (!gpu_refit) {
+            std::vector<AABB> triangle_bounds = get_transformed_triangle_bounds();
+            refit_bvh.refit(triangle_bounds);
+            refit_bvh_cost = refit_bvh.sah_cost();
+            if (refit_bvh_cost > refit_rebuild_ratio*refit_bvh_build_cost) {
+                nr_refit_rebuilds++;
+                rebuild_refit_bvh(triangle_bounds);
+                return;
+            }
+
+            std::vector<unsigned char> nodes;
+            refit_bvh.nodes_as_byte_array(nodes);
+            gl->glNamedBufferSubData(dynamic_bvh_ssbo, 0, nodes.size(), nodes.data());
+            return;
+        }
+
+        // Pick up the cost computed by an earlier refit if the GPU is done with it
+        // (never waits; the check is simply skipped until it is ready)
+        if (refit_cost_fence) {
+            GLenum status = gl->glClientWaitSync(refit_cost_fence, 0, 0);
+            if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED) {
+                gl->glDeleteSync(refit_cost_fence);
+                refit_cost_fence = nullptr;
+                gl->glGetNamedBufferSubData(refit_ssbo, 0, sizeof(float), &refit_bvh_cost);
+
+                if (refit_bvh_cost > refit_rebuild_ratio*refit_bvh_build_cost) {
+                    nr_refit_rebuilds++;
+                    rebuild_refit_bvh(get_transformed_triangle_bounds());
+                    return;
+                }
+            }
+        }
+
+        gl->glUseProgram(refit_shader.get_id());
+        refit_shader.set_uint("nr_static_indices", static_index_ssbo_size);
+        refit_shader.set_uint("nr_static_vertices", static_vertex_ssbo_size);
+        refit_shader.set_uint("nr_dynamic_bvh_nodes", dynamic_bvh_ssbo_size);
+
+        // One invocation per node, the leaves' invocations propagate the bounds up to the root
+        refit_shader.set_uint("refit_stage", 0);
+        gl->glDispatchCompute((dynamic_bvh_ssbo_size+63)/64, 1, 1);
+        gl->glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        if (!refit_cost_fence) {
+            refit_shader.set_uint("refit_stage", 1);
+            gl->glDispatchCompute(1, 1, 1);
+            gl->glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+            refit_cost_fence = gl->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        }
+        gl->glUseProgram(0);
+    }
+
+    void Renderer::rebuild_refit_bvh(const std::vector<AABB>& triangle_bounds) {
+        refit_bvh.build_binned(triangle_bounds);
+        refit_bvh_build_cost = refit_bvh.sah_cost();
+        refit_bvh_cost = refit_bvh_build_cost;
+        refit_bvh_triangles = dynamic_triangles;
+        refit_bvh_triangle_vertices = dynamic_triangle_vertices;
+        refit_bvh_triangle_slots.resize(refit_bvh.get_primitive_indices().size());
+        for (size_t i=0; i<refit_bvh_triangle_slots.size(); i++) refit_bvh_triangle_slots[refit_bvh.get_primitive_indices()[i]] = i;
+
+        // A pending cost belongs to the old hierarchy
+        if (refit_cost_fence) {
+            gl->glDeleteSync(refit_cost_fence);
+            refit_cost_fence = nullptr;
+        }
+
+        std::vector<unsigned char> nodes;
+        refit_bvh.nodes_as_byte_array(nodes);
+        gl->glNamedBufferData(dynamic_bvh_ssbo, nodes.size(), nodes.data(), GL_DYNAMIC_DRAW);
+        dynamic_bvh_ssbo_size = nodes.size() / bvh_node_size_in_opengl;
+
+        // The triangles in the order of the BVH's leaves
+        std::vector<uint32_t> triangles;
+        triangles.reserve(dynamic_triangles.size());
+        for (uint32_t triangle : refit_bvh.get_primitive_indices()) {
+            triangles.push_back(dynamic_triangles[2*triangle+0]);
+            triangles.push_back(dynamic_triangles[2*triangle+1]);
+        }
+        gl->glNamedBufferData(dynamic_bvh_triangle_ssbo, triangles.size()*sizeof(uint32_t), triangles.data(), GL_DYNAMIC_DRAW);
+
+        // Header (sah_cost, written by the shader, and padding) followed by (parent, 0) for every node
+        std::vector<uint32_t> refit_nodes{0, 0};
+        for (uint32_t parent : refit_bvh.get_parent_indices()) {
+            refit_nodes.push_back(parent);
+            refit_nodes.push_back(0);
+        }
+        gl->glNamedBufferData(refit_ssbo, refit_nodes.size()*sizeof(uint32_t), refit_nodes.data(), GL_DYNAMIC_DRAW);
+    }
+
+    std::vector<AABB> Renderer::get_transformed_triangle_bounds() {
+        // Only the positions have to be read back
+        std::vector<unsigned char> transformed_positions(dynamic_vertex_ssbo_size*vertex_position_size_in_opengl);
+        gl->glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+        gl->glGetNamedBufferSubData(vertex_position_ssbo, static_vertex_ssbo_size*vertex_position_size_in_opengl, transformed_positions.size(), transformed_positions.data());
+
+        std::vector<AABB> triangle_bounds(dynamic_triangle_vertices.size()/3);
+        for (size_t i=0; i<dynamic_triangle_vertices.size(); i++) {
+            glm::vec3 position;
+            unsigned char* tmp = reinterpret_cast<unsigned char*>(&position);
+            unsigned char const* vertex = transformed_positions.data() + dynamic_triangle_vertices[i]*vertex_position_size_in_opengl;
+            std::copy(vertex, vertex+12, tmp);
+            triangle_bounds[i/3].grow(position);
+        }
+        return triangle_bounds;
+    }
+
+    void Renderer::build_lbvh() {
+        uint32_t nr_triangles = dynamic_triangles.size() / 2;
+        if (nr_triangles == 0) {
+            lbvh_triangles.clear();
+            dynamic_bvh_ssbo_size = 0;
+            return;
+        }
+        unsigned int nr_work_groups = (nr_triangles + LBVH_WORK_GROUP_SIZE - 1) / LBVH_WORK_GROUP_SIZE;
+
+        if (dynamic_triangles != lbvh_triangles) {
+            lbvh_triangles = dynamic_triangles;
+            gl->glNamedBufferData(lbvh_triangle_ssbo, lbvh_triangles.size()*sizeof(uint32_t), lbvh_triangles.data(), GL_DYNAMIC_DRAW);
+
+            // A binary tree with one triangle per leaf
+            dynamic_bvh_ssbo_size = 2*nr_triangles - 1;
+            gl->glNamedBufferData(dynamic_bvh_ssbo, dynamic_bvh_ssbo_size*bvh_node_size_in_opengl, nullptr, GL_DYNAMIC_DRAW);
+            gl->glNamedBufferData(dynamic_bvh_triangle_ssbo, lbvh_triangles.size()*sizeof(uint32_t), nullptr, GL_DYNAMIC_DRAW);
+            // sah_cost and padding followed by (parent, 0) for every node (written by lbvh.glsl)
+            gl->glNamedBufferData(refit_ssbo, (2 + 2*dynamic_bvh_ssbo_size)*sizeof(uint32_t), nullptr, GL_DYNAMIC_DRAW);
+            // Centroid bounds, two buffers of (Morton code, triangle) pairs and the per work group digit counts
+            gl->glNamedBufferData(lbvh_sort_ssbo, (8 + 4*nr_triangles + LBVH_RADIX_SIZE*nr_work_groups)*sizeof(uint32_t), nullptr, GL_DYNAMIC_DRAW);
+        }
+
+        const uint32_t empty_centroid_bounds[8] = {
+            0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0,
+            0, 0, 0, 0
+        };
+        gl->glNamedBufferSubData(lbvh_sort_ssbo, 0, sizeof(empty_centroid_bounds), empty_centroid_bounds);
+
+        gl->glUseProgram(lbvh_shader.get_id());
+        lbvh_shader.set_uint("nr_static_indices", static_index_ssbo_size);
+        lbvh_shader.set_uint("nr_static_vertices", static_vertex_ssbo_size);
+        lbvh_shader.set_uint("nr_lbvh_triangles", nr_triangles);
+
+        // Every stage depends on the results of the one before it
+        auto dispatch_stage = [this](unsigned int stage, unsigned int nr_groups) {
+            lbvh_shader.set_uint("lbvh_stage", stage);
+            gl->glDispatchCompute(nr_groups, 1, 1);
+            gl->glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        };
+
+        dispatch_stage(0, nr_work_groups); // Centroid bounds
+        dispatch_stage(1, nr_work_groups); // Morton codes
+        for (int pass=0; pass<LBVH_SORT_PASSES; pass++) {
+            lbvh_shader.set_uint("sort_pass", pass);
+            dispatch_stage(2, nr_work_groups); // Count digits
+            dispatch_stage(3, 1);              // Prefix sum of the counts
+            dispatch_stage(4, nr_work_groups); // Scatter
+        }
+        dispatch_stage(5, nr_work_groups); // Hierarchy
+
+        // Fit the bounds bottom up like a refit
+        gl->glUseProgram(refit_shader.get_id());
+        refit_shader.set_uint("nr_static_indices", static_index_ssbo_size);
+        refit_shader.set_uint("nr_static_vertices", static_vertex_ssbo_size);
+        refit_shader.set_uint("nr_dynamic_bvh_nodes", dynamic_bvh_ssbo_size);
+        refit_shader.set_uint("refit_stage", 0);
+        gl->glDispatchCompute((dynamic_bvh_ssbo_size+63)/64, 1, 1);
+        gl->glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        gl->glUseProgram(0);
     }
 
     void Renderer::update_material_textures() {
@@ -3,12 +3,18 @@
 
 #include <QObject>
 #include <QOpenGLFunctions_4_5_Core>
+#include <unordered_map>
+#include <unordered_set>
+#include <map>
 
 #include "RaytracerGlobals.hpp"
 
 #include "rendering/AbstractCamera.hpp"
 #include "rendering/Shader.hpp"
 #include "rendering/OpenGLFunctions.hpp"
+#include "rendering/StageTimer.hpp"
+#include "rendering/RingBuffer.hpp"
+#include "rendering/FreeListAllocator.hpp"
 #include "materials/Texture.hpp"
 #include "materials/Material.hpp"
 #include "materials/MaterialManager.hpp"
@@ -16,6 +22,10 @@
 #include "scene/Node.hpp"
 #include "scene/Mesh.hpp"
 #include "scene/Scene.hpp"
+#include "acceleration/BVH.hpp"
+#include "scene/lights/LightSampler.hpp"
+#include "scene/lights/LightGrid.hpp"
+#include "scene/lights/AbstractLight.hpp"
 
 namespace Rt {
 
@@ -27,6 +37,136 @@ namespace Rt {
         ~Renderer();
         void initialize(OpenGLFunctions* gl);
 
+        // How meshes that aren't part of the Scene's static geometry are intersected
+        enum DynamicGeometry : int32_t {
+            // Each mesh has a BVH in object space; a top level BVH over the mesh instances
+            // is rebuilt each frame and rays are transformed into object space per instance
+            INSTANCED = 0,
+            // Vertices are transformed into world space by the vertex shader each frame
+            // and every triangle is tested
+            TRANSFORMED = 1,
+            // Like TRANSFORMED but the triangles are intersected through a world space BVH
+            // which is refit to the transformed vertices each frame; it is only rebuilt when
+            // the meshes change or its quality degrades past the refit rebuild ratio
+            REFITTED = 2,
+            // Like REFITTED but the world space BVH is rebuilt from scratch every frame by
+            // compute shaders (a linear BVH over the triangles sorted by their Morton codes)
+            // without anything being read back or uploaded per frame
+            REBUILT = 3
+        };
+        Q_ENUM(DynamicGeometry);
+        void set_dynamic_geometry(DynamicGeometry new_dynamic_geometry);
+        DynamicGeometry get_dynamic_geometry() const;
+
+        // Refit the REFITTED BVH with a compute shader (default) or on the CPU
+        // The CPU refit has to read the transformed vertices back every frame
+        void set_gpu_refit(bool new_gpu_refit);
+        bool get_gpu_refit() const;
+
+        // The REFITTED BVH is rebuilt once the SAH cost of the refit hierarchy exceeds
+        // its cost right after the last rebuild by this ratio (default 1.5)
+        void set_refit_rebuild_ratio(float new_refit_rebuild_ratio);
+        float get_refit_rebuild_ratio() const;
+        // Number of times the REFITTED BVH has been rebuilt since it was first built
+        unsigned int get_nr_refit_rebuilds() const;
+
+        // Traverse the static geometry through the compact QuantizedBVH copy of its BVH
+        // (default false; falls back to the full BVH if the scene's BVH couldn't be quantized)
+        void set_quantized_static_bvh(bool new_quantized_static_bvh);
+        bool get_quantized_static_bvh() const;
+
+        // How rays are intersected with triangles
+        enum TriangleIntersection : int32_t {
+            // The ray hits the triangle's plane and the hit point is tested with the areas of
+            // the sub-triangles it forms (not watertight: rays can slip between adjacent triangles)
+            LEGACY = 0,
+            // Watertight test of Woop et al. 2013 on the triangle's vertices sheared into ray space
+            // The static triangles are read from precomputed records holding their positions
+            // instead of going through their indices and vertices
+            WATERTIGHT = 1
+        };
+        Q_ENUM(TriangleIntersection);
+        // WATERTIGHT by default
+        void set_triangle_intersection(TriangleIntersection new_triangle_intersection);
+        TriangleIntersection get_triangle_intersection() const;
+
+        // How the untransformed static and dynamic vertices are stored on the GPU
+        enum VertexFormat : int32_t {
+            // Vertex as it is (64 bytes per vertex)
+            FULL = 0,
+            // Full position with octahedral normal and tangent and half float texture
+            // coordinates (24 bytes per vertex, see Vertex::as_compact_byte_array)
+            // Normals and tangents are off by up to 0.01 degrees and texture coordinates have
+            // 11 significant bits (an error of up to 0.00025 in [0,1])
+            COMPACT = 1
+        };
+        Q_ENUM(VertexFormat);
+        // FULL by default
+        void set_vertex_format(VertexFormat new_vertex_format);
+        VertexFormat get_vertex_format() const;
+
+        // Number of lights sampled per pixel out of the PointLights (default 0: every light is evaluated)
+        // Each sample resamples a few candidates picked in proportion to their power by how much
+        // light they'd deliver to the shaded point (radiance and distance falloff) and traces one
+        // shadow ray; SunLights are always evaluated
+        // The estimate is unbiased and uses different random numbers every frame so it converges
+        // to the same image as evaluating every light when accumulated over frames
+        void set_light_samples(unsigned int new_light_samples);
+        unsigned int get_light_samples() const;
+
+        // Only evaluate the PointLights whose cutoff radius reaches the shaded point (default true)
+        // A grid of the lights overlapping each of its cells is built over the lights' spheres of
+        // influence every frame; this only changes the performance, not the image
+        // Only used when every light is evaluated (no light samples)
+        void set_light_culling(bool new_light_culling);
+        bool get_light_culling() const;
+
+        // Stages of a frame which are timed when stage timing is on
+        enum Stage : int32_t {
+            // Walking the node tree and building the TLAS and light BVH (CPU time)
+            SCENE_TRAVERSAL = 0,
+            // Uploading the per frame buffers and material textures
+            UPLOAD = 1,
+            // The vertex_shader dispatch
+            VERTEX_SHADER = 2,
+            // Refitting or rebuilding the dynamic BVH (REFITTED and REBUILT only)
+            DYNAMIC_BVH = 3,
+            // The raytrace dispatch
+            RAYTRACE = 4,
+            // Drawing the render result (timed by whoever draws it, e.g. OpenGLWidget)
+            BLIT = 5
+        };
+        Q_ENUM(Stage);
+        static constexpr int nr_stages = 6;
+
+        // Time every stage of each frame (default false)
+        // Stages on the GPU are timed with a pair of GL_TIMESTAMP queries around each stage whose
+        // results are read back a few frames later so timing never waits for the GPU
+        void set_stage_timing(bool new_stage_timing);
+        bool get_stage_timing() const;
+        // Number of frames the stage statistics are over (default 120)
+        void set_stage_timing_window(unsigned int new_stage_timing_window);
+        unsigned int get_stage_timing_window() const;
+        // Mean, median and 99th percentile time of stage over the last frames
+        // Includes every result the GPU has finished so far without waiting for the others
+        TimingStatistics get_stage_statistics(Stage stage);
+
+        // Time the GPU commands issued in between as stage
+        // Does nothing unless stage timing is on
+        void begin_stage(Stage stage);
+        void end_stage(Stage stage);
+
+        // Write the mesh records, lights and TLAS into persistently mapped RingBuffers (default)
+        // or into plain buffers with glNamedBufferData and glNamedBufferSubData
+        void set_persistent_buffers(bool new_persistent_buffers);
+        bool get_persistent_buffers() const;
+
+        // Number of buffer uploads and bytes uploaded by the last update()
+        // Nodes are tracked through their signals so only what changed is re-packed and uploaded
+        // and an update() of a scene in which nothing changed uploads nothing
+        unsigned int get_nr_uploads() const;
+        size_t get_uploaded_bytes() const;
+
         bool update();
 
         // Returns true for a successful render
@@ -57,33 +197,242 @@ namespace Rt {
         // Note: not a "real" opengl vertex shader; rather, this is a compute
         // shader carrying out the function of a vertex shader
         Shader vertex_shader;
+        Shader refit_shader;
+        Shader lbvh_shader;
         int vertex_shader_work_group_size[3];
-        // This MUST match the Y_SIZE in vertex_shader.glsl
-        // See definition there for explanation
-        static constexpr int Y_SIZE = 64;
+        // OpenGL only guarantees this many work groups per dimension
+        static constexpr unsigned int max_work_groups = 65535;
 
-        unsigned int vertex_ssbo;
+        // The transformed vertices: their positions and their other attributes
+        unsigned int vertex_position_ssbo;
+        unsigned int vertex_attribute_ssbo;
         unsigned int vertex_ssbo_size;
+        // The static vertices are transformed once into the start of the buffers and kept there
+        // so the buffers only get reallocated (and the static vertices transformed again) to grow
+        size_t vertex_capacity;
+        bool static_vertices_transformed;
+        // Runs vertex_shader over the dynamic vertices (and the static ones if they aren't transformed yet)
+        void transform_vertices();
 
+        // (first vertex, mesh index) of every dynamic mesh with vertices sorted by first vertex so
+        // the vertex shader can binary search for the mesh transforming a vertex
+        std::vector<glm::uvec2> vertex_meshes;
+        unsigned int vertex_mesh_ssbo;
+        unsigned int vertex_mesh_ssbo_size;
+
+        VertexFormat vertex_format;
+        // Size of an untransformed vertex in the vertex format in use
+        int get_vertex_size_in_opengl() const;
         unsigned int static_vertex_ssbo;
         unsigned int static_vertex_ssbo_size;
+        void upload_static_vertices();
         unsigned int static_index_ssbo;
         unsigned int static_index_ssbo_size;
+        unsigned int static_bvh_ssbo;
+        unsigned int static_bvh_ssbo_size;
+        unsigned int static_triangle_record_ssbo;
+        TriangleIntersection triangle_intersection;
+        // Only the nodes of the format in use are uploaded
+        bool quantized_static_bvh;
+        unsigned int quantized_static_bvh_ssbo;
+        unsigned int quantized_static_bvh_ssbo_size;
+        void upload_static_bvh();
+        unsigned int nr_static_meshes;
 
         unsigned int dynamic_vertex_ssbo;
         unsigned int dynamic_vertex_ssbo_size;
         unsigned int dynamic_index_ssbo;
         unsigned int dynamic_index_ssbo_size;
 
-        std::vector<unsigned char> dynamic_vertices;
-        std::vector<Index> dynamic_indices;
+        // The geometry of every dynamic mesh gets ranges of the dynamic vertex, index and BVH
+        // buffers which are uploaded when the mesh is added and freed when it's removed, so adding
+        // or removing a mesh only costs as much as its own geometry
+        // Instanced meshes are intersected in object space so all their instances share one
+        // allocation; the other modes transform every vertex into exactly one mesh record so a
+        // mesh gets an allocation in every node it's in
+        struct MeshAllocation {
+            // Detects a new mesh at the address of a destroyed one
+            std::weak_ptr<Mesh> mesh;
+            size_t vertex_offset = 0;
+            size_t nr_vertices = 0;
+            size_t index_offset = 0;
+            size_t nr_indices = 0;
+            // Only used when dynamic_geometry is INSTANCED
+            size_t bvh_offset = 0;
+            size_t nr_bvh_nodes = 0;
+            // Reached by the last traversal; the others are freed after it
+            bool used = false;
+            // Byte offsets in meshes of the records packed with this geometry
+            std::vector<size_t> records;
+        };
+        // Keyed by (nullptr, mesh) when dynamic_geometry is INSTANCED
+        std::map<std::pair<const Node*, const Mesh*>, MeshAllocation> mesh_allocations;
+        FreeListAllocator vertex_allocator;
+        FreeListAllocator index_allocator;
+        FreeListAllocator bvh_allocator;
+        // The mesh allocation at every allocated offset of each allocator
+        std::unordered_map<size_t, MeshAllocation*> vertex_allocations;
+        std::unordered_map<size_t, MeshAllocation*> index_allocations;
+        std::unordered_map<size_t, MeshAllocation*> bvh_allocations;
+        // Sizes of the dynamic buffers in bytes
+        size_t dynamic_vertex_capacity;
+        size_t dynamic_index_capacity;
+        size_t dynamic_bvh_capacity;
+        // Allocated by the last traversal and uploaded after it
+        std::vector<std::pair<MeshAllocation*, std::shared_ptr<Mesh>>> pending_mesh_uploads;
+        // Meshes whose geometry changed since the last traversal
+        std::unordered_set<const Mesh*> dirty_meshes;
+        MeshAllocation& allocate_mesh(const Node* node, const std::shared_ptr<Mesh>& mesh);
+        void free_mesh(MeshAllocation& allocation);
+        void free_all_meshes();
+        void upload_pending_meshes();
+        // Grows buffer (bound to binding) to hold at least size bytes, keeping its contents
+        void reserve_dynamic_buffer(unsigned int& buffer, unsigned int binding, size_t& capacity, size_t size);
+        // Moves the highest allocations down into free ranges, copying at most compaction_budget
+        // bytes per update so compacting a large scene is spread over several frames
+        // Returns the allocations which moved (once each)
+        static constexpr size_t compaction_budget = 1 << 22;
+        std::vector<MeshAllocation*> compact_dynamic_geometry();
+        // A buffer whose contents move along with an allocator's ranges: unit_size bytes per
+        // allocated unit, with the allocator's offset 0 at unit first
+        struct CompactedBuffer {
+            unsigned int buffer;
+            size_t unit_size;
+            size_t first;
+        };
+        void compact(FreeListAllocator& allocator, std::unordered_map<size_t, MeshAllocation*>& allocations, std::initializer_list<CompactedBuffer> buffers, size_t MeshAllocation::* offset, size_t& budget, std::vector<MeshAllocation*>& moved);
+        bool needs_compaction() const;
+        // Re-packs the record at byte mesh_offset of meshes and its dynamic triangles with the
+        // allocation's current offsets; returns the record's old first vertex
+        Index repack_mesh_offsets(const MeshAllocation& allocation, size_t mesh_offset);
+        // Moves the moved meshes' geometry into the records, vertex meshes and dynamic BVH
+        // triangles without re-packing or re-transforming anything else
+        void move_mesh_records(const std::vector<MeshAllocation*>& moved, std::vector<std::pair<size_t, size_t>>& mesh_ranges);
+        void mark_mesh_dirty();
 
-        unsigned int mesh_ssbo;
+        // The mesh records, lights and TLAS change whenever a node moves so they're written
+        // straight into persistently mapped ring buffers
+        RingBuffer mesh_ssbo;
         unsigned int mesh_ssbo_size;
 
         std::vector<unsigned char> meshes;
         void traverse_node_tree(Node* node, glm::mat4 transformation=glm::mat4(1.0f));
 
+        // Where traverse_node_tree packed every node so a node whose transformation or light
+        // properties change can be re-packed in place with its subtree
+        struct PackedNode {
+            glm::mat4 parent_transformation;
+            // Byte ranges of the subtree's records in meshes and lights (contiguous in traversal order)
+            size_t meshes_begin;
+            size_t meshes_end;
+            size_t lights_begin;
+            size_t lights_end;
+        };
+        std::unordered_map<const Node*, PackedNode> packed_nodes;
+        // What the record of every dynamic mesh was packed with
+        struct PackedMesh {
+            Index vertex_offset;
+            Index index_offset;
+            MaterialIndex material_index;
+            int32_t bvh_offset;
+            // Index in instance_bounds or -1
+            int32_t instance;
+            // Index of its first triangle in dynamic_triangles (REFITTED and REBUILT only)
+            uint32_t first_triangle;
+        };
+        std::vector<PackedMesh> packed_meshes;
+        // The light of every record in lights
+        std::vector<AbstractLight*> packed_lights;
+        void repack_node_tree(Node* node, glm::mat4 transformation);
+        void pack_light(AbstractLight* light, const glm::mat4& transformation, size_t light_index);
+        // Collects light_sphere_bounds and light_sphere_indices from the packed lights
+        void gather_light_spheres();
+
+        // Everything is re-packed and uploaded by the next update()
+        bool scene_dirty;
+        // The light sampler and grid are rebuilt by the next update()
+        bool lights_dirty;
+        // Nodes re-packed by the next update()
+        std::vector<Node*> dirty_nodes;
+        void mark_scene_dirty();
+        void mark_node_dirty();
+        void connect_node(Node* node);
+
+        // Writes bytes [begin, end) of data (size bytes) to buffer so it holds a copy of data
+        // The buffer's storage only grows (to at least twice its size); growing it uploads all of data
+        void upload_range(unsigned int buffer, const void* data, size_t size, size_t begin, size_t end);
+        void upload(unsigned int buffer, const void* data, size_t size);
+        std::unordered_map<unsigned int, size_t> buffer_capacities;
+        unsigned int nr_uploads;
+        size_t uploaded_bytes;
+        size_t uploaded_material_bytes;
+
+        DynamicGeometry dynamic_geometry;
+
+        // Bottom level: the object space BVHs of every dynamic mesh in their allocations
+        // (holds refit_bvh instead when dynamic_geometry is REFITTED and the linear BVH when it is REBUILT)
+        unsigned int dynamic_bvh_ssbo;
+        unsigned int dynamic_bvh_ssbo_size;
+
+        // Top level: BVH over the world space bounds of the dynamic mesh instances
+        // Leaves hold the index of their mesh instead of a primitive index
+        BVH tlas;
+        std::vector<AABB> instance_bounds;
+        std::vector<MeshIndex> instance_meshes;
+        std::vector<unsigned char> tlas_nodes;
+        RingBuffer tlas_ssbo;
+        unsigned int tlas_ssbo_size;
+        void build_tlas();
+
+        // BVH over the spheres of the visible lights; its nodes are appended to tlas_nodes
+        // Leaves hold the index of their light instead of a primitive index
+        BVH light_bvh;
+        std::vector<AABB> light_sphere_bounds;
+        std::vector<uint32_t> light_sphere_indices;
+        unsigned int light_bvh_offset;
+        unsigned int nr_light_bvh_nodes;
+        void build_light_bvh();
+
+        // World space BVH over every dynamic triangle for DynamicGeometry::REFITTED
+        BVH refit_bvh;
+        // Per dynamic triangle: the index of its first index and its mesh index
+        std::vector<uint32_t> dynamic_triangles;
+        // Per dynamic triangle: its 3 vertices relative to the first dynamic vertex
+        std::vector<Index> dynamic_triangle_vertices;
+        // The triangles refit_bvh was built over; the BVH is rebuilt when they change
+        std::vector<uint32_t> refit_bvh_triangles;
+        std::vector<Index> refit_bvh_triangle_vertices;
+        // Where every triangle is in dynamic_bvh_triangle_ssbo (the BVH's leaf order)
+        std::vector<uint32_t> refit_bvh_triangle_slots;
+        unsigned int dynamic_bvh_triangle_ssbo;
+        // Parent indices for the compute shader refit and the SAH cost it computes
+        unsigned int refit_ssbo;
+        bool gpu_refit;
+        float refit_rebuild_ratio;
+        float refit_bvh_build_cost;
+        float refit_bvh_cost;
+        unsigned int nr_refit_rebuilds;
+        // Signalled once the cost computed by the last compute shader refit can be read
+        GLsync refit_cost_fence;
+        void update_refit_bvh();
+        void rebuild_refit_bvh(const std::vector<AABB>& triangle_bounds);
+        // Reads the transformed dynamic vertices back from the vertex buffer (stalls until
+        // the vertex shader is done)
+        std::vector<AABB> get_transformed_triangle_bounds();
+
+        // Linear BVH built by lbvh.glsl for DynamicGeometry::REBUILT
+        // The triangles it was built over; the buffers are only reallocated when they change
+        std::vector<uint32_t> lbvh_triangles;
+        unsigned int lbvh_triangle_ssbo;
+        // Centroid bounds, Morton codes and radix sort scratch space
+        unsigned int lbvh_sort_ssbo;
+        // These MUST match WORK_GROUP_SIZE and RADIX_SIZE in lbvh.glsl
+        static constexpr int LBVH_WORK_GROUP_SIZE = 64;
+        static constexpr int LBVH_RADIX_SIZE = 16;
+        // Number of radix sort passes over the 30 bit Morton codes (4 bits per pass)
+        static constexpr int LBVH_SORT_PASSES = 8;
+        void build_lbvh();
+
         unsigned int material_ssbo;
         unsigned int material_ssbo_size;
 
@@ -92,9 +441,28 @@ namespace Rt {
         void update_material_textures();
 
         std::vector<unsigned char> lights;
-        unsigned int light_ssbo;
+        RingBuffer light_ssbo;
         unsigned int light_ssbo_size;
 
+        // Alias table over the PointLights' power for set_light_samples()
+        std::vector<float> light_weights;
+        LightSampler light_sampler;
+        std::vector<unsigned char> light_samples;
+        unsigned int light_sampler_ssbo;
+        unsigned int nr_light_samples;
+        // World space grid over the PointLights' cutoff radii for set_light_culling()
+        std::vector<glm::vec4> light_spheres;
+        LightGrid light_grid;
+        std::vector<unsigned char> light_grid_cells;
+        unsigned int light_grid_ssbo;
+        bool light_culling;
+
+        StageTimer stage_timer;
+        bool stage_timing;
+
+        // Seeds the random numbers in raytrace.glsl
+        uint32_t frame_index;
+
         unsigned int prev_width;
         unsigned int prev_height;
     };
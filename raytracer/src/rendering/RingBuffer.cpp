@@ -0,0 +1,189 @@
+#include "RingBuffer.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace Rt {
+
+    namespace {
+
+        // Sorts ranges and merges the ones which overlap or touch
+        void merge_ranges(std::vector<std::pair<size_t, size_t>>& ranges) {
+            std::sort(ranges.begin(), ranges.end());
+            size_t nr_merged = 0;
+            for (const std::pair<size_t, size_t>& range : ranges) {
+                if (nr_merged > 0 && range.first <= ranges[nr_merged-1].second)
+                    ranges[nr_merged-1].second = std::max(ranges[nr_merged-1].second, range.second);
+                else
+                    ranges[nr_merged++] = range;
+            }
+            ranges.resize(nr_merged);
+        }
+
+    }
+
+    RingBuffer::RingBuffer() {
+        gl = nullptr;
+        binding = 0;
+        buffer = 0;
+        mapping = nullptr;
+        region_size = 0;
+        alignment = 1;
+        region = 0;
+        size = 0;
+        for (unsigned int i=0; i<nr_regions; i++) {
+            fences[i] = nullptr;
+            stale[i] = true;
+        }
+        nr_stalls = 0;
+        persistent = true;
+    }
+
+    RingBuffer::~RingBuffer() {
+        if (!gl) return;
+        gl->make_current();
+        release();
+    }
+
+    void RingBuffer::initialize(OpenGLFunctions* gl, unsigned int binding) {
+        this->gl = gl;
+        this->binding = binding;
+        gl->make_current();
+
+        // Regions are bound with glBindBufferRange so they have to start at aligned offsets
+        GLint offset_alignment = 1;
+        gl->glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &offset_alignment);
+        alignment = std::max(offset_alignment, 1);
+
+        // Something is always bound even before the first write
+        allocate(alignment);
+    }
+
+    size_t RingBuffer::write(const void* data, size_t new_size, const std::vector<std::pair<size_t, size_t>>& ranges) {
+        if (new_size > region_size)
+            allocate(std::max(new_size, 2*region_size));
+
+        if (!persistent) {
+            // Everything changed if the size did
+            std::vector<std::pair<size_t, size_t>> changed = ranges;
+            if (new_size != size) changed = {{0, new_size}};
+            size = new_size;
+            merge_ranges(changed);
+            const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+            size_t copied = 0;
+            for (const std::pair<size_t, size_t>& range : changed) {
+                size_t end = std::min(range.second, size);
+                if (range.first >= end) continue;
+                gl->glNamedBufferSubData(buffer, range.first, end - range.first, bytes + range.first);
+                copied += end - range.first;
+            }
+            return copied;
+        }
+
+        if (new_size != size) {
+            size = new_size;
+            for (unsigned int i=0; i<nr_regions; i++) stale[i] = true;
+        } else {
+            for (unsigned int i=0; i<nr_regions; i++) {
+                if (!stale[i]) missed_ranges[i].insert(missed_ranges[i].end(), ranges.begin(), ranges.end());
+            }
+        }
+
+        // Everything issued since the current region was written may read it
+        if (fences[region]) gl->glDeleteSync(fences[region]);
+        fences[region] = gl->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+        region = (region + 1) % nr_regions;
+        if (fences[region]) {
+            // The GPU is nr_regions writes behind
+            GLenum status = gl->glClientWaitSync(fences[region], GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+            if (status == GL_TIMEOUT_EXPIRED) {
+                nr_stalls++;
+                do {
+                    status = gl->glClientWaitSync(fences[region], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+                } while (status == GL_TIMEOUT_EXPIRED);
+            }
+            gl->glDeleteSync(fences[region]);
+            fences[region] = nullptr;
+        }
+
+        unsigned char* region_data = mapping + region*region_size;
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+        size_t copied = 0;
+        if (stale[region]) {
+            std::memcpy(region_data, bytes, size);
+            copied = size;
+        } else {
+            merge_ranges(missed_ranges[region]);
+            for (const std::pair<size_t, size_t>& range : missed_ranges[region]) {
+                size_t end = std::min(range.second, size);
+                if (range.first >= end) continue;
+                std::memcpy(region_data + range.first, bytes + range.first, end - range.first);
+                copied += end - range.first;
+            }
+        }
+        missed_ranges[region].clear();
+        stale[region] = false;
+
+        gl->glBindBufferRange(GL_SHADER_STORAGE_BUFFER, binding, buffer, region*region_size, region_size);
+        return copied;
+    }
+
+    size_t RingBuffer::write(const void* data, size_t new_size) {
+        return write(data, new_size, {{0, new_size}});
+    }
+
+    unsigned int RingBuffer::get_nr_stalls() const {
+        return nr_stalls;
+    }
+
+    void RingBuffer::set_persistent(bool new_persistent) {
+        if (persistent == new_persistent) return;
+        persistent = new_persistent;
+        if (!gl) return;
+        gl->make_current();
+        allocate(region_size);
+    }
+
+    bool RingBuffer::get_persistent() const {
+        return persistent;
+    }
+
+    void RingBuffer::allocate(size_t new_region_size) {
+        release();
+
+        region_size = (new_region_size + alignment - 1) / alignment * alignment;
+        region = 0;
+        size = 0;
+        if (!persistent) {
+            gl->glCreateBuffers(1, &buffer);
+            gl->glNamedBufferData(buffer, region_size, nullptr, GL_DYNAMIC_DRAW);
+            gl->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, buffer);
+            return;
+        }
+
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        gl->glCreateBuffers(1, &buffer);
+        gl->glNamedBufferStorage(buffer, region_size*nr_regions, nullptr, flags);
+        mapping = static_cast<unsigned char*>(gl->glMapNamedBufferRange(buffer, 0, region_size*nr_regions, flags));
+
+        for (unsigned int i=0; i<nr_regions; i++) {
+            stale[i] = true;
+            missed_ranges[i].clear();
+        }
+        gl->glBindBufferRange(GL_SHADER_STORAGE_BUFFER, binding, buffer, 0, region_size);
+    }
+
+    void RingBuffer::release() {
+        // The GPU keeps a deleted buffer alive until the commands using it have finished
+        for (unsigned int i=0; i<nr_regions; i++) {
+            if (fences[i]) gl->glDeleteSync(fences[i]);
+            fences[i] = nullptr;
+        }
+        if (mapping) gl->glUnmapNamedBuffer(buffer);
+        if (buffer) gl->glDeleteBuffers(1, &buffer);
+        buffer = 0;
+        mapping = nullptr;
+    }
+
+}
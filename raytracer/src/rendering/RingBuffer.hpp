@@ -0,0 +1,76 @@
+#ifndef RT_RING_BUFFER_HPP
+#define RT_RING_BUFFER_HPP
+
+#include <QtGlobal>
+#include <utility>
+#include <vector>
+
+#include "RaytracerGlobals.hpp"
+#include "rendering/OpenGLFunctions.hpp"
+
+namespace Rt {
+
+    // Shader storage buffer for data which is rewritten while the GPU may still be reading the
+    // previous frames' copies (e.g. the mesh records and lights of moving nodes)
+    // The immutable storage is split into nr_regions regions and stays persistently and coherently
+    // mapped so writes are plain copies into GPU visible memory without the driver copying or
+    // reallocating anything; every write goes to the next region, whose previous contents are
+    // fenced when the region after them is written
+    // Only grows; the storage is recreated (at least twice as large) when data doesn't fit
+    // Updating a buffer the GPU is still reading with glNamedBufferSubData makes the driver either
+    // wait for the GPU or copy the data aside first, and orphaning it with glNamedBufferData makes
+    // it allocate new storage; the ring does neither and pays a fence and a plain memcpy per write
+    // Drivers whose buffers live in system memory (e.g. llvmpipe) do neither either, so there the
+    // fence makes the ring slower than a plain buffer (compare both with the "upload" benchmark)
+    class RAYTRACER_LIB_EXPORT RingBuffer {
+    public:
+        RingBuffer();
+        ~RingBuffer();
+
+        static constexpr unsigned int nr_regions = 3;
+
+        // binding is the shader storage binding point the current region is bound to
+        void initialize(OpenGLFunctions* gl, unsigned int binding);
+
+        // Makes the buffer's contents size bytes of data; ranges are the byte ranges [begin, end)
+        // which changed since the last write (everything changed if size did)
+        // Returns the number of bytes copied
+        size_t write(const void* data, size_t size, const std::vector<std::pair<size_t, size_t>>& ranges);
+        size_t write(const void* data, size_t size);
+
+        // Number of times a write had to wait for the GPU to finish reading a region
+        unsigned int get_nr_stalls() const;
+
+        // Persistently mapped regions (default) or a single plain buffer updated with
+        // glNamedBufferData and glNamedBufferSubData (which is what the ring replaced)
+        // Switching recreates the storage; the next write has to write everything
+        void set_persistent(bool new_persistent);
+        bool get_persistent() const;
+
+    private:
+        OpenGLFunctions* gl;
+        unsigned int binding;
+
+        unsigned int buffer;
+        unsigned char* mapping;
+        size_t region_size;
+        size_t alignment;
+        unsigned int region;
+        // Bytes of data in every region
+        size_t size;
+        // Completion of the commands issued while each region was current
+        GLsync fences[nr_regions];
+        // Ranges each region missed since it was last written (the region is rewritten
+        // entirely if it is stale)
+        std::vector<std::pair<size_t, size_t>> missed_ranges[nr_regions];
+        bool stale[nr_regions];
+        unsigned int nr_stalls;
+        bool persistent;
+
+        void allocate(size_t new_region_size);
+        void release();
+    };
+
+}
+
+#endif
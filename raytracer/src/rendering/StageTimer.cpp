@@ -0,0 +1,129 @@
+#include "StageTimer.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace Rt {
+
+    StageTimer::StageTimer() {
+        gl = nullptr;
+        window = 120;
+    }
+
+    StageTimer::~StageTimer() {
+        if (!gl) return;
+        gl->make_current();
+        for (Stage& stage : stages) gl->glDeleteQueries(nr_queries*2, &stage.queries[0][0]);
+    }
+
+    void StageTimer::initialize(OpenGLFunctions* gl, unsigned int nr_stages) {
+        this->gl = gl;
+        gl->make_current();
+        stages.resize(nr_stages);
+        for (Stage& stage : stages) {
+            gl->glGenQueries(nr_queries*2, &stage.queries[0][0]);
+            std::fill(stage.pending, stage.pending+nr_queries, false);
+            stage.next_query = 0;
+            stage.active_query = -1;
+            stage.next_sample = 0;
+        }
+    }
+
+    void StageTimer::set_window(unsigned int new_window) {
+        window = std::max(new_window, 1u);
+        for (Stage& stage : stages) {
+            // Keep the newest samples in order
+            std::vector<double> samples;
+            for (size_t i=0; i<stage.samples.size(); i++)
+                samples.push_back(stage.samples[(stage.next_sample+i) % stage.samples.size()]);
+            if (samples.size() > window) samples.erase(samples.begin(), samples.end()-window);
+            stage.samples = samples;
+            stage.next_sample = 0;
+        }
+    }
+
+    unsigned int StageTimer::get_window() const {
+        return window;
+    }
+
+    void StageTimer::begin(unsigned int stage) {
+        Stage& s = stages[stage];
+        int query = s.next_query;
+        // Already being timed or the GPU is more than nr_queries measurements behind
+        // (skip this one instead of waiting)
+        if (s.active_query >= 0 || s.pending[query]) return;
+
+        gl->glQueryCounter(s.queries[query][0], GL_TIMESTAMP);
+        s.active_query = query;
+    }
+
+    void StageTimer::end(unsigned int stage) {
+        Stage& s = stages[stage];
+        if (s.active_query < 0) return;
+
+        gl->glQueryCounter(s.queries[s.active_query][1], GL_TIMESTAMP);
+        s.pending[s.active_query] = true;
+        s.next_query = (s.active_query+1) % nr_queries;
+        s.active_query = -1;
+    }
+
+    void StageTimer::add_sample(unsigned int stage, double milliseconds) {
+        Stage& s = stages[stage];
+        if (s.samples.size() < window) {
+            s.samples.push_back(milliseconds);
+        }
+        else {
+            s.samples[s.next_sample] = milliseconds;
+            s.next_sample = (s.next_sample+1) % window;
+        }
+    }
+
+    void StageTimer::collect() {
+        for (unsigned int stage=0; stage<stages.size(); stage++) {
+            Stage& s = stages[stage];
+            // Oldest first so the samples stay in order
+            for (int i=0; i<nr_queries; i++) {
+                int query = (s.next_query+i) % nr_queries;
+                if (!s.pending[query]) continue;
+
+                // Queries finish in order so the start is available once the end is
+                GLint available = GL_FALSE;
+                gl->glGetQueryObjectiv(s.queries[query][1], GL_QUERY_RESULT_AVAILABLE, &available);
+                if (!available) break;
+
+                GLuint64 start = 0, end = 0;
+                gl->glGetQueryObjectui64v(s.queries[query][0], GL_QUERY_RESULT, &start);
+                gl->glGetQueryObjectui64v(s.queries[query][1], GL_QUERY_RESULT, &end);
+                s.pending[query] = false;
+                add_sample(stage, (end - start) / 1.0e6);
+            }
+        }
+    }
+
+    TimingStatistics StageTimer::get_statistics(unsigned int stage) const {
+        TimingStatistics statistics{0.0, 0.0, 0.0, 0};
+        std::vector<double> samples = stages[stage].samples;
+        if (samples.empty()) return statistics;
+
+        std::sort(samples.begin(), samples.end());
+        double sum = 0.0;
+        for (double sample : samples) sum += sample;
+        statistics.mean = sum / samples.size();
+        // Nearest rank percentiles
+        statistics.p50 = samples[size_t(std::ceil(0.50*samples.size())) - 1];
+        statistics.p99 = samples[size_t(std::ceil(0.99*samples.size())) - 1];
+        statistics.nr_samples = samples.size();
+        return statistics;
+    }
+
+    void StageTimer::clear() {
+        for (Stage& stage : stages) {
+            stage.active_query = -1;
+            // Results of pending queries are simply never read; the queries are reused
+            std::fill(stage.pending, stage.pending+nr_queries, false);
+            stage.samples.clear();
+            stage.next_sample = 0;
+        }
+    }
+
+}
@@ -0,0 +1,76 @@
+#ifndef RT_STAGE_TIMER_HPP
+#define RT_STAGE_TIMER_HPP
+
+#include <QtGlobal>
+#include <vector>
+
+#include "RaytracerGlobals.hpp"
+#include "rendering/OpenGLFunctions.hpp"
+
+namespace Rt {
+
+    // Rolling statistics over the last samples of a stage in milliseconds
+    struct RAYTRACER_LIB_EXPORT TimingStatistics {
+        double mean;
+        double p50;
+        double p99;
+        // Number of samples the statistics are over (0 if the stage hasn't been measured yet)
+        unsigned int nr_samples;
+    };
+
+    // Measures how long the GPU spends on stages of a frame with a GL_TIMESTAMP query at the
+    // start and end of each (unlike GL_TIME_ELAPSED queries these can overlap and they also work
+    // on Mesa's llvmpipe, whose elapsed time queries always read 0)
+    // Every stage has a small ring of query pairs and a pair's result is only read once the GPU
+    // has made it available (usually a frame or two later) so timing never waits for the GPU
+    // If all pairs of a stage are still pending the stage isn't measured that time
+    class RAYTRACER_LIB_EXPORT StageTimer {
+    public:
+        StageTimer();
+        ~StageTimer();
+
+        void initialize(OpenGLFunctions* gl, unsigned int nr_stages);
+
+        // Number of samples per stage the statistics are over (default 120)
+        void set_window(unsigned int new_window);
+        unsigned int get_window() const;
+
+        // Times the commands issued between begin() and end() of stage
+        void begin(unsigned int stage);
+        void end(unsigned int stage);
+
+        // Adds a sample measured some other way (e.g. work on the CPU)
+        void add_sample(unsigned int stage, double milliseconds);
+
+        // Reads the results of the queries the GPU has finished without waiting for the others
+        void collect();
+
+        TimingStatistics get_statistics(unsigned int stage) const;
+
+        // Drops every sample and any pending query
+        void clear();
+
+    private:
+        OpenGLFunctions* gl;
+
+        // Query pairs per stage; results are read at most this many measurements later
+        static constexpr int nr_queries = 4;
+
+        struct Stage {
+            // The start and end timestamps of every pair
+            unsigned int queries[nr_queries][2];
+            bool pending[nr_queries];
+            int next_query;
+            // Pair between begin() and end() or -1
+            int active_query;
+            // Ring of the last window samples
+            std::vector<double> samples;
+            size_t next_sample;
+        };
+        std::vector<Stage> stages;
+        unsigned int window;
+    };
+
+}
+
+#endif
@@ -0,0 +1,119 @@
+#include "TileScheduler.hpp"
+
+namespace Rt {
+
+    TileScheduler::TileScheduler() {
+        nr_deques = 0;
+        nr_steals = 0;
+        work_stealing = true;
+    }
+
+    void TileScheduler::reset(const std::vector<unsigned int>& new_tiles, unsigned int nr_threads, const std::vector<double>& tile_costs) {
+        tiles = new_tiles;
+        if (nr_deques != nr_threads) {
+            nr_deques = nr_threads;
+            deques.reset(new Deque[nr_deques]);
+        }
+        nr_steals = 0;
+        for (unsigned int i=0; i<nr_deques; i++) {
+            deques[i].stolen = false;
+            deques[i].random_state = 2654435761u * (i+1);
+        }
+
+        double total_cost = 0.0;
+        for (unsigned int tile : tiles) {
+            if (tile < tile_costs.size()) total_cost += tile_costs[tile];
+        }
+        if (total_cost <= 0.0 || !work_stealing) {
+            for (unsigned int i=0; i<nr_deques; i++) {
+                deques[i].begin = tiles.size() * i / nr_deques;
+                deques[i].end = tiles.size() * (i+1) / nr_deques;
+            }
+            return;
+        }
+
+        // Cut the order wherever the running cost passes the next multiple of total_cost/nr_deques
+        size_t tile = 0;
+        double cost = 0.0;
+        for (unsigned int i=0; i<nr_deques; i++) {
+            deques[i].begin = tile;
+            double deque_end_cost = total_cost * (i+1) / nr_deques;
+            while (tile < tiles.size() && (i+1 == nr_deques || cost < deque_end_cost)) {
+                if (tiles[tile] < tile_costs.size()) cost += tile_costs[tiles[tile]];
+                tile++;
+            }
+            deques[i].end = tile;
+        }
+    }
+
+    bool TileScheduler::next_tile(unsigned int thread, unsigned int& tile, bool& stolen) {
+        Deque& own = deques[thread];
+        while (true) {
+            {
+                std::lock_guard<std::mutex> lock(own.mutex);
+                if (own.begin < own.end) {
+                    tile = tiles[own.begin++];
+                    stolen = own.stolen;
+                    return true;
+                }
+            }
+            if (!steal(thread)) return false;
+        }
+    }
+
+    bool TileScheduler::steal(unsigned int thread) {
+        if (nr_deques < 2 || !work_stealing) return false;
+
+        Deque& own = deques[thread];
+        own.random_state ^= own.random_state << 13;
+        own.random_state ^= own.random_state >> 17;
+        own.random_state ^= own.random_state << 5;
+        unsigned int first_victim = own.random_state % (nr_deques-1);
+
+        // Try every other deque once starting at a random one and skip the ones which are locked;
+        // only if all of those were busy or empty go round again waiting for the locks
+        // Tiles can only be missed while another thief is moving them and that thief renders them
+        for (int pass=0; pass<2; pass++) {
+            bool skipped = false;
+            for (unsigned int i=0; i<nr_deques-1; i++) {
+                unsigned int victim = (thread + 1 + (first_victim + i) % (nr_deques-1)) % nr_deques;
+                std::unique_lock<std::mutex> lock(deques[victim].mutex, std::defer_lock);
+                if (pass == 0 && !lock.try_lock()) {
+                    skipped = true;
+                    continue;
+                }
+                if (pass == 1) lock.lock();
+                if (deques[victim].begin >= deques[victim].end) continue;
+
+                // The back half stays contiguous which keeps the stolen tiles close together
+                size_t end = deques[victim].end;
+                size_t begin = end - (deques[victim].end - deques[victim].begin + 1) / 2;
+                deques[victim].end = begin;
+                lock.unlock();
+
+                // Our deque is empty so other thieves have nothing to take from it until it is refilled
+                std::lock_guard<std::mutex> own_lock(own.mutex);
+                own.begin = begin;
+                own.end = end;
+                own.stolen = true;
+                nr_steals++;
+                return true;
+            }
+            if (!skipped) return false;
+        }
+        return false;
+    }
+
+    unsigned int TileScheduler::get_nr_steals() const {
+        return nr_steals;
+    }
+
+    void TileScheduler::set_work_stealing(bool new_work_stealing) {
+        work_stealing = new_work_stealing;
+    }
+
+    bool TileScheduler::get_work_stealing() const {
+        return work_stealing;
+    }
+
+}
@@ -0,0 +1,70 @@
+#ifndef RT_TILE_SCHEDULER_HPP
+#define RT_TILE_SCHEDULER_HPP
+
+#include <QtGlobal>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "RaytracerGlobals.hpp"
+
+namespace Rt {
+
+    // Work stealing scheduler handing out the tiles of a frame to a fixed number of threads
+    // Every thread owns a deque which starts with a contiguous run of the tiles (so neighbouring
+    // tiles are rendered by the same thread) and takes its tiles from the front of it
+    // A thread whose deque runs empty steals the back half of another deque so the threads
+    // rendering cheap regions (e.g. empty sky) help out with the expensive ones
+    // Thieves start at a random victim and skip deques which are busy instead of waiting on them
+    // so they rarely contend with the owners or each other
+    // With work stealing disabled every thread renders an equal share of the tiles and nothing
+    // else, which is the static partition the benchmarks compare against
+    class RAYTRACER_LIB_EXPORT TileScheduler {
+    public:
+        TileScheduler();
+
+        // Splits tiles (in the order they should be rendered) over nr_threads deques
+        // With tile_costs (the expected cost of every tile by index, e.g. its render time in the
+        // previous frame) every deque gets about the same cost instead of the same number of tiles
+        // Must not be called while next_tile() is
+        void reset(const std::vector<unsigned int>& tiles, unsigned int nr_threads, const std::vector<double>& tile_costs={});
+
+        // Takes the next tile for thread (0 <= thread < nr_threads)
+        // stolen is set if the tile was in another thread's deque at the start of the frame
+        // Returns false once every tile has been taken
+        bool next_tile(unsigned int thread, unsigned int& tile, bool& stolen);
+
+        // Number of steals since the last reset()
+        unsigned int get_nr_steals() const;
+
+        // Enabled by default; when disabled reset() ignores tile_costs and threads never steal
+        // Must not be called while next_tile() is
+        void set_work_stealing(bool new_work_stealing);
+        bool get_work_stealing() const;
+
+    private:
+        // Each deque is a range of tiles; the owner pops from begin and thieves from end
+        // Aligned to a cache line so owners locking neighbouring deques don't share one
+        struct alignas(64) Deque {
+            std::mutex mutex;
+            size_t begin = 0;
+            size_t end = 0;
+            // The range was stolen from another deque
+            bool stolen = false;
+            // xorshift state for picking victims; only used by the deque's owner
+            uint32_t random_state = 1;
+        };
+
+        std::vector<unsigned int> tiles;
+        std::unique_ptr<Deque[]> deques;
+        unsigned int nr_deques;
+        std::atomic<unsigned int> nr_steals;
+        bool work_stealing;
+
+        bool steal(unsigned int thread);
+    };
+
+}
+
+#endif
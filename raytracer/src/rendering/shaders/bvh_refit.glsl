@@ -0,0 +1,201 @@
+#version 450 core
+
+layout (std430, binding=0) buffer VertexPositionBuffer {
+    // Positions already transformed into world space by vertex_shader.glsl (3 floats per vertex)
+    float vertex_positions[];
+};
+
+vec3 get_vertex_position(uint i) {
+    return vec3(vertex_positions[3*i+0], vertex_positions[3*i+1], vertex_positions[3*i+2]);
+}
+
+layout (std430, binding=1) buffer StaticIndexBuffer {
+    uint static_indices[];
+};
+uniform uint nr_static_indices;
+
+layout (std430, binding=2) buffer DynamicIndexBuffer {
+    uint dynamic_indices[];
+};
+
+uniform uint nr_static_vertices;
+
+struct Mesh {
+                                  // Base Alignment  // Aligned Offset
+    mat4 transformation;          // 16              // 0
+                                  // 16              // 16
+                                  // 16              // 32
+                                  // 16 (total: 64)  // 48
+
+    mat4 inverse_transformation;  // 16              // 64
+                                  // 16              // 80
+                                  // 16              // 96
+                                  // 16 (total: 64)  // 112
+
+    int vertex_offset;            // 4               // 128
+
+    int index_offset;             // 4               // 132
+    int nr_indices;               // 4               // 136
+
+    int material_index;           // 4               // 140
+
+    int bvh_offset;               // 4               // 144
+
+    // PADDING:                   // 12              // 160
+
+    // Total Size: 160
+};
+
+layout (std140, binding=5) buffer MeshBuffer {
+    Mesh meshes[];
+};
+
+
+struct BVHNode {
+                        // Base Alignment  // Aligned Offset
+    vec3 bounds_min;    // 16              // 0
+    uint left_or_first; // 4               // 12
+    vec3 bounds_max;    // 16              // 16
+    uint count;         // 4               // 28
+
+    // Total Size: 32
+};
+
+layout (std430, binding=10) coherent buffer DynamicBVHBuffer {
+    // World space BVH over every dynamic triangle (Renderer::DynamicGeometry::REFITTED/REBUILT)
+    BVHNode dynamic_bvh_nodes[];
+};
+uniform uint nr_dynamic_bvh_nodes;
+
+struct BVHTriangle {
+                        // Base Alignment  // Aligned Offset
+    uint first_index;   // 4               // 0
+    uint mesh_index;    // 4               // 4
+
+    // Total Size: 8
+};
+
+layout (std430, binding=12) buffer DynamicBVHTriangleBuffer {
+    // The dynamic triangles in BVH leaf order
+    BVHTriangle dynamic_bvh_triangles[];
+};
+
+#define NO_PARENT 0xFFFFFFFFu
+
+layout (std430, binding=13) coherent buffer BVHRefitBuffer {
+                          // Base Alignment  // Aligned Offset
+    // Written by the cost pass; SAH cost of the hierarchy relative to its root's area
+    float sah_cost;       // 4               // 0
+
+    // (PADDING)          // 4               // 4
+
+    // x: index of the node's parent (NO_PARENT for the root)
+    // y: number of the node's children refit so far; the second child to finish
+    //    refits the node and resets this back to 0 for the next refit
+    uvec2 refit_nodes[];  // 8               // 8
+};
+
+// Should match BVH::traversal_cost and BVH::intersection_cost
+#define TRAVERSAL_COST 1.0f
+#define INTERSECTION_COST 1.0f
+
+#define REFIT_STAGE_BOUNDS 0
+#define REFIT_STAGE_COST 1
+uniform uint refit_stage;
+
+#define WORK_GROUP_SIZE 64
+layout (local_size_x = WORK_GROUP_SIZE) in;
+
+shared float partial_costs[WORK_GROUP_SIZE];
+
+uint get_vertex_index(uint i, uint mi) {
+    // Returns the index into vertices of the i-th index of mesh mi
+    if (i < nr_static_indices) {
+        return static_indices[i] + meshes[mi].vertex_offset;
+    } else {
+        return dynamic_indices[i-nr_static_indices] + meshes[mi].vertex_offset + nr_static_vertices;
+    }
+}
+
+float surface_area(vec3 bounds_min, vec3 bounds_max) {
+    vec3 e = max(bounds_max - bounds_min, vec3(0.0f));
+    return 2.0f * (e.x*e.y + e.y*e.z + e.z*e.x);
+}
+
+void refit_bounds() {
+    /*
+    One invocation per node; the invocations of leaves compute their bounds from the
+    transformed triangles and then walk up the tree. Only the second child to arrive at
+    a parent continues so every interior node is refit exactly once, after both children
+    */
+    uint node_index = gl_GlobalInvocationID.x;
+    if (node_index >= nr_dynamic_bvh_nodes || dynamic_bvh_nodes[node_index].count == 0) {
+        return;
+    }
+
+    vec3 bounds_min = vec3(3.402823e38f);
+    vec3 bounds_max = vec3(-3.402823e38f);
+    uint first = dynamic_bvh_nodes[node_index].left_or_first;
+    for (uint ti=first; ti<first+dynamic_bvh_nodes[node_index].count; ti++) {
+        BVHTriangle tri = dynamic_bvh_triangles[ti];
+        for (uint j=0; j<3; j++) {
+            vec3 p = get_vertex_position(get_vertex_index(tri.first_index+j, tri.mesh_index));
+            bounds_min = min(bounds_min, p);
+            bounds_max = max(bounds_max, p);
+        }
+    }
+    dynamic_bvh_nodes[node_index].bounds_min = bounds_min;
+    dynamic_bvh_nodes[node_index].bounds_max = bounds_max;
+
+    uint parent = refit_nodes[node_index].x;
+    while (parent != NO_PARENT) {
+        // Make this node's bounds visible before signalling the parent
+        memoryBarrierBuffer();
+        if (atomicAdd(refit_nodes[parent].y, 1u) == 0u) {
+            // The sibling isn't done yet; it will refit the parent
+            return;
+        }
+        refit_nodes[parent].y = 0u;
+
+        uint left = dynamic_bvh_nodes[parent].left_or_first;
+        dynamic_bvh_nodes[parent].bounds_min = min(dynamic_bvh_nodes[left].bounds_min, dynamic_bvh_nodes[left+1].bounds_min);
+        dynamic_bvh_nodes[parent].bounds_max = max(dynamic_bvh_nodes[left].bounds_max, dynamic_bvh_nodes[left+1].bounds_max);
+
+        parent = refit_nodes[parent].x;
+    }
+}
+
+void compute_cost() {
+    /*
+    Dispatched as a single work group which sums the cost of every node
+    Mirrors BVH::sah_cost()
+    */
+    float cost = 0.0f;
+    for (uint i=gl_LocalInvocationID.x; i<nr_dynamic_bvh_nodes; i+=WORK_GROUP_SIZE) {
+        BVHNode node = dynamic_bvh_nodes[i];
+        float area = surface_area(node.bounds_min, node.bounds_max);
+        cost += area * (node.count > 0 ? INTERSECTION_COST*node.count : TRAVERSAL_COST);
+    }
+    partial_costs[gl_LocalInvocationID.x] = cost;
+    barrier();
+
+    for (uint stride=WORK_GROUP_SIZE/2; stride>0; stride/=2) {
+        if (gl_LocalInvocationID.x < stride) {
+            partial_costs[gl_LocalInvocationID.x] += partial_costs[gl_LocalInvocationID.x + stride];
+        }
+        barrier();
+    }
+
+    if (gl_LocalInvocationID.x == 0) {
+        float root_area = surface_area(dynamic_bvh_nodes[0].bounds_min, dynamic_bvh_nodes[0].bounds_max);
+        sah_cost = root_area > 0.0f ? partial_costs[0] / root_area : 0.0f;
+    }
+}
+
+void main() {
+    if (refit_stage == REFIT_STAGE_BOUNDS) {
+        refit_bounds();
+    } else if (gl_WorkGroupID.x == 0) {
+        compute_cost();
+    }
+}
@@ -0,0 +1,440 @@
+#version 450 core
+
+layout (std430, binding=0) buffer VertexPositionBuffer {
+    // Positions already transformed into world space by vertex_shader.glsl (3 floats per vertex)
+    float vertex_positions[];
+};
+
+vec3 get_vertex_position(uint i) {
+    return vec3(vertex_positions[3*i+0], vertex_positions[3*i+1], vertex_positions[3*i+2]);
+}
+
+layout (std430, binding=1) buffer StaticIndexBuffer {
+    uint static_indices[];
+};
+uniform uint nr_static_indices;
+
+layout (std430, binding=2) buffer DynamicIndexBuffer {
+    uint dynamic_indices[];
+};
+
+uniform uint nr_static_vertices;
+
+struct Mesh {
+                                  // Base Alignment  // Aligned Offset
+    mat4 transformation;          // 16              // 0
+                                  // 16              // 16
+                                  // 16              // 32
+                                  // 16 (total: 64)  // 48
+
+    mat4 inverse_transformation;  // 16              // 64
+                                  // 16              // 80
+                                  // 16              // 96
+                                  // 16 (total: 64)  // 112
+
+    int vertex_offset;            // 4               // 128
+
+    int index_offset;             // 4               // 132
+    int nr_indices;               // 4               // 136
+
+    int material_index;           // 4               // 140
+
+    int bvh_offset;               // 4               // 144
+
+    // PADDING:                   // 12              // 160
+
+    // Total Size: 160
+};
+
+layout (std140, binding=5) buffer MeshBuffer {
+    Mesh meshes[];
+};
+
+
+struct BVHNode {
+                        // Base Alignment  // Aligned Offset
+    vec3 bounds_min;    // 16              // 0
+    uint left_or_first; // 4               // 12
+    vec3 bounds_max;    // 16              // 16
+    uint count;         // 4               // 28
+
+    // Total Size: 32
+};
+
+layout (std430, binding=10) buffer DynamicBVHBuffer {
+    // Only the hierarchy is written here; bvh_refit.glsl fits the bounds afterwards
+    BVHNode dynamic_bvh_nodes[];
+};
+
+struct BVHTriangle {
+                        // Base Alignment  // Aligned Offset
+    uint first_index;   // 4               // 0
+    uint mesh_index;    // 4               // 4
+
+    // Total Size: 8
+};
+
+layout (std430, binding=12) buffer DynamicBVHTriangleBuffer {
+    // Output: the dynamic triangles sorted by their Morton codes (the leaf order)
+    BVHTriangle dynamic_bvh_triangles[];
+};
+
+#define NO_PARENT 0xFFFFFFFFu
+
+layout (std430, binding=13) buffer BVHRefitBuffer {
+    // Same layout as in bvh_refit.glsl
+    float sah_cost;
+    uvec2 refit_nodes[];
+};
+
+layout (std430, binding=14) buffer LBVHTriangleBuffer {
+    // Every dynamic triangle in no particular order
+    BVHTriangle lbvh_triangles[];
+};
+uniform uint nr_lbvh_triangles;
+
+layout (std430, binding=15) buffer LBVHSortBuffer {
+                                // Base Alignment  // Aligned Offset
+    // Bounds of the triangle centroids stored as order preserving uints (see float_to_ordered)
+    // [0, 3): minimum, [4, 7): maximum; must be reset to 0xFFFFFFFF and 0 before the bounds stage
+    uint centroid_bounds[8];    // 4               // 0
+
+    // [0, 2*nr_lbvh_triangles): (Morton code, triangle) pairs
+    // [2*nr_lbvh_triangles, 4*nr_lbvh_triangles): (Morton code, triangle) pairs, the other sort buffer
+    // [4*nr_lbvh_triangles, ...): per digit and work group counts, then their exclusive prefix sum
+    uint sort_data[];           // 4               // 32
+};
+
+#define LBVH_STAGE_BOUNDS 0
+#define LBVH_STAGE_MORTON 1
+#define LBVH_STAGE_SORT_COUNT 2
+#define LBVH_STAGE_SORT_SCAN 3
+#define LBVH_STAGE_SORT_SCATTER 4
+#define LBVH_STAGE_HIERARCHY 5
+uniform uint lbvh_stage;
+
+// The sort consumes RADIX_BITS of the 30 bit Morton codes per pass
+#define RADIX_BITS 4
+#define RADIX_SIZE 16
+uniform uint sort_pass;
+
+#define WORK_GROUP_SIZE 64
+layout (local_size_x = WORK_GROUP_SIZE) in;
+
+shared vec3 partial_min[WORK_GROUP_SIZE];
+shared vec3 partial_max[WORK_GROUP_SIZE];
+shared uint digits[WORK_GROUP_SIZE];
+shared uint partial_sums[WORK_GROUP_SIZE];
+
+uint get_vertex_index(uint i, uint mi) {
+    // Returns the index into vertices of the i-th index of mesh mi
+    if (i < nr_static_indices) {
+        return static_indices[i] + meshes[mi].vertex_offset;
+    } else {
+        return dynamic_indices[i-nr_static_indices] + meshes[mi].vertex_offset + nr_static_vertices;
+    }
+}
+
+vec3 triangle_centroid(BVHTriangle tri) {
+    vec3 p0 = get_vertex_position(get_vertex_index(tri.first_index+0, tri.mesh_index));
+    vec3 p1 = get_vertex_position(get_vertex_index(tri.first_index+1, tri.mesh_index));
+    vec3 p2 = get_vertex_position(get_vertex_index(tri.first_index+2, tri.mesh_index));
+    return (p0 + p1 + p2) / 3.0f;
+}
+
+uint float_to_ordered(float f) {
+    // Maps floats onto uints such that the uints compare the same as the floats
+    // which lets atomicMin/atomicMax be used on them
+    uint u = floatBitsToUint(f);
+    return (u & 0x80000000u) != 0u ? ~u : u | 0x80000000u;
+}
+
+float ordered_to_float(uint u) {
+    return uintBitsToFloat((u & 0x80000000u) != 0u ? u & 0x7FFFFFFFu : ~u);
+}
+
+uint expand_bits(uint v) {
+    // Inserts two 0 bits after each of the lower 10 bits of v
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+uint morton_code(vec3 p) {
+    // p must be in [0, 1]
+    p = clamp(p * 1024.0f, 0.0f, 1023.0f);
+    return expand_bits(uint(p.x)) * 4u + expand_bits(uint(p.y)) * 2u + expand_bits(uint(p.z));
+}
+
+void compute_centroid_bounds() {
+    // One invocation per triangle; the work group's bounds are reduced in shared memory
+    // so only one invocation per work group needs to use the atomics
+    uint ti = gl_GlobalInvocationID.x;
+    uint li = gl_LocalInvocationID.x;
+    if (ti < nr_lbvh_triangles) {
+        vec3 center = triangle_centroid(lbvh_triangles[ti]);
+        partial_min[li] = center;
+        partial_max[li] = center;
+    } else {
+        partial_min[li] = vec3(3.402823e38f);
+        partial_max[li] = vec3(-3.402823e38f);
+    }
+    barrier();
+
+    for (uint stride=WORK_GROUP_SIZE/2; stride>0; stride/=2) {
+        if (li < stride) {
+            partial_min[li] = min(partial_min[li], partial_min[li + stride]);
+            partial_max[li] = max(partial_max[li], partial_max[li + stride]);
+        }
+        barrier();
+    }
+
+    if (li == 0) {
+        for (uint axis=0; axis<3; axis++) {
+            atomicMin(centroid_bounds[axis], float_to_ordered(partial_min[0][axis]));
+            atomicMax(centroid_bounds[4+axis], float_to_ordered(partial_max[0][axis]));
+        }
+    }
+}
+
+void compute_morton_codes() {
+    uint ti = gl_GlobalInvocationID.x;
+    if (ti >= nr_lbvh_triangles) {
+        return;
+    }
+
+    vec3 bounds_min, bounds_max;
+    for (uint axis=0; axis<3; axis++) {
+        bounds_min[axis] = ordered_to_float(centroid_bounds[axis]);
+        bounds_max[axis] = ordered_to_float(centroid_bounds[4+axis]);
+    }
+    vec3 extent = bounds_max - bounds_min;
+    vec3 p = (triangle_centroid(lbvh_triangles[ti]) - bounds_min) / max(extent, vec3(1e-30f));
+
+    sort_data[2*ti+0] = morton_code(p);
+    sort_data[2*ti+1] = ti;
+}
+
+/*
+Least significant digit radix sort of the (Morton code, triangle) pairs
+Every pass is split into three dispatches:
+  SORT_COUNT:   each work group counts the digits of its WORK_GROUP_SIZE pairs
+  SORT_SCAN:    a single work group turns the counts (stored digit major) into an exclusive
+                prefix sum which gives each work group the output offset for each digit
+  SORT_SCATTER: each pair is written to its offset plus the number of pairs before it in
+                its work group with the same digit, keeping the sort stable
+*/
+
+uint sort_input(uint pass) {
+    return (pass % 2 == 0) ? 0 : 2*nr_lbvh_triangles;
+}
+
+uint sort_output(uint pass) {
+    return (pass % 2 == 0) ? 2*nr_lbvh_triangles : 0;
+}
+
+uint nr_sort_work_groups() {
+    return (nr_lbvh_triangles + WORK_GROUP_SIZE - 1) / WORK_GROUP_SIZE;
+}
+
+uint digit_count_index(uint digit, uint work_group) {
+    return 4*nr_lbvh_triangles + digit*nr_sort_work_groups() + work_group;
+}
+
+void load_digits() {
+    uint ti = gl_GlobalInvocationID.x;
+    if (ti < nr_lbvh_triangles) {
+        uint code = sort_data[sort_input(sort_pass) + 2*ti];
+        digits[gl_LocalInvocationID.x] = (code >> (sort_pass*RADIX_BITS)) & (RADIX_SIZE-1);
+    } else {
+        // Out of range invocations get a digit that is never counted
+        digits[gl_LocalInvocationID.x] = RADIX_SIZE;
+    }
+    barrier();
+}
+
+void count_digits() {
+    load_digits();
+
+    uint li = gl_LocalInvocationID.x;
+    if (li < RADIX_SIZE) {
+        uint count = 0;
+        for (uint i=0; i<WORK_GROUP_SIZE; i++) {
+            count += digits[i] == li ? 1 : 0;
+        }
+        sort_data[digit_count_index(li, gl_WorkGroupID.x)] = count;
+    }
+}
+
+void scan_digit_counts() {
+    // Dispatched as a single work group; each invocation scans a contiguous chunk
+    uint li = gl_LocalInvocationID.x;
+    uint nr_counts = RADIX_SIZE * nr_sort_work_groups();
+    uint chunk_size = (nr_counts + WORK_GROUP_SIZE - 1) / WORK_GROUP_SIZE;
+    uint first = digit_count_index(0, 0) + min(li*chunk_size, nr_counts);
+    uint last = digit_count_index(0, 0) + min((li+1)*chunk_size, nr_counts);
+
+    uint sum = 0;
+    for (uint i=first; i<last; i++) {
+        sum += sort_data[i];
+    }
+    partial_sums[li] = sum;
+    barrier();
+
+    // Exclusive prefix sum of the chunk sums (WORK_GROUP_SIZE is small)
+    if (li == 0) {
+        uint total = 0;
+        for (uint i=0; i<WORK_GROUP_SIZE; i++) {
+            uint chunk_sum = partial_sums[i];
+            partial_sums[i] = total;
+            total += chunk_sum;
+        }
+    }
+    barrier();
+
+    uint offset = partial_sums[li];
+    for (uint i=first; i<last; i++) {
+        uint count = sort_data[i];
+        sort_data[i] = offset;
+        offset += count;
+    }
+}
+
+void scatter_pairs() {
+    load_digits();
+
+    uint ti = gl_GlobalInvocationID.x;
+    uint li = gl_LocalInvocationID.x;
+    if (ti >= nr_lbvh_triangles) {
+        return;
+    }
+
+    uint digit = digits[li];
+    uint rank = 0;
+    for (uint i=0; i<li; i++) {
+        rank += digits[i] == digit ? 1 : 0;
+    }
+
+    uint destination = sort_data[digit_count_index(digit, gl_WorkGroupID.x)] + rank;
+    sort_data[sort_output(sort_pass) + 2*destination + 0] = sort_data[sort_input(sort_pass) + 2*ti + 0];
+    sort_data[sort_output(sort_pass) + 2*destination + 1] = sort_data[sort_input(sort_pass) + 2*ti + 1];
+}
+
+int common_prefix(int i, int j) {
+    /*
+    Length of the longest common prefix of the sorted codes i and j (-1 if j is out of range)
+    Duplicate codes are made unique by falling back to the indices themselves
+    */
+    if (j < 0 || j >= int(nr_lbvh_triangles)) {
+        return -1;
+    }
+    uint code_i = sort_data[2*i];
+    uint code_j = sort_data[2*j];
+    if (code_i == code_j) {
+        return 32 + 31 - findMSB(uint(i ^ j));
+    }
+    return 31 - findMSB(code_i ^ code_j);
+}
+
+void set_child(uint slot, uint child, bool is_leaf) {
+    // Children of internal node k are placed at 2k+1 and 2k+2 so siblings are next
+    // to each other like in the BVHs built on the CPU
+    if (is_leaf) {
+        dynamic_bvh_nodes[slot].left_or_first = child;
+        dynamic_bvh_nodes[slot].count = 1;
+    } else {
+        dynamic_bvh_nodes[slot].left_or_first = 2*child + 1;
+        dynamic_bvh_nodes[slot].count = 0;
+        refit_nodes[2*child + 1].x = slot;
+        refit_nodes[2*child + 2].x = slot;
+    }
+    refit_nodes[slot].y = 0;
+}
+
+void build_hierarchy() {
+    /*
+    One invocation per sorted triangle
+    Invocation i writes out the i-th leaf's triangle and, for i < nr_lbvh_triangles-1,
+    finds the range and split of internal node i from the sorted codes alone
+    (Karras, "Maximizing Parallelism in the Construction of BVHs, Octrees, and k-d Trees")
+    The bounds are left to bvh_refit.glsl which uses the parent indices written here
+    Every child shares a longer prefix of its (30 bit code, index) keys than its parent so
+    no leaf is deeper than 30 + log2(nr_lbvh_triangles), within BVH::max_depth for any count
+    */
+    int i = int(gl_GlobalInvocationID.x);
+    int n = int(nr_lbvh_triangles);
+    if (i >= n) {
+        return;
+    }
+
+    dynamic_bvh_triangles[i] = lbvh_triangles[sort_data[2*i + 1]];
+
+    if (i == 0) {
+        dynamic_bvh_nodes[0].left_or_first = n > 1 ? 1 : 0;
+        dynamic_bvh_nodes[0].count = n > 1 ? 0 : 1;
+        refit_nodes[0] = uvec2(NO_PARENT, 0);
+        if (n > 1) {
+            refit_nodes[1].x = 0;
+            refit_nodes[2].x = 0;
+        }
+    }
+    if (i >= n-1) {
+        return;
+    }
+
+    // Direction of the node's range
+    int d = common_prefix(i, i+1) - common_prefix(i, i-1) >= 0 ? 1 : -1;
+
+    // Upper bound for the length of the range
+    int min_prefix = common_prefix(i, i-d);
+    int max_length = 2;
+    while (common_prefix(i, i + max_length*d) > min_prefix) {
+        max_length *= 2;
+    }
+
+    // Binary search for the other end of the range
+    int length = 0;
+    for (int t=max_length/2; t>=1; t/=2) {
+        if (common_prefix(i, i + (length+t)*d) > min_prefix) {
+            length += t;
+        }
+    }
+    int j = i + length*d;
+
+    // Binary search for the split position
+    int node_prefix = common_prefix(i, j);
+    int split = 0;
+    for (int divisor=2; ; divisor*=2) {
+        int t = (length + divisor - 1) / divisor;
+        if (common_prefix(i, i + (split+t)*d) > node_prefix) {
+            split += t;
+        }
+        if (t <= 1) {
+            break;
+        }
+    }
+    int gamma = i + split*d + min(d, 0);
+
+    set_child(2*i + 1, gamma, min(i, j) == gamma);
+    set_child(2*i + 2, gamma + 1, max(i, j) == gamma + 1);
+}
+
+void main() {
+    if (lbvh_stage == LBVH_STAGE_BOUNDS) {
+        compute_centroid_bounds();
+    } else if (lbvh_stage == LBVH_STAGE_MORTON) {
+        compute_morton_codes();
+    } else if (lbvh_stage == LBVH_STAGE_SORT_COUNT) {
+        count_digits();
+    } else if (lbvh_stage == LBVH_STAGE_SORT_SCAN) {
+        if (gl_WorkGroupID.x == 0) {
+            scan_digit_counts();
+        }
+    } else if (lbvh_stage == LBVH_STAGE_SORT_SCATTER) {
+        scatter_pairs();
+    } else {
+        build_hierarchy();
+    }
+}
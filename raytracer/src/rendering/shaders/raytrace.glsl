@@ -26,14 +26,29 @@ struct Vertex {
     // Total Size: 64
 };
 
-layout (std140, binding=0) buffer VertexBuffer {
-    Vertex vertices[];
-    //             // Base Alignment  // Aligned Offset
-    // vertex[0]      64                 0
-    // vertex[1]      64                 64
-    // vertex[2]      64                 128
-    // ...
-    // Potential maximum of 2,000,000 Vertices (128 MB / 64 B)
+layout (std430, binding=0) buffer VertexPositionBuffer {
+    // The positions of the transformed vertices, tightly packed (3 floats per vertex)
+    // They are all the intersection tests need; the rest of each vertex is in VertexAttributeBuffer
+    float vertex_positions[];
+};
+
+vec3 get_vertex_position(uint i) {
+    return vec3(vertex_positions[3*i+0], vertex_positions[3*i+1], vertex_positions[3*i+2]);
+}
+
+struct VertexAttributes {
+                    // Base Alignment  // Aligned Offset
+    vec4 normal;    // 16                 0
+    vec4 tangent;   // 16                 16
+    vec2 tex_coord; // 8                  32
+    // (PADDING)    // 8                  40
+
+    // Total Size: 48
+};
+
+layout (std430, binding=20) buffer VertexAttributeBuffer {
+    // The transformed normals, tangents and texture coordinates (same order as VertexPositionBuffer)
+    VertexAttributes vertex_attributes[];
 };
 uniform uint nr_vertices = 0;
 
@@ -45,6 +60,86 @@ layout (std430, binding=1) buffer StaticIndexBuffer {
 uniform uint nr_static_indices = 0;
 
 
+struct BVHNode {
+                        // Base Alignment  // Aligned Offset
+    vec3 bounds_min;    // 16              // 0
+    // Interior nodes: index of the left child (the right child is at left_or_first+1)
+    // Leaf nodes: index of the first triangle (in static_triangle_records for static_bvh_nodes;
+    // see DynamicBVHBuffer for dynamic_bvh_nodes)
+    uint left_or_first; // 4               // 12
+    vec3 bounds_max;    // 16              // 16
+    // Number of triangles in a leaf; 0 for interior nodes
+    uint count;         // 4               // 28
+
+    // Total Size: 32
+};
+
+layout (std430, binding=8) buffer StaticBVHBuffer {
+    // SAH BVH over the static triangles; the root is at index 0
+    BVHNode static_bvh_nodes[];
+};
+uniform uint nr_static_bvh_nodes = 0;
+
+struct QuantizedBVHNode {
+                            // Base Alignment  // Aligned Offset
+    float origin[3];        // 4               // 0
+    // Biased exponents (bytes 0-2) of the grid spacing along each axis
+    uint exponents;         // 4               // 12
+    // Bytes: child 0 min xyz, child 0 max xyz, child 1 min xyz, child 1 max xyz
+    uint child_bounds[3];   // 4               // 16
+    // Interior children: node index
+    // Leaf children: QUANTIZED_LEAF | count << QUANTIZED_COUNT_SHIFT | first triangle
+    uint children[2];       // 4               // 28
+
+    // Total Size: 36
+};
+
+// Should match QuantizedBVH
+#define QUANTIZED_LEAF 0x80000000u
+#define QUANTIZED_COUNT_SHIFT 27
+#define QUANTIZED_FIRST_MASK 0x07FFFFFFu
+
+layout (std430, binding=16) buffer QuantizedStaticBVHBuffer {
+    // Compact copy of the static BVH holding only the interior nodes; used instead of
+    // static_bvh_nodes when there are any
+    QuantizedBVHNode quantized_static_bvh_nodes[];
+};
+uniform uint nr_quantized_static_bvh_nodes = 0;
+
+// A triangle of a dynamic mesh in dynamic_bvh_triangles (see get_vertex_index)
+struct BVHTriangle {
+                        // Base Alignment  // Aligned Offset
+    uint first_index;   // 4               // 0  (first of the triangle's indices; always >= nr_static_indices)
+    uint mesh_index;    // 4               // 4
+
+    // Total Size: 8
+};
+
+
+struct TriangleRecord {
+                        // Base Alignment  // Aligned Offset
+    vec3 position0;     // 16              // 0
+    uint first_index;   // 4               // 12
+    vec3 position1;     // 16              // 16
+    uint mesh_index;    // 4               // 28
+    vec3 position2;     // 16              // 32
+                        // 4 (padding)     // 44
+
+    // Total Size: 48
+};
+
+layout (std430, binding=19) buffer StaticTriangleRecordBuffer {
+    // The static triangles in BVH leaf order with their vertex positions
+    // (precomputed by Scene so they don't have to be looked up)
+    TriangleRecord static_triangle_records[];
+};
+
+// Should match Renderer::TriangleIntersection
+#define TRIANGLE_INTERSECTION_LEGACY 0
+#define TRIANGLE_INTERSECTION_WATERTIGHT 1
+uniform uint triangle_intersection = TRIANGLE_INTERSECTION_WATERTIGHT;
+
+
 layout (std430, binding=2) buffer DynamicIndexBuffer {
     // Same as StaticIndexBuffer
     // Indices correspond to vertices[dynamic_indices[i] + nr_static_indices]
@@ -53,45 +148,133 @@ layout (std430, binding=2) buffer DynamicIndexBuffer {
 uniform uint nr_dynamic_indices = 0;
 
 
-layout (std140, binding=3) buffer StaticVertexBuffer {
-    // Same memory layout as VertexBuffer
-    Vertex static_vertices[];
-};
+// The static vertices (StaticVertexBuffer) are only read through VertexBuffer, which
+// vertex_shader.glsl copies them into; leaving the block out keeps the shader within
+// the 16 storage blocks it may use
 uniform uint nr_static_vertices = 0;
 
 
-layout (std140, binding=4) buffer DynamicVertexBuffer {
-    Vertex dynamic_vertices[];
+// The untransformed dynamic vertices are either Vertex structs (FULL_VERTEX_STRIDE uvec2s each) or
+// compact vertices (COMPACT_VERTEX_STRIDE uvec2s each) depending on compact_vertices
+// This MUST match Vertex::as_byte_array and Vertex::as_compact_byte_array in Vertex.cpp
+#define FULL_VERTEX_STRIDE 8
+#define COMPACT_VERTEX_STRIDE 3
+uniform bool compact_vertices = false;
+
+layout (std430, binding=4) buffer DynamicVertexBuffer {
+    uvec2 dynamic_vertex_data[];
 };
 uniform uint nr_dynamic_vertices = 0;
 
+vec3 octahedral_decode(vec2 encoded) {
+    // This MUST match Vertex::octahedral_decode in Vertex.cpp
+    vec3 v = vec3(encoded, 1.0f - abs(encoded.x) - abs(encoded.y));
+    if (v.z < 0.0f)
+        v.xy = (1.0f - abs(encoded.yx)) * vec2(encoded.x >= 0.0f ? 1.0f : -1.0f, encoded.y >= 0.0f ? 1.0f : -1.0f);
+    return normalize(v);
+}
+
+vec3 get_dynamic_vertex_position(uint i) {
+    // The position is the first 3 floats of both formats
+    uint o = i * (compact_vertices ? COMPACT_VERTEX_STRIDE : FULL_VERTEX_STRIDE);
+    return uintBitsToFloat(uvec3(dynamic_vertex_data[o], dynamic_vertex_data[o+1].x));
+}
+
+Vertex get_dynamic_vertex(uint i) {
+    Vertex vert;
+    if (compact_vertices) {
+        uint o = i*COMPACT_VERTEX_STRIDE;
+        uvec2 w0 = dynamic_vertex_data[o];
+        uvec2 w1 = dynamic_vertex_data[o+1];
+        uvec2 w2 = dynamic_vertex_data[o+2];
+        vert.position = vec4(uintBitsToFloat(uvec3(w0, w1.x)), 1.0f);
+        vert.normal = vec4(octahedral_decode(unpackSnorm2x16(w1.y)), 0.0f);
+        // The lowest bit of the tangent holds the bitangent sign
+        vert.tangent = vec4(octahedral_decode(unpackSnorm2x16(w2.x)), (w2.x & 1u) != 0u ? -1.0f : 1.0f);
+        vert.tex_coord = unpackHalf2x16(w2.y);
+    } else {
+        uint o = i*FULL_VERTEX_STRIDE;
+        vert.position = uintBitsToFloat(uvec4(dynamic_vertex_data[o], dynamic_vertex_data[o+1]));
+        vert.normal = uintBitsToFloat(uvec4(dynamic_vertex_data[o+2], dynamic_vertex_data[o+3]));
+        vert.tangent = uintBitsToFloat(uvec4(dynamic_vertex_data[o+4], dynamic_vertex_data[o+5]));
+        vert.tex_coord = uintBitsToFloat(dynamic_vertex_data[o+6]);
+    }
+    return vert;
+}
+
 
 struct Mesh {
-                          // Base Alignment  // Aligned Offset
-    mat4 transformation;  // 16              // 0
-                          // 16              // 16
-                          // 16              // 32
-                          // 16 (total: 64)  // 48
+                                  // Base Alignment  // Aligned Offset
+    mat4 transformation;          // 16              // 0
+                                  // 16              // 16
+                                  // 16              // 32
+                                  // 16 (total: 64)  // 48
 
-    int vertex_offset;    // 4               // 64
+    mat4 inverse_transformation;  // 16              // 64
+                                  // 16              // 80
+                                  // 16              // 96
+                                  // 16 (total: 64)  // 112
 
-    int index_offset;     // 4               // 68
-    int nr_indices;       // 4               // 72
+    int vertex_offset;            // 4               // 128
 
-    int material_index;   // 4               // 76
+    int index_offset;             // 4               // 132
+    int nr_indices;               // 4               // 136
 
-    // Total Size: 80
+    int material_index;           // 4               // 140
+
+    // Index of the root of the mesh's object space BVH in DynamicBVHBuffer (-1 if it has none)
+    int bvh_offset;               // 4               // 144
+
+    // PADDING:                   // 12              // 160
+
+    // Total Size: 160
 };
 
 layout (std140, binding=5) buffer MeshBuffer {
     Mesh meshes[];
     //          // Base Alignment  // Aligned Offset
-    // mesh[0]  // 80              // 0
-    // mesh[1]  // 80              // 80
-    // mesh[3]  // 80              // 160
+    // mesh[0]  // 160             // 0
+    // mesh[1]  // 160             // 160
+    // mesh[3]  // 160             // 320
     // ...
 };
 uniform uint nr_meshes = 0;
+// The static meshes come first in MeshBuffer
+uniform uint nr_static_meshes = 0;
+
+
+layout (std430, binding=10) buffer DynamicBVHBuffer {
+    // DYNAMIC_GEOMETRY_INSTANCED: the object space BVHs of the dynamic meshes (bottom level)
+    // Child indices are relative to the mesh's bvh_offset and leaves
+    // refer to the mesh's triangles (index_offset + 3*triangle)
+    // DYNAMIC_GEOMETRY_REFITTED/REBUILT: a single world space BVH over every dynamic triangle
+    // whose leaves refer to dynamic_bvh_triangles
+    BVHNode dynamic_bvh_nodes[];
+};
+uniform uint nr_dynamic_bvh_nodes = 0;
+
+layout (std430, binding=12) buffer DynamicBVHTriangleBuffer {
+    // The dynamic triangles in the leaf order of the refit BVH
+    BVHTriangle dynamic_bvh_triangles[];
+};
+
+layout (std430, binding=11) buffer TLASBuffer {
+    // BVH over the world space bounds of the dynamic meshes (top level)
+    // Leaves hold a single mesh index in left_or_first
+    // Followed by the BVH over the visible light spheres starting at light_bvh_offset
+    // Its child indices include light_bvh_offset and its leaves hold a single light index
+    BVHNode tlas_nodes[];
+};
+uniform uint nr_tlas_nodes = 0;
+uniform uint light_bvh_offset = 0;
+uniform uint nr_light_bvh_nodes = 0;
+
+// Should match Renderer::DynamicGeometry
+#define DYNAMIC_GEOMETRY_INSTANCED 0
+#define DYNAMIC_GEOMETRY_TRANSFORMED 1
+#define DYNAMIC_GEOMETRY_REFITTED 2
+#define DYNAMIC_GEOMETRY_REBUILT 3
+uniform uint dynamic_geometry = DYNAMIC_GEOMETRY_INSTANCED;
 
 
 layout (binding=0) uniform sampler2DArray material_textures;
@@ -135,14 +318,55 @@ struct Light {
     int visibility;           // 4               // 28
     vec3 radiance;            // 12              // 32
     float ambient_multiplier; // 4               // 44
+    float cutoff_radius;      // 4               // 48
+                              // 12 (padding)    // 52
 
-    // Total Size: 48
+    // Total Size: 64
 };
 
 layout(std430, binding=7) buffer LightBuffer {
     Light lights[];
 };
 uniform uint nr_lights = 0;
+// Radius of the lights with a visibility of 1 (sphere)
+// This MUST match light_sphere_radius in AbstractLight.hpp
+#define LIGHT_SPHERE_RADIUS 0.1f
+
+// Alias table over the PointLights (see LightSampler)
+// The nr_sampled_lights table entries are followed by nr_unsampled_lights
+// entries of which only light_index is used (the lights that are always evaluated)
+struct LightSample {
+                        // Base Alignment  // Aligned Offset
+    float threshold;    // 4               // 0
+    uint alias;         // 4               // 4
+    float pmf;          // 4               // 8
+    uint light_index;   // 4               // 12
+
+    // Total Size: 16
+};
+
+layout(std430, binding=17) buffer LightSamplerBuffer {
+    LightSample light_samples[];
+};
+// 0 evaluates every light
+uniform uint nr_light_samples = 0;
+uniform uint nr_sampled_lights = 0;
+uniform uint nr_unsampled_lights = 0;
+
+// World space grid over the PointLights with a cutoff radius (see LightGrid)
+// This MUST match light_grid_resolution in LightGrid.hpp
+#define LIGHT_GRID_RESOLUTION 16
+#define LIGHT_GRID_CELLS (LIGHT_GRID_RESOLUTION*LIGHT_GRID_RESOLUTION*LIGHT_GRID_RESOLUTION)
+layout(std430, binding=18) buffer LightGridBuffer {
+    // LIGHT_GRID_CELLS (offset, count) pairs into light_grid followed by
+    // the nr_global_lights lights without a cutoff radius and the lights of every cell
+    uint light_grid[];
+};
+// false evaluates every light
+uniform bool light_culling = false;
+uniform vec3 light_grid_min;
+uniform vec3 light_grid_cell_size;
+uniform uint nr_global_lights = 0;
 
 
 // The per-pixel material data once the textures have been read
@@ -207,6 +431,12 @@ LightData get_light_data(Light light, vec3 at) {
         light_data.direction = normalize(at - light.position);
         light_data.light_distance = distance(light.position, at);
         float falloff = 1.0f / (1.0f + light_data.light_distance*light_data.light_distance);
+        if (light.cutoff_radius > 0.0f) {
+            // Window the falloff so it smoothly reaches 0 at the cutoff radius
+            float ratio = light_data.light_distance / light.cutoff_radius;
+            float window = clamp(1.0f - ratio*ratio*ratio*ratio, 0.0f, 1.0f);
+            falloff *= window*window;
+        }
         light_data.radiance = light.radiance * falloff;
         light_data.ambient_multiplier = light.ambient_multiplier * falloff;
     }
@@ -309,6 +539,450 @@ vec4 barycentric_coordinates(vec3 point, vec3 tri0, vec3 tri1, vec3 tri2) {
     }
 }
 
+float ray_aabb_int(vec3 ray_origin, vec3 inv_ray_dir, vec3 bounds_min, vec3 bounds_max, float near_plane, float far_plane) {
+    /*
+    Slab test between the ray and the axis aligned box
+    Returns the distance at which the ray enters the box (clamped to near_plane)
+    Negative output means no intersection within [near_plane, far_plane]
+    */
+    vec3 t0 = (bounds_min - ray_origin) * inv_ray_dir;
+    vec3 t1 = (bounds_max - ray_origin) * inv_ray_dir;
+    vec3 t_min = min(t0, t1);
+    vec3 t_max = max(t0, t1);
+
+    float t_enter = max(max(t_min.x, t_min.y), max(t_min.z, near_plane));
+    float t_exit = min(min(t_max.x, t_max.y), min(t_max.z, far_plane));
+
+    return t_enter <= t_exit ? t_enter : -1.0f;
+}
+
+bool ray_triangle_int_watertight(vec3 ray_origin, vec3 ray_dir, vec3 tri0, vec3 tri1, vec3 tri2, float near_plane, inout float depth, out vec3 bc) {
+    /*
+    Watertight ray-triangle intersection (Woop, Benthin & Wald 2013)
+    The vertices are translated to the ray origin and sheared so the ray points along +z;
+    the hit is then a 2D test against the edges. Adjacent triangles compute the same
+    edge functions for their shared edge so rays can't slip between them
+    */
+    // Make the largest component of ray_dir the z axis (swapping x and y to keep the winding)
+    vec3 abs_dir = abs(ray_dir);
+    int kz = abs_dir.x > abs_dir.y ? (abs_dir.x > abs_dir.z ? 0 : 2) : (abs_dir.y > abs_dir.z ? 1 : 2);
+    int kx = kz == 2 ? 0 : kz + 1;
+    int ky = kx == 2 ? 0 : kx + 1;
+    if (ray_dir[kz] < 0.0f) {
+        int tmp = kx;
+        kx = ky;
+        ky = tmp;
+    }
+    float Sz = 1.0f / ray_dir[kz];
+    float Sx = ray_dir[kx] * Sz;
+    float Sy = ray_dir[ky] * Sz;
+
+    vec3 A = tri0 - ray_origin;
+    vec3 B = tri1 - ray_origin;
+    vec3 C = tri2 - ray_origin;
+    float Ax = A[kx] - Sx*A[kz];
+    float Ay = A[ky] - Sy*A[kz];
+    float Bx = B[kx] - Sx*B[kz];
+    float By = B[ky] - Sy*B[kz];
+    float Cx = C[kx] - Sx*C[kz];
+    float Cy = C[ky] - Sy*C[kz];
+
+    // Scaled barycentric coordinates; a point on an edge (0) counts as inside
+    float U = Cx*By - Cy*Bx;
+    float V = Ax*Cy - Ay*Cx;
+    float W = Bx*Ay - By*Ax;
+    if ((U < 0.0f || V < 0.0f || W < 0.0f) && (U > 0.0f || V > 0.0f || W > 0.0f)) {
+        return false;
+    }
+    float det = U + V + W;
+    if (det == 0.0f) {
+        return false;
+    }
+
+    float T = Sz * (U*A[kz] + V*B[kz] + W*C[kz]);
+    float dist = T / det;
+    if (dist >= near_plane && dist <= depth) {
+        depth = dist;
+        bc = vec3(U, V, W) / det;
+        return true;
+    }
+    return false;
+}
+
+bool ray_triangle_int_legacy(vec3 ray_origin, vec3 ray_dir, vec3 tri0, vec3 tri1, vec3 tri2, float near_plane, inout float depth, out vec3 bc) {
+    vec3 normal = cross(tri1-tri0, tri2-tri0);
+    float dist = ray_plane_int(ray_origin, ray_dir, tri0, normalize(normal));
+
+    if (dist >= near_plane && dist <= depth) {
+        vec4 bcw = barycentric_coordinates(ray_origin + dist*ray_dir, tri0, tri1, tri2);
+        // If the point is inside of the triangle
+        if (bcw.w > 0.0f) {
+            depth = dist;
+            bc = bcw.xyz;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ray_triangle_int(vec3 ray_origin, vec3 ray_dir, vec3 tri0, vec3 tri1, vec3 tri2, float near_plane, inout float depth, out vec3 bc) {
+    /*
+    Returns true if the ray hits the triangle between near_plane and depth
+    If so, depth is set to the distance of the intersection and bc to its barycentric coordinates
+    */
+    if (triangle_intersection == TRIANGLE_INTERSECTION_WATERTIGHT) {
+        return ray_triangle_int_watertight(ray_origin, ray_dir, tri0, tri1, tri2, near_plane, depth, bc);
+    }
+    return ray_triangle_int_legacy(ray_origin, ray_dir, tri0, tri1, tri2, near_plane, depth, bc);
+}
+
+uint get_vertex_index(uint i, uint mi) {
+    // Returns the index into vertices of the i-th index of mesh mi
+    // All mesh vertices must be the in same array (static or dynamic)
+    if (i < nr_static_indices) {
+        return static_indices[i] + meshes[mi].vertex_offset;
+    } else {
+        return dynamic_indices[i-nr_static_indices] + meshes[mi].vertex_offset + nr_static_vertices;
+    }
+}
+
+uint get_dynamic_vertex_index(uint i, uint mi) {
+    // Returns the index into dynamic_vertices (untransformed) of the i-th index of dynamic mesh mi
+    return dynamic_indices[i-nr_static_indices] + meshes[mi].vertex_offset;
+}
+
+bool static_triangle_int(vec3 ray_origin, vec3 ray_dir, uint ti, float near_plane, inout float depth, out uint first_index, out uint mesh_index, out vec3 bc) {
+    // ray_triangle_int with the ti-th static triangle in BVH leaf order
+    // Also returns the index of its first index and its mesh index
+    if (triangle_intersection == TRIANGLE_INTERSECTION_WATERTIGHT) {
+        TriangleRecord tri = static_triangle_records[ti];
+        first_index = tri.first_index;
+        mesh_index = tri.mesh_index;
+        return ray_triangle_int_watertight(ray_origin, ray_dir, tri.position0, tri.position1, tri.position2, near_plane, depth, bc);
+    }
+    // Only the indices of the record are used; the vertices are looked up through them
+    TriangleRecord tri = static_triangle_records[ti];
+    first_index = tri.first_index;
+    mesh_index = tri.mesh_index;
+    vec3 p0 = get_vertex_position(get_vertex_index(tri.first_index+0, tri.mesh_index));
+    vec3 p1 = get_vertex_position(get_vertex_index(tri.first_index+1, tri.mesh_index));
+    vec3 p2 = get_vertex_position(get_vertex_index(tri.first_index+2, tri.mesh_index));
+    return ray_triangle_int_legacy(ray_origin, ray_dir, p0, p1, p2, near_plane, depth, bc);
+}
+
+// Should match BVH::traversal_stack_size
+// Every BVH is at most BVH::max_depth deep (see lbvh.glsl for the GPU built one) so the
+// traversals never reach the bounds checks which would otherwise skip children
+#define BVH_STACK_SIZE 64
+
+void decode_child_bounds(QuantizedBVHNode node, uint child, out vec3 bounds_min, out vec3 bounds_max) {
+    // Mirrors QuantizedBVHNode::get_child_bounds(); q*spacing is exact so this matches the CPU
+    vec3 origin = vec3(node.origin[0], node.origin[1], node.origin[2]);
+    vec3 spacing = vec3(
+        uintBitsToFloat((node.exponents & 0xFFu) << 23),
+        uintBitsToFloat(((node.exponents >> 8) & 0xFFu) << 23),
+        uintBitsToFloat(((node.exponents >> 16) & 0xFFu) << 23)
+    );
+    uvec3 q_min, q_max;
+    for (uint axis=0; axis<3; axis++) {
+        uint min_byte = 6*child + axis;
+        uint max_byte = 6*child + 3 + axis;
+        q_min[axis] = (node.child_bounds[min_byte/4] >> (8*(min_byte%4))) & 0xFFu;
+        q_max[axis] = (node.child_bounds[max_byte/4] >> (8*(max_byte%4))) & 0xFFu;
+    }
+    bounds_min = origin + vec3(q_min) * spacing;
+    bounds_max = origin + vec3(q_max) * spacing;
+}
+
+// The traversals below are shared by cast_ray (closest hit) and occluded (any hit)
+// Each one returns true if it hit a triangle nearer than depth and updates depth, mesh_index,
+// hit_index (the first index of the triangle) and hit_bc (its barycentric coordinates)
+// With any_hit they return at the first hit they find instead of looking for the nearest one
+
+bool static_leaf_int(vec3 ray_origin, vec3 ray_dir, uint first, uint count, float near_plane, bool any_hit, inout float depth, inout int mesh_index, inout uint hit_index, inout vec3 hit_bc) {
+    // Intersects the static triangles [first, first+count) in BVH leaf order
+    bool hit = false;
+    for (uint ti=first; ti<first+count; ti++) {
+        uint first_index, tri_mesh_index;
+        vec3 bc;
+        if (static_triangle_int(ray_origin, ray_dir, ti, near_plane, depth, first_index, tri_mesh_index, bc)) {
+            hit = true;
+            mesh_index = int(tri_mesh_index);
+            hit_index = first_index;
+            hit_bc = bc;
+            if (any_hit) return true;
+        }
+    }
+    return hit;
+}
+
+bool static_bvh_int(vec3 ray_origin, vec3 ray_dir, float near_plane, bool any_hit, inout float depth, inout int mesh_index, inout uint hit_index, inout vec3 hit_bc) {
+    // Traverses static_bvh_nodes (nearest child first)
+    vec3 inv_ray_dir = 1.0f / ray_dir;
+    bool hit = false;
+    uint stack[BVH_STACK_SIZE];
+    uint stack_size = 0;
+    if (ray_aabb_int(ray_origin, inv_ray_dir, static_bvh_nodes[0].bounds_min, static_bvh_nodes[0].bounds_max, near_plane, depth) >= 0.0f) {
+        stack[stack_size++] = 0;
+    }
+
+    while (stack_size > 0) {
+        BVHNode node = static_bvh_nodes[stack[--stack_size]];
+
+        if (node.count > 0) {
+            if (static_leaf_int(ray_origin, ray_dir, node.left_or_first, node.count, near_plane, any_hit, depth, mesh_index, hit_index, hit_bc)) {
+                hit = true;
+                if (any_hit) return true;
+            }
+        } else {
+            uint left = node.left_or_first;
+            uint right = node.left_or_first + 1;
+            float left_dist = ray_aabb_int(ray_origin, inv_ray_dir, static_bvh_nodes[left].bounds_min, static_bvh_nodes[left].bounds_max, near_plane, depth);
+            float right_dist = ray_aabb_int(ray_origin, inv_ray_dir, static_bvh_nodes[right].bounds_min, static_bvh_nodes[right].bounds_max, near_plane, depth);
+
+            // Push the farther child first so the nearer one is visited first
+            if (left_dist >= 0.0f && right_dist >= 0.0f && stack_size+2 <= BVH_STACK_SIZE) {
+                bool left_first = left_dist <= right_dist;
+                stack[stack_size++] = left_first ? right : left;
+                stack[stack_size++] = left_first ? left : right;
+            } else if (left_dist >= 0.0f && stack_size < BVH_STACK_SIZE) {
+                stack[stack_size++] = left;
+            } else if (right_dist >= 0.0f && stack_size < BVH_STACK_SIZE) {
+                stack[stack_size++] = right;
+            }
+        }
+    }
+    return hit;
+}
+
+bool quantized_static_bvh_int(vec3 ray_origin, vec3 ray_dir, float near_plane, bool any_hit, inout float depth, inout int mesh_index, inout uint hit_index, inout vec3 hit_bc) {
+    // Traverses quantized_static_bvh_nodes (nearest child first)
+    // Leaves have no nodes of their own; they are intersected as soon as their parent is visited
+    vec3 inv_ray_dir = 1.0f / ray_dir;
+    bool hit = false;
+    uint stack[BVH_STACK_SIZE];
+    uint stack_size = 0;
+    stack[stack_size++] = 0;
+
+    while (stack_size > 0) {
+        QuantizedBVHNode node = quantized_static_bvh_nodes[stack[--stack_size]];
+
+        float dist[2];
+        for (uint c=0; c<2; c++) {
+            vec3 bounds_min, bounds_max;
+            decode_child_bounds(node, c, bounds_min, bounds_max);
+            dist[c] = ray_aabb_int(ray_origin, inv_ray_dir, bounds_min, bounds_max, near_plane, depth);
+        }
+        uint near = (dist[1] >= 0.0f && (dist[0] < 0.0f || dist[1] < dist[0])) ? 1 : 0;
+        uint far = 1 - near;
+
+        for (uint k=0; k<2; k++) {
+            uint c = k == 0 ? near : far;
+            uint child = node.children[c];
+            if (dist[c] < 0.0f || (child & QUANTIZED_LEAF) == 0) {
+                continue;
+            }
+            uint first = child & QUANTIZED_FIRST_MASK;
+            uint count = (child & ~QUANTIZED_LEAF) >> QUANTIZED_COUNT_SHIFT;
+            if (static_leaf_int(ray_origin, ray_dir, first, count, near_plane, any_hit, depth, mesh_index, hit_index, hit_bc)) {
+                hit = true;
+                if (any_hit) return true;
+            }
+        }
+
+        // Push the farther interior child first so the nearer one is visited first
+        if (dist[far] >= 0.0f && (node.children[far] & QUANTIZED_LEAF) == 0 && stack_size < BVH_STACK_SIZE) {
+            stack[stack_size++] = node.children[far];
+        }
+        if (dist[near] >= 0.0f && (node.children[near] & QUANTIZED_LEAF) == 0 && stack_size < BVH_STACK_SIZE) {
+            stack[stack_size++] = node.children[near];
+        }
+    }
+    return hit;
+}
+
+bool ray_instance_int(vec3 ray_origin, vec3 ray_dir, uint mi, float near_plane, bool any_hit, inout float depth, inout uint hit_index, inout vec3 hit_bc) {
+    // Intersects the ray with dynamic mesh mi by traversing the mesh's BVH in object space
+    mat4 inverse_transformation = meshes[mi].inverse_transformation;
+    // The direction isn't normalized so distances along the ray stay the same as in world space
+    vec3 origin = (inverse_transformation * vec4(ray_origin, 1.0f)).xyz;
+    vec3 dir = mat3(inverse_transformation) * ray_dir;
+    vec3 inv_dir = 1.0f / dir;
+
+    uint bvh_offset = uint(meshes[mi].bvh_offset);
+    uint index_offset = uint(meshes[mi].index_offset);
+    bool hit = false;
+    vec3 bc;
+
+    uint stack[BVH_STACK_SIZE];
+    uint stack_size = 0;
+    if (ray_aabb_int(origin, inv_dir, dynamic_bvh_nodes[bvh_offset].bounds_min, dynamic_bvh_nodes[bvh_offset].bounds_max, near_plane, depth) >= 0.0f) {
+        stack[stack_size++] = 0;
+    }
+
+    while (stack_size > 0) {
+        BVHNode node = dynamic_bvh_nodes[bvh_offset + stack[--stack_size]];
+
+        if (node.count > 0) {
+            for (uint i=index_offset+3*node.left_or_first; i<index_offset+3*(node.left_or_first+node.count); i+=3) {
+                vec3 p0 = get_dynamic_vertex_position(get_dynamic_vertex_index(i+0, mi));
+                vec3 p1 = get_dynamic_vertex_position(get_dynamic_vertex_index(i+1, mi));
+                vec3 p2 = get_dynamic_vertex_position(get_dynamic_vertex_index(i+2, mi));
+                if (ray_triangle_int(origin, dir, p0, p1, p2, near_plane, depth, bc)) {
+                    hit = true;
+                    hit_index = i;
+                    hit_bc = bc;
+                    if (any_hit) return true;
+                }
+            }
+        } else {
+            uint left = node.left_or_first;
+            uint right = node.left_or_first + 1;
+            float left_dist = ray_aabb_int(origin, inv_dir, dynamic_bvh_nodes[bvh_offset+left].bounds_min, dynamic_bvh_nodes[bvh_offset+left].bounds_max, near_plane, depth);
+            float right_dist = ray_aabb_int(origin, inv_dir, dynamic_bvh_nodes[bvh_offset+right].bounds_min, dynamic_bvh_nodes[bvh_offset+right].bounds_max, near_plane, depth);
+
+            if (left_dist >= 0.0f && right_dist >= 0.0f && stack_size+2 <= BVH_STACK_SIZE) {
+                bool left_first = left_dist <= right_dist;
+                stack[stack_size++] = left_first ? right : left;
+                stack[stack_size++] = left_first ? left : right;
+            } else if (left_dist >= 0.0f && stack_size < BVH_STACK_SIZE) {
+                stack[stack_size++] = left;
+            } else if (right_dist >= 0.0f && stack_size < BVH_STACK_SIZE) {
+                stack[stack_size++] = right;
+            }
+        }
+    }
+    return hit;
+}
+
+bool tlas_int(vec3 ray_origin, vec3 ray_dir, float near_plane, bool any_hit, inout float depth, inout int mesh_index, inout uint hit_index, inout vec3 hit_bc) {
+    // Traverses the top level BVH and descends into the object space BVH of every mesh instance hit
+    vec3 inv_ray_dir = 1.0f / ray_dir;
+    bool hit = false;
+    uint stack[BVH_STACK_SIZE];
+    uint stack_size = 0;
+    if (ray_aabb_int(ray_origin, inv_ray_dir, tlas_nodes[0].bounds_min, tlas_nodes[0].bounds_max, near_plane, depth) >= 0.0f) {
+        stack[stack_size++] = 0;
+    }
+
+    while (stack_size > 0) {
+        BVHNode node = tlas_nodes[stack[--stack_size]];
+
+        if (node.count > 0) {
+            if (ray_instance_int(ray_origin, ray_dir, node.left_or_first, near_plane, any_hit, depth, hit_index, hit_bc)) {
+                hit = true;
+                mesh_index = int(node.left_or_first);
+                if (any_hit) return true;
+            }
+        } else {
+            uint left = node.left_or_first;
+            uint right = node.left_or_first + 1;
+            float left_dist = ray_aabb_int(ray_origin, inv_ray_dir, tlas_nodes[left].bounds_min, tlas_nodes[left].bounds_max, near_plane, depth);
+            float right_dist = ray_aabb_int(ray_origin, inv_ray_dir, tlas_nodes[right].bounds_min, tlas_nodes[right].bounds_max, near_plane, depth);
+
+            if (left_dist >= 0.0f && right_dist >= 0.0f && stack_size+2 <= BVH_STACK_SIZE) {
+                bool left_first = left_dist <= right_dist;
+                stack[stack_size++] = left_first ? right : left;
+                stack[stack_size++] = left_first ? left : right;
+            } else if (left_dist >= 0.0f && stack_size < BVH_STACK_SIZE) {
+                stack[stack_size++] = left;
+            } else if (right_dist >= 0.0f && stack_size < BVH_STACK_SIZE) {
+                stack[stack_size++] = right;
+            }
+        }
+    }
+    return hit;
+}
+
+bool dynamic_bvh_int(vec3 ray_origin, vec3 ray_dir, float near_plane, bool any_hit, inout float depth, inout int mesh_index, inout uint hit_index, inout vec3 hit_bc) {
+    // Same as static_bvh_int but with the world space BVH refit to (or rebuilt over) the transformed vertices
+    vec3 inv_ray_dir = 1.0f / ray_dir;
+    bool hit = false;
+    vec3 bc;
+    uint stack[BVH_STACK_SIZE];
+    uint stack_size = 0;
+    if (ray_aabb_int(ray_origin, inv_ray_dir, dynamic_bvh_nodes[0].bounds_min, dynamic_bvh_nodes[0].bounds_max, near_plane, depth) >= 0.0f) {
+        stack[stack_size++] = 0;
+    }
+
+    while (stack_size > 0) {
+        BVHNode node = dynamic_bvh_nodes[stack[--stack_size]];
+
+        if (node.count > 0) {
+            for (uint ti=node.left_or_first; ti<node.left_or_first+node.count; ti++) {
+                BVHTriangle tri = dynamic_bvh_triangles[ti];
+                vec3 p0 = get_vertex_position(get_vertex_index(tri.first_index+0, tri.mesh_index));
+                vec3 p1 = get_vertex_position(get_vertex_index(tri.first_index+1, tri.mesh_index));
+                vec3 p2 = get_vertex_position(get_vertex_index(tri.first_index+2, tri.mesh_index));
+                if (ray_triangle_int(ray_origin, ray_dir, p0, p1, p2, near_plane, depth, bc)) {
+                    hit = true;
+                    mesh_index = int(tri.mesh_index);
+                    hit_index = tri.first_index;
+                    hit_bc = bc;
+                    if (any_hit) return true;
+                }
+            }
+        } else {
+            uint left = node.left_or_first;
+            uint right = node.left_or_first + 1;
+            float left_dist = ray_aabb_int(ray_origin, inv_ray_dir, dynamic_bvh_nodes[left].bounds_min, dynamic_bvh_nodes[left].bounds_max, near_plane, depth);
+            float right_dist = ray_aabb_int(ray_origin, inv_ray_dir, dynamic_bvh_nodes[right].bounds_min, dynamic_bvh_nodes[right].bounds_max, near_plane, depth);
+
+            if (left_dist >= 0.0f && right_dist >= 0.0f && stack_size+2 <= BVH_STACK_SIZE) {
+                bool left_first = left_dist <= right_dist;
+                stack[stack_size++] = left_first ? right : left;
+                stack[stack_size++] = left_first ? left : right;
+            } else if (left_dist >= 0.0f && stack_size < BVH_STACK_SIZE) {
+                stack[stack_size++] = left;
+            } else if (right_dist >= 0.0f && stack_size < BVH_STACK_SIZE) {
+                stack[stack_size++] = right;
+            }
+        }
+    }
+    return hit;
+}
+
+bool transformed_meshes_int(vec3 ray_origin, vec3 ray_dir, float near_plane, bool any_hit, inout float depth, inout int mesh_index, inout uint hit_index, inout vec3 hit_bc) {
+    // Tests every transformed triangle of the dynamic meshes
+    bool hit = false;
+    vec3 bc;
+    for (uint mi=nr_static_meshes; mi<nr_meshes; mi++) {
+        for (uint i=meshes[mi].index_offset; i<meshes[mi].index_offset+meshes[mi].nr_indices; i+=3) {
+            vec3 p0 = get_vertex_position(get_vertex_index(i+0, mi));
+            vec3 p1 = get_vertex_position(get_vertex_index(i+1, mi));
+            vec3 p2 = get_vertex_position(get_vertex_index(i+2, mi));
+            if (ray_triangle_int(ray_origin, ray_dir, p0, p1, p2, near_plane, depth, bc)) {
+                hit = true;
+                mesh_index = int(mi);
+                hit_index = i;
+                hit_bc = bc;
+                if (any_hit) return true;
+            }
+        }
+    }
+    return hit;
+}
+
+bool scene_int(vec3 ray_origin, vec3 ray_dir, float near_plane, bool any_hit, inout float depth, inout int mesh_index, inout uint hit_index, inout vec3 hit_bc) {
+    // Intersects the static and the dynamic geometry through whichever structures currently hold them
+    bool hit = false;
+    if (nr_quantized_static_bvh_nodes > 0) {
+        hit = quantized_static_bvh_int(ray_origin, ray_dir, near_plane, any_hit, depth, mesh_index, hit_index, hit_bc);
+    } else if (nr_static_bvh_nodes > 0) {
+        hit = static_bvh_int(ray_origin, ray_dir, near_plane, any_hit, depth, mesh_index, hit_index, hit_bc);
+    }
+    if (hit && any_hit) return true;
+
+    if (dynamic_geometry == DYNAMIC_GEOMETRY_INSTANCED) {
+        if (nr_tlas_nodes > 0 && tlas_int(ray_origin, ray_dir, near_plane, any_hit, depth, mesh_index, hit_index, hit_bc)) hit = true;
+    } else if (dynamic_geometry == DYNAMIC_GEOMETRY_REFITTED || dynamic_geometry == DYNAMIC_GEOMETRY_REBUILT) {
+        if (nr_dynamic_bvh_nodes > 0 && dynamic_bvh_int(ray_origin, ray_dir, near_plane, any_hit, depth, mesh_index, hit_index, hit_bc)) hit = true;
+    } else {
+        if (transformed_meshes_int(ray_origin, ray_dir, near_plane, any_hit, depth, mesh_index, hit_index, hit_bc)) hit = true;
+    }
+    return hit;
+}
+
 Vertex cast_ray(vec3 ray_origin, vec3 ray_dir, float near_plane, float far_plane, out int mesh_index) {
     /*
     Returns an interpolated vertex from the intersection between the ray and the
@@ -325,43 +999,35 @@ Vertex cast_ray(vec3 ray_origin, vec3 ray_dir, float near_plane, float far_plane
         vec2(0.0f)
     );
     mesh_index = -1;
-
-    for (uint mi=0; mi<nr_meshes; mi++) {
-
-        for (uint i=meshes[mi].index_offset; i<meshes[mi].index_offset+meshes[mi].nr_indices; i+=3) {
-            Vertex v0;
-            Vertex v1;
-            Vertex v2;
-
-            // All mesh vertices must be the in same array (static or dynamic)
-            if (i < nr_static_indices) {
-                v0 = vertices[static_indices[i+0] + meshes[mi].vertex_offset];
-                v1 = vertices[static_indices[i+1] + meshes[mi].vertex_offset];
-                v2 = vertices[static_indices[i+2] + meshes[mi].vertex_offset];
-            } else {
-                v0 = vertices[dynamic_indices[i+0-nr_static_indices] + meshes[mi].vertex_offset + nr_static_vertices];
-                v1 = vertices[dynamic_indices[i+1-nr_static_indices] + meshes[mi].vertex_offset + nr_static_vertices];
-                v2 = vertices[dynamic_indices[i+2-nr_static_indices] + meshes[mi].vertex_offset + nr_static_vertices];
-            }
-
-            vec3 normal = cross(vec3(v1.position-v0.position), vec3(v2.position-v0.position));
-            float rpi = ray_plane_int(ray_origin, ray_dir, v0.position.xyz, normalize(normal));
-
-            // If the ray intersects the triangle
-            float dist = rpi;
-            if (dist >= near_plane && dist <= depth) {
-                vec3 intersection_point = ray_origin + rpi*ray_dir;
-                vec4 bc = barycentric_coordinates(intersection_point, v0.position.xyz, v1.position.xyz, v2.position.xyz);
-                // If the point is inside of the triangle
-                if (bc.w > 0.0f) {
-                    depth = dist;
-                    vert.position = vec4(intersection_point, 1.0f);
-                    vert.normal = bc.x*v0.normal + bc.y*v1.normal + bc.z*v2.normal;
-                    vert.tangent = bc.x*v0.tangent + bc.y*v1.tangent + bc.z*v2.tangent;
-                    vert.tex_coord = bc.x*v0.tex_coord + bc.y*v1.tex_coord + bc.z*v2.tex_coord;
-                    mesh_index = int(mi);
-                }
-            }
+    // Index of the first index of the nearest triangle and its barycentric coordinates
+    uint hit_index = 0;
+    vec3 hit_bc = vec3(0.0f);
+    scene_int(ray_origin, ray_dir, near_plane, false, depth, mesh_index, hit_index, hit_bc);
+
+    // Only interpolate the attributes of the nearest triangle
+    if (mesh_index != -1) {
+        vert.position = vec4(ray_origin + depth*ray_dir, 1.0f);
+
+        if (mesh_index >= nr_static_meshes && dynamic_geometry == DYNAMIC_GEOMETRY_INSTANCED) {
+            // The vertices are still in object space
+            Vertex v0 = get_dynamic_vertex(get_dynamic_vertex_index(hit_index+0, mesh_index));
+            Vertex v1 = get_dynamic_vertex(get_dynamic_vertex_index(hit_index+1, mesh_index));
+            Vertex v2 = get_dynamic_vertex(get_dynamic_vertex_index(hit_index+2, mesh_index));
+
+            mat3 ti_model = transpose(mat3(meshes[mesh_index].inverse_transformation));
+            vec3 normal = hit_bc.x*v0.normal.xyz + hit_bc.y*v1.normal.xyz + hit_bc.z*v2.normal.xyz;
+            vec4 tangent = hit_bc.x*v0.tangent + hit_bc.y*v1.tangent + hit_bc.z*v2.tangent;
+            vert.normal = vec4(ti_model * normal, 0.0f);
+            vert.tangent = vec4(ti_model * tangent.xyz, tangent.w);
+            vert.tex_coord = hit_bc.x*v0.tex_coord + hit_bc.y*v1.tex_coord + hit_bc.z*v2.tex_coord;
+        } else {
+            VertexAttributes v0 = vertex_attributes[get_vertex_index(hit_index+0, mesh_index)];
+            VertexAttributes v1 = vertex_attributes[get_vertex_index(hit_index+1, mesh_index)];
+            VertexAttributes v2 = vertex_attributes[get_vertex_index(hit_index+2, mesh_index)];
+
+            vert.normal = hit_bc.x*v0.normal + hit_bc.y*v1.normal + hit_bc.z*v2.normal;
+            vert.tangent = hit_bc.x*v0.tangent + hit_bc.y*v1.tangent + hit_bc.z*v2.tangent;
+            vert.tex_coord = hit_bc.x*v0.tex_coord + hit_bc.y*v1.tex_coord + hit_bc.z*v2.tex_coord;
         }
     }
     vert.normal = vec4(normalize(vert.normal.rgb), 0.0f);
@@ -372,17 +1038,56 @@ Vertex cast_ray(vec3 ray_origin, vec3 ray_dir, out int mesh_index) {
     return cast_ray(ray_origin, ray_dir, NEAR_PLANE, FAR_PLANE, mesh_index);
 }
 
+bool occluded(vec3 ray_origin, vec3 ray_dir, float near_plane, float far_plane) {
+    /*
+    Returns true if the ray hits any triangle between near_plane and far_plane
+    Unlike cast_ray this stops at the first hit (in whatever order the BVHs are traversed)
+    and doesn't interpolate any attributes, which is all shadow rays need
+    */
+    float depth = far_plane;
+    int mesh_index = -1;
+    uint hit_index = 0;
+    vec3 hit_bc = vec3(0.0f);
+    return scene_int(ray_origin, ray_dir, near_plane, true, depth, mesh_index, hit_index, hit_bc);
+}
+
 int cast_ray_for_lights(vec3 ray_origin, vec3 ray_dir, float near_plane, float far_plane, out float depth) {
+    // Traverse the BVH over the visible light spheres (nearest child first)
     int closest_light_index = -1;
     float closest_depth = far_plane;
-    for (uint i=0; i<nr_lights; i++) {
-        Light current_light = lights[i];
-        if (current_light.visibility == 1) {
-            bool intersected;
-            float current_depth = ray_sphere_int(ray_origin, ray_dir, current_light.position, 0.1f, intersected);
-            if (intersected && current_depth > near_plane && current_depth < closest_depth) {
-                closest_depth = current_depth;
-                closest_light_index = int(i);
+    if (nr_light_bvh_nodes > 0) {
+        vec3 inv_ray_dir = 1.0f / ray_dir;
+        uint stack[BVH_STACK_SIZE];
+        uint stack_size = 0;
+        if (ray_aabb_int(ray_origin, inv_ray_dir, tlas_nodes[light_bvh_offset].bounds_min, tlas_nodes[light_bvh_offset].bounds_max, near_plane, closest_depth) >= 0.0f) {
+            stack[stack_size++] = light_bvh_offset;
+        }
+
+        while (stack_size > 0) {
+            BVHNode node = tlas_nodes[stack[--stack_size]];
+
+            if (node.count > 0) {
+                bool intersected;
+                float current_depth = ray_sphere_int(ray_origin, ray_dir, lights[node.left_or_first].position, LIGHT_SPHERE_RADIUS, intersected);
+                if (intersected && current_depth > near_plane && current_depth < closest_depth) {
+                    closest_depth = current_depth;
+                    closest_light_index = int(node.left_or_first);
+                }
+            } else {
+                uint left = node.left_or_first;
+                uint right = node.left_or_first + 1;
+                float left_dist = ray_aabb_int(ray_origin, inv_ray_dir, tlas_nodes[left].bounds_min, tlas_nodes[left].bounds_max, near_plane, closest_depth);
+                float right_dist = ray_aabb_int(ray_origin, inv_ray_dir, tlas_nodes[right].bounds_min, tlas_nodes[right].bounds_max, near_plane, closest_depth);
+
+                if (left_dist >= 0.0f && right_dist >= 0.0f && stack_size+2 <= BVH_STACK_SIZE) {
+                    bool left_first = left_dist <= right_dist;
+                    stack[stack_size++] = left_first ? right : left;
+                    stack[stack_size++] = left_first ? left : right;
+                } else if (left_dist >= 0.0f && stack_size < BVH_STACK_SIZE) {
+                    stack[stack_size++] = left;
+                } else if (right_dist >= 0.0f && stack_size < BVH_STACK_SIZE) {
+                    stack[stack_size++] = right;
+                }
             }
         }
     }
@@ -456,11 +1161,9 @@ vec3 cook_torrance_BRDF(vec3 view, vec3 normal, vec3 light, MaterialData materia
 vec3 calculate_light(vec3 position, vec3 normal, vec3 ray_dir, MaterialData material, Light light) {
     LightData light_data = get_light_data(light, position);
     #if SHADOWS
-        int mesh_index;
         float light_distance = light_data.light_distance;
         if (light_distance < -EPSILON) light_distance = FAR_PLANE;
-        cast_ray(position, -light_data.direction, BIAS, light_distance, mesh_index);
-        if (mesh_index != -1) {
+        if (occluded(position, -light_data.direction, BIAS, light_distance)) {
             return material.albedo.rgb * material.AO * light_data.radiance * light_data.ambient_multiplier;
         }
     #endif
@@ -471,6 +1174,68 @@ vec3 calculate_light(vec3 position, vec3 normal, vec3 ray_dir, MaterialData mate
 }
 
 
+// ~=~=~=~=~=~=~= Light Sampling =~=~=~=~=~=~=~
+
+uniform uint frame_index = 0;
+uint rng_state;
+
+uint pcg_hash(uint x) {
+    uint state = x * 747796405u + 2891336453u;
+    uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+float random_float() {
+    // Uniform in [0,1)
+    rng_state = pcg_hash(rng_state);
+    return float(rng_state >> 8) * (1.0f / 16777216.0f);
+}
+
+float luminance(vec3 radiance) {
+    // Must match LightSampler::luminance
+    return dot(radiance, vec3(0.2126f, 0.7152f, 0.0722f));
+}
+
+LightSample sample_light() {
+    // Mirrors LightSampler::sample
+    float scaled = random_float() * float(nr_sampled_lights);
+    uint i = min(uint(scaled), nr_sampled_lights-1);
+    return scaled - float(i) < light_samples[i].threshold ? light_samples[i] : light_samples[light_samples[i].alias];
+}
+
+// Candidates picked from the alias table for every light sample
+#define LIGHT_CANDIDATES 8
+vec3 sample_lights(vec3 position, vec3 normal, vec3 ray_dir, MaterialData material) {
+    /*
+    Estimates the light from every PointLight with nr_light_samples shadow rays
+    Each sample picks LIGHT_CANDIDATES lights in proportion to their power and keeps one of them
+    in proportion to the light it would deliver to position (resampled importance sampling)
+    The estimate is unbiased since every light delivering any light can be kept
+    */
+    vec3 color = vec3(0.0f);
+    for (uint s=0; s<nr_light_samples; s++) {
+        float weight_sum = 0.0f;
+        uint chosen = 0;
+        float chosen_target = 0.0f;
+        for (uint c=0; c<LIGHT_CANDIDATES; c++) {
+            LightSample candidate = sample_light();
+            float target = luminance(get_light_data(lights[candidate.light_index], position).radiance);
+            float weight = target / candidate.pmf;
+            weight_sum += weight;
+            if (random_float() * weight_sum < weight) {
+                chosen = candidate.light_index;
+                chosen_target = target;
+            }
+        }
+        if (chosen_target > 0.0f) {
+            float contribution_weight = weight_sum / (float(LIGHT_CANDIDATES) * chosen_target);
+            color += calculate_light(position, normal, ray_dir, material, lights[chosen]) * contribution_weight;
+        }
+    }
+    return color / float(nr_light_samples);
+}
+
+
 // ~=~=~=~=~=~=~= Tracing =~=~=~=~=~=~=~
 
 vec4 trace(vec3 ray_origin, vec3 ray_dir) {
@@ -479,10 +1244,11 @@ vec4 trace(vec3 ray_origin, vec3 ray_dir) {
     Vertex vert = cast_ray(ray_origin, ray_dir, mesh_index);
 
     // Check for ray intersection w/ light (if so, terminate early to avoid unnecessary calculations)
-    float vertex_depth = length(vert.position.xyz-ray_origin);
+    // Only lights in front of the hit triangle are looked for
+    float vertex_depth = mesh_index == -1 ? FAR_PLANE : length(vert.position.xyz-ray_origin);
     float lights_depth;
-    int light_index = cast_ray_for_lights(ray_origin, ray_dir, lights_depth);
-    if (light_index != -1 && (lights_depth <= vertex_depth || mesh_index == -1)) {
+    int light_index = cast_ray_for_lights(ray_origin, ray_dir, NEAR_PLANE, vertex_depth, lights_depth);
+    if (light_index != -1) {
         return vec4(lights[light_index].radiance, 1.0f);
     }
 
@@ -507,8 +1273,32 @@ vec4 trace(vec3 ray_origin, vec3 ray_dir) {
     MaterialData mat = get_material_data(material, vert.tex_coord);
     // vec3 color = calculate_light(vert.position.rgb, vert.normal.xyz, ray_dir, mat, Light(vec3(0.0f), 0, vec3(0.4f, -1.0f, -0.4f), 1, vec3(3.0f), 1.0f));
     vec3 color = vec3(0.0f);
-    for (uint i=0; i<nr_lights; i++) {
-        color += calculate_light(vert.position.rgb, vert.normal.xyz, ray_dir, mat, lights[i]);
+    if (nr_light_samples == 0 && light_culling) {
+        uint global_lights = 2*LIGHT_GRID_CELLS;
+        for (uint i=global_lights; i<global_lights+nr_global_lights; i++) {
+            color += calculate_light(vert.position.rgb, vert.normal.xyz, ray_dir, mat, lights[light_grid[i]]);
+        }
+        // Points outside of the grid are out of reach of every light with a cutoff radius
+        ivec3 cell = ivec3(floor((vert.position.xyz - light_grid_min) / light_grid_cell_size));
+        if (all(greaterThanEqual(cell, ivec3(0))) && all(lessThan(cell, ivec3(LIGHT_GRID_RESOLUTION)))) {
+            uint cell_index = (cell.z*LIGHT_GRID_RESOLUTION + cell.y)*LIGHT_GRID_RESOLUTION + cell.x;
+            uint offset = light_grid[2*cell_index];
+            uint count = light_grid[2*cell_index+1];
+            for (uint i=offset; i<offset+count; i++) {
+                color += calculate_light(vert.position.rgb, vert.normal.xyz, ray_dir, mat, lights[light_grid[i]]);
+            }
+        }
+    } else if (nr_light_samples == 0) {
+        for (uint i=0; i<nr_lights; i++) {
+            color += calculate_light(vert.position.rgb, vert.normal.xyz, ray_dir, mat, lights[i]);
+        }
+    } else {
+        for (uint i=nr_sampled_lights; i<nr_sampled_lights+nr_unsampled_lights; i++) {
+            color += calculate_light(vert.position.rgb, vert.normal.xyz, ray_dir, mat, lights[light_samples[i].light_index]);
+        }
+        if (nr_sampled_lights > 0) {
+            color += sample_lights(vert.position.rgb, vert.normal.xyz, ray_dir, mat);
+        }
     }
     return vec4(color, 1.0f);
 }
@@ -523,6 +1313,8 @@ void main() {
         return;
     }
 
+    rng_state = pcg_hash(uint(pix.x) + pcg_hash(uint(pix.y) + pcg_hash(frame_index)));
+
     vec2 tex_coords = vec2(pix)/size;
 
     vec3 ray = mix(mix(ray00, ray10, tex_coords.x), mix(ray01, ray11, tex_coords.x), tex_coords.y);
@@ -26,28 +26,97 @@ struct Vertex {
     // Total Size: 64
 };
 
-layout (std140, binding=0) buffer VertexBuffer {
-    Vertex vertices[];
-    //             // Base Alignment  // Aligned Offset
-    // vertex[0]      64                 0
-    // vertex[1]      64                 64
-    // vertex[2]      64                 128
-    // ...
-    // Potential maximum of 2,000,000 Vertices (128 MB / 64 B)
+struct VertexAttributes {
+                    // Base Alignment  // Aligned Offset
+    vec4 normal;    // 16                 0
+    vec4 tangent;   // 16                 16
+    vec2 tex_coord; // 8                  32
+    // (PADDING)    // 8                  40
+
+    // Total Size: 48
 };
-uniform uint nr_vertices;
 
-layout (std140, binding=3) buffer StaticVertexBuffer {
-    // Same memory layout as VertexBuffer
-    Vertex static_vertices[];
+// The transformed vertices are split into two streams so traversal only reads the positions
+layout (std430, binding=0) buffer VertexPositionBuffer {
+    // 3 floats per vertex
+    float vertex_positions[];
+};
+
+layout (std430, binding=20) buffer VertexAttributeBuffer {
+    VertexAttributes vertex_attributes[];
+};
+uniform uint nr_vertices;
+// The vertices before first_vertex (the static ones once they've been transformed) are skipped
+uniform uint first_vertex = 0;
+
+// The untransformed vertices are either Vertex structs (FULL_VERTEX_STRIDE uvec2s each) or
+// compact vertices (COMPACT_VERTEX_STRIDE uvec2s each) depending on compact_vertices
+// This MUST match Vertex::as_byte_array and Vertex::as_compact_byte_array in Vertex.cpp
+#define FULL_VERTEX_STRIDE 8
+#define COMPACT_VERTEX_STRIDE 3
+uniform bool compact_vertices = false;
+
+layout (std430, binding=3) buffer StaticVertexBuffer {
+    uvec2 static_vertex_data[];
 };
 uniform uint nr_static_vertices;
 
-layout (std140, binding=4) buffer DynamicVertexBuffer {
-    Vertex dynamic_vertices[];
+layout (std430, binding=4) buffer DynamicVertexBuffer {
+    uvec2 dynamic_vertex_data[];
 };
 uniform uint nr_dynamic_vertices;
 
+vec3 octahedral_decode(vec2 encoded) {
+    // This MUST match Vertex::octahedral_decode in Vertex.cpp
+    vec3 v = vec3(encoded, 1.0f - abs(encoded.x) - abs(encoded.y));
+    if (v.z < 0.0f)
+        v.xy = (1.0f - abs(encoded.yx)) * vec2(encoded.x >= 0.0f ? 1.0f : -1.0f, encoded.y >= 0.0f ? 1.0f : -1.0f);
+    return normalize(v);
+}
+
+Vertex unpack_compact_vertex(uvec2 w0, uvec2 w1, uvec2 w2) {
+    Vertex vert;
+    vert.position = vec4(uintBitsToFloat(uvec3(w0, w1.x)), 1.0f);
+    vert.normal = vec4(octahedral_decode(unpackSnorm2x16(w1.y)), 0.0f);
+    // The lowest bit of the tangent holds the bitangent sign
+    vert.tangent = vec4(octahedral_decode(unpackSnorm2x16(w2.x)), (w2.x & 1u) != 0u ? -1.0f : 1.0f);
+    vert.tex_coord = unpackHalf2x16(w2.y);
+    return vert;
+}
+
+Vertex unpack_full_vertex(uvec2 w0, uvec2 w1, uvec2 w2, uvec2 w3, uvec2 w4, uvec2 w5, uvec2 w6) {
+    Vertex vert;
+    vert.position = uintBitsToFloat(uvec4(w0, w1));
+    vert.normal = uintBitsToFloat(uvec4(w2, w3));
+    vert.tangent = uintBitsToFloat(uvec4(w4, w5));
+    vert.tex_coord = uintBitsToFloat(w6);
+    return vert;
+}
+
+Vertex get_static_vertex(uint i) {
+    if (compact_vertices) {
+        uint o = i*COMPACT_VERTEX_STRIDE;
+        return unpack_compact_vertex(static_vertex_data[o], static_vertex_data[o+1], static_vertex_data[o+2]);
+    }
+    uint o = i*FULL_VERTEX_STRIDE;
+    return unpack_full_vertex(
+        static_vertex_data[o], static_vertex_data[o+1], static_vertex_data[o+2], static_vertex_data[o+3],
+        static_vertex_data[o+4], static_vertex_data[o+5], static_vertex_data[o+6]
+    );
+}
+
+Vertex get_dynamic_vertex(uint i) {
+    if (compact_vertices) {
+        uint o = i*COMPACT_VERTEX_STRIDE;
+        return unpack_compact_vertex(dynamic_vertex_data[o], dynamic_vertex_data[o+1], dynamic_vertex_data[o+2]);
+    }
+    uint o = i*FULL_VERTEX_STRIDE;
+    return unpack_full_vertex(
+        dynamic_vertex_data[o], dynamic_vertex_data[o+1], dynamic_vertex_data[o+2], dynamic_vertex_data[o+3],
+        dynamic_vertex_data[o+4], dynamic_vertex_data[o+5], dynamic_vertex_data[o+6]
+    );
+}
+
 layout (std430, binding=1) buffer StaticIndexBuffer {
     // Memory layout should exactly match that of a C++ int array
     uint static_indices[];
@@ -62,73 +131,90 @@ layout (std430, binding=2) buffer DynamicIndexBuffer {
 uniform uint nr_dynamic_indices;
 
 struct Mesh {
-                          // Base Alignment  // Aligned Offset
-    mat4 transformation;  // 16              // 0
-                          // 16              // 16
-                          // 16              // 32
-                          // 16 (total: 64)  // 48
+                                  // Base Alignment  // Aligned Offset
+    mat4 transformation;          // 16              // 0
+                                  // 16              // 16
+                                  // 16              // 32
+                                  // 16 (total: 64)  // 48
+
+    mat4 inverse_transformation;  // 16              // 64
+                                  // 16              // 80
+                                  // 16              // 96
+                                  // 16 (total: 64)  // 112
+
+    int vertex_offset;            // 4               // 128
 
-    int vertex_offset;    // 4               // 64
+    int index_offset;             // 4               // 132
+    int nr_indices;               // 4               // 136
 
-    int index_offset;     // 4               // 68
-    int nr_indices;       // 4               // 72
+    int material_index;           // 4               // 140
 
-    int material_index;   // 4               // 76
+    // Index of the root of the mesh's object space BVH in DynamicBVHBuffer (-1 if it has none)
+    int bvh_offset;               // 4               // 144
 
-    // Total Size: 80
+    // PADDING:                   // 12              // 160
+
+    // Total Size: 160
 };
 
 layout (std140, binding=5) buffer MeshBuffer {
     Mesh meshes[];
     //          // Base Alignment  // Aligned Offset
-    // mesh[0]  // 80              // 0
-    // mesh[1]  // 80              // 80
-    // mesh[3]  // 80              // 160
+    // mesh[0]  // 160             // 0
+    // mesh[1]  // 160             // 160
+    // mesh[3]  // 160             // 320
     // ...
 };
-uniform uint nr_meshes;
 
-#define Y_SIZE 64
-layout (local_size_x = 8, local_size_y = 8) in;
+layout (std430, binding=21) buffer VertexMeshBuffer {
+    // (first vertex, index in meshes) of every dynamic mesh with vertices sorted by first vertex
+    // Dynamic meshes are sub-allocated so their vertices aren't in the same order as the meshes
+    uvec2 vertex_meshes[];
+};
+uniform uint nr_vertex_meshes;
+
+layout (local_size_x = 64) in;
 
 void main() {
     // The OGL spec says the minimum possible invocations for x, y, and z is 65535
     // The maximum number of elements in VertexBuffer far exceeds this number
-    // so a second axis must be used to augment the size of index
-
-    // The corresponding ogl code calling dispatch compute MUST know this Y_SIZE value and
-    // take it into account when dispatching compute
-    uint index = gl_GlobalInvocationID.x*Y_SIZE + gl_GlobalInvocationID.y;
-    if (index >= nr_vertices || gl_GlobalInvocationID.y >= Y_SIZE) {
+    // so rows of work groups along the y axis augment the size of index
+    uint index = first_vertex + gl_GlobalInvocationID.y*gl_NumWorkGroups.x*gl_WorkGroupSize.x + gl_GlobalInvocationID.x;
+    if (index >= nr_vertices) {
         return;
     }
 
     Vertex vert;
+    // Static meshes aren't transformed
+    mat4 model = mat4(1.0f);
     if (index < nr_static_vertices) {
-        vert = static_vertices[index];
+        vert = get_static_vertex(index);
     } else {
-        vert = dynamic_vertices[index - nr_static_vertices];
-    }
-
-    // Honestly not a great solution but I have no idea how to get the mesh index another way
-    uint mesh_index = 0;
-    for (uint mi=0; mi<nr_meshes; mi++) {
-        uint mesh_mi_vertex_offset = meshes[mi].vertex_offset;
-        if (meshes[mi].index_offset >= nr_static_indices)
-            mesh_mi_vertex_offset += nr_static_vertices;
-
-        if (mesh_mi_vertex_offset > index)
-            break;
-
-        mesh_index = mi;
+        uint dynamic_index = index - nr_static_vertices;
+        vert = get_dynamic_vertex(dynamic_index);
+
+        // The vertex belongs to the last mesh starting at or before it
+        if (nr_vertex_meshes > 0) {
+            uint first = 0;
+            uint last = nr_vertex_meshes;
+            while (last - first > 1) {
+                uint middle = (first + last) / 2;
+                if (vertex_meshes[middle].x <= dynamic_index)
+                    first = middle;
+                else
+                    last = middle;
+            }
+            model = meshes[vertex_meshes[first].y].transformation;
+        }
     }
 
-    mat4 model = meshes[mesh_index].transformation;
-
-    vert.position = model * vec4(vert.position.xyz, 1.0f);
+    vec3 position = (model * vec4(vert.position.xyz, 1.0f)).xyz;
     mat3 ti_model = transpose(inverse(mat3(model)));
-    vert.normal = vec4(ti_model * vert.normal.xyz, 0.0f);
-    vert.tangent = vec4(ti_model * vert.tangent.xyz, vert.tangent.w);
+    vec3 normal = ti_model * vert.normal.xyz;
+    vec3 tangent = ti_model * vert.tangent.xyz;
 
-    vertices[index] = vert;
+    vertex_positions[3*index+0] = position.x;
+    vertex_positions[3*index+1] = position.y;
+    vertex_positions[3*index+2] = position.z;
+    vertex_attributes[index] = VertexAttributes(vec4(normal, 0.0f), vec4(tangent, vert.tangent.w), vert.tex_coord);
 }
\ No newline at end of file
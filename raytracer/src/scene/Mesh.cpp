@@ -1,9 +1,13 @@
 #include "Mesh.hpp"
 #include <QDebug>
+#include "acceleration/BVHCache.hpp"
 
 namespace Rt {
 
     Mesh::Mesh(std::shared_ptr<Material> material) : material(material) {
+        bvh_dirty = true;
+        geometry_edited = false;
+        compact_vertices_dirty = true;
         setObjectName("Mesh");
     }
 
@@ -12,6 +16,9 @@ namespace Rt {
         vertices(vertices),
         indices(indices)
     {
+        bvh_dirty = true;
+        geometry_edited = false;
+        compact_vertices_dirty = true;
         setObjectName("Mesh");
     }
 
@@ -19,6 +26,7 @@ namespace Rt {
 
     void Mesh::set_material(std::shared_ptr<Material> new_material) {
         material = new_material;
+        emit material_changed(material);
     }
 
     std::shared_ptr<Material> Mesh::get_material() {
@@ -31,10 +39,18 @@ namespace Rt {
 
     void Mesh::insert_vertices(const std::vector<Vertex>& new_vertices, size_t location) {
         vertices.insert(std::begin(vertices)+location, std::begin(new_vertices), std::end(new_vertices));
+        bvh_dirty = true;
+        geometry_edited = true;
+        compact_vertices_dirty = true;
+        emit geometry_changed();
     }
 
     void Mesh::erase_vertices(size_t first, size_t last) {
         vertices.erase(std::begin(vertices)+first, std::begin(vertices)+last);
+        bvh_dirty = true;
+        geometry_edited = true;
+        compact_vertices_dirty = true;
+        emit geometry_changed();
     }
 
 
@@ -44,29 +60,77 @@ namespace Rt {
 
     void Mesh::insert_indices(const std::vector<Index>& new_indices, size_t location) {
         indices.insert(std::begin(indices)+location, std::begin(new_indices), std::end(new_indices));
+        bvh_dirty = true;
+        geometry_edited = true;
+        emit geometry_changed();
     }
 
     void Mesh::erase_indices(size_t first, size_t last) {
         indices.erase(std::begin(indices)+first, std::begin(indices)+last);
+        bvh_dirty = true;
+        geometry_edited = true;
+        emit geometry_changed();
     }
 
 
-    void Mesh::as_byte_array(unsigned char byte_array[mesh_size_in_opengl], const glm::mat4& transformation, Index vertex_offset, Index index_offset, MaterialIndex material_index) const {
+    const BVH& Mesh::get_bvh() {
+        if (bvh_dirty) {
+            std::vector<AABB> triangle_bounds;
+            triangle_bounds.reserve(indices.size()/3);
+            for (size_t i=0; i+2<indices.size(); i+=3) {
+                AABB bounds;
+                bounds.grow(glm::vec3(vertices[indices[i+0]].position));
+                bounds.grow(glm::vec3(vertices[indices[i+1]].position));
+                bounds.grow(glm::vec3(vertices[indices[i+2]].position));
+                triangle_bounds.push_back(bounds);
+            }
+            if (geometry_edited) {
+                bvh.build_binned(triangle_bounds);
+            } else {
+                BVHCache::Key key;
+                key.add_mesh(vertices, indices);
+                BVHCache::build(key.result(), bvh, triangle_bounds);
+            }
+            bvh_dirty = false;
+        }
+        return bvh;
+    }
+
+    const std::vector<unsigned char>& Mesh::get_compact_vertices() {
+        if (compact_vertices_dirty) {
+            compact_vertices.resize(vertices.size()*compact_vertex_size_in_opengl);
+            for (size_t i=0; i<vertices.size(); i++) {
+                vertices[i].as_compact_byte_array(compact_vertices.data()+i*compact_vertex_size_in_opengl);
+            }
+            compact_vertices_dirty = false;
+        }
+        return compact_vertices;
+    }
+
+
+    void Mesh::as_byte_array(unsigned char byte_array[mesh_size_in_opengl], const glm::mat4& transformation, Index vertex_offset, Index index_offset, MaterialIndex material_index, int32_t bvh_offset) const {
         unsigned char const* tmp = reinterpret_cast<unsigned char const*>(&transformation);
         std::copy(tmp, tmp+64, byte_array);
 
+        glm::mat4 inverse_transformation = glm::inverse(transformation);
+        tmp = reinterpret_cast<unsigned char const*>(&inverse_transformation);
+        std::copy(tmp, tmp+64, byte_array+64);
+
         tmp = reinterpret_cast<unsigned char const*>(&vertex_offset);
-        std::copy(tmp, tmp+4, byte_array+64);
+        std::copy(tmp, tmp+4, byte_array+128);
 
         tmp = reinterpret_cast<unsigned char const*>(&index_offset);
-        std::copy(tmp, tmp+4, byte_array+68);
+        std::copy(tmp, tmp+4, byte_array+132);
 
         Index nr_indices = indices.size();
         tmp = reinterpret_cast<unsigned char const*>(&nr_indices);
-        std::copy(tmp, tmp+4, byte_array+72);
+        std::copy(tmp, tmp+4, byte_array+136);
 
         tmp = reinterpret_cast<unsigned char const*>(&material_index);
-        std::copy(tmp, tmp+4, byte_array+76);
+        std::copy(tmp, tmp+4, byte_array+140);
+
+        tmp = reinterpret_cast<unsigned char const*>(&bvh_offset);
+        std::copy(tmp, tmp+4, byte_array+144);
     }
 
 }
\ No newline at end of file
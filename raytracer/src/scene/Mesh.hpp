@@ -9,10 +9,11 @@
 #include "RaytracerGlobals.hpp"
 #include "scene/Vertex.hpp"
 #include "materials/Material.hpp"
+#include "acceleration/BVH.hpp"
 
 namespace Rt {
 
-    constexpr int mesh_size_in_opengl = 80;
+    constexpr int mesh_size_in_opengl = 160;
 
     typedef uint32_t MeshIndex;
 
@@ -35,13 +36,37 @@ namespace Rt {
         virtual void insert_indices(const std::vector<Index>& new_indices, size_t location);
         virtual void erase_indices(size_t first, size_t last);
 
-        virtual void as_byte_array(unsigned char byte_array[mesh_size_in_opengl], const glm::mat4& transformation, Index vertex_offset, Index index_offset, MaterialIndex material_index) const;
+        // Object space BVH over the mesh's triangles (bottom level of the renderer's two-level hierarchy)
+        // Rebuilt the next time it is requested after the vertices or indices change
+        // The first one of a mesh constructed with its geometry goes through BVHCache (since it
+        // was most likely loaded) but the rebuilds after an edit don't
+        virtual const BVH& get_bvh();
+
+        // The vertices in the compact encoding of Vertex::as_compact_byte_array
+        // Re-encoded the next time they are requested after the vertices change
+        virtual const std::vector<unsigned char>& get_compact_vertices();
+
+        // bvh_offset is the index of the root of the mesh's BVH in the renderer's BVH buffer (-1 if it has none)
+        virtual void as_byte_array(unsigned char byte_array[mesh_size_in_opengl], const glm::mat4& transformation, Index vertex_offset, Index index_offset, MaterialIndex material_index, int32_t bvh_offset=-1) const;
+
+    signals:
+        void material_changed(std::shared_ptr<Material> material);
+        // The vertices or indices changed
+        void geometry_changed();
     
     private:
         std::shared_ptr<Material> material;
 
         std::vector<Vertex> vertices;
         std::vector<Index> indices;
+
+        BVH bvh;
+        bool bvh_dirty;
+        // The vertices or indices changed since the mesh was constructed
+        bool geometry_edited;
+
+        std::vector<unsigned char> compact_vertices;
+        bool compact_vertices_dirty;
     };
 
 }
@@ -1,6 +1,7 @@
 #include "Node.hpp"
 
 #include <QDebug>
+#include <algorithm>
 #include <glm/gtc/matrix_transform.hpp>
 
 namespace Rt {
@@ -44,7 +45,11 @@ namespace Rt {
         emit added_child_node(node);
     }
     bool Node::remove_node(std::shared_ptr<Node> node) {
-        return false;
+        auto it = std::find(child_nodes.begin(), child_nodes.end(), node);
+        if (it == child_nodes.end()) return false;
+        child_nodes.erase(it);
+        emit removed_child_node(node);
+        return true;
     }
 
     void Node::add_mesh(std::shared_ptr<Mesh> mesh) {
@@ -52,7 +57,11 @@ namespace Rt {
         emit added_child_mesh(mesh);
     }
     bool Node::remove_mesh(std::shared_ptr<Mesh> mesh) {
-        return false;
+        auto it = std::find(child_meshes.begin(), child_meshes.end(), mesh);
+        if (it == child_meshes.end()) return false;
+        child_meshes.erase(it);
+        emit removed_child_mesh(mesh);
+        return true;
     }
 
     const std::vector<std::shared_ptr<Node>>& Node::get_child_nodes() const {
@@ -1,5 +1,6 @@
 #include "Scene.hpp"
 #include <glm/glm.hpp>
+#include "acceleration/BVHCache.hpp"
 
 namespace Rt {
 
@@ -30,6 +31,7 @@ namespace Rt {
             mesh->as_byte_array(mesh_bytes, glm::mat4(1.0f), vertex_offset, index_offset, material_index);
             this->static_meshes.insert(std::end(this->static_meshes), mesh_bytes, mesh_bytes+mesh_size_in_opengl);
         }
+        build_static_bvh(static_meshes);
     }
 
     Scene::~Scene() {}
@@ -47,6 +49,24 @@ namespace Rt {
         return static_vertices;
     }
 
+    const std::vector<unsigned char>& Scene::get_static_compact_vertices() const {
+        // Only encoded once something uses the compact format, from the bytes of Vertex::as_byte_array
+        if (static_compact_vertices.empty() && !static_vertices.empty()) {
+            size_t nr_vertices = static_vertices.size()/vertex_size_in_opengl;
+            static_compact_vertices.resize(nr_vertices*compact_vertex_size_in_opengl);
+            for (size_t i=0; i<nr_vertices; i++) {
+                const unsigned char* vertex_bytes = static_vertices.data() + i*vertex_size_in_opengl;
+                Vertex vertex;
+                std::copy(vertex_bytes, vertex_bytes+16, reinterpret_cast<unsigned char*>(&vertex.position));
+                std::copy(vertex_bytes+16, vertex_bytes+32, reinterpret_cast<unsigned char*>(&vertex.normal));
+                std::copy(vertex_bytes+32, vertex_bytes+48, reinterpret_cast<unsigned char*>(&vertex.tangent));
+                std::copy(vertex_bytes+48, vertex_bytes+56, reinterpret_cast<unsigned char*>(&vertex.tex_coords));
+                vertex.as_compact_byte_array(static_compact_vertices.data() + i*compact_vertex_size_in_opengl);
+            }
+        }
+        return static_compact_vertices;
+    }
+
     const std::vector<Index>& Scene::get_static_indices() const {
         return static_indices;
     }
@@ -55,4 +75,80 @@ namespace Rt {
         return static_meshes;
     }
 
+    const BVH& Scene::get_static_bvh() const {
+        return static_bvh;
+    }
+
+    const std::vector<unsigned char>& Scene::get_static_bvh_nodes() const {
+        return static_bvh_nodes;
+    }
+
+    const QuantizedBVH& Scene::get_static_quantized_bvh() const {
+        return static_quantized_bvh;
+    }
+
+    const std::vector<unsigned char>& Scene::get_static_quantized_bvh_nodes() const {
+        return static_quantized_bvh_nodes;
+    }
+
+    const std::vector<unsigned char>& Scene::get_static_triangle_records() const {
+        return static_triangle_records;
+    }
+
+    void Scene::build_static_bvh(const std::vector<std::shared_ptr<Mesh>>& meshes) {
+        // Static meshes aren't transformed so the BVH can be built over the vertices as they are
+        std::vector<AABB> triangle_bounds;
+        std::vector<Index> triangle_first_indices;
+        std::vector<MeshIndex> triangle_meshes;
+        std::vector<glm::vec3> triangle_positions;
+        triangle_bounds.reserve(static_indices.size()/3);
+        triangle_first_indices.reserve(static_indices.size()/3);
+        triangle_meshes.reserve(static_indices.size()/3);
+        triangle_positions.reserve(static_indices.size());
+
+        BVHCache::Key key;
+        Index index_offset = 0;
+        for (MeshIndex mi=0; mi<meshes.size(); mi++) {
+            const std::vector<Vertex>& mesh_vertices = meshes[mi]->get_vertices();
+            const std::vector<Index>& mesh_indices = meshes[mi]->get_indices();
+            key.add_mesh(mesh_vertices, mesh_indices);
+            for (Index i=0; i+2<mesh_indices.size(); i+=3) {
+                AABB bounds;
+                for (Index j=i; j<i+3; j++) {
+                    glm::vec3 position = glm::vec3(mesh_vertices[mesh_indices[j]].position);
+                    bounds.grow(position);
+                    triangle_positions.push_back(position);
+                }
+                triangle_bounds.push_back(bounds);
+                triangle_first_indices.push_back(index_offset + i);
+                triangle_meshes.push_back(mi);
+            }
+            index_offset += mesh_indices.size();
+        }
+
+        // The static geometry rarely changes between launches so its BVH is usually loaded from disk
+        // along with the node bytes the renderers upload
+        BVHCache::build(key.result(), static_bvh, triangle_bounds, 4, &static_bvh_nodes);
+
+        static_quantized_bvh.build(static_bvh);
+        static_quantized_bvh_nodes.clear();
+        static_quantized_bvh.nodes_as_byte_array(static_quantized_bvh_nodes);
+
+        const std::vector<uint32_t>& triangle_order = static_bvh.get_primitive_indices();
+        static_triangle_records.assign(triangle_order.size()*triangle_record_size_in_opengl, 0);
+        for (size_t i=0; i<triangle_order.size(); i++) {
+            unsigned char* record = static_triangle_records.data() + i*triangle_record_size_in_opengl;
+            for (int v=0; v<3; v++) {
+                unsigned char const* tmp = reinterpret_cast<unsigned char const*>(&triangle_positions[3*triangle_order[i]+v]);
+                std::copy(tmp, tmp+12, record+16*v);
+            }
+
+            unsigned char const* tmp = reinterpret_cast<unsigned char const*>(&triangle_first_indices[triangle_order[i]]);
+            std::copy(tmp, tmp+4, record+12);
+
+            tmp = reinterpret_cast<unsigned char const*>(&triangle_meshes[triangle_order[i]]);
+            std::copy(tmp, tmp+4, record+28);
+        }
+    }
+
 }
\ No newline at end of file
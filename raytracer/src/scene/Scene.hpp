@@ -11,9 +11,13 @@
 #include "scene/Node.hpp"
 #include "materials/Material.hpp"
 #include "materials/MaterialManager.hpp"
+#include "acceleration/BVH.hpp"
+#include "acceleration/QuantizedBVH.hpp"
 
 namespace Rt {
 
+    constexpr int triangle_record_size_in_opengl = 48;
+
     // Warning: While Scene is a Node, using Scene as a child node
     // is *strongly* discouraged
     class RAYTRACER_LIB_EXPORT Scene : public Node {
@@ -27,9 +31,21 @@ namespace Rt {
         MaterialManager& get_material_manager();
 
         const std::vector<unsigned char>& get_static_vertices() const;
+        // The static vertices in the compact encoding of Vertex::as_compact_byte_array
+        const std::vector<unsigned char>& get_static_compact_vertices() const;
         const std::vector<Index>& get_static_indices() const;
         const std::vector<unsigned char>& get_static_meshes() const;
 
+        // SAH BVH over every static triangle (in world space)
+        const BVH& get_static_bvh() const;
+        const std::vector<unsigned char>& get_static_bvh_nodes() const;
+        // Compact copy of the static BVH (empty if it couldn't be quantized)
+        const QuantizedBVH& get_static_quantized_bvh() const;
+        const std::vector<unsigned char>& get_static_quantized_bvh_nodes() const;
+        // The static triangles in BVH leaf order with their vertex positions so they can be
+        // intersected without looking up their indices and vertices
+        const std::vector<unsigned char>& get_static_triangle_records() const;
+
     private:
         void init();
 
@@ -37,9 +53,29 @@ namespace Rt {
 
         // Should match OpenGL memory layout
         std::vector<unsigned char> static_vertices;
+        // Encoded by the first get_static_compact_vertices()
+        mutable std::vector<unsigned char> static_compact_vertices;
         std::vector<Index> static_indices;
         std::vector<unsigned char> static_meshes;
 
+        BVH static_bvh;
+        // Should match OpenGL memory layout
+        std::vector<unsigned char> static_bvh_nodes;
+        QuantizedBVH static_quantized_bvh;
+        std::vector<unsigned char> static_quantized_bvh_nodes;
+        // first_index is the index of the triangle's first index in static_indices
+        // and mesh_index the index of its mesh in static_meshes
+        // OpenGL (std430) memory layout of every triangle record:
+        //                  // Base Alignment  // Aligned Offset
+        // position0        // 16                 0
+        // first_index      // 4                  12
+        // position1        // 16                 16
+        // mesh_index       // 4                  28
+        // position2        // 16                 32
+        // padding          // 4                  44
+        // Total Size: 48
+        std::vector<unsigned char> static_triangle_records;
+        void build_static_bvh(const std::vector<std::shared_ptr<Mesh>>& meshes);
     };
 
 }
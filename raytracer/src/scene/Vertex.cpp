@@ -2,6 +2,7 @@
 #include <QDebug>
 
 #include <algorithm>
+#include <cmath>
 
 namespace Rt {
 
@@ -39,4 +40,66 @@ namespace Rt {
         std::copy(tmp, tmp+8, byte_array+48);
     }
 
+    void Vertex::as_compact_byte_array(unsigned char byte_array[compact_vertex_size_in_opengl]) const {
+        uint32_t packed_normal = glm::packSnorm2x16(octahedral_encode(glm::vec3(normal)));
+        uint32_t packed_tangent = glm::packSnorm2x16(octahedral_encode(glm::vec3(tangent)));
+        // Giving up the lowest bit of x is an error of at most 1/32767 in the encoded tangent
+        packed_tangent = (packed_tangent & ~1u) | (tangent.w < 0.0f ? 1u : 0u);
+        uint32_t packed_tex_coords = glm::packHalf2x16(tex_coords);
+
+        unsigned char const* tmp = reinterpret_cast<unsigned char const*>(&position);
+        std::copy(tmp, tmp+12, byte_array);
+
+        tmp = reinterpret_cast<unsigned char const*>(&packed_normal);
+        std::copy(tmp, tmp+4, byte_array+12);
+
+        tmp = reinterpret_cast<unsigned char const*>(&packed_tangent);
+        std::copy(tmp, tmp+4, byte_array+16);
+
+        tmp = reinterpret_cast<unsigned char const*>(&packed_tex_coords);
+        std::copy(tmp, tmp+4, byte_array+20);
+    }
+
+    Vertex Vertex::from_compact_byte_array(const unsigned char byte_array[compact_vertex_size_in_opengl]) {
+        glm::vec3 position;
+        uint32_t packed_normal;
+        uint32_t packed_tangent;
+        uint32_t packed_tex_coords;
+        std::copy(byte_array, byte_array+12, reinterpret_cast<unsigned char*>(&position));
+        std::copy(byte_array+12, byte_array+16, reinterpret_cast<unsigned char*>(&packed_normal));
+        std::copy(byte_array+16, byte_array+20, reinterpret_cast<unsigned char*>(&packed_tangent));
+        std::copy(byte_array+20, byte_array+24, reinterpret_cast<unsigned char*>(&packed_tex_coords));
+
+        Vertex vertex(
+            glm::vec4(position, 1.0f),
+            glm::vec4(octahedral_decode(glm::unpackSnorm2x16(packed_normal)), 0.0f),
+            glm::unpackHalf2x16(packed_tex_coords)
+        );
+        vertex.tangent = glm::vec4(octahedral_decode(glm::unpackSnorm2x16(packed_tangent)), (packed_tangent & 1u) ? -1.0f : 1.0f);
+        return vertex;
+    }
+
+    glm::vec2 Vertex::octahedral_encode(const glm::vec3& direction) {
+        float l1_norm = std::abs(direction.x) + std::abs(direction.y) + std::abs(direction.z);
+        // e.g. the tangent of a vertex without one; it can't be represented so it becomes +z
+        if (l1_norm == 0.0f) return glm::vec2(0.0f);
+        glm::vec3 v = direction / l1_norm;
+        glm::vec2 encoded(v.x, v.y);
+        if (v.z < 0.0f) {
+            // Fold the lower half of the octahedron over the diagonals
+            encoded.x = (1.0f - std::abs(v.y)) * (v.x >= 0.0f ? 1.0f : -1.0f);
+            encoded.y = (1.0f - std::abs(v.x)) * (v.y >= 0.0f ? 1.0f : -1.0f);
+        }
+        return encoded;
+    }
+
+    glm::vec3 Vertex::octahedral_decode(const glm::vec2& encoded) {
+        glm::vec3 v(encoded.x, encoded.y, 1.0f - std::abs(encoded.x) - std::abs(encoded.y));
+        if (v.z < 0.0f) {
+            v.x = (1.0f - std::abs(encoded.y)) * (encoded.x >= 0.0f ? 1.0f : -1.0f);
+            v.y = (1.0f - std::abs(encoded.x)) * (encoded.y >= 0.0f ? 1.0f : -1.0f);
+        }
+        return glm::normalize(v);
+    }
+
 }
\ No newline at end of file
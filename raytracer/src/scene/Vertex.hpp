@@ -8,6 +8,13 @@
 namespace Rt {
 
     constexpr int vertex_size_in_opengl = 64;
+    // The transformed vertices are split into a stream of positions (3 floats each), which is
+    // all the intersection tests read, and a stream of the attributes of every vertex,
+    // which are only read for the nearest hit (see vertex_shader.glsl)
+    constexpr int vertex_position_size_in_opengl = 12;
+    constexpr int vertex_attribute_size_in_opengl = 48;
+    // Size of a vertex in the compact encoding of Vertex::as_compact_byte_array
+    constexpr int compact_vertex_size_in_opengl = 24;
 
     struct Vertex {
     public:
@@ -41,6 +48,25 @@ namespace Rt {
         Vertex() = default;
 
         void as_byte_array(unsigned char byte_array[vertex_size_in_opengl]) const;
+
+        // Compact encoding of the vertex:
+        //                  // Base Alignment  // Aligned Offset
+        // position.xyz     // 4                  0
+        // normal           // 4                  12  (octahedral, 2x snorm16)
+        // tangent          // 4                  16  (octahedral, 2x snorm16)
+        // tex_coords       // 4                  20  (2x half float)
+        // Total Size: 24
+        // The lowest bit of the tangent's x component is set if the bitangent sign is negative
+        // Position w is always 1, normal w 0, and normal and tangent are normalized
+        // This MUST match unpack_compact_vertex in vertex_shader.glsl and raytrace.glsl
+        void as_compact_byte_array(unsigned char byte_array[compact_vertex_size_in_opengl]) const;
+        static Vertex from_compact_byte_array(const unsigned char byte_array[compact_vertex_size_in_opengl]);
+
+        // Maps a direction onto the unit octahedron and unfolds it onto [-1,1]^2
+        // (a zero vector is encoded as +z)
+        static glm::vec2 octahedral_encode(const glm::vec3& direction);
+        // Returns the normalized direction
+        static glm::vec3 octahedral_decode(const glm::vec2& encoded);
     };
 
     /*
@@ -6,7 +6,10 @@
 
 namespace Rt {
 
-    constexpr int light_size_in_opengl = 48;
+    constexpr int light_size_in_opengl = 64;
+    // Radius of the sphere drawn for lights with Visibility::SPHERE
+    // This MUST match LIGHT_SPHERE_RADIUS in raytrace.glsl
+    constexpr float light_sphere_radius = 0.1f;
 
     class RAYTRACER_LIB_EXPORT AbstractLight : public Node {
         Q_OBJECT;
@@ -0,0 +1,96 @@
+#include "LightGrid.hpp"
+
+#include <algorithm>
+#include <limits>
+
+namespace Rt {
+
+    void LightGrid::build(const std::vector<glm::vec4>& light_spheres) {
+        constexpr uint32_t nr_cells = light_grid_resolution*light_grid_resolution*light_grid_resolution;
+
+        grid.assign(2*nr_cells, 0);
+        nr_global_lights = 0;
+        nr_cell_lights = 0;
+
+        glm::vec3 max(-std::numeric_limits<float>::infinity());
+        min = glm::vec3(std::numeric_limits<float>::infinity());
+        for (uint32_t i=0; i<light_spheres.size(); i++) {
+            if (light_spheres[i].w > 0.0f) {
+                min = glm::min(min, glm::vec3(light_spheres[i]) - light_spheres[i].w);
+                max = glm::max(max, glm::vec3(light_spheres[i]) + light_spheres[i].w);
+            } else {
+                grid.push_back(i);
+                nr_global_lights++;
+            }
+        }
+        if (nr_global_lights == light_spheres.size()) {
+            min = glm::vec3(0.0f);
+            cell_size = glm::vec3(0.0f);
+            return;
+        }
+        cell_size = (max - min) / float(light_grid_resolution);
+
+        // Every (cell, light) pair where the light's sphere overlaps the cell
+        std::vector<std::pair<uint32_t, uint32_t>> overlaps;
+        for (uint32_t i=0; i<light_spheres.size(); i++) {
+            float radius = light_spheres[i].w;
+            if (radius <= 0.0f) continue;
+            glm::vec3 center = glm::vec3(light_spheres[i]);
+            glm::ivec3 first = glm::clamp(glm::ivec3(glm::floor((center-radius-min)/cell_size)), 0, light_grid_resolution-1);
+            glm::ivec3 last = glm::clamp(glm::ivec3(glm::floor((center+radius-min)/cell_size)), 0, light_grid_resolution-1);
+            for (int z=first.z; z<=last.z; z++) {
+                for (int y=first.y; y<=last.y; y++) {
+                    for (int x=first.x; x<=last.x; x++) {
+                        // Skip the corner cells of the sphere's bounds it doesn't reach
+                        glm::vec3 cell_min = min + glm::vec3(x,y,z)*cell_size;
+                        glm::vec3 closest = glm::clamp(center, cell_min, cell_min+cell_size);
+                        glm::vec3 to_closest = closest - center;
+                        if (glm::dot(to_closest, to_closest) > radius*radius) continue;
+
+                        uint32_t cell = (z*light_grid_resolution + y)*light_grid_resolution + x;
+                        overlaps.push_back({cell, i});
+                        grid[2*cell+1]++;
+                    }
+                }
+            }
+        }
+
+        uint32_t offset = grid.size();
+        for (uint32_t cell=0; cell<nr_cells; cell++) {
+            grid[2*cell] = offset;
+            offset += grid[2*cell+1];
+        }
+        nr_cell_lights = overlaps.size();
+        grid.resize(offset);
+
+        // Overlaps were found light by light so every cell's list stays sorted by light index
+        std::vector<uint32_t> cell_fill(nr_cells, 0);
+        for (const std::pair<uint32_t, uint32_t>& overlap : overlaps) {
+            grid[grid[2*overlap.first] + cell_fill[overlap.first]++] = overlap.second;
+        }
+    }
+
+    bool LightGrid::is_empty() const {
+        return nr_cell_lights == 0;
+    }
+
+    const glm::vec3& LightGrid::get_min() const {
+        return min;
+    }
+
+    const glm::vec3& LightGrid::get_cell_size() const {
+        return cell_size;
+    }
+
+    uint32_t LightGrid::get_nr_global_lights() const {
+        return nr_global_lights;
+    }
+
+    void LightGrid::as_byte_array(std::vector<unsigned char>& byte_array) const {
+        size_t offset = byte_array.size();
+        byte_array.resize(offset + grid.size()*sizeof(uint32_t));
+        unsigned char const* tmp = reinterpret_cast<unsigned char const*>(grid.data());
+        std::copy(tmp, tmp+grid.size()*sizeof(uint32_t), byte_array.data()+offset);
+    }
+
+}
@@ -0,0 +1,49 @@
+#ifndef RT_LIGHT_GRID_HPP
+#define RT_LIGHT_GRID_HPP
+
+#include <QtGlobal>
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "RaytracerGlobals.hpp"
+
+namespace Rt {
+
+    // Cells along every axis of the grid
+    // This MUST match LIGHT_GRID_RESOLUTION in raytrace.glsl
+    constexpr int light_grid_resolution = 16;
+
+    // World space grid over the influence spheres of the lights with a cutoff radius
+    // Every cell lists the lights whose sphere overlaps it so raytrace.glsl only has to evaluate
+    // those (and the lights without a cutoff radius) for a point inside it
+    class RAYTRACER_LIB_EXPORT LightGrid {
+    public:
+        // Takes the world space position (xyz) and cutoff radius (w) of every light
+        // Lights with a radius of 0 reach every point; they aren't part of any cell
+        // and are listed once after the cells instead
+        void build(const std::vector<glm::vec4>& light_spheres);
+
+        // True if no light has a cutoff radius (every light has to be evaluated everywhere)
+        bool is_empty() const;
+
+        const glm::vec3& get_min() const;
+        const glm::vec3& get_cell_size() const;
+        uint32_t get_nr_global_lights() const;
+
+        // OpenGL (std430) memory layout as a uint array:
+        // light_grid_resolution^3 (offset, count) pairs, one per cell (x varying fastest)
+        // followed by the indices of the nr_global_lights lights without a cutoff radius
+        // followed by the light indices of every cell (offsets are from the start of the array)
+        void as_byte_array(std::vector<unsigned char>& byte_array) const;
+
+    private:
+        glm::vec3 min = glm::vec3(0.0f);
+        glm::vec3 cell_size = glm::vec3(0.0f);
+        std::vector<uint32_t> grid;
+        uint32_t nr_global_lights = 0;
+        uint32_t nr_cell_lights = 0;
+    };
+
+}
+
+#endif
@@ -0,0 +1,106 @@
+#include "LightSampler.hpp"
+
+#include <algorithm>
+
+namespace Rt {
+
+    void LightSampler::build(const std::vector<float>& light_weights) {
+        entries.clear();
+        unsampled_lights.clear();
+
+        double total_weight = 0.0;
+        for (uint32_t i=0; i<light_weights.size(); i++) {
+            if (light_weights[i] > 0.0f) {
+                entries.push_back(Entry{0.0f, 0, 0.0f, i});
+                total_weight += light_weights[i];
+            } else {
+                unsampled_lights.push_back(i);
+            }
+        }
+        if (entries.empty()) return;
+
+        // Vose's alias method: every entry gets a probability of 1/n split between itself and its alias
+        uint32_t n = entries.size();
+        std::vector<double> scaled_weights(n);
+        std::vector<uint32_t> small;
+        std::vector<uint32_t> large;
+        for (uint32_t i=0; i<n; i++) {
+            entries[i].pmf = light_weights[entries[i].light_index] / total_weight;
+            scaled_weights[i] = light_weights[entries[i].light_index] * n / total_weight;
+            if (scaled_weights[i] < 1.0)
+                small.push_back(i);
+            else
+                large.push_back(i);
+        }
+
+        while (!small.empty() && !large.empty()) {
+            uint32_t s = small.back();
+            small.pop_back();
+            uint32_t l = large.back();
+            large.pop_back();
+
+            entries[s].threshold = scaled_weights[s];
+            entries[s].alias = l;
+            scaled_weights[l] = (scaled_weights[l] + scaled_weights[s]) - 1.0;
+            if (scaled_weights[l] < 1.0)
+                small.push_back(l);
+            else
+                large.push_back(l);
+        }
+        // Whatever is left over is (up to rounding) exactly 1/n
+        for (uint32_t i : small) {
+            entries[i].threshold = 1.0f;
+            entries[i].alias = i;
+        }
+        for (uint32_t i : large) {
+            entries[i].threshold = 1.0f;
+            entries[i].alias = i;
+        }
+    }
+
+    uint32_t LightSampler::get_nr_sampled_lights() const {
+        return entries.size();
+    }
+
+    uint32_t LightSampler::get_nr_unsampled_lights() const {
+        return unsampled_lights.size();
+    }
+
+    uint32_t LightSampler::sample(float u, float& pmf) const {
+        float scaled = u * entries.size();
+        uint32_t i = std::min(uint32_t(scaled), uint32_t(entries.size()-1));
+        const Entry& entry = scaled - i < entries[i].threshold ? entries[i] : entries[entries[i].alias];
+        pmf = entry.pmf;
+        return entry.light_index;
+    }
+
+    float LightSampler::luminance(const glm::vec3& radiance) {
+        return glm::dot(radiance, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+    }
+
+    void LightSampler::as_byte_array(std::vector<unsigned char>& byte_array) const {
+        size_t offset = byte_array.size();
+        byte_array.resize(offset + (entries.size()+unsampled_lights.size())*light_sample_size_in_opengl);
+        for (const Entry& entry : entries) {
+            unsigned char const* tmp = reinterpret_cast<unsigned char const*>(&entry.threshold);
+            std::copy(tmp, tmp+4, byte_array.data()+offset);
+
+            tmp = reinterpret_cast<unsigned char const*>(&entry.alias);
+            std::copy(tmp, tmp+4, byte_array.data()+offset+4);
+
+            tmp = reinterpret_cast<unsigned char const*>(&entry.pmf);
+            std::copy(tmp, tmp+4, byte_array.data()+offset+8);
+
+            tmp = reinterpret_cast<unsigned char const*>(&entry.light_index);
+            std::copy(tmp, tmp+4, byte_array.data()+offset+12);
+            offset += light_sample_size_in_opengl;
+        }
+        for (uint32_t light_index : unsampled_lights) {
+            std::fill(byte_array.data()+offset, byte_array.data()+offset+12, 0);
+            unsigned char const* tmp = reinterpret_cast<unsigned char const*>(&light_index);
+            std::copy(tmp, tmp+4, byte_array.data()+offset+12);
+            offset += light_sample_size_in_opengl;
+        }
+    }
+
+}
@@ -0,0 +1,59 @@
+#ifndef RT_LIGHT_SAMPLER_HPP
+#define RT_LIGHT_SAMPLER_HPP
+
+#include <QtGlobal>
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "RaytracerGlobals.hpp"
+
+namespace Rt {
+
+    constexpr int light_sample_size_in_opengl = 16;
+
+    // Alias table for picking one of many lights in proportion to its weight in constant time
+    // Used by raytrace.glsl to only evaluate a few lights per pixel when there are many of them
+    class RAYTRACER_LIB_EXPORT LightSampler {
+    public:
+        // Lights with a weight of 0 (e.g. SunLights, which reach every point) aren't part of
+        // the table; they are listed after it so they can be evaluated every time instead
+        void build(const std::vector<float>& light_weights);
+
+        uint32_t get_nr_sampled_lights() const;
+        uint32_t get_nr_unsampled_lights() const;
+
+        // Mirrors sample_light() in raytrace.glsl: picks a light with u in [0,1)
+        // Returns its index in the light_weights build() was called with and sets pmf to
+        // the probability of picking it
+        uint32_t sample(float u, float& pmf) const;
+
+        // Approximate power of a light used as its weight
+        static float luminance(const glm::vec3& radiance);
+
+        // OpenGL (std430) memory layout of every entry:
+        //                  // Base Alignment  // Aligned Offset
+        // threshold        // 4                  0
+        // alias            // 4                  4
+        // pmf              // 4                  8
+        // light_index      // 4                  12
+        // Total Size: 16
+        // The nr_sampled_lights table entries are followed by nr_unsampled_lights entries
+        // of which only light_index is used
+        void as_byte_array(std::vector<unsigned char>& byte_array) const;
+
+    private:
+        struct Entry {
+            // Entry i is picked if the fractional part of u*nr_sampled_lights is below threshold
+            // and entry alias otherwise
+            float threshold;
+            uint32_t alias;
+            float pmf;
+            uint32_t light_index;
+        };
+        std::vector<Entry> entries;
+        std::vector<uint32_t> unsampled_lights;
+    };
+
+}
+
+#endif
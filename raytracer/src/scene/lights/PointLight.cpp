@@ -1,5 +1,7 @@
 #include "PointLight.hpp"
 
+#include <algorithm>
+
 namespace Rt {
 
     PointLight::PointLight() {
@@ -20,6 +22,7 @@ namespace Rt {
 
     void PointLight::init() {
         light_type = AbstractLight::LightType::POINTLIGHT;
+        cutoff_radius = 0.0f;
         set_visibility(AbstractLight::Visibility::SPHERE);
         setObjectName("PointLight");
     }
@@ -46,6 +49,18 @@ namespace Rt {
         float ambient_multiplier = get_ambient_multiplier();
         tmp = reinterpret_cast<unsigned char const*>(&ambient_multiplier);
         std::copy(tmp, tmp+4, byte_array+44);
+
+        tmp = reinterpret_cast<unsigned char const*>(&cutoff_radius);
+        std::copy(tmp, tmp+4, byte_array+48);
+    }
+
+    void PointLight::set_cutoff_radius(float new_cutoff_radius) {
+        cutoff_radius = std::max(new_cutoff_radius, 0.0f);
+        emit cutoff_radius_changed(cutoff_radius);
+    }
+
+    float PointLight::get_cutoff_radius() const {
+        return cutoff_radius;
     }
 
 }
\ No newline at end of file
@@ -17,8 +17,18 @@ namespace Rt {
 
         virtual void as_byte_array(unsigned char byte_array[light_size_in_opengl], const glm::mat4& transformation) const override;
 
+        // Distance past which the light has no effect (default 0: the light reaches every point)
+        // The falloff is windowed to smoothly reach 0 at the cutoff radius so the Renderer
+        // only has to evaluate the light for points within it
+        void set_cutoff_radius(float new_cutoff_radius);
+        float get_cutoff_radius() const;
+
+    signals:
+        void cutoff_radius_changed(float);
+
     private:
         void init();
+        float cutoff_radius;
     };
 
 }
@@ -42,6 +42,11 @@ namespace Rt {
         float ambient_multiplier = get_ambient_multiplier();
         tmp = reinterpret_cast<unsigned char const*>(&ambient_multiplier);
         std::copy(tmp, tmp+4, byte_array+44);
+
+        // SunLights reach every point
+        float cutoff_radius = 0.0f;
+        tmp = reinterpret_cast<unsigned char const*>(&cutoff_radius);
+        std::copy(tmp, tmp+4, byte_array+48);
     }
 
 }
\ No newline at end of file
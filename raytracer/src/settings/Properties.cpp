@@ -11,6 +11,7 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include "scene/lights/SunLight.hpp"
+#include "scene/lights/PointLight.hpp"
 #include "settings/VectorView.hpp"
 
 namespace Rt {
@@ -97,6 +98,19 @@ namespace Rt {
         connect(light, &AbstractLight::ambient_multiplier_changed, ambient_multiplier, &QDoubleSpinBox::setValue);
         lighting_layout->addWidget(ambient_multiplier, 1, 1);
 
+        if (light->get_light_type() == AbstractLight::LightType::POINTLIGHT) {
+            PointLight* point_light = static_cast<PointLight*>(light);
+            lighting_layout->addWidget(new QLabel(tr("Cutoff"), lighting), 2, 0);
+            QDoubleSpinBox* cutoff_radius = new QDoubleSpinBox(lighting);
+            cutoff_radius->setDecimals(2);
+            cutoff_radius->setMaximum(10000.0);
+            cutoff_radius->setSpecialValueText(tr("None"));
+            cutoff_radius->setValue(point_light->get_cutoff_radius());
+            connect(cutoff_radius, QOverload<double>::of(&QDoubleSpinBox::valueChanged), point_light, &PointLight::set_cutoff_radius);
+            connect(point_light, &PointLight::cutoff_radius_changed, cutoff_radius, &QDoubleSpinBox::setValue);
+            lighting_layout->addWidget(cutoff_radius, 2, 1);
+        }
+
         properties->addItem(lighting, tr("Lighting"));
 
         QWidget* visibility = new QWidget(this);
@@ -3,11 +3,13 @@
 #include <QApplication>
 #include <QKeyEvent>
 #include <QGridLayout>
+#include <QMetaEnum>
 #include <QDebug>
 
 Viewport::Viewport(Camera* camera, CameraController* cam_controller, QWidget* parent) :
     QWidget(parent), 
     gl_widget(this),
+    stage_timings(this),
     camera(camera),
     cam_controller(cam_controller)
 {
@@ -16,6 +18,11 @@ Viewport::Viewport(Camera* camera, CameraController* cam_controller, QWidget* pa
     QGridLayout* layout = new QGridLayout(this);
     layout->setContentsMargins(0, 0, 0, 0);
     layout->addWidget(&gl_widget, 0, 0);
+    layout->addWidget(&stage_timings, 0, 0, Qt::AlignTop | Qt::AlignLeft);
+    stage_timings.setStyleSheet("QLabel { background-color: rgba(0, 0, 0, 160); color: white; padding: 4px; font-family: monospace; }");
+    stage_timings.setAttribute(Qt::WA_TransparentForMouseEvents);
+    stage_timings.raise();
+    stage_timings.hide();
     setFocusPolicy(Qt::StrongFocus);
 
     renderer = gl_widget.get_renderer();
@@ -31,6 +38,7 @@ Viewport::~Viewport() {}
 void Viewport::main_loop() {
     cam_controller->main_loop();
     gl_widget.main_loop();
+    if (stage_timings.isVisible()) update_stage_timings();
 }
 
 Rt::Renderer* Viewport::get_renderer() {
@@ -49,6 +57,7 @@ void Viewport::keyPressEvent(QKeyEvent* event) {
         case Qt::Key_F2:
             break;
         case Qt::Key_F3:
+            toggle_stage_timings();
             break;
         default:
             cam_controller->key_event(event);
@@ -84,4 +93,23 @@ void Viewport::release_mouse() {
     mouse_captured = false;
     releaseMouse();
     setMouseTracking(false);
-}
\ No newline at end of file
+}
+
+void Viewport::toggle_stage_timings() {
+    bool timing = !renderer->get_stage_timing();
+    renderer->set_stage_timing(timing);
+    stage_timings.setVisible(timing);
+    if (timing) update_stage_timings();
+}
+
+void Viewport::update_stage_timings() {
+    QMetaEnum stages = QMetaEnum::fromType<Rt::Renderer::Stage>();
+    QString text = QString("%1 %2 %3 %4").arg("stage", -16).arg("mean", 8).arg("p50", 8).arg("p99", 8);
+    for (int i=0; i<Rt::Renderer::nr_stages; i++) {
+        Rt::TimingStatistics statistics = renderer->get_stage_statistics(Rt::Renderer::Stage(i));
+        text += QString("\n%1 %2 %3 %4").arg(QString(stages.valueToKey(i)).toLower(), -16)
+            .arg(statistics.mean, 8, 'f', 3).arg(statistics.p50, 8, 'f', 3).arg(statistics.p99, 8, 'f', 3);
+    }
+    text += "\n(ms over the last " + QString::number(renderer->get_stage_timing_window()) + " frames)";
+    stage_timings.setText(text);
+}
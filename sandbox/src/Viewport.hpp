@@ -2,6 +2,7 @@
 #define VIEWPORT_HPP
 
 #include <QWidget>
+#include <QLabel>
 
 #include <rendering/OpenGLWidget.hpp>
 #include <rendering/OpenGLFunctions.hpp>
@@ -34,7 +35,12 @@ private:
     void capture_mouse();
     void release_mouse();
 
+    // Overlay of the renderer's per stage timings (toggled with F3)
+    void toggle_stage_timings();
+    void update_stage_timings();
+
     Rt::OpenGLWidget gl_widget;
+    QLabel stage_timings;
     Rt::Renderer* renderer;
 
     bool mouse_captured;